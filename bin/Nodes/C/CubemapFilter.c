@@ -8,6 +8,7 @@ typedef struct CubemapFilter_t
 	int glossScale;
 	int glossBias;
 	int faceSize;
+	int filterMode; // 0 radiance, 1 irradiance from spherical harmonics
 }CubemapFilterData;
 
 typedef struct JobData_t
@@ -15,11 +16,19 @@ typedef struct JobData_t
 	int targetIndex;
 	Image image;
 	CubemapFilterData param;
+	float sh[27];
 } JobData;
 
 
 int UploadImageJob(JobData *data)
 {
+	// superseded: the newer job uploads and clears processing
+	if (IsJobCancelled())
+	{
+		FreeImage(&data->image);
+		return EVAL_OK;
+	}
+	SetEvaluationIrradianceSH(data->targetIndex, data->param.filterMode ? data->sh : 0);
 	SetEvaluationImage(data->targetIndex, &data->image);
 	FreeImage(&data->image);
 	SetProcessing(data->targetIndex, 0);
@@ -28,7 +37,17 @@ int UploadImageJob(JobData *data)
 
 int FilterJob(JobData *data)
 {
-	if (CubemapFilter(&data->image, 32<<data->param.faceSize, data->param.lightingModel, data->param.excludeBase, data->param.glossScale, data->param.glossBias) == EVAL_OK)
+	int res;
+	if (IsJobCancelled())
+	{
+		FreeImage(&data->image);
+		return EVAL_OK;
+	}
+	if (data->param.filterMode)
+		res = CubemapIrradiance(&data->image, 32<<data->param.faceSize, data->sh);
+	else
+		res = CubemapFilter(&data->image, 32<<data->param.faceSize, data->param.lightingModel, data->param.excludeBase, data->param.glossScale, data->param.glossBias);
+	if (res == EVAL_OK)
 	{	
 		JobData dataUp = *data;
 		JobMain(UploadImageJob, &dataUp, sizeof(JobData));
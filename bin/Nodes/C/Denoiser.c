@@ -0,0 +1,26 @@
+#include "Imogen.h"
+
+typedef struct Denoiser_t
+{
+	int iterations;
+	float colorSigma;
+	float normalSigma;
+	float depthSigma;
+} Denoiser;
+
+int main(Denoiser *param, Evaluation *evaluation)
+{
+	int width, height;
+	// input is a PathTracer in progressive or CPU mode, its renderer has the albedo, normal and depth guides
+	if (evaluation->inputIndices[0] == -1)
+		return EVAL_OK;
+	if (GetEvaluationSize(evaluation->inputIndices[0], &width, &height) == EVAL_OK)
+		SetEvaluationSize(evaluation->targetIndex, width, height);
+
+	// 0 uses the default values
+	return DenoiseRenderer(evaluation->targetIndex, evaluation->inputIndices[0],
+		(param->iterations > 0) ? param->iterations : 5,
+		(param->colorSigma > 0.f) ? param->colorSigma : 0.7f,
+		(param->normalSigma > 0.f) ? param->normalSigma : 0.3f,
+		(param->depthSigma > 0.f) ? param->depthSigma : 0.1f);
+}
\ No newline at end of file
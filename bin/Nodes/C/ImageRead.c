@@ -23,6 +23,12 @@ typedef struct JobData_t
 
 int UploadImageJob(JobData *data)
 {
+	// superseded: the newer job uploads and clears processing
+	if (IsJobCancelled())
+	{
+		FreeImage(&data->image);
+		return EVAL_OK;
+	}
 	if (data->isCube)
 	{
 		SetEvaluationImageCube(data->targetIndex, &data->image, data->face);
@@ -38,6 +44,8 @@ int UploadImageJob(JobData *data)
 
 int ReadJob(JobData *data)
 {
+	if (IsJobCancelled())
+		return EVAL_OK;
 	if (ReadImage(data->filename, &data->image) == EVAL_OK)
 	{
 		JobData dataUp = *data;
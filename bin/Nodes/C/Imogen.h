@@ -112,9 +112,26 @@ int GetEvaluationSize(int target, int *imageWidth, int *imageHeight);
 int SetEvaluationSize(int target, int imageWidth, int imageHeight);
 int SetEvaluationCubeSize(int target, int faceWidth);
 int CubemapFilter(Image *image, int faceSize, int lightingModel, int excludeBase, int glossScale, int glossBias);
+// irradiance cubemap from the 3rd order spherical harmonics of the image. faceSize 0 keeps the source size.
+// coefficients receives 9 RGB triplets (27 floats)
+int CubemapIrradiance(Image *image, int faceSize, float *coefficients);
+// SH coefficients of the target irradiance, read by GLSL nodes with IrradianceSH(). NULL clears them
+int SetEvaluationIrradianceSH(int target, const float *coefficients);
 
 int Job(int(*jobFunction)(void*), void *ptr, unsigned int size);
 int JobMain(int(*jobMainFunction)(void*), void *ptr, unsigned int size);
+// jobs are tagged with the evaluation that queued them. A newer evaluation of the same node
+// cancels them. Cancelled jobs still run so they can free what they own: check this to skip
+// the work and never upload a stale result
+int IsJobCancelled();
+// calls function with sub ranges [begin, end) of [0, count) on all cores. Ranges are at least
+// grain long, grain <= 0 picks one. userData is not copied and must stay valid until the work is done.
+// returns a handle for WaitJob. Handles not waited for are released when the node main or Job that
+// called ParallelFor returns, once the work is done: don't pass them to WaitJob after that
+void* ParallelFor(void(*function)(void *userData, int begin, int end), void *userData, int count, int grain);
+// wait for a ParallelFor to complete and release its handle, the calling thread helps with the work.
+// EVAL_ERR for a handle already released
+int WaitJob(void *handle);
 // processing values:
 // 0 : no more processing, display node as normal
 // 1 : processing with an animation for node display
@@ -124,12 +141,24 @@ void SetProcessing(int target, int processing);
 // compute shader memory allocation
 int AllocateComputeBuffer(int target, int elementCount, int elementSize);
 
+// loads the scene and returns once it's loaded or failed. Blocks the calling thread, call it from a Job.
 int LoadScene(const char *filename, void **scene);
+// loads the scene in the background. Returns EVAL_DIRTY while loading, the target shows the progress,
+// EVAL_OK once scene is set. Scenes are shared and stay in memory while a stage references them
+// with SetEvaluationScene or InitRenderer.
+int LoadSceneAsync(int target, const char *filename, void **scene);
 int SetEvaluationScene(int target, void *scene);
 int GetEvaluationScene(int target, void **scene);
 int GetEvaluationRenderer(int target, void **renderer);
+// mode 0 is the tiled GL renderer, 1 the progressive GL renderer and 2 the CPU renderer
 int InitRenderer(int target, int mode, void *scene);
+// progressive renderer: tiles stop sampling once their relative noise is under threshold
+int SetRendererNoiseThreshold(int target, float threshold);
 int UpdateRenderer(int target);
+// a-trous filter of the renderer of source, guided by the albedo, normal and depth of the first hits.
+// Draws to target, 0 parameters use the default values. Only the progressive and CPU renderers have the
+// guides: the tiled renderer output is drawn unfiltered
+int DenoiseRenderer(int target, int source, int iterations, float colorSigma, float normalSigma, float depthSigma);
 
 #define EVAL_OK 0
 #define EVAL_ERR 1
@@ -3,26 +3,27 @@
 typedef struct PathTracer_t
 {
 	int mode;
+	float camera[16];
+	// 0 uses the default threshold
+	float noiseThreshold;
 } PathTracer;
 
 int main(PathTracer *param, Evaluation *evaluation)
 {
 	void *scene;
-	void *renderer;
 	if (evaluation->inputIndices[0] == -1)
 		return EVAL_OK;
 	if (GetEvaluationScene(evaluation->inputIndices[0], &scene) != EVAL_OK)
 		return EVAL_ERR;
 	if (!scene)
 		return EVAL_OK;
-	if (GetEvaluationRenderer(evaluation->targetIndex, &renderer) != EVAL_OK)
+	// creates the renderer, or recreates it when the mode changed
+	if (InitRenderer(evaluation->targetIndex, param->mode, scene) != EVAL_OK)
 		return EVAL_ERR;
-	if (!renderer)
-	{
-		if (InitRenderer(evaluation->targetIndex, 0, scene) != EVAL_OK)
-			return EVAL_ERR;
-	}
-	SetEvaluationSize(evaluation->targetIndex, 1024, 1024);
+	// CPU mode uploads images of the scene resolution
+	if (param->mode != 2)
+		SetEvaluationSize(evaluation->targetIndex, 1024, 1024);
+	SetRendererNoiseThreshold(evaluation->targetIndex, (param->noiseThreshold > 0.f) ? param->noiseThreshold : 0.02f);
 	SetProcessing(evaluation->targetIndex, 2);
 	
 	return UpdateRenderer(evaluation->targetIndex);
@@ -5,6 +5,7 @@ layout (std140) uniform CubemapFilterBlock
 	int glossScale;
 	int glossBias;
 	int faceSize;
+	int filterMode;
 };
 
 vec4 CubemapFilter()
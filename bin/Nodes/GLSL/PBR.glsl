@@ -238,7 +238,9 @@ vec4 PBR()
 
         vec3 env       = texture(CubeSampler4, InvertCubeY(refl), roughnessE*12.0).xyz;
         
-        diffuse += diffuseColor * EnvRemap(env);
+        // irradiance SH of a CubemapFilter node, else the reflection sample
+        vec3 irradiance = HasIrradianceSH(5) ? IrradianceSH(5, InvertCubeY(normal)) : env;
+        diffuse += diffuseColor * EnvRemap(irradiance);
         specular += envSpecularColor * env;
 
 		diffuse  += diffuseColor * saturate( dot( normal, lightDir ) );
@@ -36,6 +36,13 @@ layout (std140) uniform EvaluationBlock
 	int localFrame;
 } EvaluationParam;
 
+// 3rd order SH of the irradiance of each input, 9 coefficients per input, see IrradianceSH
+layout (std140) uniform IrradianceSHBlock
+{
+	vec4 coefficients[72];
+	ivec4 valid[2];
+} IrradianceSHParam;
+
 struct Camera
 {
 	vec4 pos;
@@ -75,6 +82,26 @@ vec3 InvertCubeY(vec3 dir)
 {
 	return vec3(dir.x, -dir.y, dir.z);
 }
+bool HasIrradianceSH(int inputIndex)
+{
+	return IrradianceSHParam.valid[inputIndex/4][inputIndex%4] != 0;
+}
+// irradiance over PI in the direction of the unit normal n, same scale as the radiance of the cubemap
+vec3 IrradianceSH(int inputIndex, vec3 n)
+{
+	int base = inputIndex * 9;
+	// bands scaled by the clamped cosine convolution: 1, 2/3, 1/4
+	vec3 irradiance = IrradianceSHParam.coefficients[base].xyz * 0.282094792;
+	irradiance += (IrradianceSHParam.coefficients[base+1].xyz * (-0.488602512 * n.y)
+		+ IrradianceSHParam.coefficients[base+2].xyz * (0.488602512 * n.z)
+		+ IrradianceSHParam.coefficients[base+3].xyz * (-0.488602512 * n.x)) * (2.0/3.0);
+	irradiance += (IrradianceSHParam.coefficients[base+4].xyz * (1.092548431 * n.y * n.x)
+		+ IrradianceSHParam.coefficients[base+5].xyz * (-1.092548431 * n.y * n.z)
+		+ IrradianceSHParam.coefficients[base+6].xyz * (0.315391565 * (3.0 * n.z * n.z - 1.0))
+		+ IrradianceSHParam.coefficients[base+7].xyz * (-1.092548431 * n.x * n.z)
+		+ IrradianceSHParam.coefficients[base+8].xyz * (0.546274215 * (n.x * n.x - n.y * n.y))) * 0.25;
+	return max(irradiance, vec3(0.0));
+}
 float Circle(vec2 uv, float radius, float t)
 {
     float r = length(uv-vec2(0.5));
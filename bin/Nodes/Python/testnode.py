@@ -1,17 +1,13 @@
-import imo
-        
-def test(a, b, e):
-    res = imo.add(a,b)
-    res2 = imo.add2(a, b)
-    #e = imo.accessor_api()
-    print ("result = {}".format(res))
-    print ("result2 = {}".format(res2))
-    print ("target is {}".format(e["target"]))
-    print ("inputs is {}".format(e["inputs"]))
-    img = imo.GetImage()
-    print (img)
-    imo.SaveImage(img)
-    print (imo.add)
-    #help(imo)
-    return 1
-	
+import Imogen
+import numpy as np
+
+# accessor: target, inputs, frame, localFrame, uiPass, forcedDirty, parameters (raw parameter block)
+def main(accessor):
+    image = Imogen.Image()
+    if Imogen.GetEvaluationImage(accessor["inputs"][0], image) != 0:
+        return 1
+    # view on the image pixels, vectorized operations write straight into the image
+    pixels = np.asarray(image)
+    pixels[..., :3] = np.iinfo(pixels.dtype).max - pixels[..., :3] if pixels.dtype.kind == 'u' else 1.0 - pixels[..., :3]
+    Imogen.SetEvaluationImage(accessor["target"], image)
+    return 0
@@ -0,0 +1,57 @@
+#version 330
+
+out vec4 color;
+in vec2 TexCoords;
+
+uniform sampler2D illuminationTexture;
+uniform sampler2D guideTexture;
+uniform int stepWidth;
+uniform float colorPhi;
+uniform float normalPhi;
+uniform float depthPhi;
+
+float Luminance(vec3 c)
+{
+	return dot(c, vec3(0.3, 0.6, 0.1));
+}
+
+// One level of the edge avoiding a-trous wavelet transform (Dammertz et al. 2010).
+// 5x5 B3 spline kernel with holes of stepWidth pixels. Taps are weighted by the difference of
+// illumination (compressed so highlights do not dominate), normal and relative depth with the center.
+void main()
+{
+	const float kernel[3] = float[3](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+	ivec2 coord = ivec2(gl_FragCoord.xy);
+	ivec2 size = textureSize(illuminationTexture, 0);
+	vec3 center = texelFetch(illuminationTexture, coord, 0).xyz;
+	vec4 centerGuide = texelFetch(guideTexture, coord, 0);
+	vec3 centerColor = center / (1.0 + Luminance(center));
+	float invDepth = 1.0 / max(centerGuide.w, 0.0001);
+	float invStep2 = 1.0 / float(stepWidth * stepWidth);
+
+	vec3 sum = vec3(0.0);
+	float weightSum = 0.0;
+	for (int y = -2; y <= 2; y++)
+	{
+		for (int x = -2; x <= 2; x++)
+		{
+			ivec2 tap = clamp(coord + ivec2(x, y) * stepWidth, ivec2(0), size - 1);
+			vec3 c = texelFetch(illuminationTexture, tap, 0).xyz;
+			vec4 g = texelFetch(guideTexture, tap, 0);
+
+			// product of the color, normal and depth weights
+			vec3 t = c / (1.0 + Luminance(c)) - centerColor;
+			float exponent = dot(t, t) / colorPhi;
+			t = g.xyz - centerGuide.xyz;
+			exponent += dot(t, t) * invStep2 / normalPhi;
+			float dz = (g.w - centerGuide.w) * invDepth;
+			exponent += dz * dz / depthPhi;
+
+			float weight = kernel[abs(x)] * kernel[abs(y)] * exp(-exponent);
+			sum += c * weight;
+			weightSum += weight;
+		}
+	}
+	color = vec4(sum / weightSum, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,27 @@
+#version 330
+
+layout(location = 0) out vec4 illumination;
+layout(location = 1) out vec4 albedo;
+layout(location = 2) out vec4 guide;
+in vec2 TexCoords;
+
+// sums of the path traced samples, alpha of the albedo counts them
+uniform sampler2D colorTexture;
+uniform sampler2D albedoTexture;
+uniform sampler2D normalDepthTexture;
+
+// Mean radiance divided by the albedo of the first hit, so the filter does not blur the textures.
+// Guide is the normal and the depth used by the edge stopping functions of ATrousFrag.glsl
+void main()
+{
+	ivec2 coord = ivec2(gl_FragCoord.xy);
+	vec4 albedoSum = texelFetch(albedoTexture, coord, 0);
+	float invSamples = 1.0 / max(albedoSum.w, 1.0);
+	vec3 surfaceAlbedo = max(albedoSum.xyz * invSamples, vec3(0.01));
+	vec4 normalDepth = texelFetch(normalDepthTexture, coord, 0) * invSamples;
+	float normalLength = length(normalDepth.xyz);
+
+	illumination = vec4(texelFetch(colorTexture, coord, 0).xyz * invSamples / surfaceAlbedo, 1.0);
+	albedo = vec4(surfaceAlbedo, 1.0);
+	guide = vec4(normalLength > 0.0 ? normalDepth.xyz / normalLength : vec3(0.0), normalDepth.w);
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#version 330
+
+out vec4 color;
+in vec2 TexCoords;
+
+uniform sampler2D illuminationTexture;
+uniform sampler2D albedoTexture;
+
+vec4 ToneMap(in vec4 c, float limit)
+{
+	float luminance = 0.3*c.x + 0.6*c.y + 0.1*c.z;
+
+	return c * 1.0/(1.0 + luminance/limit);
+}
+
+// filtered illumination times the albedo, tone mapped like Progressive/OutputFrag.glsl
+void main()
+{
+	color = vec4(texture(illuminationTexture, TexCoords).xyz * texture(albedoTexture, TexCoords).xyz, 1.0);
+	color = vec4(pow(ToneMap(color, 1.5).xyz, vec3(1.0 / 2.2)), 1.0);
+}
\ No newline at end of file
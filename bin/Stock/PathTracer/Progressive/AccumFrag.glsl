@@ -1,11 +1,17 @@
 #version 330
 
-out vec4 color;
+layout(location = 0) out vec4 color;
+layout(location = 1) out vec4 albedo;
+layout(location = 2) out vec4 normalDepth;
 in vec2 TexCoords;
 
 uniform sampler2D pathTraceTexture;
+uniform sampler2D albedoTexture;
+uniform sampler2D normalDepthTexture;
 
 void main()
 {
 	color = texture(pathTraceTexture, TexCoords);
+	albedo = texture(albedoTexture, TexCoords);
+	normalDepth = texture(normalDepthTexture, TexCoords);
 }
\ No newline at end of file
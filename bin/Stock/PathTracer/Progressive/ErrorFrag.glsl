@@ -0,0 +1,32 @@
+#version 330
+
+out vec4 color;
+in vec2 TexCoords;
+
+uniform sampler2D pathTraceTexture;
+uniform sampler2D tileTexture;
+uniform vec2 screenResolution;
+uniform int tileSize;
+
+// One fragment per tile: mean noise of its pixels. The noise of a pixel is the standard error of its
+// luminance divided by the square root of the mean, about how much it shows after the 1/2.2 gamma.
+void main()
+{
+	ivec2 tile = ivec2(gl_FragCoord.xy);
+	float samples = texelFetch(tileTexture, tile, 0).g;
+	ivec2 start = tile * tileSize;
+	ivec2 end = min(start + ivec2(tileSize), ivec2(screenResolution));
+
+	float error = 0.0;
+	for (int y = start.y; y < end.y; y++)
+	{
+		for (int x = start.x; x < end.x; x++)
+		{
+			vec4 accum = texelFetch(pathTraceTexture, ivec2(x, y), 0);
+			float mean = dot(accum.xyz, vec3(0.3, 0.6, 0.1)) / samples;
+			float variance = max(accum.w / samples - mean * mean, 0.0);
+			error += sqrt(variance / samples) / sqrt(mean + 0.0001);
+		}
+	}
+	color = vec4(error / float((end.x - start.x) * (end.y - start.y)));
+}
\ No newline at end of file
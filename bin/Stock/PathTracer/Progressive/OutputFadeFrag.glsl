@@ -5,8 +5,10 @@ in vec2 TexCoords;
 
 uniform sampler2D pathTraceTextureHalf;
 uniform sampler2D pathTraceTexture;
+uniform sampler2D tileTexture;
+uniform vec2 screenResolution;
+uniform int tileSize;
 
-uniform float invSampleCounter;
 uniform float fadeAmt;
 
 vec4 ToneMap(in vec4 c, float limit)
@@ -16,10 +18,17 @@ vec4 ToneMap(in vec4 c, float limit)
 	return c * 1.0/(1.0 + luminance/limit);
 }
 
+// samples accumulated in the tile of the pixel
+float InvSampleCounter()
+{
+	ivec2 tile = min(ivec2(TexCoords * screenResolution) / tileSize, textureSize(tileTexture, 0) - 1);
+	return 1.0 / max(texelFetch(tileTexture, tile, 0).g, 1.0);
+}
+
 void main()
 {
-	vec4 color1 = texture(pathTraceTextureHalf, TexCoords);
-	vec4 color2 = texture(pathTraceTexture, TexCoords) * invSampleCounter;
+	vec4 color1 = vec4(texture(pathTraceTextureHalf, TexCoords).xyz, 1.0);
+	vec4 color2 = vec4(texture(pathTraceTexture, TexCoords).xyz * InvSampleCounter(), 1.0);
 
 	color1 = pow(ToneMap(color1, 1.5), vec4(1.0 / 2.2));
 	color2 = pow(ToneMap(color2, 1.5), vec4(1.0 / 2.2));
@@ -7,5 +7,5 @@ uniform sampler2D pathTraceTexture;
 
 void main()
 {
-	color = texture(pathTraceTexture, TexCoords);
+	color = texelFetch(pathTraceTexture, ivec2(gl_FragCoord.xy), 0);
 }
\ No newline at end of file
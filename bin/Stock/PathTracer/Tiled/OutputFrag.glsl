@@ -3,8 +3,10 @@
 out vec4 color;
 in vec2 TexCoords;
 
-uniform sampler2D pathTraceTexture;
-uniform float invSampleCounter;
+uniform sampler2D accumTexture;
+uniform sampler2D tileTexture;
+uniform vec2 screenResolution;
+uniform int tileSize;
 
 vec4 ToneMap(in vec4 c, float limit)
 {
@@ -13,7 +15,15 @@ vec4 ToneMap(in vec4 c, float limit)
 	return c * 1.0/(1.0 + luminance/limit);
 }
 
+// samples accumulated in the tile of the pixel
+float InvSampleCounter()
+{
+	ivec2 tile = min(ivec2(TexCoords * screenResolution) / tileSize, textureSize(tileTexture, 0) - 1);
+	return 1.0 / max(texelFetch(tileTexture, tile, 0).g, 1.0);
+}
+
 void main()
 {
-	color = texture(pathTraceTexture, TexCoords) * invSampleCounter;
+	color = vec4(texture(accumTexture, TexCoords).xyz * InvSampleCounter(), 1.0);
+	color = pow(ToneMap(color, 1.5), vec4(1.0 / 2.2));
 }
\ No newline at end of file
@@ -6,12 +6,11 @@ uniform bool isCameraMoving;
 uniform bool useEnvMap;
 uniform vec3 randomVector;
 uniform vec2 screenResolution;
-uniform int tileX;
-uniform int tileY;
-uniform float invTileWidth;
-uniform float invTileHeight;
+uniform int tilePass;
+uniform int tileSize;
 
 uniform sampler2D accumTexture;
+uniform sampler2D tileTexture;
 uniform samplerBuffer BVH;
 uniform samplerBuffer triangleIndicesTex;
 uniform samplerBuffer verticesTex;
@@ -31,11 +30,16 @@ uniform float hdrMultiplier;
 
 uniform int numOfLights;
 uniform int maxDepth;
+uniform bool wideBVH;
 
 #define PI        3.14159265358979323
 #define TWO_PI    6.28318530717958648
 #define INFINITY  1000000.0
 #define EPS 0.001
+// set by the renderer from the depth of the scene wide BVH. Default for 64 levels
+#ifndef WIDE_STACK_SIZE
+#define WIDE_STACK_SIZE 193
+#endif
 
 vec2 seed;
 
@@ -121,6 +125,25 @@ float IntersectRayAABB(vec3 minCorner, vec3 maxCorner, Ray r)
 	return (t1 >= t0) ? (t0 > 0.f ? t0 : t1) : -1.0;
 }
 
+//----------------------------------------------------------------
+float IntersectRayAABBEntry(vec3 minCorner, vec3 maxCorner, Ray r)
+//----------------------------------------------------------------
+{
+	// distance where the ray enters the box, 0 when it starts inside, -1 on a miss
+	vec3 invdir = 1.0 / r.direction;
+
+	vec3 f = (maxCorner - r.origin) * invdir;
+	vec3 n = (minCorner - r.origin) * invdir;
+
+	vec3 tmax = max(f, n);
+	vec3 tmin = min(f, n);
+
+	float t1 = min(tmax.x, min(tmax.y, tmax.z));
+	float t0 = max(tmin.x, max(tmin.y, tmin.z));
+
+	return (t1 >= t0 && t1 > 0.0) ? max(t0, 0.0) : -1.0;
+}
+
 //-------------------------------------------------------------------------------
 vec3 BarycentricCoord(vec3 point, vec3 v0, vec3 v1, vec3 v2)
 //-------------------------------------------------------------------------------
@@ -145,58 +168,310 @@ vec3 BarycentricCoord(vec3 point, vec3 v0, vec3 v1, vec3 v2)
 }
 
 //-----------------------------------------------------------------------
-float SceneIntersect(Ray r, inout State state, inout LightSampleRec lightSampleRec)
+vec4 IntersectChildren4(int node, Ray r, vec3 invDir, float tMax, out ivec4 child, out ivec4 count)
 //-----------------------------------------------------------------------
 {
-	float t = INFINITY;
-	float d;
+	// 4 wide node: min x, y, z and max x, y, z of the children, then children and counts as int bits.
+	// count is 0 for an inner node, the triangle count of a leaf or -1 for an empty slot
+	vec4 nx = (texelFetch(BVH, node * 8 + 0) - r.origin.x) * invDir.x;
+	vec4 ny = (texelFetch(BVH, node * 8 + 1) - r.origin.y) * invDir.y;
+	vec4 nz = (texelFetch(BVH, node * 8 + 2) - r.origin.z) * invDir.z;
+	vec4 fx = (texelFetch(BVH, node * 8 + 3) - r.origin.x) * invDir.x;
+	vec4 fy = (texelFetch(BVH, node * 8 + 4) - r.origin.y) * invDir.y;
+	vec4 fz = (texelFetch(BVH, node * 8 + 5) - r.origin.z) * invDir.z;
+	child = floatBitsToInt(texelFetch(BVH, node * 8 + 6));
+	count = floatBitsToInt(texelFetch(BVH, node * 8 + 7));
+
+	vec4 tNear = max(max(min(nx, fx), min(ny, fy)), max(min(nz, fz), vec4(0.0)));
+	vec4 tFar = min(min(max(nx, fx), max(ny, fy)), min(max(nz, fz), vec4(tMax)));
+
+	// entry distance of the children hit, -1 for the others
+	vec4 hit = vec4(lessThanEqual(tNear, tFar)) * vec4(greaterThanEqual(count, ivec4(0)));
+	return mix(vec4(-1.0), tNear, hit);
+}
 
-	// Intersect Emitters
-	for (int i = 0; i < numOfLights; i++)
+//-----------------------------------------------------------------------
+float SceneIntersectWide(Ray r, inout State state, float t)
+//-----------------------------------------------------------------------
+{
+	vec3 invDir = 1.0 / r.direction;
+	int stack[WIDE_STACK_SIZE];
+	int ptr = 0;
+	stack[ptr++] = -1;
+
+	int idx = 0;
+
+	while (idx > -1)
 	{
-		// Fetch light Data
-		vec3 position = texelFetch(lightsTex, i * 5 + 0).xyz;
-		vec3 emission = texelFetch(lightsTex, i * 5 + 1).xyz;
-		vec3 u = texelFetch(lightsTex, i * 5 + 2).xyz;
-		vec3 v = texelFetch(lightsTex, i * 5 + 3).xyz;
-		vec3 radiusAreaType = texelFetch(lightsTex, i * 5 + 4).xyz;
+		ivec4 child;
+		ivec4 count;
+		vec4 dist = IntersectChildren4(idx, r, invDir, t, child, count);
 
-		if (radiusAreaType.z == 0) // Rectangular Area Light
+		for (int i = 0; i < 4; i++)
 		{
-			vec3 normal = normalize(cross(u, v));
-			if (dot(normal, r.direction) > 0) // Hide backfacing quad light
+			if (dist[i] < 0.0 || count[i] == 0)
 				continue;
-			vec4 plane = vec4(normal, dot(normal, position));
-			u *= 1.0f / dot(u, u);
-			v *= 1.0f / dot(v, v);
-
-			d = RectIntersect(position, u, v, normal, plane, r);
-			if (d < 0)
-				d = INFINITY;
-			if (d < t)
+
+			for (int j = 0; j < count[i]; j++)
 			{
-				t = d;
-				float cosTheta = dot(-r.direction, normal);
-				float pdf = (t * t) / (radiusAreaType.y * cosTheta);
-				lightSampleRec.emission = emission;
-				lightSampleRec.pdf = pdf; 
-				state.isEmitter = true;
+				vec4 triIndex = texelFetch(triangleIndicesTex, child[i] + j).xyzw;
+
+				vec3 v0 = texelFetch(verticesTex, int(triIndex.x)).xyz;
+				vec3 v1 = texelFetch(verticesTex, int(triIndex.y)).xyz;
+				vec3 v2 = texelFetch(verticesTex, int(triIndex.z)).xyz;
+
+				vec3 e0 = v1 - v0;
+				vec3 e1 = v2 - v0;
+				vec3 pv = cross(r.direction, e1);
+				float det = dot(e0, pv);
+
+				vec3 tv = r.origin - v0.xyz;
+				vec3 qv = cross(tv, e0);
+
+				vec4 uvt;
+				uvt.x = dot(tv, pv);
+				uvt.y = dot(r.direction, qv);
+				uvt.z = dot(e1, qv);
+				uvt.xyz = uvt.xyz / det;
+				uvt.w = 1.0 - uvt.x - uvt.y;
+
+				if (all(greaterThanEqual(uvt, vec4(0.0))) && uvt.z < t)
+				{
+					t = uvt.z;
+					state.isEmitter = false;
+					state.triID = int(triIndex.w);
+					state.fhp = r.origin + r.direction * t;
+					state.bary = BarycentricCoord(state.fhp, v0, v1, v2);
+				}
 			}
 		}
-		if (radiusAreaType.z == 1) // Spherical Area Light
+
+		// inner children in front of the closest hit, farthest pushed first
+		for (int k = 0; k < 4; k++)
 		{
-			d = SphereIntersect(radiusAreaType.x, position, r);
-			if (d < 0)
-				d = INFINITY;
-			if (d < t)
+			int farthest = -1;
+			for (int i = 0; i < 4; i++)
 			{
-				t = d;
-				float pdf = (t * t) / radiusAreaType.y;
-				lightSampleRec.emission = emission;
-				lightSampleRec.pdf = pdf;
-				state.isEmitter = true;
+				if (count[i] == 0 && dist[i] >= 0.0 && dist[i] <= t && (farthest == -1 || dist[i] > dist[farthest]))
+					farthest = i;
 			}
+			if (farthest == -1)
+				break;
+			stack[ptr++] = child[farthest];
+			dist[farthest] = -1.0;
 		}
+
+		idx = stack[--ptr];
+	}
+
+	return t;
+}
+
+//-----------------------------------------------------------------------
+bool SceneIntersectShadowWide(Ray r, float maxDist)
+//-----------------------------------------------------------------------
+{
+	vec3 invDir = 1.0 / r.direction;
+	int stack[WIDE_STACK_SIZE];
+	int ptr = 0;
+	stack[ptr++] = -1;
+
+	int idx = 0;
+
+	while (idx > -1)
+	{
+		ivec4 child;
+		ivec4 count;
+		vec4 dist = IntersectChildren4(idx, r, invDir, maxDist, child, count);
+
+		for (int i = 0; i < 4; i++)
+		{
+			if (dist[i] < 0.0)
+				continue;
+
+			if (count[i] == 0)
+			{
+				stack[ptr++] = child[i];
+				continue;
+			}
+
+			for (int j = 0; j < count[i]; j++)
+			{
+				vec4 triIndex = texelFetch(triangleIndicesTex, child[i] + j).xyzw;
+
+				vec3 v0 = texelFetch(verticesTex, int(triIndex.x)).xyz;
+				vec3 v1 = texelFetch(verticesTex, int(triIndex.y)).xyz;
+				vec3 v2 = texelFetch(verticesTex, int(triIndex.z)).xyz;
+
+				vec3 e0 = v1 - v0;
+				vec3 e1 = v2 - v0;
+				vec3 pv = cross(r.direction, e1);
+				float det = dot(e0, pv);
+
+				vec3 tv = r.origin - v0.xyz;
+				vec3 qv = cross(tv, e0);
+
+				vec4 uvt;
+				uvt.x = dot(tv, pv);
+				uvt.y = dot(r.direction, qv);
+				uvt.z = dot(e1, qv);
+				uvt.xyz = uvt.xyz / det;
+				uvt.w = 1.0 - uvt.x - uvt.y;
+
+				if (all(greaterThanEqual(uvt, vec4(0.0))) && uvt.z < maxDist)
+					return true;
+			}
+		}
+
+		idx = stack[--ptr];
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------
+void LightIntersect(int i, Ray r, inout float t, inout State state, inout LightSampleRec lightSampleRec)
+//-----------------------------------------------------------------------
+{
+	float d;
+
+	// Fetch light Data
+	vec3 position = texelFetch(lightsTex, i * 5 + 0).xyz;
+	vec3 emission = texelFetch(lightsTex, i * 5 + 1).xyz;
+	vec3 u = texelFetch(lightsTex, i * 5 + 2).xyz;
+	vec3 v = texelFetch(lightsTex, i * 5 + 3).xyz;
+	vec3 radiusAreaType = texelFetch(lightsTex, i * 5 + 4).xyz;
+
+	// probability of picking the light in DirectLight, from its entry of the alias table
+	float pickPdf = texelFetch(lightsTex, numOfLights * 5 + i).z;
+
+	if (radiusAreaType.z == 0) // Rectangular Area Light
+	{
+		vec3 normal = normalize(cross(u, v));
+		if (dot(normal, r.direction) > 0) // Hide backfacing quad light
+			return;
+		vec4 plane = vec4(normal, dot(normal, position));
+		u *= 1.0f / dot(u, u);
+		v *= 1.0f / dot(v, v);
+
+		d = RectIntersect(position, u, v, normal, plane, r);
+		if (d < 0)
+			d = INFINITY;
+		if (d < t)
+		{
+			t = d;
+			float cosTheta = dot(-r.direction, normal);
+			float pdf = pickPdf * (t * t) / (radiusAreaType.y * cosTheta);
+			lightSampleRec.emission = emission;
+			lightSampleRec.pdf = pdf;
+			state.isEmitter = true;
+		}
+	}
+	if (radiusAreaType.z == 1) // Spherical Area Light
+	{
+		d = SphereIntersect(radiusAreaType.x, position, r);
+		if (d < 0)
+			d = INFINITY;
+		if (d < t)
+		{
+			t = d;
+			float pdf = pickPdf * (t * t) / radiusAreaType.y;
+			lightSampleRec.emission = emission;
+			lightSampleRec.pdf = pdf;
+			state.isEmitter = true;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------
+float LightsIntersect(Ray r, inout State state, inout LightSampleRec lightSampleRec)
+//-----------------------------------------------------------------------
+{
+	// nodes of the light BVH follow the light data and the alias table: bounds min, max, then left, right and light
+	int nodes = numOfLights * 6;
+	float t = INFINITY;
+
+	int stack[32];
+	int ptr = 0;
+	stack[ptr++] = -1;
+
+	int idx = 0;
+	float leftHit = 0.0;
+	float rightHit = 0.0;
+
+	while (idx > -1)
+	{
+		vec3 LRLight = texelFetch(lightsTex, nodes + idx * 3 + 2).xyz;
+
+		int leftIndex = int(LRLight.x);
+		int rightIndex = int(LRLight.y);
+		int light = int(LRLight.z);
+
+		if (light >= 0)
+		{
+			LightIntersect(light, r, t, state, lightSampleRec);
+		}
+		else
+		{
+			leftHit = IntersectRayAABBEntry(texelFetch(lightsTex, nodes + leftIndex * 3 + 0).xyz, texelFetch(lightsTex, nodes + leftIndex * 3 + 1).xyz, r);
+			rightHit = IntersectRayAABBEntry(texelFetch(lightsTex, nodes + rightIndex * 3 + 0).xyz, texelFetch(lightsTex, nodes + rightIndex * 3 + 1).xyz, r);
+
+			// children entered behind the closest light hit are skipped. Entry distance, the exit one
+			// would cull boxes containing the origin
+			if (leftHit >= t)
+				leftHit = -1.0;
+			if (rightHit >= t)
+				rightHit = -1.0;
+
+			if (leftHit >= 0.0 && rightHit >= 0.0)
+			{
+				int deferred = -1;
+				if (leftHit > rightHit)
+				{
+					idx = rightIndex;
+					deferred = leftIndex;
+				}
+				else
+				{
+					idx = leftIndex;
+					deferred = rightIndex;
+				}
+
+				stack[ptr++] = deferred;
+				continue;
+			}
+			else if (leftHit >= 0.0)
+			{
+				idx = leftIndex;
+				continue;
+			}
+			else if (rightHit >= 0.0)
+			{
+				idx = rightIndex;
+				continue;
+			}
+		}
+		idx = stack[--ptr];
+	}
+
+	return t;
+}
+
+//-----------------------------------------------------------------------
+float SceneIntersect(Ray r, inout State state, inout LightSampleRec lightSampleRec)
+//-----------------------------------------------------------------------
+{
+	float t = INFINITY;
+
+	// Intersect Emitters
+	if (numOfLights > 0)
+		t = LightsIntersect(r, state, lightSampleRec);
+
+	if (wideBVH)
+	{
+		t = SceneIntersectWide(r, state, t);
+		state.hitDist = t;
+		return t;
 	}
 
 	int stack[64];
@@ -296,6 +571,9 @@ float SceneIntersect(Ray r, inout State state, inout LightSampleRec lightSampleR
 bool SceneIntersectShadow(Ray r, float maxDist)
 //-----------------------------------------------------------------------
 {
+	if (wideBVH)
+		return SceneIntersectShadowWide(r, maxDist);
+
 	int stack[64];
 	int ptr = 0;
 	stack[ptr++] = -1;
@@ -726,7 +1004,7 @@ void sampleSphereLight(in Light light, inout LightSampleRec lightSampleRec)
 
 	lightSampleRec.surfacePos = light.position + UniformSampleSphere(r1, r2) * light.radiusAreaType.x;
 	lightSampleRec.normal = normalize(lightSampleRec.surfacePos - light.position);
-	lightSampleRec.emission = light.emission * numOfLights;
+	lightSampleRec.emission = light.emission;
 }
 
 //-----------------------------------------------------------------------
@@ -738,7 +1016,7 @@ void sampleQuadLight(in Light light, inout LightSampleRec lightSampleRec)
 
 	lightSampleRec.surfacePos = light.position + light.u * r1 + light.v * r2;
 	lightSampleRec.normal = normalize(cross(light.u, light.v));
-	lightSampleRec.emission = light.emission * numOfLights;
+	lightSampleRec.emission = light.emission;
 }
 
 //-----------------------------------------------------------------------
@@ -819,8 +1097,13 @@ vec3 DirectLight(in Ray r, in State state)
 		LightSampleRec lightSampleRec;
 		Light light;
 
-		//Pick a light to sample
-		int index = int(rand() * numOfLights);
+		//Pick a light to sample, proportionally to its power with the alias table that follows the light data
+		float lightPick = rand() * numOfLights;
+		int index = min(int(lightPick), numOfLights - 1);
+		vec3 aliasEntry = texelFetch(lightsTex, numOfLights * 5 + index).xyz;
+		if (lightPick - float(index) >= aliasEntry.x)
+			index = int(aliasEntry.y);
+		float pickPdf = texelFetch(lightsTex, numOfLights * 5 + index).z;
 
 		// Fetch light Data
 		vec3 p = texelFetch(lightsTex, index * 5 + 0).xyz;
@@ -847,7 +1130,7 @@ vec3 DirectLight(in Ray r, in State state)
 		{
 			float bsdfPdf = UE4Pdf(r, state, lightDir);
 			vec3 f = UE4Eval(r, state, lightDir);
-			float lightPdf = lightDistSq / (light.radiusAreaType.y * abs(dot(lightSampleRec.normal, lightDir)));
+			float lightPdf = pickPdf * lightDistSq / (light.radiusAreaType.y * abs(dot(lightSampleRec.normal, lightDir)));
 
 			L += powerHeuristic(lightPdf, bsdfPdf) * f * abs(dot(state.normal, lightDir)) * lightSampleRec.emission / lightPdf;
 		}
@@ -946,32 +1229,25 @@ vec3 PathTrace(Ray r)
 	return radiance;
 }
 
-float map(float value, float low1, float high1, float low2, float high2)
-{
-	return low2 + ((value - low1) * (high2 - low2)) / (high1 - low1);
-}
-
 void main(void)
 {
+	// red of the tile is the number of passes it is traced this frame
+	if (texelFetch(tileTexture, ivec2(gl_FragCoord.xy) / tileSize, 0).r <= float(tilePass))
+		discard;
+
 	seed = gl_FragCoord.xy;
 
 	float r1 = 2.0 * rand();
 	float r2 = 2.0 * rand();
 
-	vec2 coords = TexCoords;
-
-	float xoffset = -1.0 + 2.0 * invTileWidth * tileX;
-	float yoffset = -1.0 + 2.0 * invTileHeight * tileY;
-
-	coords.x = map(coords.x, 0.0, 1.0, xoffset, xoffset + 2.0 * invTileWidth);
-	coords.y = map(coords.y, 0.0, 1.0, yoffset, yoffset + 2.0 * invTileHeight);
+	vec2 coords = gl_FragCoord.xy / screenResolution;
 
 	vec2 jitter;
 	jitter.x = r1 < 1.0 ? sqrt(r1) - 1.0 : 1.0 - sqrt(2.0 - r1);
 	jitter.y = r2 < 1.0 ? sqrt(r2) - 1.0 : 1.0 - sqrt(2.0 - r2);
 
 	jitter /= (screenResolution * 0.5);
-	vec2 d = coords + jitter;
+	vec2 d = 2.0 * coords - 1.0 + jitter;
 
 	d.x *= screenResolution.x / screenResolution.y * tan(camera.fov / 2.0);
 	d.y *= tan(camera.fov / 2.0);
@@ -979,10 +1255,7 @@ void main(void)
 
 	Ray ray = Ray(camera.position, rayDir);
 
-	coords.x = map(TexCoords.x, 0.0, 1.0, invTileWidth * tileX, invTileWidth * tileX + invTileWidth);
-	coords.y = map(TexCoords.y, 0.0, 1.0, invTileHeight * tileY, invTileHeight * tileY + invTileHeight);
-
-	vec3 accumColor = texture(accumTexture, coords).xyz;
+	vec3 accumColor = texelFetch(accumTexture, ivec2(gl_FragCoord.xy), 0).xyz;
 
 	if (isCameraMoving)
 		accumColor = vec3(0);
@@ -0,0 +1,1124 @@
+#include "CPURenderer.h"
+#include "Camera.h"
+#include "LightBVH.h"
+#include "TaskScheduler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace GLSLPathTracer
+{
+    static const float PI = 3.14159265358979323f;
+    static const float TWO_PI = 6.28318530717958648f;
+    static const float INFINITY_DIST = 1000000.f;
+    static const float EPS = 0.001f;
+    static const int TileSize = 32;
+
+    struct Ray { glm::vec3 origin; glm::vec3 direction; };
+    struct Material { glm::vec4 albedo; glm::vec4 emission; glm::vec4 param; glm::vec4 texIDs; };
+    struct State { glm::vec3 normal; glm::vec3 ffnormal; glm::vec3 fhp; bool isEmitter; int depth; float hitDist; glm::vec2 texCoord; glm::vec3 bary; int triID; int matID; Material mat; bool specularBounce; };
+    struct BsdfSampleRec { glm::vec3 bsdfDir; float pdf; };
+    struct LightSampleRec { glm::vec3 surfacePos; glm::vec3 normal; glm::vec3 emission; float pdf; };
+
+    // xorshift sequence seeded per pixel and per pass
+    struct Random
+    {
+        Random(int x, int y, int sample)
+        {
+            uint32_t a = uint32_t(x) * 1973u + uint32_t(y) * 9277u + uint32_t(sample) * 26699u;
+            a = (a ^ 61u) ^ (a >> 16);
+            a *= 9u;
+            a = a ^ (a >> 4);
+            a *= 0x27d4eb2du;
+            a = a ^ (a >> 15);
+            state = a | 1u;
+        }
+        float operator()()
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return float(state >> 8) * (1.f / 16777216.f);
+        }
+        uint32_t state;
+    };
+
+    static float SchlickFresnel(float u)
+    {
+        float m = glm::clamp(1.f - u, 0.f, 1.f);
+        float m2 = m * m;
+        return m2 * m2 * m;
+    }
+
+    static float GTR2(float NDotH, float a)
+    {
+        float a2 = a * a;
+        float t = 1.f + (a2 - 1.f) * NDotH * NDotH;
+        return a2 / (PI * t * t);
+    }
+
+    static float SmithG_GGX(float NDotv, float alphaG)
+    {
+        float a = alphaG * alphaG;
+        float b = NDotv * NDotv;
+        return 1.f / (NDotv + sqrtf(a + b - a * b));
+    }
+
+    static float powerHeuristic(float a, float b)
+    {
+        float t = a * a;
+        return t / (b * b + t);
+    }
+
+    static glm::vec3 CosineSampleHemisphere(float u1, float u2)
+    {
+        glm::vec3 dir;
+        float r = sqrtf(u1);
+        float phi = 2.f * PI * u2;
+        dir.x = r * cosf(phi);
+        dir.y = r * sinf(phi);
+        dir.z = sqrtf(glm::max(0.f, 1.f - dir.x * dir.x - dir.y * dir.y));
+        return dir;
+    }
+
+    static glm::vec3 UniformSampleSphere(float u1, float u2)
+    {
+        float z = 1.f - 2.f * u1;
+        float r = sqrtf(glm::max(0.f, 1.f - z * z));
+        float phi = 2.f * PI * u2;
+        return glm::vec3(r * cosf(phi), r * sinf(phi), z);
+    }
+
+    static void Basis(const glm::vec3& N, glm::vec3& tangentX, glm::vec3& tangentY)
+    {
+        glm::vec3 upVector = fabsf(N.z) < 0.999f ? glm::vec3(0, 0, 1) : glm::vec3(1, 0, 0);
+        tangentX = glm::normalize(glm::cross(upVector, N));
+        tangentY = glm::cross(N, tangentX);
+    }
+
+    // same slab test as IntersectRayAABB in PathTraceFrag.glsl, with the inverse direction precomputed
+    static float IntersectRayAABB(const glm::vec3& minCorner, const glm::vec3& maxCorner, const Ray& r, const glm::vec3& invDir)
+    {
+        glm::vec3 f = (maxCorner - r.origin) * invDir;
+        glm::vec3 n = (minCorner - r.origin) * invDir;
+
+        glm::vec3 tmax = glm::max(f, n);
+        glm::vec3 tmin = glm::min(f, n);
+
+        float t1 = glm::min(tmax.x, glm::min(tmax.y, tmax.z));
+        float t0 = glm::max(tmin.x, glm::max(tmin.y, tmin.z));
+
+        return (t1 >= t0) ? (t0 > 0.f ? t0 : t1) : -1.f;
+    }
+
+    // distance where the ray enters the box, 0 when it starts inside, -1 on a miss. Same as IntersectRayAABBEntry in PathTraceFrag.glsl
+    static float IntersectRayAABBEntry(const glm::vec3& minCorner, const glm::vec3& maxCorner, const Ray& r, const glm::vec3& invDir)
+    {
+        glm::vec3 f = (maxCorner - r.origin) * invDir;
+        glm::vec3 n = (minCorner - r.origin) * invDir;
+
+        glm::vec3 tmax = glm::max(f, n);
+        glm::vec3 tmin = glm::min(f, n);
+
+        float t1 = glm::min(tmax.x, glm::min(tmax.y, tmax.z));
+        float t0 = glm::max(tmin.x, glm::max(tmin.y, tmin.z));
+
+        return (t1 >= t0 && t1 > 0.f) ? glm::max(t0, 0.f) : -1.f;
+    }
+
+    static glm::vec3 BarycentricCoord(const glm::vec3& point, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
+    {
+        glm::vec3 ab = v1 - v0;
+        glm::vec3 ac = v2 - v0;
+        glm::vec3 ah = point - v0;
+
+        float ab_ab = glm::dot(ab, ab);
+        float ab_ac = glm::dot(ab, ac);
+        float ac_ac = glm::dot(ac, ac);
+        float ab_ah = glm::dot(ab, ah);
+        float ac_ah = glm::dot(ac, ah);
+
+        float inv_denom = 1.f / (ab_ab * ac_ac - ab_ac * ab_ac);
+
+        float v = (ac_ac * ab_ah - ab_ac * ac_ah) * inv_denom;
+        float w = (ab_ab * ac_ah - ab_ac * ab_ah) * inv_denom;
+        return glm::vec3(1.f - v - w, v, w);
+    }
+
+    // bilinear fetch with repeat wrapping, like the default GL sampler state of the renderer textures
+    static glm::vec3 SampleRGB8(const unsigned char *texels, int width, int height, float u, float v)
+    {
+        float x = u * width - 0.5f;
+        float y = v * height - 0.5f;
+        float fx = floorf(x);
+        float fy = floorf(y);
+        float tx = x - fx;
+        float ty = y - fy;
+        int x0 = int(fx) % width; if (x0 < 0) x0 += width;
+        int y0 = int(fy) % height; if (y0 < 0) y0 += height;
+        int x1 = (x0 + 1) % width;
+        int y1 = (y0 + 1) % height;
+        auto texel = [&](int px, int py) {
+            const unsigned char *t = texels + (size_t(py) * width + px) * 3;
+            return glm::vec3(t[0], t[1], t[2]) * (1.f / 255.f);
+        };
+        return glm::mix(glm::mix(texel(x0, y0), texel(x1, y0), tx), glm::mix(texel(x0, y1), texel(x1, y1), tx), ty);
+    }
+
+    static glm::vec3 SampleRGB32F(const float *texels, int width, int height, float u, float v)
+    {
+        float x = u * width - 0.5f;
+        float y = v * height - 0.5f;
+        float fx = floorf(x);
+        float fy = floorf(y);
+        float tx = x - fx;
+        float ty = y - fy;
+        int x0 = int(fx) % width; if (x0 < 0) x0 += width;
+        int y0 = int(fy) % height; if (y0 < 0) y0 += height;
+        int x1 = (x0 + 1) % width;
+        int y1 = (y0 + 1) % height;
+        auto texel = [&](int px, int py) {
+            const float *t = texels + (size_t(py) * width + px) * 3;
+            return glm::vec3(t[0], t[1], t[2]);
+        };
+        return glm::mix(glm::mix(texel(x0, y0), texel(x1, y0), tx), glm::mix(texel(x0, y1), texel(x1, y1), tx), ty);
+    }
+
+    // Scene data and the ported shader functions. Read only once built, shared by all tile tasks.
+    struct CPURenderer::Tracer
+    {
+        const GPUBVHNode *nodes;
+        const TriIndexData *triIndices;
+        const VertexData *vertices;
+        const NormalTexData *normalTexData;
+        const MaterialData *materials;
+        const LightData *lights;
+        int numOfLights;
+        // lights are picked with its alias table and intersected with its BVH, as in PathTraceFrag.glsl
+        const LightBVH *lightBVH;
+        const TexData *texData;
+        const HDRLoaderResult *hdr;
+        bool useEnvMap;
+        float hdrResolution;
+        float hdrMultiplier;
+        int maxDepth;
+        const WideBVH<4> *wideBVH4;
+        const WideBVH<8> *wideBVH8;
+
+        // closest triangle with the wide BVH of the scene, if any
+        template<int Width>
+        void WideIntersect(const WideBVH<Width> *wideBVH, const Ray& r, float& t, State& state) const
+        {
+            int triIndex;
+            if (!wideBVH->intersect(r.origin, r.direction, t, triIndex))
+                return;
+            const glm::vec4& indices = triIndices[triIndex].indices;
+            state.isEmitter = false;
+            state.triID = int(indices.w);
+            state.fhp = r.origin + r.direction * t;
+            state.bary = BarycentricCoord(state.fhp, vertices[int(indices.x)].vertex, vertices[int(indices.y)].vertex, vertices[int(indices.z)].vertex);
+        }
+
+        // closest of light i and t, as LightIntersect in PathTraceFrag.glsl
+        void LightIntersect(int i, const Ray& r, float& t, State& state, LightSampleRec& lightSampleRec) const
+        {
+            float d;
+            const LightData& light = lights[i];
+            glm::vec3 u = light.u;
+            glm::vec3 v = light.v;
+
+            if (light.radiusAreaType.z == 0) // Rectangular Area Light
+            {
+                glm::vec3 normal = glm::normalize(glm::cross(u, v));
+                if (glm::dot(normal, r.direction) > 0) // Hide backfacing quad light
+                    return;
+                float planeDist = glm::dot(normal, light.position);
+                u *= 1.f / glm::dot(u, u);
+                v *= 1.f / glm::dot(v, v);
+
+                d = INFINITY_DIST;
+                float dt = glm::dot(r.direction, normal);
+                float tp = (planeDist - glm::dot(normal, r.origin)) / dt;
+                if (tp > EPS)
+                {
+                    glm::vec3 vi = r.origin + r.direction * tp - light.position;
+                    float a1 = glm::dot(u, vi);
+                    float a2 = glm::dot(v, vi);
+                    if (a1 >= 0 && a1 <= 1 && a2 >= 0 && a2 <= 1)
+                        d = tp;
+                }
+                if (d < t)
+                {
+                    t = d;
+                    float cosTheta = glm::dot(-r.direction, normal);
+                    lightSampleRec.emission = light.emission;
+                    lightSampleRec.pdf = lightBVH->pdf(i) * (t * t) / (light.radiusAreaType.y * cosTheta);
+                    state.isEmitter = true;
+                }
+            }
+            if (light.radiusAreaType.z == 1) // Spherical Area Light
+            {
+                glm::vec3 op = light.position - r.origin;
+                float b = glm::dot(op, r.direction);
+                float det = b * b - glm::dot(op, op) + light.radiusAreaType.x * light.radiusAreaType.x;
+                d = INFINITY_DIST;
+                if (det >= 0.f)
+                {
+                    det = sqrtf(det);
+                    if (b - det > EPS)
+                        d = b - det;
+                    else if (b + det > EPS)
+                        d = b + det;
+                }
+                if (d < t)
+                {
+                    t = d;
+                    lightSampleRec.emission = light.emission;
+                    lightSampleRec.pdf = lightBVH->pdf(i) * (t * t) / light.radiusAreaType.y;
+                    state.isEmitter = true;
+                }
+            }
+        }
+
+        // closest light hit with the light BVH, nearest child first. Children entered behind the closest hit are skipped
+        float LightsIntersect(const Ray& r, const glm::vec3& invDir, State& state, LightSampleRec& lightSampleRec) const
+        {
+            const LightBVHNode *lightNodes = lightBVH->nodes.data();
+            float t = INFINITY_DIST;
+            int stack[32];
+            int ptr = 0;
+            stack[ptr++] = -1;
+            int idx = 0;
+
+            while (idx > -1)
+            {
+                const LightBVHNode& node = lightNodes[idx];
+                int light = int(node.leftRightLight.z);
+                if (light >= 0)
+                {
+                    LightIntersect(light, r, t, state, lightSampleRec);
+                }
+                else
+                {
+                    int leftIndex = int(node.leftRightLight.x);
+                    int rightIndex = int(node.leftRightLight.y);
+                    float leftHit = IntersectRayAABBEntry(lightNodes[leftIndex].bboxMin, lightNodes[leftIndex].bboxMax, r, invDir);
+                    float rightHit = IntersectRayAABBEntry(lightNodes[rightIndex].bboxMin, lightNodes[rightIndex].bboxMax, r, invDir);
+                    if (leftHit >= t)
+                        leftHit = -1.f;
+                    if (rightHit >= t)
+                        rightHit = -1.f;
+
+                    if (leftHit >= 0.f && rightHit >= 0.f)
+                    {
+                        if (leftHit > rightHit)
+                        {
+                            idx = rightIndex;
+                            stack[ptr++] = leftIndex;
+                        }
+                        else
+                        {
+                            idx = leftIndex;
+                            stack[ptr++] = rightIndex;
+                        }
+                        continue;
+                    }
+                    else if (leftHit >= 0.f)
+                    {
+                        idx = leftIndex;
+                        continue;
+                    }
+                    else if (rightHit >= 0.f)
+                    {
+                        idx = rightIndex;
+                        continue;
+                    }
+                }
+                idx = stack[--ptr];
+            }
+            return t;
+        }
+
+        float SceneIntersect(const Ray& r, State& state, LightSampleRec& lightSampleRec) const
+        {
+            float t = INFINITY_DIST;
+            glm::vec3 invDir = 1.f / r.direction;
+
+            // Intersect Emitters
+            if (numOfLights > 0)
+                t = LightsIntersect(r, invDir, state, lightSampleRec);
+
+            if (wideBVH4 || wideBVH8)
+            {
+                if (wideBVH4)
+                    WideIntersect(wideBVH4, r, t, state);
+                else
+                    WideIntersect(wideBVH8, r, t, state);
+                state.hitDist = t;
+                return t;
+            }
+
+            int stack[64];
+            int ptr = 0;
+            stack[ptr++] = -1;
+            int idx = 0;
+
+            while (idx > -1)
+            {
+                const GPUBVHNode& node = nodes[idx];
+                int leftIndex = int(node.LRLeaf.x);
+                int rightIndex = int(node.LRLeaf.y);
+
+                if (node.LRLeaf.z == 1.f)
+                {
+                    // leaf: first triangle and triangle count
+                    for (int i = 0; i < rightIndex; i++)
+                    {
+                        const glm::vec4& triIndex = triIndices[leftIndex + i].indices;
+                        const glm::vec3& v0 = vertices[int(triIndex.x)].vertex;
+                        const glm::vec3& v1 = vertices[int(triIndex.y)].vertex;
+                        const glm::vec3& v2 = vertices[int(triIndex.z)].vertex;
+
+                        glm::vec3 e0 = v1 - v0;
+                        glm::vec3 e1 = v2 - v0;
+                        glm::vec3 pv = glm::cross(r.direction, e1);
+                        float det = glm::dot(e0, pv);
+                        glm::vec3 tv = r.origin - v0;
+                        glm::vec3 qv = glm::cross(tv, e0);
+
+                        glm::vec4 uvt;
+                        uvt.x = glm::dot(tv, pv) / det;
+                        uvt.y = glm::dot(r.direction, qv) / det;
+                        uvt.z = glm::dot(e1, qv) / det;
+                        uvt.w = 1.f - uvt.x - uvt.y;
+
+                        if (uvt.x >= 0.f && uvt.y >= 0.f && uvt.z >= 0.f && uvt.w >= 0.f && uvt.z < t)
+                        {
+                            t = uvt.z;
+                            state.isEmitter = false;
+                            state.triID = int(triIndex.w);
+                            state.fhp = r.origin + r.direction * t;
+                            state.bary = BarycentricCoord(state.fhp, v0, v1, v2);
+                        }
+                    }
+                }
+                else
+                {
+                    float leftHit = IntersectRayAABB(nodes[leftIndex].BBoxMin, nodes[leftIndex].BBoxMax, r, invDir);
+                    float rightHit = IntersectRayAABB(nodes[rightIndex].BBoxMin, nodes[rightIndex].BBoxMax, r, invDir);
+
+                    if (leftHit > 0.f && rightHit > 0.f)
+                    {
+                        // nearest child first
+                        if (leftHit > rightHit)
+                        {
+                            idx = rightIndex;
+                            stack[ptr++] = leftIndex;
+                        }
+                        else
+                        {
+                            idx = leftIndex;
+                            stack[ptr++] = rightIndex;
+                        }
+                        continue;
+                    }
+                    else if (leftHit > 0.f)
+                    {
+                        idx = leftIndex;
+                        continue;
+                    }
+                    else if (rightHit > 0.f)
+                    {
+                        idx = rightIndex;
+                        continue;
+                    }
+                }
+                idx = stack[--ptr];
+            }
+
+            state.hitDist = t;
+            return t;
+        }
+
+        bool SceneIntersectShadow(const Ray& r, float maxDist) const
+        {
+            if (wideBVH4)
+                return wideBVH4->occluded(r.origin, r.direction, maxDist);
+            if (wideBVH8)
+                return wideBVH8->occluded(r.origin, r.direction, maxDist);
+
+            glm::vec3 invDir = 1.f / r.direction;
+            int stack[64];
+            int ptr = 0;
+            stack[ptr++] = -1;
+            int idx = 0;
+
+            while (idx > -1)
+            {
+                const GPUBVHNode& node = nodes[idx];
+                int leftIndex = int(node.LRLeaf.x);
+                int rightIndex = int(node.LRLeaf.y);
+
+                if (node.LRLeaf.z == 1.f)
+                {
+                    for (int i = 0; i < rightIndex; i++)
+                    {
+                        const glm::vec4& triIndex = triIndices[leftIndex + i].indices;
+                        const glm::vec3& v0 = vertices[int(triIndex.x)].vertex;
+                        const glm::vec3& v1 = vertices[int(triIndex.y)].vertex;
+                        const glm::vec3& v2 = vertices[int(triIndex.z)].vertex;
+
+                        glm::vec3 e0 = v1 - v0;
+                        glm::vec3 e1 = v2 - v0;
+                        glm::vec3 pv = glm::cross(r.direction, e1);
+                        float det = glm::dot(e0, pv);
+                        glm::vec3 tv = r.origin - v0;
+                        glm::vec3 qv = glm::cross(tv, e0);
+
+                        float u = glm::dot(tv, pv) / det;
+                        float v = glm::dot(r.direction, qv) / det;
+                        float t = glm::dot(e1, qv) / det;
+                        if (u >= 0.f && v >= 0.f && t >= 0.f && 1.f - u - v >= 0.f && t < maxDist)
+                            return true;
+                    }
+                }
+                else
+                {
+                    float leftHit = IntersectRayAABB(nodes[leftIndex].BBoxMin, nodes[leftIndex].BBoxMax, r, invDir);
+                    float rightHit = IntersectRayAABB(nodes[rightIndex].BBoxMin, nodes[rightIndex].BBoxMax, r, invDir);
+
+                    if (leftHit > 0.f && rightHit > 0.f)
+                    {
+                        if (leftHit > rightHit)
+                        {
+                            idx = rightIndex;
+                            stack[ptr++] = leftIndex;
+                        }
+                        else
+                        {
+                            idx = leftIndex;
+                            stack[ptr++] = rightIndex;
+                        }
+                        continue;
+                    }
+                    else if (leftHit > 0.f)
+                    {
+                        idx = leftIndex;
+                        continue;
+                    }
+                    else if (rightHit > 0.f)
+                    {
+                        idx = rightIndex;
+                        continue;
+                    }
+                }
+                idx = stack[--ptr];
+            }
+            return false;
+        }
+
+        void GetNormalAndTexCoord(State& state, const Ray& r) const
+        {
+            const NormalTexData& data = normalTexData[state.triID];
+
+            state.matID = int(data.texCoords[0].z);
+            state.texCoord = glm::vec2(data.texCoords[0]) * state.bary.x + glm::vec2(data.texCoords[1]) * state.bary.y + glm::vec2(data.texCoords[2]) * state.bary.z;
+
+            glm::vec3 normal = glm::normalize(data.normals[0] * state.bary.x + data.normals[1] * state.bary.y + data.normals[2] * state.bary.z);
+            state.normal = normal;
+            state.ffnormal = glm::dot(normal, r.direction) <= 0.f ? normal : -normal;
+        }
+
+        void GetMaterialsAndTextures(State& state, const Ray& r) const
+        {
+            const MaterialData& data = materials[state.matID];
+            Material mat = { data.albedo, data.emission, data.params, data.texIDs };
+            const glm::vec2& uv = state.texCoord;
+
+            if (int(mat.texIDs.x) >= 0)
+            {
+                const TexData& tex = *texData;
+                const unsigned char *layer = tex.albedoTextures + size_t(int(mat.texIDs.x)) * tex.albedoTextureSize.x * tex.albedoTextureSize.y * 3;
+                glm::vec3 albedo = glm::pow(SampleRGB8(layer, tex.albedoTextureSize.x, tex.albedoTextureSize.y, uv.x, uv.y), glm::vec3(2.2f));
+                mat.albedo.x *= albedo.x;
+                mat.albedo.y *= albedo.y;
+                mat.albedo.z *= albedo.z;
+            }
+
+            if (int(mat.texIDs.y) >= 0)
+            {
+                const TexData& tex = *texData;
+                const unsigned char *layer = tex.metallicRoughnessTextures + size_t(int(mat.texIDs.y)) * tex.metallicRoughnessTextureSize.x * tex.metallicRoughnessTextureSize.y * 3;
+                glm::vec3 metallicRoughness = SampleRGB8(layer, tex.metallicRoughnessTextureSize.x, tex.metallicRoughnessTextureSize.y, uv.x, uv.y);
+                mat.param.x = powf(metallicRoughness.z, 2.2f);
+                mat.param.y = powf(metallicRoughness.y, 2.2f);
+            }
+
+            if (int(mat.texIDs.z) >= 0)
+            {
+                const TexData& tex = *texData;
+                const unsigned char *layer = tex.normalTextures + size_t(int(mat.texIDs.z)) * tex.normalTextureSize.x * tex.normalTextureSize.y * 3;
+                glm::vec3 nrm = glm::normalize(SampleRGB8(layer, tex.normalTextureSize.x, tex.normalTextureSize.y, uv.x, uv.y) * 2.f - 1.f);
+
+                glm::vec3 tangentX, tangentY;
+                Basis(state.ffnormal, tangentX, tangentY);
+                nrm = tangentX * nrm.x + tangentY * nrm.y + state.ffnormal * nrm.z;
+                state.normal = glm::normalize(nrm);
+                state.ffnormal = glm::dot(state.normal, r.direction) <= 0.f ? state.normal : -state.normal;
+            }
+
+            state.mat = mat;
+        }
+
+        float UE4Pdf(const Ray& ray, const State& state, const glm::vec3& bsdfDir) const
+        {
+            const glm::vec3& n = state.normal;
+            glm::vec3 V = -ray.direction;
+            const glm::vec3& L = bsdfDir;
+
+            float specularAlpha = glm::max(0.001f, state.mat.param.y);
+            float diffuseRatio = 0.5f * (1.f - state.mat.param.x);
+            float specularRatio = 1.f - diffuseRatio;
+
+            glm::vec3 halfVec = glm::normalize(L + V);
+            float cosTheta = fabsf(glm::dot(halfVec, n));
+            float pdfGTR2 = GTR2(cosTheta, specularAlpha) * cosTheta;
+
+            float pdfSpec = pdfGTR2 / (4.f * fabsf(glm::dot(L, halfVec)));
+            float pdfDiff = fabsf(glm::dot(L, n)) * (1.f / PI);
+
+            return diffuseRatio * pdfDiff + specularRatio * pdfSpec;
+        }
+
+        glm::vec3 UE4Sample(const Ray& ray, const State& state, Random& rand) const
+        {
+            const glm::vec3& N = state.normal;
+            glm::vec3 V = -ray.direction;
+            glm::vec3 dir;
+
+            float probability = rand();
+            float diffuseRatio = 0.5f * (1.f - state.mat.param.x);
+            float r1 = rand();
+            float r2 = rand();
+
+            glm::vec3 tangentX, tangentY;
+            Basis(N, tangentX, tangentY);
+
+            if (probability < diffuseRatio) // sample diffuse
+            {
+                dir = CosineSampleHemisphere(r1, r2);
+                dir = tangentX * dir.x + tangentY * dir.y + N * dir.z;
+            }
+            else
+            {
+                float a = glm::max(0.001f, state.mat.param.y);
+                float phi = r1 * 2.f * PI;
+                float cosTheta = sqrtf((1.f - r2) / (1.f + (a * a - 1.f) * r2));
+                float sinTheta = glm::clamp(sqrtf(1.f - cosTheta * cosTheta), 0.f, 1.f);
+
+                glm::vec3 halfVec = glm::vec3(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+                halfVec = tangentX * halfVec.x + tangentY * halfVec.y + N * halfVec.z;
+                dir = 2.f * glm::dot(V, halfVec) * halfVec - V;
+            }
+            return dir;
+        }
+
+        glm::vec3 UE4Eval(const Ray& ray, const State& state, const glm::vec3& bsdfDir) const
+        {
+            const glm::vec3& N = state.normal;
+            glm::vec3 V = -ray.direction;
+            const glm::vec3& L = bsdfDir;
+
+            float NDotL = glm::dot(N, L);
+            float NDotV = glm::dot(N, V);
+            if (NDotL <= 0.f || NDotV <= 0.f)
+                return glm::vec3(0.f);
+
+            glm::vec3 H = glm::normalize(L + V);
+            float NDotH = glm::dot(N, H);
+            float LDotH = glm::dot(L, H);
+
+            glm::vec3 albedo(state.mat.albedo);
+            float specular = 0.5f;
+            glm::vec3 specularCol = glm::mix(glm::vec3(0.08f * specular), albedo, state.mat.param.x);
+            float a = glm::max(0.001f, state.mat.param.y);
+            float Ds = GTR2(NDotH, a);
+            float FH = SchlickFresnel(LDotH);
+            glm::vec3 Fs = glm::mix(specularCol, glm::vec3(1.f), FH);
+            float roughg = state.mat.param.y * 0.5f + 0.5f;
+            roughg = roughg * roughg;
+            float Gs = SmithG_GGX(NDotL, roughg) * SmithG_GGX(NDotV, roughg);
+
+            return (albedo / PI) * (1.f - state.mat.param.x) + Gs * Fs * Ds;
+        }
+
+        glm::vec3 GlassSample(const Ray& ray, const State& state, Random& rand) const
+        {
+            float n1 = 1.f;
+            float n2 = state.mat.param.z;
+            float R0 = (n1 - n2) / (n1 + n2);
+            R0 *= R0;
+            float theta = glm::dot(-ray.direction, state.ffnormal);
+            float prob = R0 + (1.f - R0) * SchlickFresnel(theta);
+
+            float eta = glm::dot(state.normal, state.ffnormal) > 0.f ? (n1 / n2) : (n2 / n1);
+            float cos2t = 1.f - eta * eta * (1.f - theta * theta);
+
+            if (cos2t < 0.f || rand() < prob) // Reflection
+                return glm::normalize(glm::reflect(ray.direction, state.ffnormal));
+            return glm::normalize(glm::refract(ray.direction, state.ffnormal, eta));
+        }
+
+        float EnvPdf(const Ray& r) const
+        {
+            float theta = acosf(glm::clamp(r.direction.y, -1.f, 1.f));
+            float u = (PI + atan2f(r.direction.z, r.direction.x)) * (1.f / TWO_PI);
+            float v = theta * (1.f / PI);
+            float sinTheta = sinf(theta);
+            if (sinTheta <= 0.f)
+                return 0.f;
+            float pdf = Conditional(u, v).y * Marginal(v).y;
+            return (pdf * hdrResolution) / (2.f * PI * PI * sinTheta);
+        }
+
+        glm::vec4 EnvSample(glm::vec3& color, Random& rand) const
+        {
+            float r1 = rand();
+            float r2 = rand();
+
+            float v = Marginal(r1).x;
+            float u = Conditional(r2, v).x;
+
+            color = SampleRGB32F(hdr->cols, hdr->width, hdr->height, u, v) * hdrMultiplier;
+            float pdf = Conditional(u, v).y * Marginal(v).y;
+
+            float phi = u * TWO_PI;
+            float theta = v * PI;
+            float sinTheta = sinf(theta);
+            if (sinTheta <= 0.f)
+                return glm::vec4(0.f, 1.f, 0.f, 0.f);
+
+            return glm::vec4(-sinTheta * cosf(phi), cosf(theta), -sinTheta * sinf(phi), (pdf * hdrResolution) / (2.f * PI * PI * sinTheta));
+        }
+
+        // nearest fetches, the distribution textures are not filtered
+        const glm::vec2& Marginal(float v) const
+        {
+            return hdr->marginalDistData[glm::clamp(int(v * hdr->height), 0, hdr->height - 1)];
+        }
+
+        const glm::vec2& Conditional(float u, float v) const
+        {
+            int x = glm::clamp(int(u * hdr->width), 0, hdr->width - 1);
+            int y = glm::clamp(int(v * hdr->height), 0, hdr->height - 1);
+            return hdr->conditionalDistData[y * hdr->width + x];
+        }
+
+        glm::vec3 DirectLight(const Ray& r, const State& state, Random& rand) const
+        {
+            glm::vec3 L(0.f);
+            glm::vec3 surfacePos = state.fhp + state.normal * EPS;
+
+            // Environment Light
+            if (useEnvMap)
+            {
+                glm::vec3 color;
+                glm::vec4 dirPdf = EnvSample(color, rand);
+                glm::vec3 lightDir(dirPdf);
+                float lightPdf = dirPdf.w;
+
+                if (lightPdf > 0.f && !SceneIntersectShadow({ surfacePos, lightDir }, INFINITY_DIST - EPS))
+                {
+                    float bsdfPdf = UE4Pdf(r, state, lightDir);
+                    glm::vec3 f = UE4Eval(r, state, lightDir);
+
+                    float misWeight = powerHeuristic(lightPdf, bsdfPdf);
+                    if (misWeight > 0.f)
+                        L += misWeight * f * fabsf(glm::dot(lightDir, state.normal)) * color / lightPdf;
+                }
+            }
+
+            // Sample Analytic Lights
+            if (numOfLights > 0)
+            {
+                // Pick a light to sample, proportionally to its power
+                float pickPdf;
+                const LightData& light = lights[lightBVH->sample(rand(), pickPdf)];
+
+                LightSampleRec lightSampleRec;
+                float r1 = rand();
+                float r2 = rand();
+                if (int(light.radiusAreaType.z) == 0) // Quad Light
+                {
+                    lightSampleRec.surfacePos = light.position + light.u * r1 + light.v * r2;
+                    lightSampleRec.normal = glm::normalize(glm::cross(light.u, light.v));
+                }
+                else
+                {
+                    lightSampleRec.surfacePos = light.position + UniformSampleSphere(r1, r2) * light.radiusAreaType.x;
+                    lightSampleRec.normal = glm::normalize(lightSampleRec.surfacePos - light.position);
+                }
+                lightSampleRec.emission = light.emission;
+
+                glm::vec3 lightDir = lightSampleRec.surfacePos - surfacePos;
+                float lightDist = glm::length(lightDir);
+                float lightDistSq = lightDist * lightDist;
+                lightDir /= lightDist;
+
+                if (glm::dot(lightDir, state.normal) <= 0.f || glm::dot(lightDir, lightSampleRec.normal) >= 0.f)
+                    return L;
+
+                if (!SceneIntersectShadow({ surfacePos, lightDir }, lightDist - EPS))
+                {
+                    float bsdfPdf = UE4Pdf(r, state, lightDir);
+                    glm::vec3 f = UE4Eval(r, state, lightDir);
+                    float lightPdf = pickPdf * lightDistSq / (light.radiusAreaType.y * fabsf(glm::dot(lightSampleRec.normal, lightDir)));
+
+                    L += powerHeuristic(lightPdf, bsdfPdf) * f * fabsf(glm::dot(state.normal, lightDir)) * lightSampleRec.emission / lightPdf;
+                }
+            }
+
+            return L;
+        }
+
+        // albedo and normalDepth receive the first hit, for the Denoiser
+        glm::vec3 PathTrace(Ray r, Random& rand, glm::vec3& albedo, glm::vec4& normalDepth) const
+        {
+            glm::vec3 radiance(0.f);
+            glm::vec3 throughput(1.f);
+            State state = {};
+            LightSampleRec lightSampleRec = {};
+            BsdfSampleRec bsdfSampleRec = {};
+
+            for (int depth = 0; depth < maxDepth; depth++)
+            {
+                state.depth = depth;
+                float t = SceneIntersect(r, state, lightSampleRec);
+
+                if (t == INFINITY_DIST)
+                {
+                    if (useEnvMap)
+                    {
+                        float misWeight = 1.f;
+                        glm::vec2 uv((PI + atan2f(r.direction.z, r.direction.x)) * (1.f / TWO_PI), acosf(glm::clamp(r.direction.y, -1.f, 1.f)) * (1.f / PI));
+
+                        if (depth > 0 && !state.specularBounce)
+                            misWeight = powerHeuristic(bsdfSampleRec.pdf, EnvPdf(r));
+
+                        radiance += misWeight * SampleRGB32F(hdr->cols, hdr->width, hdr->height, uv.x, uv.y) * throughput * hdrMultiplier;
+                    }
+                    break;
+                }
+
+                if (state.isEmitter)
+                {
+                    if (depth == 0)
+                        normalDepth = glm::vec4(-r.direction, t);
+                    // emitters are analytic lights, the triangle data of the previous hit is not theirs
+                    if (depth == 0 || state.specularBounce)
+                        radiance += lightSampleRec.emission * throughput;
+                    else
+                        radiance += powerHeuristic(bsdfSampleRec.pdf, lightSampleRec.pdf) * lightSampleRec.emission * throughput;
+                    break;
+                }
+
+                GetNormalAndTexCoord(state, r);
+                GetMaterialsAndTextures(state, r);
+
+                if (depth == 0)
+                {
+                    albedo = glm::vec3(state.mat.albedo);
+                    normalDepth = glm::vec4(state.ffnormal, t);
+                }
+
+                radiance += glm::vec3(state.mat.emission) * throughput;
+
+                if (state.mat.albedo.w == 0.f) // UE4 Brdf
+                {
+                    state.specularBounce = false;
+                    if (depth < maxDepth - 1)
+                        radiance += DirectLight(r, state, rand) * throughput;
+
+                    bsdfSampleRec.bsdfDir = UE4Sample(r, state, rand);
+                    bsdfSampleRec.pdf = UE4Pdf(r, state, bsdfSampleRec.bsdfDir);
+
+                    if (bsdfSampleRec.pdf > 0.f)
+                        throughput *= UE4Eval(r, state, bsdfSampleRec.bsdfDir) * fabsf(glm::dot(state.normal, bsdfSampleRec.bsdfDir)) / bsdfSampleRec.pdf;
+                    else
+                        break;
+                }
+                else // Glass
+                {
+                    state.specularBounce = true;
+                    bsdfSampleRec.bsdfDir = GlassSample(r, state, rand);
+                    bsdfSampleRec.pdf = 1.f;
+                    throughput *= glm::vec3(state.mat.albedo);
+                }
+
+                r.direction = bsdfSampleRec.bsdfDir;
+                r.origin = state.fhp + r.direction * EPS;
+            }
+
+            return radiance;
+        }
+    };
+
+    struct CPURenderer::PassTaskSet : public enki::ITaskSet
+    {
+        PassTaskSet(CPURenderer *renderer, uint32_t tileCount) : enki::ITaskSet(tileCount), renderer(renderer) {}
+
+        void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum) override
+        {
+            for (uint32_t tile = range.start; tile < range.end; tile++)
+                renderer->traceTile(int(tile));
+        }
+
+        CPURenderer *renderer;
+    };
+
+    CPURenderer::CPURenderer(const Scene *scene, enki::TaskScheduler *taskScheduler) : Renderer(scene, "")
+        , taskScheduler(taskScheduler)
+        , tracer(nullptr)
+        , passTask(nullptr)
+        , maxSamples(glm::max(scene->renderOptions.maxSamples, 1))
+        , maxDepth(scene->renderOptions.maxDepth)
+        , sampleCounter(0)
+        , passSample(0)
+        , resolvedPass(-1)
+        , numTilesX(0)
+        , numTilesY(0)
+        , passRunning(false)
+        , restart(true)
+        , imageChanged(false)
+        , cancelPass(false)
+        , cameraFov(0.f)
+    {
+    }
+
+    CPURenderer::~CPURenderer()
+    {
+        // before ~Renderer, that would release GL objects this renderer never created
+        finish();
+    }
+
+    void CPURenderer::init()
+    {
+        if (initialized)
+            return;
+
+        if (scene == nullptr || scene->gpuBVH == nullptr)
+        {
+            Log("Error: No Scene Found\n");
+            return;
+        }
+
+        tracer = new Tracer;
+        tracer->nodes = scene->gpuBVH->gpuNodes;
+        tracer->triIndices = scene->gpuBVH->bvhTriangleIndices.data();
+        tracer->vertices = scene->vertexData.data();
+        tracer->normalTexData = scene->normalTexData.data();
+        tracer->materials = scene->materialData.data();
+        tracer->lights = scene->lightData.data();
+        tracer->numOfLights = int(scene->lightData.size());
+        tracer->lightBVH = new LightBVH(scene->lightData);
+        tracer->texData = &scene->texData;
+        tracer->hdr = &scene->hdrLoaderRes;
+        tracer->useEnvMap = scene->renderOptions.useEnvMap && scene->hdrLoaderRes.cols;
+        tracer->hdrResolution = float(scene->hdrLoaderRes.width * scene->hdrLoaderRes.height);
+        tracer->hdrMultiplier = scene->renderOptions.hdrMultiplier;
+        tracer->maxDepth = maxDepth;
+        tracer->wideBVH4 = scene->wideBVH4;
+        tracer->wideBVH8 = scene->wideBVH8;
+
+        numTilesX = (screenSize.x + TileSize - 1) / TileSize;
+        numTilesY = (screenSize.y + TileSize - 1) / TileSize;
+        passTask = new PassTaskSet(this, uint32_t(numTilesX * numTilesY));
+        const size_t pixelCount = size_t(screenSize.x) * screenSize.y;
+        accumulation.assign(pixelCount, glm::vec3(0.f));
+        albedoAccumulation.assign(pixelCount, glm::vec3(0.f));
+        normalDepthAccumulation.assign(pixelCount, glm::vec4(0.f));
+        resolvedColor.resize(pixelCount);
+        resolvedAlbedo.resize(pixelCount);
+        resolvedNormalDepth.resize(pixelCount);
+        output.assign(size_t(screenSize.x) * screenSize.y * 4, 0);
+
+        sampleCounter = 0;
+        restart = true;
+        imageChanged = false;
+        initialized = true;
+    }
+
+    void CPURenderer::finish()
+    {
+        if (!initialized)
+            return;
+
+        if (passRunning)
+        {
+            cancelPass = true;
+            taskScheduler->WaitforTask(passTask);
+            passRunning = false;
+            cancelPass = false;
+        }
+        delete passTask;
+        passTask = nullptr;
+        delete tracer->lightBVH;
+        delete tracer;
+        tracer = nullptr;
+        accumulation.clear();
+        albedoAccumulation.clear();
+        normalDepthAccumulation.clear();
+        resolvedColor.clear();
+        resolvedAlbedo.clear();
+        resolvedNormalDepth.clear();
+        output.clear();
+        initialized = false;
+    }
+
+    bool CPURenderer::cameraChanged() const
+    {
+        const Camera *camera = scene->camera;
+        return camera->position != cameraPosition || camera->right != cameraRight || camera->up != cameraUp || camera->forward != cameraForward || camera->fov != cameraFov;
+    }
+
+    void CPURenderer::update(float secondsElapsed)
+    {
+        if (!initialized || restart || !cameraChanged())
+            return;
+
+        // the running pass traces the previous view, skip its remaining tiles
+        restart = true;
+        if (passRunning)
+            cancelPass = true;
+    }
+
+    void CPURenderer::render()
+    {
+        if (!initialized)
+            return;
+
+        if (passRunning)
+        {
+            if (!passTask->GetIsComplete())
+                return;
+            passRunning = false;
+            if (!cancelPass)
+            {
+                sampleCounter++;
+                resolve();
+            }
+            cancelPass = false;
+        }
+
+        if (restart)
+        {
+            std::fill(accumulation.begin(), accumulation.end(), glm::vec3(0.f));
+            std::fill(albedoAccumulation.begin(), albedoAccumulation.end(), glm::vec3(0.f));
+            std::fill(normalDepthAccumulation.begin(), normalDepthAccumulation.end(), glm::vec4(0.f));
+            sampleCounter = 0;
+            restart = false;
+
+            const Camera *camera = scene->camera;
+            cameraPosition = camera->position;
+            cameraRight = camera->right;
+            cameraUp = camera->up;
+            cameraForward = camera->forward;
+            cameraFov = camera->fov;
+        }
+
+        if (sampleCounter < maxSamples)
+        {
+            passSample = sampleCounter;
+            passRunning = true;
+            taskScheduler->AddTaskSetToPipe(passTask);
+        }
+    }
+
+    void CPURenderer::traceTile(int tile)
+    {
+        if (cancelPass)
+            return;
+
+        const int x0 = (tile % numTilesX) * TileSize;
+        const int y0 = (tile / numTilesX) * TileSize;
+        const int x1 = glm::min(x0 + TileSize, screenSize.x);
+        const int y1 = glm::min(y0 + TileSize, screenSize.y);
+        const glm::vec2 resolution(screenSize);
+        const float tanHalfFov = tanf(cameraFov * 0.5f);
+        const float aspect = resolution.x / resolution.y;
+
+        for (int y = y0; y < y1; y++)
+        {
+            for (int x = x0; x < x1; x++)
+            {
+                Random rand(x, y, passSample);
+
+                // tent filtered jitter, as in PathTraceFrag.glsl
+                float r1 = 2.f * rand();
+                float r2 = 2.f * rand();
+                glm::vec2 jitter;
+                jitter.x = r1 < 1.f ? sqrtf(r1) - 1.f : 1.f - sqrtf(2.f - r1);
+                jitter.y = r2 < 1.f ? sqrtf(r2) - 1.f : 1.f - sqrtf(2.f - r2);
+                jitter /= resolution * 0.5f;
+
+                glm::vec2 texCoords((x + 0.5f) / resolution.x, (y + 0.5f) / resolution.y);
+                glm::vec2 d = 2.f * texCoords - 1.f + jitter;
+                d.x *= aspect * tanHalfFov;
+                d.y *= tanHalfFov;
+                Ray ray = { cameraPosition, glm::normalize(d.x * cameraRight + d.y * cameraUp + cameraForward) };
+
+                // background: white albedo and a depth of 0
+                glm::vec3 albedo(1.f);
+                glm::vec4 normalDepth(-ray.direction, 0.f);
+                glm::vec3 color = tracer->PathTrace(ray, rand, albedo, normalDepth);
+                const size_t index = size_t(y) * screenSize.x + x;
+                if (std::isfinite(color.x) && std::isfinite(color.y) && std::isfinite(color.z))
+                    accumulation[index] += color;
+                albedoAccumulation[index] += albedo;
+                normalDepthAccumulation[index] += normalDepth;
+            }
+        }
+    }
+
+    void CPURenderer::resolve()
+    {
+        // same tone mapping as OutputFrag.glsl
+        const float invSampleCounter = 1.f / float(sampleCounter);
+        const float limit = 1.5f;
+        for (size_t i = 0; i < accumulation.size(); i++)
+        {
+            glm::vec3 c = accumulation[i] * invSampleCounter;
+            resolvedColor[i] = c;
+            resolvedAlbedo[i] = albedoAccumulation[i] * invSampleCounter;
+            resolvedNormalDepth[i] = normalDepthAccumulation[i] * invSampleCounter;
+            float luminance = 0.3f * c.x + 0.6f * c.y + 0.1f * c.z;
+            c = glm::pow(c * (1.f / (1.f + luminance / limit)), glm::vec3(1.f / 2.2f));
+            output[i * 4 + 0] = (unsigned char)(glm::clamp(c.x, 0.f, 1.f) * 255.f + 0.5f);
+            output[i * 4 + 1] = (unsigned char)(glm::clamp(c.y, 0.f, 1.f) * 255.f + 0.5f);
+            output[i * 4 + 2] = (unsigned char)(glm::clamp(c.z, 0.f, 1.f) * 255.f + 0.5f);
+            output[i * 4 + 3] = 255;
+        }
+        imageChanged = true;
+        resolvedPass++;
+    }
+
+    float CPURenderer::getProgress() const
+    {
+        return float(sampleCounter) / float(maxSamples);
+    }
+
+    int CPURenderer::getDenoiserInputs(const glm::vec3 *&color, const glm::vec3 *&albedo, const glm::vec4 *&normalDepth) const
+    {
+        color = resolvedColor.data();
+        albedo = resolvedAlbedo.data();
+        normalDepth = resolvedNormalDepth.data();
+        return resolvedPass;
+    }
+
+    const unsigned char *CPURenderer::getImage()
+    {
+        if (!imageChanged)
+            return nullptr;
+        imageChanged = false;
+        return output.data();
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Renderer.h"
+#include <atomic>
+#include <vector>
+
+namespace enki
+{
+    class TaskScheduler;
+}
+
+namespace GLSLPathTracer
+{
+    // Path tracer running on the CPU, for machines without a usable GPU.
+    // Traverses the wide BVH of the scene, or the GPUBVH arrays, and shades like PathTraceFrag.glsl.
+    // Each pass adds one sample per pixel and is split in tiles traced by enkiTS tasks. render() never
+    // blocks: it collects a finished pass and starts the next one. The tone mapped result is read back
+    // with getImage.
+    class CPURenderer : public Renderer
+    {
+    private:
+        struct Tracer;
+        struct PassTaskSet;
+
+        enki::TaskScheduler *taskScheduler;
+        Tracer *tracer;
+        PassTaskSet *passTask;
+        std::vector<glm::vec3> accumulation, albedoAccumulation;
+        std::vector<glm::vec4> normalDepthAccumulation;
+        std::vector<unsigned char> output;
+        // averages of the last finished pass, read by the Denoiser while the next pass is traced
+        std::vector<glm::vec3> resolvedColor, resolvedAlbedo;
+        std::vector<glm::vec4> resolvedNormalDepth;
+        int maxSamples, maxDepth, sampleCounter, passSample, resolvedPass, numTilesX, numTilesY;
+        bool passRunning, restart, imageChanged;
+        std::atomic<bool> cancelPass;
+        glm::vec3 cameraPosition, cameraRight, cameraUp, cameraForward;
+        float cameraFov;
+
+        void traceTile(int tile);
+        void resolve();
+        bool cameraChanged() const;
+
+    public:
+        CPURenderer(const Scene *scene, enki::TaskScheduler *taskScheduler);
+        ~CPURenderer();
+
+        void init();
+        void finish();
+
+        void render();
+        void present() const {}
+        void update(float secondsElapsed);
+        float getProgress() const;
+        RendererType getType() const { return Renderer_CPU; }
+
+        // RGBA8 image of screenSize, rows bottom to top like GL textures.
+        // Returns nullptr when no pass finished since the previous call.
+        const unsigned char *getImage();
+        // linear color, albedo and normal/depth averages of the last finished pass. Returns the count
+        // of finished passes minus one, -1 when there is none yet
+        int getDenoiserInputs(const glm::vec3 *&color, const glm::vec3 *&albedo, const glm::vec4 *&normalDepth) const;
+    };
+}
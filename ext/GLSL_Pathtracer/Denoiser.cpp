@@ -0,0 +1,275 @@
+#include "Denoiser.h"
+#include "Quad.h"
+#include "TaskScheduler.h"
+#include <cmath>
+#include <cstdlib>
+
+namespace GLSLPathTracer
+{
+    Program *loadShaders(const std::string &vertex_shader_fileName, const std::string &frag_shader_fileName, const std::string &fragDefines = std::string());
+
+    // B3 spline, from the center tap
+    static const float Kernel[3] = { 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+    static const float MinAlbedo = 0.01f;
+
+    static float Luminance(const glm::vec3& c)
+    {
+        return 0.3f * c.x + 0.6f * c.y + 0.1f * c.z;
+    }
+
+    Denoiser::Denoiser(const std::string& shadersDirectory, enki::TaskScheduler *taskScheduler) : filteredPass(-1)
+        , filteredSettings()
+        , passThroughLogged(false)
+        , shadersDirectory(shadersDirectory)
+        , taskScheduler(taskScheduler)
+        , demodulateShader(nullptr)
+        , aTrousShader(nullptr)
+        , modulateShader(nullptr)
+        , quad(nullptr)
+        , textureSize(0)
+        , resultIndex(0)
+    {
+    }
+
+    Denoiser::~Denoiser()
+    {
+        finishGL();
+        delete demodulateShader;
+        delete aTrousShader;
+        delete modulateShader;
+        delete quad;
+    }
+
+    void Denoiser::initGL(const glm::ivec2& size)
+    {
+        if (size == textureSize)
+            return;
+        finishGL();
+        textureSize = size;
+
+        if (!quad)
+        {
+            quad = new Quad();
+            demodulateShader = loadShaders(shadersDirectory + "DemodulateVert.glsl", shadersDirectory + "DemodulateFrag.glsl");
+            aTrousShader = loadShaders(shadersDirectory + "ATrousVert.glsl", shadersDirectory + "ATrousFrag.glsl");
+            modulateShader = loadShaders(shadersDirectory + "ModulateVert.glsl", shadersDirectory + "ModulateFrag.glsl");
+
+            GLuint shaderObject = demodulateShader->object();
+            demodulateShader->use();
+            glUniform1i(glGetUniformLocation(shaderObject, "colorTexture"), 0);
+            glUniform1i(glGetUniformLocation(shaderObject, "albedoTexture"), 1);
+            glUniform1i(glGetUniformLocation(shaderObject, "normalDepthTexture"), 2);
+            demodulateShader->stopUsing();
+
+            shaderObject = aTrousShader->object();
+            aTrousShader->use();
+            glUniform1i(glGetUniformLocation(shaderObject, "illuminationTexture"), 0);
+            glUniform1i(glGetUniformLocation(shaderObject, "guideTexture"), 1);
+            aTrousShader->stopUsing();
+
+            shaderObject = modulateShader->object();
+            modulateShader->use();
+            glUniform1i(glGetUniformLocation(shaderObject, "illuminationTexture"), 0);
+            glUniform1i(glGetUniformLocation(shaderObject, "albedoTexture"), 1);
+            modulateShader->stopUsing();
+        }
+
+        auto createTexture = [&](GLenum internalFormat)
+        {
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size.x, size.y, 0, GL_RGBA, GL_FLOAT, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            return texture;
+        };
+        illuminationTexture[0] = createTexture(GL_RGBA16F);
+        illuminationTexture[1] = createTexture(GL_RGBA16F);
+        albedoTexture = createTexture(GL_RGBA16F);
+        // depth needs the precision
+        guideTexture = createTexture(GL_RGBA32F);
+
+        static const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glGenFramebuffers(1, &demodulateFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, demodulateFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, illuminationTexture[0], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, albedoTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, guideTexture, 0);
+        glDrawBuffers(3, drawBuffers);
+
+        glGenFramebuffers(2, filterFBO);
+        for (int i = 0; i < 2; i++)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, filterFBO[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, illuminationTexture[i], 0);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void Denoiser::finishGL()
+    {
+        if (textureSize == glm::ivec2(0))
+            return;
+
+        glDeleteFramebuffers(1, &demodulateFBO);
+        glDeleteFramebuffers(2, filterFBO);
+        glDeleteTextures(2, illuminationTexture);
+        glDeleteTextures(1, &albedoTexture);
+        glDeleteTextures(1, &guideTexture);
+        textureSize = glm::ivec2(0);
+    }
+
+    void Denoiser::filter(const glm::ivec2& size, GLuint colorInput, GLuint albedoInput, GLuint normalDepthInput, const DenoiserSettings& settings)
+    {
+        initGL(size);
+
+        glViewport(0, 0, size.x, size.y);
+        glBindFramebuffer(GL_FRAMEBUFFER, demodulateFBO);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, colorInput);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, albedoInput);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, normalDepthInput);
+        quad->Draw(demodulateShader);
+
+        GLuint shaderObject = aTrousShader->object();
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, guideTexture);
+        resultIndex = 0;
+        for (int level = 0; level < settings.iterations; level++)
+        {
+            aTrousShader->use();
+            glUniform1i(glGetUniformLocation(shaderObject, "stepWidth"), 1 << level);
+            glUniform1f(glGetUniformLocation(shaderObject, "colorPhi"), settings.colorSigma * settings.colorSigma / float(1 << level));
+            glUniform1f(glGetUniformLocation(shaderObject, "normalPhi"), settings.normalSigma * settings.normalSigma);
+            glUniform1f(glGetUniformLocation(shaderObject, "depthPhi"), settings.depthSigma * settings.depthSigma);
+            aTrousShader->stopUsing();
+
+            glBindFramebuffer(GL_FRAMEBUFFER, filterFBO[resultIndex ^ 1]);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, illuminationTexture[resultIndex]);
+            quad->Draw(aTrousShader);
+            resultIndex ^= 1;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void Denoiser::present() const
+    {
+        if (textureSize == glm::ivec2(0))
+            return;
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, illuminationTexture[resultIndex]);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, albedoTexture);
+        quad->Draw(modulateShader);
+    }
+
+    void Denoiser::parallelRows(int height, const std::function<void(int begin, int end)>& function)
+    {
+        enki::TaskSet task(uint32_t(height), [&](enki::TaskSetPartition range, uint32_t threadnum)
+        {
+            function(int(range.start), int(range.end));
+        });
+        taskScheduler->AddTaskSetToPipe(&task);
+        taskScheduler->WaitforTask(&task);
+    }
+
+    // same filter as DemodulateFrag, ATrousFrag and ModulateFrag
+    const unsigned char *Denoiser::filter(const glm::ivec2& size, const glm::vec3 *colorInput, const glm::vec3 *albedoInput, const glm::vec4 *normalDepthInput, const DenoiserSettings& settings)
+    {
+        const size_t pixelCount = size_t(size.x) * size.y;
+        illumination[0].resize(pixelCount);
+        illumination[1].resize(pixelCount);
+        albedo.resize(pixelCount);
+        guide.resize(pixelCount);
+        output.resize(pixelCount * 4);
+
+        parallelRows(size.y, [&](int begin, int end)
+        {
+            for (size_t i = size_t(begin) * size.x; i < size_t(end) * size.x; i++)
+            {
+                albedo[i] = glm::max(albedoInput[i], glm::vec3(MinAlbedo));
+                illumination[0][i] = colorInput[i] / albedo[i];
+                glm::vec3 normal(normalDepthInput[i]);
+                float normalLength = glm::length(normal);
+                guide[i] = glm::vec4(normalLength > 0.f ? normal / normalLength : glm::vec3(0.f), normalDepthInput[i].w);
+            }
+        });
+
+        int source = 0;
+        for (int level = 0; level < settings.iterations; level++)
+        {
+            const int stepWidth = 1 << level;
+            const float invColorPhi = float(stepWidth) / (settings.colorSigma * settings.colorSigma);
+            const float invNormalPhi = 1.f / (settings.normalSigma * settings.normalSigma * float(stepWidth * stepWidth));
+            const float invDepthPhi = 1.f / (settings.depthSigma * settings.depthSigma);
+            const glm::vec3 *src = illumination[source].data();
+            glm::vec3 *dst = illumination[source ^ 1].data();
+
+            parallelRows(size.y, [&](int begin, int end)
+            {
+                for (int y = begin; y < end; y++)
+                {
+                    for (int x = 0; x < size.x; x++)
+                    {
+                        const size_t index = size_t(y) * size.x + x;
+                        const glm::vec3& center = src[index];
+                        const glm::vec4& centerGuide = guide[index];
+                        const glm::vec3 centerColor = center / (1.f + Luminance(center));
+                        const float invDepth = 1.f / glm::max(centerGuide.w, 0.0001f);
+
+                        glm::vec3 sum(0.f);
+                        float weightSum = 0.f;
+                        for (int ky = -2; ky <= 2; ky++)
+                        {
+                            const int ty = glm::clamp(y + ky * stepWidth, 0, size.y - 1);
+                            for (int kx = -2; kx <= 2; kx++)
+                            {
+                                const int tx = glm::clamp(x + kx * stepWidth, 0, size.x - 1);
+                                const size_t tap = size_t(ty) * size.x + tx;
+                                const glm::vec3& c = src[tap];
+                                const glm::vec4& g = guide[tap];
+
+                                // product of the color, normal and depth weights
+                                glm::vec3 t = c / (1.f + Luminance(c)) - centerColor;
+                                float exponent = glm::dot(t, t) * invColorPhi;
+                                t = glm::vec3(g) - glm::vec3(centerGuide);
+                                exponent += glm::dot(t, t) * invNormalPhi;
+                                float dz = (g.w - centerGuide.w) * invDepth;
+                                exponent += dz * dz * invDepthPhi;
+
+                                float weight = Kernel[abs(kx)] * Kernel[abs(ky)] * expf(-exponent);
+                                sum += c * weight;
+                                weightSum += weight;
+                            }
+                        }
+                        dst[index] = sum / weightSum;
+                    }
+                }
+            });
+            source ^= 1;
+        }
+
+        const float limit = 1.5f;
+        parallelRows(size.y, [&](int begin, int end)
+        {
+            for (size_t i = size_t(begin) * size.x; i < size_t(end) * size.x; i++)
+            {
+                glm::vec3 c = illumination[source][i] * albedo[i];
+                c = glm::pow(c * (1.f / (1.f + Luminance(c) / limit)), glm::vec3(1.f / 2.2f));
+                output[i * 4 + 0] = (unsigned char)(glm::clamp(c.x, 0.f, 1.f) * 255.f + 0.5f);
+                output[i * 4 + 1] = (unsigned char)(glm::clamp(c.y, 0.f, 1.f) * 255.f + 0.5f);
+                output[i * 4 + 2] = (unsigned char)(glm::clamp(c.z, 0.f, 1.f) * 255.f + 0.5f);
+                output[i * 4 + 3] = 255;
+            }
+        });
+        return output.data();
+    }
+}
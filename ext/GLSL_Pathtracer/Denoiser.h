@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Program.h"
+#include <glm/glm.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace enki
+{
+    class TaskScheduler;
+}
+
+namespace GLSLPathTracer
+{
+    class Quad;
+
+    struct DenoiserSettings
+    {
+        int iterations;     // a-trous levels, level i skips 2^i - 1 pixels between taps
+        float colorSigma;   // illumination difference, halved at each level
+        float normalSigma;
+        float depthSigma;   // depth difference relative to the depth of the filtered pixel
+
+        bool operator == (const DenoiserSettings& other) const
+        {
+            return iterations == other.iterations && colorSigma == other.colorSigma && normalSigma == other.normalSigma && depthSigma == other.depthSigma;
+        }
+        bool operator != (const DenoiserSettings& other) const { return !(*this == other); }
+    };
+
+    // Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) of a path traced image, guided by the
+    // albedo, normal and depth of the first hits. The radiance is divided by the albedo before filtering and
+    // multiplied back after so textures stay sharp. The result is tone mapped like Progressive/OutputFrag.glsl.
+    // The GL filter reads the sample sums of the ProgressiveRenderer, the CPU filter reads the averages of the
+    // CPURenderer and runs each level as enkiTS tasks over the rows.
+    class Denoiser
+    {
+    public:
+        Denoiser(const std::string& shadersDirectory, enki::TaskScheduler *taskScheduler);
+        ~Denoiser();
+
+        // filters textures of size pixels, present() then draws the result in the bound framebuffer
+        void filter(const glm::ivec2& size, GLuint colorInput, GLuint albedoInput, GLuint normalDepthInput, const DenoiserSettings& settings);
+        void present() const;
+
+        // RGBA8 image of size, rows bottom to top like GL textures. Blocks until every level is filtered
+        const unsigned char *filter(const glm::ivec2& size, const glm::vec3 *colorInput, const glm::vec3 *albedoInput, const glm::vec4 *normalDepthInput, const DenoiserSettings& settings);
+
+        // pass and settings of the last CPU filter, so it only runs again for a new pass of the CPURenderer
+        int filteredPass;
+        DenoiserSettings filteredSettings;
+        // the renderer has no guides (TiledRenderer), its output was passed through and that was logged
+        bool passThroughLogged;
+
+    private:
+        std::string shadersDirectory;
+        enki::TaskScheduler *taskScheduler;
+
+        Program *demodulateShader, *aTrousShader, *modulateShader;
+        Quad *quad;
+        GLuint demodulateFBO, filterFBO[2], illuminationTexture[2], albedoTexture, guideTexture;
+        glm::ivec2 textureSize;
+        int resultIndex;
+
+        std::vector<glm::vec3> illumination[2], albedo;
+        std::vector<glm::vec4> guide;
+        std::vector<unsigned char> output;
+
+        void initGL(const glm::ivec2& size);
+        void finishGL();
+        void parallelRows(int height, const std::function<void(int begin, int end)>& function);
+    };
+}
@@ -3,31 +3,29 @@
 
 namespace GLSLPathTracer
 {
-    static int current;
-
     int GPUBVH::traverseBVH(BVHNode *root)
     {
         AABB *cbox = &root->m_bounds;
-        gpuNodes[current].BBoxMin[0] = cbox->min().x;
-        gpuNodes[current].BBoxMin[1] = cbox->min().y;
-        gpuNodes[current].BBoxMin[2] = cbox->min().z;
+        gpuNodes[currentNode].BBoxMin[0] = cbox->min().x;
+        gpuNodes[currentNode].BBoxMin[1] = cbox->min().y;
+        gpuNodes[currentNode].BBoxMin[2] = cbox->min().z;
 
-        gpuNodes[current].BBoxMax[0] = cbox->max().x;
-        gpuNodes[current].BBoxMax[1] = cbox->max().y;
-        gpuNodes[current].BBoxMax[2] = cbox->max().z;
+        gpuNodes[currentNode].BBoxMax[0] = cbox->max().x;
+        gpuNodes[currentNode].BBoxMax[1] = cbox->max().y;
+        gpuNodes[currentNode].BBoxMax[2] = cbox->max().z;
 
-        gpuNodes[current].LRLeaf[2] = 0.0f;
+        gpuNodes[currentNode].LRLeaf[2] = 0.0f;
 
-        int index = current;
+        int index = currentNode;
 
         if (root->isLeaf())
         {
             const LeafNode* leaf = reinterpret_cast<const LeafNode*>(root);
             int start = int(bvhTriangleIndices.size());
 
-            gpuNodes[current].LRLeaf[0] = float(start); // strange cast here. loss of data for big numbers
-            gpuNodes[current].LRLeaf[1] = float(leaf->m_hi - leaf->m_lo);
-            gpuNodes[current].LRLeaf[2] = 1.0f;
+            gpuNodes[currentNode].LRLeaf[0] = float(start); // strange cast here. loss of data for big numbers
+            gpuNodes[currentNode].LRLeaf[1] = float(leaf->m_hi - leaf->m_lo);
+            gpuNodes[currentNode].LRLeaf[2] = 1.0f;
 
             for (int i = leaf->m_lo; i < leaf->m_hi; i++)
             {
@@ -38,23 +36,35 @@ namespace GLSLPathTracer
         }
         else
         {
-            current++;
+            currentNode++;
             gpuNodes[index].LRLeaf[0] = float(traverseBVH(root->getChildNode(0)));
-            current++;
+            currentNode++;
             gpuNodes[index].LRLeaf[1] = float(traverseBVH(root->getChildNode(1)));
         }
         return index;
     }
 
-    GPUBVH::GPUBVH(const BVH* bvh)
+    GPUBVH::GPUBVH(const BVH* bvh) : ownsNodes(true)
     {
         this->bvh = bvh;
         createGPUBVH();
     }
 
+    GPUBVH::GPUBVH(int numNodes, GPUBVHNode *gpuNodes) : gpuNodes(gpuNodes), numNodes(numNodes), bvh(nullptr), ownsNodes(false)
+    {
+    }
+
+    GPUBVH::~GPUBVH()
+    {
+        if (ownsNodes)
+            delete[] gpuNodes;
+    }
+
     void GPUBVH::createGPUBVH()
     {
-        gpuNodes = new GPUBVHNode[bvh->getNumNodes()];
+        numNodes = bvh->getNumNodes();
+        gpuNodes = new GPUBVHNode[numNodes];
+        currentNode = 0;
         traverseBVH(bvh->getRoot());
     }
 }
\ No newline at end of file
@@ -22,10 +22,19 @@ namespace GLSLPathTracer
     {
     public:
         GPUBVH(const BVH *bvh);
+        // nodes and triangle indices already flattened, bvh is null
+        GPUBVH(int numNodes, GPUBVHNode *gpuNodes);
+        ~GPUBVH();
         void createGPUBVH();
         int traverseBVH(BVHNode *root);
         GPUBVHNode *gpuNodes;
+        int numNodes;
+        // null once the GPUBVH is built
         const BVH *bvh;
         std::vector<TriIndexData> bvhTriangleIndices;
+    private:
+        bool ownsNodes;
+        // next node written by traverseBVH
+        int currentNode;
     };
 }
\ No newline at end of file
@@ -0,0 +1,143 @@
+#include "LightBVH.h"
+#include "Scene.h"
+#include <algorithm>
+#include <cfloat>
+
+namespace GLSLPathTracer
+{
+    // emitted power up to a constant: luminance of the emission times the area
+    static float LightPower(const LightData& light)
+    {
+        return (0.3f * light.emission.x + 0.6f * light.emission.y + 0.1f * light.emission.z) * light.radiusAreaType.y;
+    }
+
+    static void LightBounds(const LightData& light, glm::vec3& bboxMin, glm::vec3& bboxMax)
+    {
+        if (light.radiusAreaType.z == 0) // Rectangular Area Light
+        {
+            bboxMin = glm::min(glm::min(light.position, light.position + light.u), glm::min(light.position + light.v, light.position + light.u + light.v));
+            bboxMax = glm::max(glm::max(light.position, light.position + light.u), glm::max(light.position + light.v, light.position + light.u + light.v));
+        }
+        else // Spherical Area Light
+        {
+            bboxMin = light.position - glm::vec3(light.radiusAreaType.x);
+            bboxMax = light.position + glm::vec3(light.radiusAreaType.x);
+        }
+        // quads aligned on an axis have flat bounds
+        bboxMin -= glm::vec3(1e-4f);
+        bboxMax += glm::vec3(1e-4f);
+    }
+
+    LightBVH::LightBVH(const std::vector<LightData>& lights)
+    {
+        if (lights.empty())
+            return;
+
+        buildAliasTable(lights);
+
+        std::vector<glm::vec3> lightMin(lights.size()), lightMax(lights.size());
+        std::vector<int> indices(lights.size());
+        for (size_t i = 0; i < lights.size(); i++)
+        {
+            LightBounds(lights[i], lightMin[i], lightMax[i]);
+            indices[i] = int(i);
+        }
+        nodes.reserve(lights.size() * 2 - 1);
+        build(lightMin, lightMax, indices, 0, int(lights.size()));
+    }
+
+    // Vose's construction: entries under the average probability are filled with the excess of one above it
+    void LightBVH::buildAliasTable(const std::vector<LightData>& lights)
+    {
+        const int count = int(lights.size());
+        std::vector<float> power(count);
+        float totalPower = 0.f;
+        for (int i = 0; i < count; i++)
+        {
+            power[i] = glm::max(LightPower(lights[i]), 0.f);
+            totalPower += power[i];
+        }
+        // without any emission the lights are picked uniformly
+        if (totalPower <= 0.f)
+        {
+            std::fill(power.begin(), power.end(), 1.f);
+            totalPower = float(count);
+        }
+
+        aliasTable.resize(count);
+        std::vector<float> scaled(count);
+        std::vector<int> small, large;
+        for (int i = 0; i < count; i++)
+        {
+            aliasTable[i].pdf = power[i] / totalPower;
+            scaled[i] = aliasTable[i].pdf * count;
+            (scaled[i] < 1.f ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty())
+        {
+            int less = small.back();
+            small.pop_back();
+            int more = large.back();
+            large.pop_back();
+
+            aliasTable[less].probability = scaled[less];
+            aliasTable[less].alias = float(more);
+            scaled[more] += scaled[less] - 1.f;
+            (scaled[more] < 1.f ? small : large).push_back(more);
+        }
+        // what remains is 1 up to rounding errors
+        for (int i : small)
+            aliasTable[i] = { 1.f, float(i), aliasTable[i].pdf };
+        for (int i : large)
+            aliasTable[i] = { 1.f, float(i), aliasTable[i].pdf };
+    }
+
+    // Splits the lights at the median of their centers on the largest axis. Nodes are laid out depth first.
+    int LightBVH::build(const std::vector<glm::vec3>& lightMin, const std::vector<glm::vec3>& lightMax, std::vector<int>& indices, int begin, int end)
+    {
+        const int nodeIndex = int(nodes.size());
+        nodes.push_back(LightBVHNode());
+
+        glm::vec3 bboxMin(FLT_MAX), bboxMax(-FLT_MAX);
+        // bounds of the light centers, doubled
+        glm::vec3 centerMin(FLT_MAX), centerMax(-FLT_MAX);
+        for (int i = begin; i < end; i++)
+        {
+            bboxMin = glm::min(bboxMin, lightMin[indices[i]]);
+            bboxMax = glm::max(bboxMax, lightMax[indices[i]]);
+            centerMin = glm::min(centerMin, lightMin[indices[i]] + lightMax[indices[i]]);
+            centerMax = glm::max(centerMax, lightMin[indices[i]] + lightMax[indices[i]]);
+        }
+        nodes[nodeIndex].bboxMin = bboxMin;
+        nodes[nodeIndex].bboxMax = bboxMax;
+
+        if (end - begin == 1)
+        {
+            nodes[nodeIndex].leftRightLight = glm::vec3(-1.f, -1.f, float(indices[begin]));
+            return nodeIndex;
+        }
+
+        glm::vec3 extent = centerMax - centerMin;
+        int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : ((extent.y > extent.z) ? 1 : 2);
+        int middle = (begin + end) / 2;
+        std::nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end, [&](int a, int b) {
+            return lightMin[a][axis] + lightMax[a][axis] < lightMin[b][axis] + lightMax[b][axis];
+        });
+
+        int left = build(lightMin, lightMax, indices, begin, middle);
+        int right = build(lightMin, lightMax, indices, middle, end);
+        nodes[nodeIndex].leftRightLight = glm::vec3(float(left), float(right), -1.f);
+        return nodeIndex;
+    }
+
+    int LightBVH::sample(float u, float& pdf) const
+    {
+        const int count = int(aliasTable.size());
+        float scaled = u * count;
+        int light = glm::min(int(scaled), count - 1);
+        if (scaled - light >= aliasTable[light].probability)
+            light = int(aliasTable[light].alias);
+        pdf = aliasTable[light].pdf;
+        return light;
+    }
+}
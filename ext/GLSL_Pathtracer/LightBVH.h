@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace GLSLPathTracer
+{
+    struct LightData;
+
+    // Node of the light BVH, 3 RGB32F texels: bounds min, bounds max, then children and light.
+    // light is the index in Scene::lightData for a leaf and -1 for an inner node.
+    struct LightBVHNode
+    {
+        glm::vec3 bboxMin;
+        glm::vec3 bboxMax;
+        glm::vec3 leftRightLight;
+    };
+
+    // Entry of the alias table, one RGB32F texel. A uniform pick of the entry keeps its light
+    // with probability, else takes alias. pdf is the probability of sampling the light of the entry.
+    struct LightAliasEntry
+    {
+        float probability;
+        float alias;
+        float pdf;
+    };
+
+    // Sampling and intersection structures of the analytic lights, built on upload.
+    // Lights are picked proportionally to their power with Walker's alias table, and rays find the
+    // emitters they hit with a binary BVH of one light per leaf. The GL renderers append both
+    // to the light texture: LightData texels, then aliasTable, then nodes.
+    class LightBVH
+    {
+    public:
+        LightBVH(const std::vector<LightData>& lights);
+
+        // light picked by a uniform number in [0, 1), pdf is the probability of picking it
+        int sample(float u, float& pdf) const;
+        float pdf(int light) const { return aliasTable[light].pdf; }
+
+        std::vector<LightBVHNode> nodes;
+        std::vector<LightAliasEntry> aliasTable;
+
+    private:
+        void buildAliasTable(const std::vector<LightData>& lights);
+        int build(const std::vector<glm::vec3>& lightMin, const std::vector<glm::vec3>& lightMax, std::vector<int>& indices, int begin, int end);
+    };
+}
@@ -160,6 +160,7 @@ namespace GLSLPathTracer
         //Defaults
         MaterialData defaultMat;
         Scene *scene = new Scene(filename);
+        scene->sourceFiles.push_back(filename);
         scene->materialData.push_back(defaultMat);
         materialCount++;
         Camera *defaultCamera = new Camera(glm::vec3(0, 0, 0), glm::vec3(0, 0, -1), 35.0f);
@@ -350,11 +351,13 @@ namespace GLSLPathTracer
                     sscanf(line, " maxSamples %i", &scene->renderOptions.maxSamples);
                     sscanf(line, " numTilesX %i", &scene->renderOptions.numTilesX);
                     sscanf(line, " numTilesY %i", &scene->renderOptions.numTilesY);
+                    sscanf(line, " bvhWidth %i", &scene->renderOptions.bvhWidth);
 
                     if (strcmp(envMap, "None") != 0)
                     {
                         HDRLoader hdrLoader;
                         hdrLoader.load(envMap, scene->hdrLoaderRes);
+                        scene->sourceFiles.push_back(envMap);
                         scene->renderOptions.useEnvMap = true;
                     }
                     scene->renderOptions.rendererType = std::string(rendererType);
@@ -399,6 +402,7 @@ namespace GLSLPathTracer
                 if (!meshPath.empty())
                 {
                     Log("Loading Model: %s\n", meshPath.c_str());
+                    scene->sourceFiles.push_back(meshPath);
                     if (!LoadModel(scene, meshPath, materialId))
                     {
                         return false;
@@ -454,6 +458,10 @@ namespace GLSLPathTracer
         }
         scene->texData.normalTextureSize = glm::vec2(width, height);
 
+        scene->sourceFiles.insert(scene->sourceFiles.end(), albedoTex.begin(), albedoTex.end());
+        scene->sourceFiles.insert(scene->sourceFiles.end(), metallicRoughnessTex.begin(), metallicRoughnessTex.end());
+        scene->sourceFiles.insert(scene->sourceFiles.end(), normalTex.begin(), normalTex.end());
+
         return scene;
     }
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "Config.h"
 #include "ProgressiveRenderer.h"
 #include "Camera.h"
+#include <cfloat>
 
 namespace GLSLPathTracer
 {
@@ -21,14 +22,29 @@ namespace GLSLPathTracer
         //----------------------------------------------------------
         // Shaders
         //----------------------------------------------------------
-        pathTraceShader = loadShaders(shadersDirectory + "PathTraceVert.glsl", shadersDirectory + "PathTraceFrag.glsl");
+        pathTraceShader = loadShaders(shadersDirectory + "PathTraceVert.glsl", shadersDirectory + "PathTraceFrag.glsl", pathTraceDefines());
         accumShader = loadShaders(shadersDirectory + "AccumVert.glsl", shadersDirectory + "AccumFrag.glsl");
         outputShader = loadShaders(shadersDirectory + "OutputVert.glsl", shadersDirectory + "OutputFrag.glsl");
         outputFadeShader = loadShaders(shadersDirectory + "OutputFadeVert.glsl", shadersDirectory + "OutputFadeFrag.glsl");
+        errorShader = loadShaders(shadersDirectory + "ErrorVert.glsl", shadersDirectory + "ErrorFrag.glsl");
 
         //----------------------------------------------------------
         // FBO Setup
         //----------------------------------------------------------
+        static const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        auto createGuideTexture = [&](GLenum attachment)
+        {
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, screenSize.x, screenSize.y, 0, GL_RGBA, GL_FLOAT, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture, 0);
+            return texture;
+        };
+
         //Create FBOs for path trace shader
         glGenFramebuffers(1, &pathTraceFBO);
         glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBO);
@@ -36,11 +52,14 @@ namespace GLSLPathTracer
         //Create Texture for FBO
         glGenTextures(1, &pathTraceTexture);
         glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, screenSize.x, screenSize.y, 0, GL_RGB, GL_FLOAT, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, screenSize.x, screenSize.y, 0, GL_RGBA, GL_FLOAT, 0);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glBindTexture(GL_TEXTURE_2D, 0);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pathTraceTexture, 0);
+        pathTraceAlbedoTexture = createGuideTexture(GL_COLOR_ATTACHMENT1);
+        pathTraceNormalDepthTexture = createGuideTexture(GL_COLOR_ATTACHMENT2);
+        glDrawBuffers(3, drawBuffers);
 
         //Create Half Res FBOs for path trace shader
         glGenFramebuffers(1, &pathTraceFBOHalf);
@@ -62,11 +81,41 @@ namespace GLSLPathTracer
         //Create Texture for FBO
         glGenTextures(1, &accumTexture);
         glBindTexture(GL_TEXTURE_2D, accumTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, screenSize.x, screenSize.y, 0, GL_RGB, GL_FLOAT, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, screenSize.x, screenSize.y, 0, GL_RGBA, GL_FLOAT, 0);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glBindTexture(GL_TEXTURE_2D, 0);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumTexture, 0);
+        accumAlbedoTexture = createGuideTexture(GL_COLOR_ATTACHMENT1);
+        accumNormalDepthTexture = createGuideTexture(GL_COLOR_ATTACHMENT2);
+        glDrawBuffers(3, drawBuffers);
+
+        //Create tile textures, samples per tile and noise estimate
+        numTilesX = (screenSize.x + tileSize - 1) / tileSize;
+        numTilesY = (screenSize.y + tileSize - 1) / tileSize;
+        tileSamples.resize(numTilesX * numTilesY);
+        tileError.resize(numTilesX * numTilesY);
+
+        glGenTextures(1, &tileTexture);
+        glBindTexture(GL_TEXTURE_2D, tileTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, numTilesX, numTilesY, 0, GL_RG, GL_FLOAT, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &errorFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, errorFBO);
+
+        glGenTextures(1, &errorTexture);
+        glBindTexture(GL_TEXTURE_2D, errorTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, numTilesX, numTilesY, 0, GL_RED, GL_FLOAT, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, errorTexture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        resetTiles();
 
         GLuint shaderObject;
 
@@ -76,6 +125,7 @@ namespace GLSLPathTracer
         glUniform1i(glGetUniformLocation(shaderObject, "maxDepth"), maxDepth);
         glUniform2f(glGetUniformLocation(shaderObject, "screenResolution"), float(screenSize.x), float(screenSize.y));
         glUniform1i(glGetUniformLocation(shaderObject, "numOfLights"), numOfLights);
+        glUniform1i(glGetUniformLocation(shaderObject, "wideBVH"), scene->wideBVH4 != nullptr);
         glUniform1i(glGetUniformLocation(shaderObject, "useEnvMap"), scene->renderOptions.useEnvMap);
         glUniform1f(glGetUniformLocation(shaderObject, "hdrResolution"), float(scene->hdrLoaderRes.width * scene->hdrLoaderRes.height));
         glUniform1f(glGetUniformLocation(shaderObject, "hdrMultiplier"), scene->renderOptions.hdrMultiplier);
@@ -93,8 +143,107 @@ namespace GLSLPathTracer
         glUniform1i(glGetUniformLocation(shaderObject, "hdrTexture"), 10);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrMarginalDistTexture"), 11);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrCondDistTexture"), 12);
+        glUniform1i(glGetUniformLocation(shaderObject, "tileTexture"), 13);
+        glUniform1i(glGetUniformLocation(shaderObject, "tileSize"), tileSize);
+        glUniform1i(glGetUniformLocation(shaderObject, "accumAlbedoTexture"), 14);
+        glUniform1i(glGetUniformLocation(shaderObject, "accumNormalDepthTexture"), 15);
 
         pathTraceShader->stopUsing();
+
+        accumShader->use();
+        shaderObject = accumShader->object();
+        glUniform1i(glGetUniformLocation(shaderObject, "pathTraceTexture"), 0);
+        glUniform1i(glGetUniformLocation(shaderObject, "albedoTexture"), 14);
+        glUniform1i(glGetUniformLocation(shaderObject, "normalDepthTexture"), 15);
+        accumShader->stopUsing();
+
+        outputShader->use();
+        shaderObject = outputShader->object();
+        glUniform1i(glGetUniformLocation(shaderObject, "pathTraceTexture"), 0);
+        glUniform1i(glGetUniformLocation(shaderObject, "tileTexture"), 2);
+        glUniform1i(glGetUniformLocation(shaderObject, "tileSize"), tileSize);
+        glUniform2f(glGetUniformLocation(shaderObject, "screenResolution"), float(screenSize.x), float(screenSize.y));
+        outputShader->stopUsing();
+
+        outputFadeShader->use();
+        shaderObject = outputFadeShader->object();
+        glUniform1i(glGetUniformLocation(shaderObject, "pathTraceTextureHalf"), 0);
+        glUniform1i(glGetUniformLocation(shaderObject, "pathTraceTexture"), 1);
+        glUniform1i(glGetUniformLocation(shaderObject, "tileTexture"), 2);
+        glUniform1i(glGetUniformLocation(shaderObject, "tileSize"), tileSize);
+        glUniform2f(glGetUniformLocation(shaderObject, "screenResolution"), float(screenSize.x), float(screenSize.y));
+        outputFadeShader->stopUsing();
+
+        errorShader->use();
+        shaderObject = errorShader->object();
+        glUniform1i(glGetUniformLocation(shaderObject, "pathTraceTexture"), 0);
+        glUniform1i(glGetUniformLocation(shaderObject, "tileTexture"), 1);
+        glUniform1i(glGetUniformLocation(shaderObject, "tileSize"), tileSize);
+        glUniform2f(glGetUniformLocation(shaderObject, "screenResolution"), float(screenSize.x), float(screenSize.y));
+        errorShader->stopUsing();
+    }
+
+    void ProgressiveRenderer::resetTiles()
+    {
+        for (auto& samples : tileSamples)
+            samples = glm::vec2(1.f, 0.f);
+        for (auto& error : tileError)
+            error = FLT_MAX;
+        framePasses = 1;
+        // scenes may ask for fewer samples than the uniform pass
+        framesToEstimate = glm::min(int(minSamples), maxSamples);
+        convergedTiles = 0;
+    }
+
+    void ProgressiveRenderer::estimateError()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, errorFBO);
+        glViewport(0, 0, numTilesX, numTilesY);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, tileTexture);
+        quad->Draw(errorShader);
+        // a few hundred floats, the stall is once every estimateInterval frames
+        glReadPixels(0, 0, numTilesX, numTilesY, GL_RED, GL_FLOAT, tileError.data());
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void ProgressiveRenderer::allocateSamples()
+    {
+        const int tileCount = numTilesX * numTilesY;
+        float errorSum = 0.f;
+        convergedTiles = 0;
+        for (int i = 0; i < tileCount; i++)
+        {
+            if (tileError[i] <= noiseThreshold || tileSamples[i].y >= maxSamples)
+                convergedTiles++;
+            else
+                errorSum += tileError[i];
+        }
+
+        // one sample per tile and per frame, like a full frame pass, shared by the noisy tiles
+        framePasses = 0;
+        for (int i = 0; i < tileCount; i++)
+        {
+            int passes = 0;
+            if (tileError[i] > noiseThreshold && tileSamples[i].y < maxSamples)
+                passes = glm::clamp(int(tileCount * tileError[i] / errorSum + 0.5f), 1, maxPassesPerFrame);
+            tileSamples[i].x = float(passes);
+            framePasses = glm::max(framePasses, passes);
+        }
+    }
+
+    void ProgressiveRenderer::setNoiseThreshold(float threshold)
+    {
+        if (threshold == noiseThreshold)
+            return;
+        noiseThreshold = threshold;
+        // tiles are reallocated from the last estimate, a lower threshold resumes sampling
+        if (initialized && !lowRes && tileError[0] != FLT_MAX)
+            allocateSamples();
     }
 
     void ProgressiveRenderer::finish()
@@ -105,15 +254,23 @@ namespace GLSLPathTracer
         glDeleteFramebuffers(1, &pathTraceFBO);
         glDeleteFramebuffers(1, &pathTraceFBOHalf);
         glDeleteFramebuffers(1, &accumFBO);
+        glDeleteFramebuffers(1, &errorFBO);
 
         glDeleteTextures(1, &pathTraceTexture);
         glDeleteTextures(1, &pathTraceTextureHalf);
         glDeleteTextures(1, &accumTexture);
+        glDeleteTextures(1, &errorTexture);
+        glDeleteTextures(1, &tileTexture);
+        glDeleteTextures(1, &pathTraceAlbedoTexture);
+        glDeleteTextures(1, &pathTraceNormalDepthTexture);
+        glDeleteTextures(1, &accumAlbedoTexture);
+        glDeleteTextures(1, &accumNormalDepthTexture);
 
         delete pathTraceShader;
         delete accumShader;
         delete outputShader;
         delete outputFadeShader;
+        delete errorShader;
 
         Renderer::finish();
     }
@@ -152,6 +309,10 @@ namespace GLSLPathTracer
         glBindTexture(GL_TEXTURE_1D, hdrMarginalDistTexture);
         glActiveTexture(GL_TEXTURE12);
         glBindTexture(GL_TEXTURE_2D, hdrConditionalDistTexture);
+        glActiveTexture(GL_TEXTURE14);
+        glBindTexture(GL_TEXTURE_2D, accumAlbedoTexture);
+        glActiveTexture(GL_TEXTURE15);
+        glBindTexture(GL_TEXTURE_2D, accumNormalDepthTexture);
 
         if (lowRes)
         {
@@ -166,29 +327,78 @@ namespace GLSLPathTracer
         }
         else
         {
-            //---------------------------------------------------------
-            // Pass 1: Path trace to full-res texture
-            //---------------------------------------------------------
-            glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBO);
-            glViewport(0, 0, screenSize.x, screenSize.y);
-            quad->Draw(pathTraceShader);
+            // samples accumulated once this frame is traced, read by the output and error shaders. Passes are
+            // allocated for estimateInterval frames, tiles stop at maxSamples in between
+            for (auto& samples : tileSamples)
+            {
+                samples.x = glm::min(samples.x, float(maxSamples) - samples.y);
+                samples.y += samples.x;
+            }
+            glActiveTexture(GL_TEXTURE13);
+            glBindTexture(GL_TEXTURE_2D, tileTexture);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, numTilesX, numTilesY, GL_RG, GL_FLOAT, tileSamples.data());
 
-            //----------------------------------------------------------
-            // Pass 2: Accumulation buffer
-            //---------------------------------------------------------
-            glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
-            glViewport(0, 0, screenSize.x, screenSize.y);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
-            quad->Draw(accumShader);
+            // tiles traced fewer times than the pass index are discarded by the shader
+            for (int pass = 0; pass < framePasses; pass++)
+            {
+                GLuint shaderObject = pathTraceShader->object();
+                pathTraceShader->use();
+                glUniform1i(glGetUniformLocation(shaderObject, "tilePass"), pass);
+                if (pass)
+                    glUniform3f(glGetUniformLocation(shaderObject, "randomVector"), (float)rand() / RAND_MAX, (float)rand() / RAND_MAX, (float)rand() / RAND_MAX);
+                pathTraceShader->stopUsing();
+
+                //---------------------------------------------------------
+                // Pass 1: Path trace to full-res texture
+                //---------------------------------------------------------
+                glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBO);
+                glViewport(0, 0, screenSize.x, screenSize.y);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, accumTexture);
+                glActiveTexture(GL_TEXTURE14);
+                glBindTexture(GL_TEXTURE_2D, accumAlbedoTexture);
+                glActiveTexture(GL_TEXTURE15);
+                glBindTexture(GL_TEXTURE_2D, accumNormalDepthTexture);
+                quad->Draw(pathTraceShader);
+
+                //----------------------------------------------------------
+                // Pass 2: Accumulation buffer
+                //---------------------------------------------------------
+                glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
+                glViewport(0, 0, screenSize.x, screenSize.y);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
+                glActiveTexture(GL_TEXTURE14);
+                glBindTexture(GL_TEXTURE_2D, pathTraceAlbedoTexture);
+                glActiveTexture(GL_TEXTURE15);
+                glBindTexture(GL_TEXTURE_2D, pathTraceNormalDepthTexture);
+                quad->Draw(accumShader);
+            }
+
+            if (--framesToEstimate <= 0)
+            {
+                estimateError();
+                allocateSamples();
+                framesToEstimate = estimateInterval;
+            }
         }
     }
 
+    bool ProgressiveRenderer::getDenoiserInputs(GLuint& colorTexture, GLuint& albedoTexture, GLuint& normalDepthTexture) const
+    {
+        if (!initialized || lowRes)
+            return false;
+        colorTexture = pathTraceTexture;
+        albedoTexture = pathTraceAlbedoTexture;
+        normalDepthTexture = pathTraceNormalDepthTexture;
+        return true;
+    }
+
     float ProgressiveRenderer::getProgress() const
     {
         if (lowRes || fadeIn)
             return 0.f;
-        return 1.f;
+        return float(convergedTiles) / float(numTilesX * numTilesY);
     }
 
     void ProgressiveRenderer::present() const
@@ -199,6 +409,8 @@ namespace GLSLPathTracer
         //----------------------------------------------------------
         // final output
         //----------------------------------------------------------
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, tileTexture);
         if (lowRes)
         {
             glActiveTexture(GL_TEXTURE0);
@@ -249,6 +461,7 @@ namespace GLSLPathTracer
                 glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
                 glClear(GL_COLOR_BUFFER_BIT);
                 glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                resetTiles();
             }
             lowRes = false;
             sampleCounter += 1;
@@ -279,18 +492,17 @@ namespace GLSLPathTracer
         glUniform1i(glGetUniformLocation(shaderObject, "maxDepth"), lowRes ? 2 : maxDepth);
         glUniform1i(glGetUniformLocation(shaderObject, "isCameraMoving"), scene->camera->isMoving);
         glUniform2f(glGetUniformLocation(shaderObject, "screenResolution"), float(screenSize.x), float(screenSize.y));
+        // the half res pass traces every pixel
+        glUniform1i(glGetUniformLocation(shaderObject, "tilePass"), lowRes ? -1 : 0);
         pathTraceShader->stopUsing();
 
         outputShader->use();
         shaderObject = outputShader->object();
-        glUniform1f(glGetUniformLocation(shaderObject, "invSampleCounter"), lowRes ? 1.0f : (1.0f / sampleCounter));
+        glUniform1i(glGetUniformLocation(shaderObject, "lowRes"), lowRes);
         outputShader->stopUsing();
 
         outputFadeShader->use();
         shaderObject = outputFadeShader->object();
-        glUniform1i(glGetUniformLocation(shaderObject, "pathTraceTextureHalf"), 0);
-        glUniform1i(glGetUniformLocation(shaderObject, "pathTraceTexture"), 1);
-        glUniform1f(glGetUniformLocation(shaderObject, "invSampleCounter"), 1.0f / sampleCounter);
         glUniform1f(glGetUniformLocation(shaderObject, "fadeAmt"), glm::min(fadeTimer / timeToFade, 1.0f));
         outputFadeShader->stopUsing();
     }
@@ -1,22 +1,46 @@
 #pragma once
 
 #include "Renderer.h"
+#include <vector>
 
 namespace GLSLPathTracer
 {
+    // Full frame path tracer with adaptive sampling. The frame is split in tiles of tileSize pixels.
+    // Once every tile has minSamples, the noise of each tile is estimated from the per pixel variance of
+    // the luminance every estimateInterval frames. Tiles under the noise threshold stop sampling, the others
+    // share a budget of one sample per tile and per frame, proportionally to their noise.
+    // Rendering is complete when every tile is converged or reached maxSamples.
     class ProgressiveRenderer : public Renderer
     {
     private:
-        GLuint pathTraceFBO, pathTraceFBOHalf, accumFBO;
-        Program *pathTraceShader, *accumShader, *outputShader, *outputFadeShader;
-        GLuint pathTraceTexture, pathTraceTextureHalf, accumTexture;
+        GLuint pathTraceFBO, pathTraceFBOHalf, accumFBO, errorFBO;
+        Program *pathTraceShader, *accumShader, *outputShader, *outputFadeShader, *errorShader;
+        GLuint pathTraceTexture, pathTraceTextureHalf, accumTexture, errorTexture, tileTexture;
+        // albedo and normal/depth of the first hits, summed for the Denoiser. Albedo alpha counts the samples
+        GLuint pathTraceAlbedoTexture, pathTraceNormalDepthTexture, accumAlbedoTexture, accumNormalDepthTexture;
         int maxSamples, maxDepth;
         float sampleCounter, timeToFade, fadeTimer, lowResTimer;
         bool lowRes, fadeIn;
 
+        static const int tileSize = 32;
+        static const int minSamples = 16;
+        static const int estimateInterval = 8;
+        static const int maxPassesPerFrame = 8;
+        int numTilesX, numTilesY, framePasses, framesToEstimate, convergedTiles;
+        float noiseThreshold;
+        // per tile, samples traced this frame and samples accumulated. Uploaded to tileTexture
+        std::vector<glm::vec2> tileSamples;
+        std::vector<float> tileError;
+
+        void resetTiles();
+        void estimateError();
+        void allocateSamples();
+
     public:
         ProgressiveRenderer(const Scene *scene, const std::string& shadersDirectory) : Renderer(scene, shadersDirectory)
+            , maxSamples(glm::max(scene->renderOptions.maxSamples, 1))
             , maxDepth(scene->renderOptions.maxDepth)
+            , noiseThreshold(0.02f)
         {
         };
         
@@ -28,5 +52,9 @@ namespace GLSLPathTracer
         void update(float secondsElapsed);
         float getProgress() const;
         RendererType getType() const { return Renderer_Progressive; }
+        // relative noise under which a tile stops sampling, see ErrorFrag.glsl
+        void setNoiseThreshold(float threshold);
+        // sums of the full resolution samples. False while the half resolution preview is traced
+        bool getDenoiserInputs(GLuint& colorTexture, GLuint& albedoTexture, GLuint& normalDepthTexture) const;
     };
-}
\ No newline at end of file
+}
@@ -1,16 +1,24 @@
 #include "Config.h"
 #include "Renderer.h"
+#include "LightBVH.h"
 
 namespace GLSLPathTracer
 {
-    Program *loadShaders(const std::string &vertex_shader_fileName, const std::string &frag_shader_fileName)
+    Program *loadShaders(const std::string &vertex_shader_fileName, const std::string &frag_shader_fileName, const std::string &fragDefines)
     {
         std::vector<Shader> shaders;
         shaders.push_back(Shader(vertex_shader_fileName, GL_VERTEX_SHADER));
-        shaders.push_back(Shader(frag_shader_fileName, GL_FRAGMENT_SHADER));
+        shaders.push_back(Shader(frag_shader_fileName, GL_FRAGMENT_SHADER, fragDefines));
         return new Program(shaders);
     }
 
+    std::string Renderer::pathTraceDefines() const
+    {
+        // a wide node pushes its 4 children and pops one: 3 more entries per level, plus the sentinel
+        int wideDepth = scene->wideBVH4 ? scene->wideBVH4->depth : 0;
+        return "#define WIDE_STACK_SIZE " + std::to_string(glm::max(wideDepth * 3 + 1, 2)) + "\n";
+    }
+
     void Renderer::finish()
     {
         if (!initialized)
@@ -53,13 +61,16 @@ namespace GLSLPathTracer
 
         quad = new Quad();
 
-        //Create Texture for BVH Tree
+        //Create Texture for BVH Tree, 4 wide nodes when the scene has them
         glGenBuffers(1, &BVHBuffer);
         glBindBuffer(GL_TEXTURE_BUFFER, BVHBuffer);
-        glBufferData(GL_TEXTURE_BUFFER, sizeof(GPUBVHNode) * scene->gpuBVH->bvh->getNumNodes(), &scene->gpuBVH->gpuNodes[0], GL_STATIC_DRAW);
+        if (scene->wideBVH4)
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(WideBVHNode<4>) * scene->wideBVH4->nodes.size(), scene->wideBVH4->nodes.data(), GL_STATIC_DRAW);
+        else
+            glBufferData(GL_TEXTURE_BUFFER, sizeof(GPUBVHNode) * scene->gpuBVH->numNodes, &scene->gpuBVH->gpuNodes[0], GL_STATIC_DRAW);
         glGenTextures(1, &BVHTexture);
         glBindTexture(GL_TEXTURE_BUFFER, BVHTexture);
-        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, BVHBuffer);
+        glTexBuffer(GL_TEXTURE_BUFFER, scene->wideBVH4 ? GL_RGBA32F : GL_RGB32F, BVHBuffer);
 
         //Create Buffer and Texture for TriangleIndices
         glGenBuffers(1, &triangleBuffer);
@@ -98,9 +109,18 @@ namespace GLSLPathTracer
 
         if (numOfLights > 0)
         {
+            // light data, then the alias table and the nodes of the light BVH, all RGB32F texels
+            LightBVH lightBVH(scene->lightData);
+            const size_t lightsSize = sizeof(LightData) * scene->lightData.size();
+            const size_t aliasTableSize = sizeof(LightAliasEntry) * lightBVH.aliasTable.size();
+            const size_t nodesSize = sizeof(LightBVHNode) * lightBVH.nodes.size();
+
             glGenBuffers(1, &lightArrayBuffer);
             glBindBuffer(GL_TEXTURE_BUFFER, lightArrayBuffer);
-            glBufferData(GL_TEXTURE_BUFFER, sizeof(LightData) * scene->lightData.size(), &scene->lightData[0], GL_STATIC_DRAW);
+            glBufferData(GL_TEXTURE_BUFFER, lightsSize + aliasTableSize + nodesSize, nullptr, GL_STATIC_DRAW);
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, lightsSize, &scene->lightData[0]);
+            glBufferSubData(GL_TEXTURE_BUFFER, lightsSize, aliasTableSize, &lightBVH.aliasTable[0]);
+            glBufferSubData(GL_TEXTURE_BUFFER, lightsSize + aliasTableSize, nodesSize, &lightBVH.nodes[0]);
             glGenTextures(1, &lightsTexture);
             glBindTexture(GL_TEXTURE_BUFFER, lightsTexture);
             glTexBuffer(GL_TEXTURE_BUFFER, GL_RGB32F, lightArrayBuffer);
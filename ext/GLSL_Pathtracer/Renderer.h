@@ -9,12 +9,14 @@
 
 namespace GLSLPathTracer
 {
-    Program *loadShaders(const std::string &vertex_shader_fileName, const std::string &frag_shader_fileName);
+    // fragDefines are added to the fragment shader source, after #version
+    Program *loadShaders(const std::string &vertex_shader_fileName, const std::string &frag_shader_fileName, const std::string &fragDefines = std::string());
 
     enum RendererType
     {
         Renderer_Progressive,
         Renderer_Tiled,
+        Renderer_CPU,
     };
     class Renderer
     {
@@ -58,5 +60,8 @@ namespace GLSLPathTracer
         virtual float getProgress() const = 0;
         // used for UI
         virtual RendererType getType() const = 0;
+    protected:
+        // PathTraceFrag.glsl defines sized for the scene
+        std::string pathTraceDefines() const;
     };
 }
\ No newline at end of file
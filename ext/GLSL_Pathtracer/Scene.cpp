@@ -15,8 +15,46 @@ namespace GLSLPathTracer
     {
         delete camera;
         delete gpuBVH;
+        delete wideBVH4;
+        delete wideBVH8;
+        // arrays of a scene loaded from a cache point into mappedData
+        if (!mappedData)
+        {
+            delete[] texData.albedoTextures;
+            delete[] texData.metallicRoughnessTextures;
+            delete[] texData.normalTextures;
+            delete[] hdrLoaderRes.cols;
+            delete[] hdrLoaderRes.marginalDistData;
+            delete[] hdrLoaderRes.conditionalDistData;
+        }
+    }
+    void Scene::buildBVH(enki::TaskScheduler *taskScheduler)
+    {
+        std::cout << "Building BVH with spatial splits\n";
+        BVH::BuildParams defaultparams;
+        defaultparams.taskScheduler = taskScheduler;
+        BVH *myBVH = createBVH(defaultparams);
+
+        std::cout << "Building GPU-BVH\n";
+        gpuBVH = new GPUBVH(myBVH);
+        std::cout << "GPU-BVH successfully created\n";
+        // everything needed was flattened in the GPUBVH
+        delete myBVH->getScene();
+        delete myBVH;
+        gpuBVH->bvh = nullptr;
+
+        buildWideBVH();
     }
-    void Scene::buildBVH()
+
+    void Scene::buildWideBVH()
+    {
+        if (renderOptions.bvhWidth == 4)
+            wideBVH4 = new WideBVH<4>(gpuBVH, vertexData);
+        else if (renderOptions.bvhWidth == 8)
+            wideBVH8 = new WideBVH<8>(gpuBVH, vertexData);
+    }
+
+    BVH *Scene::createBVH(const BVH::BuildParams &params) const
     {
         Array<GPUScene::Triangle> tris;
         Array<Vec3f> verts;
@@ -27,6 +65,7 @@ namespace GLSLPathTracer
 
         // convert Triangle to GPUScene::Triangle
         int triCount = int(triangleIndices.size());
+        tris.setCapacity(triCount);
         for (int i = 0; i < triCount; i++) {
             GPUScene::Triangle newtri;
             newtri.vertices = Vec3i(int(triangleIndices[i].indices.x), int(triangleIndices[i].indices.y), int(triangleIndices[i].indices.z));
@@ -35,6 +74,7 @@ namespace GLSLPathTracer
 
         // fill up Array of vertices
         int verCount = int(vertexData.size());
+        verts.setCapacity(verCount);
         for (int i = 0; i < verCount; i++) {
             verts.add(Vec3f(vertexData[i].vertex.x, vertexData[i].vertex.y, vertexData[i].vertex.z));
         }
@@ -42,15 +82,8 @@ namespace GLSLPathTracer
         std::cout << "Building a new GPU Scene\n";
         GPUScene* gpuScene = new GPUScene(triCount, verCount, tris, verts);
 
-        std::cout << "Building BVH with spatial splits\n";
         // create a default platform
         Platform defaultplatform;
-        BVH::BuildParams defaultparams;
-        BVH::Stats stats;
-        BVH *myBVH = new BVH(gpuScene, defaultplatform, defaultparams);
-
-        std::cout << "Building GPU-BVH\n";
-        gpuBVH = new GPUBVH(myBVH);
-        std::cout << "GPU-BVH successfully created\n";
+        return new BVH(gpuScene, defaultplatform, params);
     }
 }
\ No newline at end of file
@@ -1,10 +1,12 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <memory>
 #include <string>
 #include <vector>
 #include "hdrloader.h"
 #include "GPUBVH.h"
+#include "WideBVH.h"
 
 namespace GLSLPathTracer
 {
@@ -77,6 +79,7 @@ namespace GLSLPathTracer
             useEnvMap = false;
             resolution = glm::vec2(500, 500);
             hdrMultiplier = 1.0f;
+            bvhWidth = 4;
         }
         std::string rendererType;
         glm::ivec2 resolution;
@@ -86,6 +89,8 @@ namespace GLSLPathTracer
         int numTilesY;
         bool useEnvMap;
         float hdrMultiplier;
+        // children per node of the traversed BVH: 2, 4 or 8. The shaders traverse 2 or 4 wide nodes.
+        int bvhWidth;
     };
 
     class Scene
@@ -94,11 +99,17 @@ namespace GLSLPathTracer
         Scene(const std::string filename) : filename(filename)
             , camera(nullptr) 
             , gpuBVH(nullptr)
+            , wideBVH4(nullptr)
+            , wideBVH8(nullptr)
+            , texData()
         {}
         ~Scene();
         void addCamera(glm::vec3 pos, glm::vec3 lookAt, float fov);
         Camera *camera;
         GPUBVH *gpuBVH;
+        // collapsed GPUBVH, the one matching renderOptions.bvhWidth is built
+        WideBVH<4> *wideBVH4;
+        WideBVH<8> *wideBVH8;
         std::vector<TriangleData> triangleIndices;
         std::vector<NormalTexData> normalTexData;
         std::vector<VertexData> vertexData;
@@ -107,7 +118,15 @@ namespace GLSLPathTracer
         TexData texData;
         RenderOptions renderOptions;
         HDRLoaderResult hdrLoaderRes;
-        void buildBVH();
+        // files read by LoadScene, a cache of the scene is valid while they are unchanged
+        std::vector<std::string> sourceFiles;
+        // owner of the memory the texture, HDR and GPUBVH node arrays point to when loaded from a cache
+        std::shared_ptr<void> mappedData;
+        // a task scheduler builds the BVH with ParallelSplitBVHBuilder
+        void buildBVH(enki::TaskScheduler *taskScheduler = nullptr);
+        BVH *createBVH(const BVH::BuildParams &params) const;
+        // collapse gpuBVH to the width of renderOptions.bvhWidth
+        void buildWideBVH();
         const std::string& getSceneName() const { return filename; }
     protected:
         std::string filename;
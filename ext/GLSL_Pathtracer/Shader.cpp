@@ -7,7 +7,7 @@
 
 namespace GLSLPathTracer
 {
-    Shader::Shader(const std::string& filePath, GLenum shaderType)
+    Shader::Shader(const std::string& filePath, GLenum shaderType, const std::string& defines)
     {
         std::ifstream f;
         f.open(filePath.c_str(), std::ios::in | std::ios::binary);
@@ -22,6 +22,11 @@ namespace GLSLPathTracer
         buffer << f.rdbuf();
 
         std::string source = buffer.str();
+        if (!defines.empty())
+        {
+            size_t versionEnd = (source.compare(0, 8, "#version") == 0) ? source.find('\n') : std::string::npos;
+            source.insert((versionEnd == std::string::npos) ? 0 : versionEnd + 1, defines);
+        }
         _object = glCreateShader(shaderType);
         const GLchar *src = (const GLchar *)source.c_str();
         glShaderSource(_object, 1, &src, 0);
@@ -12,7 +12,8 @@ namespace GLSLPathTracer
     private:
         GLuint _object;
     public:
-        Shader(const std::string& filePath, GLuint shaderType);
+        // defines are inserted after the #version line
+        Shader(const std::string& filePath, GLuint shaderType, const std::string& defines = std::string());
         GLuint object() const;
     };
 }
\ No newline at end of file
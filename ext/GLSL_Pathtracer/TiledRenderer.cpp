@@ -4,6 +4,12 @@
 
 namespace GLSLPathTracer
 {
+    // bound to const references by glm::min, they need a definition
+    const int TiledRenderer::tileSize;
+    const int TiledRenderer::maxBucketSize;
+    const int TiledRenderer::maxPassesPerFrame;
+    const int TiledRenderer::queryCount;
+
     void TiledRenderer::init()
     {
         if (initialized)
@@ -11,27 +17,20 @@ namespace GLSLPathTracer
 
         Renderer::init();
 
-        renderCompleted = false;
-        totalTime = 0.0f;
-        sampleCounter = new float*[numTilesX];
-        for (int i = 0; i < numTilesX; i++)
-            sampleCounter[i] = new float[numTilesY];
-
-        for (int j = 0; j < numTilesY; j++)
-            for (int i = 0; i < numTilesX; i++)
-                sampleCounter[i][j] = 0;
-
-        tileWidth = (int)screenSize.x / numTilesX;
-        tileHeight = (int)screenSize.y / numTilesY;
-        tileX = 0;
-        tileY = numTilesY - 1;
+        numTilesX = (screenSize.x + tileSize - 1) / tileSize;
+        numTilesY = (screenSize.y + tileSize - 1) / tileSize;
+        tileSamples.resize(numTilesX * numTilesY);
+        bucketSize = tileSize;
+        queryIndex = 0;
+        pendingQueries = 0;
+        pixelSampleCost = 0.0;
+        resetTiles();
 
         //----------------------------------------------------------
         // Shaders
         //----------------------------------------------------------
-        pathTraceShader = loadShaders(shadersDirectory + "PathTraceVert.glsl", shadersDirectory + "PathTraceFrag.glsl");
+        pathTraceShader = loadShaders(shadersDirectory + "PathTraceVert.glsl", shadersDirectory + "PathTraceFrag.glsl", pathTraceDefines());
         accumShader = loadShaders(shadersDirectory + "AccumVert.glsl", shadersDirectory + "AccumFrag.glsl");
-        tileOutputShader = loadShaders(shadersDirectory + "TileOutputVert.glsl", shadersDirectory + "TileOutputFrag.glsl");
         outputShader = loadShaders(shadersDirectory + "OutputVert.glsl", shadersDirectory + "OutputFrag.glsl");
 
         //----------------------------------------------------------
@@ -44,11 +43,12 @@ namespace GLSLPathTracer
         //Create Texture for FBO
         glGenTextures(1, &pathTraceTexture);
         glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, tileWidth, tileHeight, 0, GL_RGB, GL_FLOAT, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, GLsizei(screenSize.x), GLsizei(screenSize.y), 0, GL_RGB, GL_FLOAT, 0);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glBindTexture(GL_TEXTURE_2D, 0);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pathTraceTexture, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
 
         //Create FBOs for screen shader
         glGenFramebuffers(1, &accumFBO);
@@ -62,32 +62,24 @@ namespace GLSLPathTracer
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glBindTexture(GL_TEXTURE_2D, 0);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumTexture, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-        //Create FBOs for output shader
-        glGenFramebuffers(1, &outputFBO);
-        glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
-
-        //Create Texture for FBO
-        glGenTextures(1, &tileOutputTexture);
-        glBindTexture(GL_TEXTURE_2D, tileOutputTexture);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, GLsizei(screenSize.x), GLsizei(screenSize.y), 0, GL_RGB, GL_FLOAT, 0);
+        //Create tile texture, samples per tile
+        glGenTextures(1, &tileTexture);
+        glBindTexture(GL_TEXTURE_2D, tileTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, numTilesX, numTilesY, 0, GL_RG, GL_FLOAT, 0);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glBindTexture(GL_TEXTURE_2D, 0);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tileOutputTexture, 0);
+
+        glGenQueries(queryCount, timerQueries);
 
         GLuint shaderObject;
 
         pathTraceShader->use();
         shaderObject = pathTraceShader->object();
 
-        glUniform3fv(glGetUniformLocation(shaderObject, "camera.position"), 1, glm::value_ptr(scene->camera->position));
-        glUniform3fv(glGetUniformLocation(shaderObject, "camera.right"), 1, glm::value_ptr(scene->camera->right));
-        glUniform3fv(glGetUniformLocation(shaderObject, "camera.up"), 1, glm::value_ptr(scene->camera->up));
-        glUniform3fv(glGetUniformLocation(shaderObject, "camera.forward"), 1, glm::value_ptr(scene->camera->forward));
-        glUniform1f(glGetUniformLocation(shaderObject, "camera.fov"), scene->camera->fov);
-        glUniform1f(glGetUniformLocation(shaderObject, "camera.focalDist"), scene->camera->focalDist);
-        glUniform1f(glGetUniformLocation(shaderObject, "camera.aperture"), scene->camera->aperture);
         glUniform1i(glGetUniformLocation(shaderObject, "useEnvMap"), scene->renderOptions.useEnvMap);
         glUniform1f(glGetUniformLocation(shaderObject, "hdrResolution"), (float)(scene->hdrLoaderRes.width * scene->hdrLoaderRes.height));
         glUniform1f(glGetUniformLocation(shaderObject, "hdrMultiplier"), scene->renderOptions.hdrMultiplier);
@@ -95,8 +87,7 @@ namespace GLSLPathTracer
         glUniform1i(glGetUniformLocation(shaderObject, "maxDepth"), maxDepth);
         glUniform2f(glGetUniformLocation(shaderObject, "screenResolution"), float(screenSize.x), float(screenSize.y));
         glUniform1i(glGetUniformLocation(shaderObject, "numOfLights"), numOfLights);
-        glUniform1f(glGetUniformLocation(shaderObject, "invTileWidth"), 1.0f / numTilesX);
-        glUniform1f(glGetUniformLocation(shaderObject, "invTileHeight"), 1.0f / numTilesY);
+        glUniform1i(glGetUniformLocation(shaderObject, "wideBVH"), scene->wideBVH4 != nullptr);
 
         glUniform1i(glGetUniformLocation(shaderObject, "accumTexture"), 0);
         glUniform1i(glGetUniformLocation(shaderObject, "BVH"), 1);
@@ -111,9 +102,23 @@ namespace GLSLPathTracer
         glUniform1i(glGetUniformLocation(shaderObject, "hdrTexture"), 10);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrMarginalDistTexture"), 11);
         glUniform1i(glGetUniformLocation(shaderObject, "hdrCondDistTexture"), 12);
+        glUniform1i(glGetUniformLocation(shaderObject, "tileTexture"), 13);
+        glUniform1i(glGetUniformLocation(shaderObject, "tileSize"), tileSize);
 
         pathTraceShader->stopUsing();
 
+        accumShader->use();
+        shaderObject = accumShader->object();
+        glUniform1i(glGetUniformLocation(shaderObject, "pathTraceTexture"), 0);
+        accumShader->stopUsing();
+
+        outputShader->use();
+        shaderObject = outputShader->object();
+        glUniform1i(glGetUniformLocation(shaderObject, "accumTexture"), 0);
+        glUniform1i(glGetUniformLocation(shaderObject, "tileTexture"), 1);
+        glUniform1i(glGetUniformLocation(shaderObject, "tileSize"), tileSize);
+        glUniform2f(glGetUniformLocation(shaderObject, "screenResolution"), float(screenSize.x), float(screenSize.y));
+        outputShader->stopUsing();
     }
 
     void TiledRenderer::finish()
@@ -123,20 +128,121 @@ namespace GLSLPathTracer
 
         glDeleteTextures(1, &pathTraceTexture);
         glDeleteTextures(1, &accumTexture);
-        glDeleteTextures(1, &tileOutputTexture);
+        glDeleteTextures(1, &tileTexture);
 
         glDeleteFramebuffers(1, &pathTraceFBO);
         glDeleteFramebuffers(1, &accumFBO);
-        glDeleteFramebuffers(1, &outputFBO);
+
+        glDeleteQueries(queryCount, timerQueries);
 
         delete pathTraceShader;
         delete accumShader;
-        delete tileOutputShader;
         delete outputShader;
 
         Renderer::finish();
     }
 
+    void TiledRenderer::resetTiles()
+    {
+        for (auto& samples : tileSamples)
+            samples = glm::vec2(0.f);
+        frameBuckets.clear();
+        framePasses = 0;
+        renderCompleted = false;
+        totalTime = 0.0f;
+    }
+
+    void TiledRenderer::readTimerQueries()
+    {
+        while (pendingQueries)
+        {
+            const int query = (queryIndex - pendingQueries + queryCount) % queryCount;
+            GLint available = 0;
+            glGetQueryObjectiv(timerQueries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(timerQueries[query], GL_QUERY_RESULT, &elapsed);
+            pendingQueries--;
+
+            double cost = double(elapsed) * 1e-9 / queryPixelSamples[query];
+            pixelSampleCost = (pixelSampleCost > 0.0) ? pixelSampleCost * 0.7 + cost * 0.3 : cost;
+        }
+    }
+
+    bool TiledRenderer::isBucketComplete(const Bucket& bucket) const
+    {
+        for (int y = bucket.y; y < glm::min(bucket.y + bucket.size, numTilesY); y++)
+            for (int x = bucket.x; x < glm::min(bucket.x + bucket.size, numTilesX); x++)
+                if (tileSamples[y * numTilesX + x].y < maxSamples)
+                    return false;
+        return true;
+    }
+
+    void TiledRenderer::scheduleBuckets()
+    {
+        // pixel samples that fit in the frame, a sample of the smallest bucket until the first measure
+        double budget = (pixelSampleCost > 0.0) ? targetFrameTime / pixelSampleCost : double(tileSize * tileSize);
+
+        // largest bucket traced once within the budget
+        bucketSize = tileSize;
+        while (bucketSize < maxBucketSize && double(bucketSize * 2) * double(bucketSize * 2) <= budget)
+            bucketSize *= 2;
+        const int bucketTiles = bucketSize / tileSize;
+        const int numBucketsX = (numTilesX + bucketTiles - 1) / bucketTiles;
+        const int numBucketsY = (numTilesY + bucketTiles - 1) / bucketTiles;
+
+        for (auto& samples : tileSamples)
+            samples.x = 0.f;
+        frameBuckets.clear();
+        framePasses = 0;
+
+        // first buckets from the top, the next bucket starts in the frame once the previous one is complete
+        for (int bucketY = numBucketsY - 1; bucketY >= 0; bucketY--)
+        {
+            for (int bucketX = 0; bucketX < numBucketsX; bucketX++)
+            {
+                Bucket bucket = { bucketX * bucketTiles, bucketY * bucketTiles, bucketTiles };
+                if (isBucketComplete(bucket))
+                    continue;
+
+                double pixels = 0.0;
+                int missingSamples = 0;
+                for (int y = bucket.y; y < glm::min(bucket.y + bucket.size, numTilesY); y++)
+                {
+                    for (int x = bucket.x; x < glm::min(bucket.x + bucket.size, numTilesX); x++)
+                    {
+                        const glm::vec2& samples = tileSamples[y * numTilesX + x];
+                        if (samples.y >= maxSamples)
+                            continue;
+                        pixels += double(glm::min(tileSize, screenSize.x - x * tileSize) * glm::min(tileSize, screenSize.y - y * tileSize));
+                        missingSamples = glm::max(missingSamples, maxSamples - int(samples.y));
+                    }
+                }
+
+                int passes = glm::min(int(budget / pixels), glm::min(missingSamples, maxPassesPerFrame));
+                if (frameBuckets.empty())
+                    passes = glm::max(passes, 1);
+                if (passes == 0)
+                    return;
+
+                for (int y = bucket.y; y < glm::min(bucket.y + bucket.size, numTilesY); y++)
+                {
+                    for (int x = bucket.x; x < glm::min(bucket.x + bucket.size, numTilesX); x++)
+                    {
+                        glm::vec2& samples = tileSamples[y * numTilesX + x];
+                        samples.x = float(glm::max(glm::min(passes, maxSamples - int(samples.y)), 0));
+                    }
+                }
+                frameBuckets.push_back(bucket);
+                framePasses = glm::max(framePasses, passes);
+                budget -= passes * pixels;
+                if (passes < missingSamples)
+                    return;
+            }
+        }
+    }
+
     void TiledRenderer::render()
     {
         if (!initialized)
@@ -144,77 +250,105 @@ namespace GLSLPathTracer
             Log("Tiled Renderer is not initialized\n");
             return;
         }
+        if (renderCompleted)
+            return;
 
-        if (!renderCompleted)
+        readTimerQueries();
+        scheduleBuckets();
+        if (frameBuckets.empty())
         {
-            GLuint shaderObject;
-            pathTraceShader->use();
+            renderCompleted = true;
+            Log("Completed: %f secs\n", totalTime);
+            return;
+        }
+
+        // samples accumulated once this frame is traced, read by the output shader
+        double pixelSamples = 0.0;
+        for (int i = 0; i < numTilesX * numTilesY; i++)
+        {
+            const int x = i % numTilesX;
+            const int y = i / numTilesX;
+            pixelSamples += double(tileSamples[i].x) * glm::min(tileSize, screenSize.x - x * tileSize) * glm::min(tileSize, screenSize.y - y * tileSize);
+            tileSamples[i].y += tileSamples[i].x;
+        }
+        glActiveTexture(GL_TEXTURE13);
+        glBindTexture(GL_TEXTURE_2D, tileTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, numTilesX, numTilesY, GL_RG, GL_FLOAT, tileSamples.data());
+
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_BUFFER, BVHTexture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_BUFFER, triangleIndicesTexture);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_BUFFER, verticesTexture);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_BUFFER, normalsTexCoordsTexture);
+        glActiveTexture(GL_TEXTURE5);
+        glBindTexture(GL_TEXTURE_BUFFER, materialsTexture);
+        glActiveTexture(GL_TEXTURE6);
+        glBindTexture(GL_TEXTURE_BUFFER, lightsTexture);
+        glActiveTexture(GL_TEXTURE7);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, albedoTextures);
+        glActiveTexture(GL_TEXTURE8);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, metallicRoughnessTextures);
+        glActiveTexture(GL_TEXTURE9);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, normalTextures);
+        glActiveTexture(GL_TEXTURE10);
+        glBindTexture(GL_TEXTURE_2D, hdrTexture);
+        glActiveTexture(GL_TEXTURE11);
+        glBindTexture(GL_TEXTURE_1D, hdrMarginalDistTexture);
+        glActiveTexture(GL_TEXTURE12);
+        glBindTexture(GL_TEXTURE_2D, hdrConditionalDistTexture);
+
+        // no query when all of them are in flight, the cost keeps its last value
+        const bool timed = pendingQueries < queryCount;
+        if (timed)
+            glBeginQuery(GL_TIME_ELAPSED, timerQueries[queryIndex]);
+
+        // buckets on the right and top edges are clipped to the screen
+        auto setViewport = [&](const Bucket& bucket)
+        {
+            const int x = bucket.x * tileSize;
+            const int y = bucket.y * tileSize;
+            glViewport(x, y, glm::min(bucket.size * tileSize, screenSize.x - x), glm::min(bucket.size * tileSize, screenSize.y - y));
+        };
 
-            shaderObject = pathTraceShader->object();
-            glUniform1i(glGetUniformLocation(shaderObject, "tileX"), tileX);
-            glUniform1i(glGetUniformLocation(shaderObject, "tileY"), tileY);
+        // tiles traced fewer times than the pass index are discarded by the shader
+        for (int pass = 0; pass < framePasses; pass++)
+        {
+            GLuint shaderObject = pathTraceShader->object();
+            pathTraceShader->use();
+            glUniform1i(glGetUniformLocation(shaderObject, "tilePass"), pass);
+            glUniform3f(glGetUniformLocation(shaderObject, "randomVector"), (float)rand() / RAND_MAX, (float)rand() / RAND_MAX, (float)rand() / RAND_MAX);
             pathTraceShader->stopUsing();
 
             glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBO);
-            glViewport(0, 0, tileWidth, tileHeight);
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, accumTexture);
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_BUFFER, BVHTexture);
-            glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_BUFFER, triangleIndicesTexture);
-            glActiveTexture(GL_TEXTURE3);
-            glBindTexture(GL_TEXTURE_BUFFER, verticesTexture);
-            glActiveTexture(GL_TEXTURE4);
-            glBindTexture(GL_TEXTURE_BUFFER, normalsTexCoordsTexture);
-            glActiveTexture(GL_TEXTURE5);
-            glBindTexture(GL_TEXTURE_BUFFER, materialsTexture);
-            glActiveTexture(GL_TEXTURE6);
-            glBindTexture(GL_TEXTURE_BUFFER, lightsTexture);
-            glActiveTexture(GL_TEXTURE7);
-            glBindTexture(GL_TEXTURE_2D_ARRAY, albedoTextures);
-            glActiveTexture(GL_TEXTURE8);
-            glBindTexture(GL_TEXTURE_2D_ARRAY, metallicRoughnessTextures);
-            glActiveTexture(GL_TEXTURE9);
-            glBindTexture(GL_TEXTURE_2D_ARRAY, normalTextures);
-            glActiveTexture(GL_TEXTURE10);
-            glBindTexture(GL_TEXTURE_2D, hdrTexture);
-            glActiveTexture(GL_TEXTURE11);
-            glBindTexture(GL_TEXTURE_1D, hdrMarginalDistTexture);
-            glActiveTexture(GL_TEXTURE12);
-            glBindTexture(GL_TEXTURE_2D, hdrConditionalDistTexture);
-
-            quad->Draw(pathTraceShader);
+            for (const Bucket& bucket : frameBuckets)
+            {
+                setViewport(bucket);
+                quad->Draw(pathTraceShader);
+            }
 
             glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
-            glViewport(tileWidth * tileX, tileHeight * tileY, tileWidth, tileHeight);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
-
-            quad->Draw(accumShader);
-
-            glBindFramebuffer(GL_FRAMEBUFFER, outputFBO);
-            glViewport(tileWidth * tileX, tileHeight * tileY, tileWidth, tileHeight);
             glActiveTexture(GL_TEXTURE0);
             glBindTexture(GL_TEXTURE_2D, pathTraceTexture);
-
-            quad->Draw(outputShader);
+            for (const Bucket& bucket : frameBuckets)
+            {
+                setViewport(bucket);
+                quad->Draw(accumShader);
+            }
         }
 
-        if (sampleCounter[tileX][tileY] > maxSamples)
+        if (timed)
         {
-            tileX++;
-            if (tileX >= numTilesX)
-            {
-                tileX = 0;
-                tileY--;
-                if (tileY < 0)
-                {
-                    renderCompleted = true;
-                    Log("Completed: %f secs\n", totalTime);
-                }
-            }
+            glEndQuery(GL_TIME_ELAPSED);
+            queryPixelSamples[queryIndex] = pixelSamples;
+            queryIndex = (queryIndex + 1) % queryCount;
+            pendingQueries++;
         }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
     void TiledRenderer::present() const
@@ -222,43 +356,54 @@ namespace GLSLPathTracer
         if (!initialized)
             return;
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, tileOutputTexture);
-        quad->Draw(tileOutputShader);
+        glBindTexture(GL_TEXTURE_2D, accumTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, tileTexture);
+        quad->Draw(outputShader);
     }
 
     float TiledRenderer::getProgress() const
     {
-        return float((numTilesY - tileY - 1) * numTilesX + tileX) / float(numTilesX * numTilesY);
+        if (!initialized)
+            return 0.f;
+        if (renderCompleted)
+            return 1.f;
+        float samples = 0.f;
+        for (const auto& tile : tileSamples)
+            samples += glm::min(tile.y, float(maxSamples));
+        return samples / (float(maxSamples) * float(tileSamples.size()));
     }
 
     void TiledRenderer::update(float secondsElapsed)
     {
-        if (renderCompleted || !initialized)
+        if (!initialized)
             return;
-        totalTime += secondsElapsed;
-        sampleCounter[tileX][tileY] += 1;
 
-        float r1 = ((float)rand() / (RAND_MAX));
-        float r2 = ((float)rand() / (RAND_MAX));
-        float r3 = ((float)rand() / (RAND_MAX));
+        // restart with the new view
+        if (scene->camera->isMoving)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, pathTraceFBO);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            resetTiles();
+        }
+        if (renderCompleted)
+            return;
+        totalTime += secondsElapsed;
 
         GLuint shaderObject;
 
         pathTraceShader->use();
         shaderObject = pathTraceShader->object();
-        glUniform3fv(glGetUniformLocation(shaderObject, "randomVector"), 1, glm::value_ptr(glm::vec3(r1, r2, r3)));
-        glUniform1i(glGetUniformLocation(shaderObject, "tileX"), tileX);
-        glUniform1i(glGetUniformLocation(shaderObject, "tileY"), tileY);
+        glUniform3fv(glGetUniformLocation(shaderObject, "camera.position"), 1, glm::value_ptr(scene->camera->position));
+        glUniform3fv(glGetUniformLocation(shaderObject, "camera.right"), 1, glm::value_ptr(scene->camera->right));
+        glUniform3fv(glGetUniformLocation(shaderObject, "camera.up"), 1, glm::value_ptr(scene->camera->up));
+        glUniform3fv(glGetUniformLocation(shaderObject, "camera.forward"), 1, glm::value_ptr(scene->camera->forward));
+        glUniform1f(glGetUniformLocation(shaderObject, "camera.fov"), scene->camera->fov);
+        glUniform1f(glGetUniformLocation(shaderObject, "camera.focalDist"), scene->camera->focalDist);
+        glUniform1f(glGetUniformLocation(shaderObject, "camera.aperture"), scene->camera->aperture);
         pathTraceShader->stopUsing();
-
-        outputShader->use();
-        shaderObject = outputShader->object();
-        glUniform1f(glGetUniformLocation(shaderObject, "invSampleCounter"), 1.0f / sampleCounter[tileX][tileY]);
-        outputShader->stopUsing();
-
-        tileOutputShader->use();
-        shaderObject = tileOutputShader->object();
-        glUniform1f(glGetUniformLocation(shaderObject, "invSampleCounter"), 1.0f);
-        tileOutputShader->stopUsing();
     }
-}
\ No newline at end of file
+}
@@ -1,28 +1,57 @@
 #pragma once
 
 #include "Renderer.h"
+#include <vector>
 
 namespace GLSLPathTracer
 {
+    // Bucket renderer: squares of the screen are traced until they have maxSamples, from the top left.
+    // The GPU time of the traced pixel samples is measured with timer queries, and the size of the squares
+    // and the samples traced per frame adapt so a frame costs about targetFrameTime. Samples are counted per
+    // tile of tileSize pixels so squares of different sizes share the accumulation.
     class TiledRenderer : public Renderer
     {
     private:
-        GLuint pathTraceFBO, accumFBO, outputFBO;
-        Program *pathTraceShader, *accumShader, *tileOutputShader, *outputShader;
-        GLuint pathTraceTexture, accumTexture, tileOutputTexture;
-        int tileX, tileY, numTilesX, numTilesY, tileWidth, tileHeight, maxSamples, maxDepth;
+        // square of size tiles at tile x, y
+        struct Bucket { int x, y, size; };
+
+        GLuint pathTraceFBO, accumFBO;
+        Program *pathTraceShader, *accumShader, *outputShader;
+        GLuint pathTraceTexture, accumTexture, tileTexture;
+        int numTilesX, numTilesY, maxSamples, maxDepth, framePasses, bucketSize;
         bool renderCompleted;
-        float **sampleCounter, totalTime;
+        float totalTime;
+
+        static const int tileSize = 32;
+        static const int maxBucketSize = 512;
+        static const int maxPassesPerFrame = 16;
+        static const int queryCount = 4;
+        // GPU time of the path tracing in a UI frame
+        float targetFrameTime;
+        // per tile, samples traced this frame and samples accumulated. Uploaded to tileTexture
+        std::vector<glm::vec2> tileSamples;
+        std::vector<Bucket> frameBuckets;
+        // ring of timer queries, each measures the frame that traced queryPixelSamples
+        GLuint timerQueries[queryCount];
+        double queryPixelSamples[queryCount];
+        int queryIndex, pendingQueries;
+        // seconds per pixel sample, running average of the timer queries
+        double pixelSampleCost;
+
+        void resetTiles();
+        void readTimerQueries();
+        void scheduleBuckets();
+        bool isBucketComplete(const Bucket& bucket) const;
+
     public:
         TiledRenderer(const Scene *scene, const std::string& shadersDirectory) : Renderer(scene, shadersDirectory)
-            , numTilesX(scene->renderOptions.numTilesX)
-            , numTilesY(scene->renderOptions.numTilesY)
-            , maxSamples(scene->renderOptions.maxSamples)
+            , maxSamples(glm::max(scene->renderOptions.maxSamples, 1))
             , maxDepth(scene->renderOptions.maxDepth)
+            , targetFrameTime(0.008f)
         {
         }
         ~TiledRenderer() {}
-        
+
         void init();
         void finish();
 
@@ -32,4 +61,4 @@ namespace GLSLPathTracer
         float getProgress() const;
         RendererType getType() const { return Renderer_Tiled; }
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,306 @@
+#include "WideBVH.h"
+#include "Scene.h"
+#include <cfloat>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WIDEBVH_SSE
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#define WIDEBVH_AVX
+#include <immintrin.h>
+#endif
+
+namespace GLSLPathTracer
+{
+    static float SurfaceArea(const GPUBVHNode& node)
+    {
+        glm::vec3 d = node.BBoxMax - node.BBoxMin;
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    template<int Width>
+    WideBVH<Width>::WideBVH(const GPUBVH *gpuBVH, const std::vector<VertexData>& vertexData) : depth(0), gpuBVH(gpuBVH), vertices(vertexData.data())
+    {
+        nodes.reserve(gpuBVH->numNodes / (Width - 1) + 1);
+        collapse(0, 1);
+    }
+
+    // Opens the inner child of largest surface area until the node is full, then recurses in the
+    // remaining inner children. Nodes are laid out depth first like the GPUBVH.
+    template<int Width>
+    int WideBVH<Width>::collapse(int binaryIndex, int level)
+    {
+        depth = glm::max(depth, level);
+        const GPUBVHNode *binaryNodes = gpuBVH->gpuNodes;
+        int slots[Width];
+        int slotCount = 0;
+
+        if (binaryNodes[binaryIndex].LRLeaf.z == 1.f)
+        {
+            // the whole tree is a single leaf
+            slots[slotCount++] = binaryIndex;
+        }
+        else
+        {
+            slots[slotCount++] = int(binaryNodes[binaryIndex].LRLeaf.x);
+            slots[slotCount++] = int(binaryNodes[binaryIndex].LRLeaf.y);
+        }
+
+        while (slotCount < Width)
+        {
+            int best = -1;
+            float bestArea = -1.f;
+            for (int i = 0; i < slotCount; i++)
+            {
+                const GPUBVHNode& node = binaryNodes[slots[i]];
+                if (node.LRLeaf.z == 1.f)
+                    continue;
+                float area = SurfaceArea(node);
+                if (area > bestArea)
+                {
+                    bestArea = area;
+                    best = i;
+                }
+            }
+            if (best == -1)
+                break;
+            const GPUBVHNode& opened = binaryNodes[slots[best]];
+            slots[best] = int(opened.LRLeaf.x);
+            slots[slotCount++] = int(opened.LRLeaf.y);
+        }
+
+        int index = int(nodes.size());
+        nodes.emplace_back();
+        for (int i = 0; i < Width; i++)
+        {
+            WideBVHNode<Width>& node = nodes[index];
+            if (i >= slotCount || (binaryNodes[slots[i]].LRLeaf.z == 1.f && binaryNodes[slots[i]].LRLeaf.y == 0.f))
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    node.bboxMin[axis][i] = 0.f;
+                    node.bboxMax[axis][i] = 0.f;
+                }
+                node.child[i] = -1;
+                node.count[i] = -1;
+                continue;
+            }
+
+            const GPUBVHNode& binaryNode = binaryNodes[slots[i]];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                node.bboxMin[axis][i] = binaryNode.BBoxMin[axis];
+                node.bboxMax[axis][i] = binaryNode.BBoxMax[axis];
+            }
+            if (binaryNode.LRLeaf.z == 1.f)
+            {
+                node.child[i] = int(binaryNode.LRLeaf.x);
+                node.count[i] = int(binaryNode.LRLeaf.y);
+            }
+            else
+            {
+                node.count[i] = 0;
+                // nodes may be reallocated by the recursion
+                int child = collapse(slots[i], level + 1);
+                nodes[index].child[i] = child;
+            }
+        }
+        return index;
+    }
+
+    namespace
+    {
+        struct RayData
+        {
+            glm::vec3 origin;
+            glm::vec3 invDir;
+        };
+
+        // Slab test of every child. Returns the mask of the children hit closer than tMax and their entry distance.
+        template<int Width>
+        struct ChildrenTest
+        {
+            static int intersect(const WideBVHNode<Width>& node, const RayData& ray, float tMax, float *dist)
+            {
+                int mask = 0;
+                for (int i = 0; i < Width; i++)
+                {
+                    if (node.count[i] < 0)
+                        continue;
+                    float tNear = 0.f;
+                    float tFar = tMax;
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        float n = (node.bboxMin[axis][i] - ray.origin[axis]) * ray.invDir[axis];
+                        float f = (node.bboxMax[axis][i] - ray.origin[axis]) * ray.invDir[axis];
+                        tNear = glm::max(tNear, glm::min(n, f));
+                        tFar = glm::min(tFar, glm::max(n, f));
+                    }
+                    dist[i] = tNear;
+                    if (tNear <= tFar)
+                        mask |= 1 << i;
+                }
+                return mask;
+            }
+        };
+
+#ifdef WIDEBVH_SSE
+        static inline int IntersectChildren4(const float *bboxMin, const float *bboxMax, const int *count, int stride, const RayData& ray, float tMax, float *dist)
+        {
+            __m128 tNear = _mm_setzero_ps();
+            __m128 tFar = _mm_set1_ps(tMax);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                __m128 origin = _mm_set1_ps(ray.origin[axis]);
+                __m128 invDir = _mm_set1_ps(ray.invDir[axis]);
+                __m128 n = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bboxMin + axis * stride), origin), invDir);
+                __m128 f = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bboxMax + axis * stride), origin), invDir);
+                tNear = _mm_max_ps(tNear, _mm_min_ps(n, f));
+                tFar = _mm_min_ps(tFar, _mm_max_ps(n, f));
+            }
+            _mm_storeu_ps(dist, tNear);
+            __m128i valid = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)count), _mm_set1_epi32(-1));
+            return _mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(tNear, tFar), _mm_castsi128_ps(valid)));
+        }
+
+        template<>
+        struct ChildrenTest<4>
+        {
+            static int intersect(const WideBVHNode<4>& node, const RayData& ray, float tMax, float *dist)
+            {
+                return IntersectChildren4(node.bboxMin[0], node.bboxMax[0], node.count, 4, ray, tMax, dist);
+            }
+        };
+
+        template<>
+        struct ChildrenTest<8>
+        {
+            static int intersect(const WideBVHNode<8>& node, const RayData& ray, float tMax, float *dist)
+            {
+#ifdef WIDEBVH_AVX
+                __m256 tNear = _mm256_setzero_ps();
+                __m256 tFar = _mm256_set1_ps(tMax);
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    __m256 origin = _mm256_set1_ps(ray.origin[axis]);
+                    __m256 invDir = _mm256_set1_ps(ray.invDir[axis]);
+                    __m256 n = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bboxMin[axis]), origin), invDir);
+                    __m256 f = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(node.bboxMax[axis]), origin), invDir);
+                    tNear = _mm256_max_ps(tNear, _mm256_min_ps(n, f));
+                    tFar = _mm256_min_ps(tFar, _mm256_max_ps(n, f));
+                }
+                _mm256_storeu_ps(dist, tNear);
+                __m256 valid = _mm256_cmp_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)node.count)), _mm256_setzero_ps(), _CMP_GE_OQ);
+                return _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ), valid));
+#else
+                // two SSE halves
+                return IntersectChildren4(node.bboxMin[0], node.bboxMax[0], node.count, 8, ray, tMax, dist)
+                    | (IntersectChildren4(node.bboxMin[0] + 4, node.bboxMax[0] + 4, node.count + 4, 8, ray, tMax, dist + 4) << 4);
+#endif
+            }
+        };
+#endif
+    }
+
+    template<int Width>
+    template<bool AnyHit>
+    bool WideBVH<Width>::traverse(const glm::vec3& origin, const glm::vec3& direction, float& t, int& triIndex) const
+    {
+        const TriIndexData *triIndices = gpuBVH->bvhTriangleIndices.data();
+        RayData ray = { origin, 1.f / direction };
+        bool hit = false;
+
+        struct StackEntry { int node; float dist; };
+        StackEntry stack[64 * (Width - 1) + 1];
+        int ptr = 0;
+        int idx = 0;
+
+        while (true)
+        {
+            const WideBVHNode<Width>& node = nodes[idx];
+            float dist[Width];
+            int mask = ChildrenTest<Width>::intersect(node, ray, t, dist);
+
+            // inner children hit, sorted nearest first
+            int inner[Width];
+            int innerCount = 0;
+            for (int i = 0; i < Width; i++)
+            {
+                if (!(mask & (1 << i)))
+                    continue;
+
+                if (node.count[i] == 0)
+                {
+                    int j = innerCount++;
+                    for (; j > 0 && dist[inner[j - 1]] > dist[i]; j--)
+                        inner[j] = inner[j - 1];
+                    inner[j] = i;
+                    continue;
+                }
+
+                // leaf, same triangle test as PathTraceFrag.glsl
+                for (int k = node.child[i], end = node.child[i] + node.count[i]; k < end; k++)
+                {
+                    const glm::vec4& indices = triIndices[k].indices;
+                    const glm::vec3& v0 = vertices[int(indices.x)].vertex;
+                    const glm::vec3& v1 = vertices[int(indices.y)].vertex;
+                    const glm::vec3& v2 = vertices[int(indices.z)].vertex;
+
+                    glm::vec3 e0 = v1 - v0;
+                    glm::vec3 e1 = v2 - v0;
+                    glm::vec3 pv = glm::cross(direction, e1);
+                    float det = glm::dot(e0, pv);
+                    glm::vec3 tv = origin - v0;
+                    glm::vec3 qv = glm::cross(tv, e0);
+
+                    float u = glm::dot(tv, pv) / det;
+                    float v = glm::dot(direction, qv) / det;
+                    float d = glm::dot(e1, qv) / det;
+                    if (u >= 0.f && v >= 0.f && d >= 0.f && 1.f - u - v >= 0.f && d < t)
+                    {
+                        if (AnyHit)
+                            return true;
+                        t = d;
+                        triIndex = k;
+                        hit = true;
+                    }
+                }
+            }
+
+            // farthest first so the nearest child is visited next
+            for (int j = innerCount - 1; j >= 0; j--)
+            {
+                int i = inner[j];
+                if (dist[i] <= t)
+                    stack[ptr++] = { node.child[i], dist[i] };
+            }
+
+            // skip nodes behind the closest hit found since they were pushed
+            do
+            {
+                if (ptr == 0)
+                    return hit;
+                --ptr;
+            } while (stack[ptr].dist > t);
+            idx = stack[ptr].node;
+        }
+    }
+
+    template<int Width>
+    bool WideBVH<Width>::intersect(const glm::vec3& origin, const glm::vec3& direction, float& t, int& triIndex) const
+    {
+        return traverse<false>(origin, direction, t, triIndex);
+    }
+
+    template<int Width>
+    bool WideBVH<Width>::occluded(const glm::vec3& origin, const glm::vec3& direction, float maxDist) const
+    {
+        int triIndex;
+        return traverse<true>(origin, direction, maxDist, triIndex);
+    }
+
+    template class WideBVH<2>;
+    template class WideBVH<4>;
+    template class WideBVH<8>;
+}
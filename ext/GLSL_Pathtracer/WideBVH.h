@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "GPUBVH.h"
+
+namespace GLSLPathTracer
+{
+    struct VertexData;
+
+    // Node of Width children with SoA bounds, one array per axis, so one SIMD instruction
+    // tests a plane of every child. For Width 4 the node is 8 RGBA32F texels:
+    // min x,y,z, max x,y,z, children and counts. The shader reads the ints with floatBitsToInt.
+    template<int Width>
+    struct WideBVHNode
+    {
+        float bboxMin[3][Width];
+        float bboxMax[3][Width];
+        int child[Width];   // inner node index, or first triangle of a leaf in the GPUBVH triangle indices
+        int count[Width];   // 0 for an inner node, triangle count of a leaf, -1 for an empty slot
+    };
+
+    // Collapse of the binary GPUBVH into Width wide nodes. Leaves keep referencing
+    // GPUBVH::bvhTriangleIndices so the triangle buffers are shared by both layouts.
+    template<int Width>
+    class WideBVH
+    {
+    public:
+        WideBVH(const GPUBVH *gpuBVH, const std::vector<VertexData>& vertexData);
+
+        // closest hit closer than t. On hit, t is updated and triIndex is the entry in GPUBVH::bvhTriangleIndices
+        bool intersect(const glm::vec3& origin, const glm::vec3& direction, float& t, int& triIndex) const;
+        // any hit closer than maxDist
+        bool occluded(const glm::vec3& origin, const glm::vec3& direction, float maxDist) const;
+
+        std::vector<WideBVHNode<Width> > nodes;
+        // levels of nodes, 1 for a root without inner children. Bounds the traversal stacks
+        int depth;
+    private:
+        const GPUBVH *gpuBVH;
+        const VertexData *vertices;
+
+        int collapse(int binaryIndex, int level);
+        template<bool AnyHit>
+        bool traverse(const glm::vec3& origin, const glm::vec3& direction, float& t, int& triIndex) const;
+    };
+}
@@ -33,6 +33,8 @@
 
 typedef float F32;
 
+namespace enki { class TaskScheduler; }
+
 struct RayStats 
 {
 	RayStats()          { clear(); }
@@ -69,12 +71,16 @@ public:
 		Stats*      stats;
 		bool        enablePrints;
 		F32         splitAlpha;     // spatial split area threshold, see Nvidia paper on SBVH by Martin Stich, usually 0.05
+		enki::TaskScheduler* taskScheduler; // when set, the BVH is built by ParallelSplitBVHBuilder
+		S32         parallelSubtreeSize;    // nodes with fewer references are built by a single task, 0 for automatic
 
 		BuildParams(void)
 		{
 			stats = NULL;
 			enablePrints = true;
 			splitAlpha = 1.0e-5f;
+			taskScheduler = NULL;
+			parallelSubtreeSize = 0;
 		}
 
 	};
@@ -0,0 +1,833 @@
+/*
+*  Copyright (c) 2009-2011, NVIDIA Corporation
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*      * Redistributions of source code must retain the above copyright
+*        notice, this list of conditions and the following disclaimer.
+*      * Redistributions in binary form must reproduce the above copyright
+*        notice, this list of conditions and the following disclaimer in the
+*        documentation and/or other materials provided with the distribution.
+*      * Neither the name of NVIDIA Corporation nor the
+*        names of its contributors may be used to endorse or promote products
+*        derived from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+*  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+*  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+*  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+*  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+*  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+*  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+*  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Same algorithm as SplitBVHBuilder, see "Spatial Splits in Bounding Volume Hierarchies" by Martin Stich, 2009.
+// Binned object split: "On fast Construction of SAH-based Bounding Volume Hierarchies" by Ingo Wald, 2007.
+
+#include "ParallelSplitBVHBuilder.h"
+#include "Sort.h"
+#include "TaskScheduler.h"
+#include <algorithm>
+
+inline float min1f3(const float& a, const float& b, const float& c){ return min1f(min1f(a, b), c); }
+
+inline int clamp1i(const int v, const int lo, const int hi){ return v < lo ? lo : v > hi ? hi : v; }
+inline float clamp1f(const float v, const float lo, const float hi){ return v < lo ? lo : v > hi ? hi : v; }
+
+inline Vec3i clamp3i(const Vec3i& v, const Vec3i& lo, const Vec3i& hi){ 
+	return Vec3i(clamp1i(v.x, lo.x, hi.x), clamp1i(v.y, lo.y, hi.y), clamp1i(v.z, lo.z, hi.z));}
+
+//------------------------------------------------------------------------
+
+ParallelSplitBVHBuilder::ParallelSplitBVHBuilder(BVH& bvh, const BVH::BuildParams& params)
+	: m_bvh(bvh),
+	m_platform(bvh.getPlatform()),
+	m_params(params),
+	m_scheduler(params.taskScheduler),
+	m_minOverlap(0.0f),
+	m_subtreeRefs(0),
+	m_numThreads(params.taskScheduler ? int(params.taskScheduler->GetNumTaskThreads()) : 1),
+	m_maxChunks(m_numThreads * 4)
+{
+	m_chunkBounds.resize(m_maxChunks);
+	m_chunkObjectBins.resize(m_maxChunks * 3 * NumObjectBins);
+	m_chunkSpatialBins.resize(m_maxChunks * 3 * NumSpatialBins);
+}
+
+//------------------------------------------------------------------------
+
+ParallelSplitBVHBuilder::~ParallelSplitBVHBuilder(void)
+{
+	for (Subtree* subtree : m_subtrees)
+		delete subtree;
+}
+
+//------------------------------------------------------------------------
+
+BVHNode* ParallelSplitBVHBuilder::run(int &numNodes)
+{
+	GPUScene* scene = m_bvh.getScene();
+	const GPUScene::Triangle* tris = scene->getTrianglePtr();
+	const Vec3f* verts = scene->getVertexPtr();
+
+	NodeSpec rootSpec;
+	rootSpec.numRef = scene->getNumTriangles();
+	m_top.refStack.resize(rootSpec.numRef);
+
+	// Initialize references and merge their bounds, one bucket per chunk.
+
+	int numChunks = parallelFor(rootSpec.numRef, BinTaskRange, m_maxChunks, [&](int begin, int end, int chunk)
+	{
+		AABB bounds;
+		for (int i = begin; i < end; i++)
+		{
+			Reference& ref = m_top.refStack[i];
+			ref.triIdx = i;
+			ref.bounds = AABB();
+			for (int j = 0; j < 3; j++)
+				ref.bounds.grow(verts[tris[i].vertices._v[j]]);
+			bounds.grow(ref.bounds);
+		}
+		m_chunkBounds[chunk] = bounds;
+	});
+
+	for (int i = 0; i < numChunks; i++)
+	{
+		if (m_chunkBounds[i].valid())
+			rootSpec.bounds.grow(m_chunkBounds[i]);
+	}
+
+	m_minOverlap = rootSpec.bounds.area() * m_params.splitAlpha;
+	m_top.rightBounds.reset(max1i(rootSpec.numRef, (int)NumSpatialBins) - 1);
+	if (!m_scheduler)
+		m_subtreeRefs = rootSpec.numRef;
+	else if (m_params.parallelSubtreeSize > 0)
+		m_subtreeRefs = m_params.parallelSubtreeSize;
+	else
+		m_subtreeRefs = max1i(4096, rootSpec.numRef / (m_numThreads * 16));
+
+	// Split the top levels until nodes are small enough for a single task.
+
+	BVHNode* root = NULL;
+	buildTopNode(rootSpec, 0, &root);
+	m_top.refStack.reset();
+	m_top.rightBounds.reset();
+
+	// Build the subtrees, largest first so the longest tasks do not start last.
+
+	std::vector<int> order(m_subtrees.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = int(i);
+	std::sort(order.begin(), order.end(), [&](int a, int b) { return m_subtrees[a]->spec.numRef > m_subtrees[b]->spec.numRef; });
+	parallelFor(int(order.size()), 1, int(order.size()), [&](int begin, int end, int chunk)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			Subtree* subtree = m_subtrees[order[i]];
+			BuildContext& ctx = subtree->context;
+			ctx.rightBounds.reset(max1i(subtree->spec.numRef, (int)NumSpatialBins) - 1);
+			subtree->root = buildNode(ctx, subtree->spec, subtree->level);
+			ctx.refStack.reset();
+			ctx.rightBounds.reset();
+		}
+	});
+
+	// Link subtrees and append their triangles in depth first, right child first order, like SplitBVHBuilder.
+
+	Array<S32>& triIndices = m_bvh.getTriIndices();
+	int numTriIndices = triIndices.getSize();
+	for (const Subtree* subtree : m_subtrees)
+		numTriIndices += subtree->context.triIndices.getSize();
+	triIndices.setCapacity(numTriIndices);
+
+	int numDuplicates = m_top.numDuplicates;
+	numNodes = m_top.numNodes;
+	for (Subtree* subtree : m_subtrees)
+	{
+		offsetLeaves(subtree->root, triIndices.getSize());
+		*subtree->slot = subtree->root;
+		triIndices.add(subtree->context.triIndices);
+		numNodes += subtree->context.numNodes;
+		numDuplicates += subtree->context.numDuplicates;
+		delete subtree;
+	}
+	const int numSubtrees = int(m_subtrees.size());
+	m_subtrees.clear();
+	triIndices.compact();
+
+	if (m_params.enablePrints)
+		printf("ParallelSplitBVHBuilder: %d subtrees on %d threads, duplicates %.0f%%\n",
+		numSubtrees, m_numThreads, (F32)numDuplicates / (F32)max1i(scene->getNumTriangles(), 1) * 100.0f);
+
+	return root;
+}
+
+//------------------------------------------------------------------------
+
+int ParallelSplitBVHBuilder::sortCompare(void* data, int idxA, int idxB)
+{
+	const BuildContext* ctx = (const BuildContext*)data;
+	int dim = ctx->sortDim;
+	const Reference& ra = ctx->refStack[idxA];
+	const Reference& rb = ctx->refStack[idxB];
+	F32 ca = ra.bounds.min()._v[dim] + ra.bounds.max()._v[dim];
+	F32 cb = rb.bounds.min()._v[dim] + rb.bounds.max()._v[dim];
+	return (ca < cb) ? -1 : (ca > cb) ? 1 : (ra.triIdx < rb.triIdx) ? -1 : (ra.triIdx > rb.triIdx) ? 1 : 0;
+}
+
+//------------------------------------------------------------------------
+
+void ParallelSplitBVHBuilder::sortSwap(void* data, int idxA, int idxB)
+{
+	BuildContext* ctx = (BuildContext*)data;
+	swap(ctx->refStack[idxA], ctx->refStack[idxB]);
+}
+
+//------------------------------------------------------------------------
+
+int ParallelSplitBVHBuilder::objectBin(const AABB& bounds, int dim, F32 origin, F32 scale)
+{
+	return clamp1i(int((bounds.min()._v[dim] + bounds.max()._v[dim] - origin) * scale), 0, NumObjectBins - 1);
+}
+
+//------------------------------------------------------------------------
+
+void ParallelSplitBVHBuilder::buildTopNode(const NodeSpec& spec, int level, BVHNode** slot)
+{
+	NodeSpec left, right;
+	if (spec.numRef <= m_subtreeRefs || !splitNode(m_top, left, right, spec, level))
+	{
+		deferSubtree(spec, level, slot);
+		return;
+	}
+
+	m_top.numNodes++;
+	InnerNode* node = new InnerNode(spec.bounds, NULL, NULL);
+	*slot = node;
+	buildTopNode(right, level + 1, &node->m_children[1]);
+	buildTopNode(left, level + 1, &node->m_children[0]);
+}
+
+//------------------------------------------------------------------------
+
+void ParallelSplitBVHBuilder::deferSubtree(const NodeSpec& spec, int level, BVHNode** slot)
+{
+	Subtree* subtree = new Subtree;
+	subtree->spec = spec;
+	subtree->level = level;
+	subtree->slot = slot;
+	subtree->root = NULL;
+
+	// move the node references from the top of the shared stack to the subtree own stack
+	Array<Reference>& refs = m_top.refStack;
+	subtree->context.refStack.set(refs.getPtr(refs.getSize() - spec.numRef), spec.numRef);
+	refs.resize(refs.getSize() - spec.numRef);
+	m_subtrees.push_back(subtree);
+}
+
+//------------------------------------------------------------------------
+
+BVHNode* ParallelSplitBVHBuilder::buildNode(BuildContext& ctx, const NodeSpec& spec, int level)
+{
+	ctx.numNodes++;
+
+	NodeSpec left, right;
+	if (!splitNode(ctx, left, right, spec, level))
+		return createLeaf(ctx, spec);
+
+	BVHNode* rightNode = buildNode(ctx, right, level + 1);
+	BVHNode* leftNode = buildNode(ctx, left, level + 1);
+	return new InnerNode(spec.bounds, leftNode, rightNode);
+}
+
+//------------------------------------------------------------------------
+
+bool ParallelSplitBVHBuilder::splitNode(BuildContext& ctx, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, int level)
+{
+	// Small enough or too deep => create leaf.
+
+	if (spec.numRef <= m_platform.getMinLeafSize() || level >= MaxDepth)
+		return false;
+
+	// Find split candidates.
+
+	F32 area = spec.bounds.area();
+	F32 leafSAH = area * m_platform.getTriangleCost(spec.numRef);
+	F32 nodeSAH = area * m_platform.getNodeCost(2);
+	ObjectSplit object = findObjectSplit(ctx, spec, nodeSAH);
+
+	SpatialSplit spatial;
+	if (level < MaxSpatialDepth)
+	{
+		AABB overlap = object.leftBounds;
+		overlap.intersect(object.rightBounds);
+		if (overlap.area() >= m_minOverlap)
+			spatial = findSpatialSplit(ctx, spec, nodeSAH);
+	}
+
+	// Leaf SAH is the lowest => create leaf.
+
+	F32 minSAH = min1f3(leafSAH, object.sah, spatial.sah);
+	if (minSAH == leafSAH && spec.numRef <= m_platform.getMaxLeafSize())
+		return false;
+
+	// Leaf SAH is not the lowest => Perform spatial split.
+
+	if (minSAH == spatial.sah)
+		performSpatialSplit(ctx, left, right, spec, spatial);
+
+	if (!left.numRef || !right.numRef)
+		performObjectSplit(ctx, left, right, spec, object);
+
+	ctx.numDuplicates += left.numRef + right.numRef - spec.numRef;
+	return true;
+}
+
+//------------------------------------------------------------------------
+
+BVHNode* ParallelSplitBVHBuilder::createLeaf(BuildContext& ctx, const NodeSpec& spec)
+{
+	Array<S32>& tris = ctx.triIndices;
+
+	for (int i = 0; i < spec.numRef; i++)
+		tris.add(ctx.refStack.removeLast().triIdx);
+
+	return new LeafNode(spec.bounds, tris.getSize() - spec.numRef, tris.getSize());
+}
+
+//------------------------------------------------------------------------
+
+ParallelSplitBVHBuilder::ObjectSplit ParallelSplitBVHBuilder::findObjectSplit(BuildContext& ctx, const NodeSpec& spec, F32 nodeSAH)
+{
+	if (spec.numRef >= MinBinnedObjectRefs)
+	{
+		ObjectSplit split = findBinnedObjectSplit(ctx, spec, nodeSAH);
+		if (split.sah < FW_F32_MAX)
+			return split;
+		// all centroids in the same bin, fall back to the sorted sweep
+	}
+
+	ObjectSplit split;
+	const Reference* refPtr = ctx.refStack.getPtr(ctx.refStack.getSize() - spec.numRef);
+
+	// Sort along each dimension.
+
+	for (ctx.sortDim = 0; ctx.sortDim < 3; ctx.sortDim++)
+	{
+		Sort(ctx.refStack.getSize() - spec.numRef, ctx.refStack.getSize(), &ctx, sortCompare, sortSwap);
+
+		// Sweep right to left and determine bounds.
+
+		AABB rightBounds;
+		for (int i = spec.numRef - 1; i > 0; i--)
+		{
+			rightBounds.grow(refPtr[i].bounds);
+			ctx.rightBounds[i - 1] = rightBounds;
+		}
+
+		// Sweep left to right and select lowest SAH.
+
+		AABB leftBounds;
+		for (int i = 1; i < spec.numRef; i++)
+		{
+			leftBounds.grow(refPtr[i - 1].bounds);
+			F32 sah = nodeSAH + leftBounds.area() * m_platform.getTriangleCost(i) + ctx.rightBounds[i - 1].area() * m_platform.getTriangleCost(spec.numRef - i);
+			if (sah < split.sah)
+			{
+				split.sah = sah;
+				split.sortDim = ctx.sortDim;
+				split.numLeft = i;
+				split.leftBounds = leftBounds;
+				split.rightBounds = ctx.rightBounds[i - 1];
+			}
+		}
+	}
+	return split;
+}
+
+//------------------------------------------------------------------------
+
+ParallelSplitBVHBuilder::ObjectSplit ParallelSplitBVHBuilder::findBinnedObjectSplit(BuildContext& ctx, const NodeSpec& spec, F32 nodeSAH)
+{
+	const Reference* refs = ctx.refStack.getPtr(ctx.refStack.getSize() - spec.numRef);
+	const bool tasks = useTasks(ctx, spec.numRef);
+
+	// Bounds of the centroids, kept doubled (min + max) like the sort key.
+
+	AABB centroidBounds;
+	if (tasks)
+	{
+		int numChunks = parallelFor(spec.numRef, BinTaskRange, m_maxChunks, [&](int begin, int end, int chunk)
+		{
+			AABB bounds;
+			for (int i = begin; i < end; i++)
+				bounds.grow(refs[i].bounds.min() + refs[i].bounds.max());
+			m_chunkBounds[chunk] = bounds;
+		});
+
+		for (int i = 0; i < numChunks; i++)
+			centroidBounds.grow(m_chunkBounds[i]);
+	}
+	else
+	{
+		for (int i = 0; i < spec.numRef; i++)
+			centroidBounds.grow(refs[i].bounds.min() + refs[i].bounds.max());
+	}
+
+	Vec3f origin = centroidBounds.min();
+	Vec3f extent = centroidBounds.max() - origin;
+	F32 scale[3];
+	for (int dim = 0; dim < 3; dim++)
+		scale[dim] = (extent._v[dim] > 0.0f) ? (F32)NumObjectBins / extent._v[dim] : 0.0f;
+
+	// Count references and grow bounds per centroid bin.
+
+	ObjectBin bins[3][NumObjectBins];
+	auto fillBins = [&](ObjectBin* dst, int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			for (int dim = 0; dim < 3; dim++)
+			{
+				if (scale[dim] == 0.0f)
+					continue;
+				ObjectBin& bin = dst[dim * NumObjectBins + objectBin(refs[i].bounds, dim, origin._v[dim], scale[dim])];
+				bin.bounds.grow(refs[i].bounds);
+				bin.count++;
+			}
+		}
+	};
+
+	for (int dim = 0; dim < 3; dim++)
+	{
+		for (int i = 0; i < NumObjectBins; i++)
+		{
+			bins[dim][i].bounds = AABB();
+			bins[dim][i].count = 0;
+		}
+	}
+
+	if (tasks)
+	{
+		int numChunks = parallelFor(spec.numRef, BinTaskRange, m_maxChunks, [&](int begin, int end, int chunk)
+		{
+			ObjectBin* chunkBins = &m_chunkObjectBins[chunk * 3 * NumObjectBins];
+			for (int i = 0; i < 3 * NumObjectBins; i++)
+			{
+				chunkBins[i].bounds = AABB();
+				chunkBins[i].count = 0;
+			}
+			fillBins(chunkBins, begin, end);
+		});
+
+		for (int chunk = 0; chunk < numChunks; chunk++)
+		{
+			const ObjectBin* chunkBins = &m_chunkObjectBins[chunk * 3 * NumObjectBins];
+			for (int i = 0; i < 3 * NumObjectBins; i++)
+			{
+				if (!chunkBins[i].count)
+					continue;
+				ObjectBin& bin = bins[i / NumObjectBins][i % NumObjectBins];
+				bin.bounds.grow(chunkBins[i].bounds);
+				bin.count += chunkBins[i].count;
+			}
+		}
+	}
+	else
+	{
+		fillBins(&bins[0][0], 0, spec.numRef);
+	}
+
+	// Select best split plane, empty bins are skipped so they do not grow the bounds.
+
+	ObjectSplit split;
+	for (int dim = 0; dim < 3; dim++)
+	{
+		if (scale[dim] == 0.0f)
+			continue;
+
+		AABB rightBounds[NumObjectBins - 1];
+		AABB bounds;
+		for (int i = NumObjectBins - 1; i > 0; i--)
+		{
+			if (bins[dim][i].count)
+				bounds.grow(bins[dim][i].bounds);
+			rightBounds[i - 1] = bounds;
+		}
+
+		AABB leftBounds;
+		int leftNum = 0;
+		for (int i = 1; i < NumObjectBins; i++)
+		{
+			if (bins[dim][i - 1].count)
+			{
+				leftBounds.grow(bins[dim][i - 1].bounds);
+				leftNum += bins[dim][i - 1].count;
+			}
+			if (!leftNum || leftNum == spec.numRef)
+				continue;
+
+			F32 sah = nodeSAH + leftBounds.area() * m_platform.getTriangleCost(leftNum) + rightBounds[i - 1].area() * m_platform.getTriangleCost(spec.numRef - leftNum);
+			if (sah < split.sah)
+			{
+				split.sah = sah;
+				split.sortDim = dim;
+				split.numLeft = leftNum;
+				split.leftBounds = leftBounds;
+				split.rightBounds = rightBounds[i - 1];
+				split.binned = true;
+				split.splitBin = i;
+				split.binOrigin = origin._v[dim];
+				split.binScale = scale[dim];
+			}
+		}
+	}
+	return split;
+}
+
+//------------------------------------------------------------------------
+
+void ParallelSplitBVHBuilder::performObjectSplit(BuildContext& ctx, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const ObjectSplit& split)
+{
+	if (split.binned)
+	{
+		// Partition: references of the bins before splitBin go to the left-hand side.
+
+		Reference* refs = ctx.refStack.getPtr(ctx.refStack.getSize() - spec.numRef);
+		int leftEnd = 0;
+		int rightStart = spec.numRef;
+		while (leftEnd < rightStart)
+		{
+			if (objectBin(refs[leftEnd].bounds, split.sortDim, split.binOrigin, split.binScale) < split.splitBin)
+				leftEnd++;
+			else
+				swap(refs[leftEnd], refs[--rightStart]);
+		}
+		FW_ASSERT(leftEnd == split.numLeft);
+	}
+	else
+	{
+		ctx.sortDim = split.sortDim;
+		Sort(ctx.refStack.getSize() - spec.numRef, ctx.refStack.getSize(), &ctx, sortCompare, sortSwap);
+	}
+
+	left.numRef = split.numLeft;
+	left.bounds = split.leftBounds;
+	right.numRef = spec.numRef - split.numLeft;
+	right.bounds = split.rightBounds;
+}
+
+//------------------------------------------------------------------------
+
+ParallelSplitBVHBuilder::SpatialSplit ParallelSplitBVHBuilder::findSpatialSplit(BuildContext& ctx, const NodeSpec& spec, F32 nodeSAH)
+{
+	// Initialize bins.
+
+	Vec3f origin = spec.bounds.min();
+	Vec3f binSize = (spec.bounds.max() - origin) * (1.0f / (F32)NumSpatialBins);
+	Vec3f invBinSize = Vec3f(1.0f / binSize.x, 1.0f / binSize.y, 1.0f / binSize.z);
+
+	for (int dim = 0; dim < 3; dim++)
+	{
+		for (int i = 0; i < NumSpatialBins; i++)
+		{
+			SpatialBin& bin = ctx.bins[dim][i];
+			bin.bounds = AABB();
+			bin.enter = 0;
+			bin.exit = 0;
+		}
+	}
+
+	// Chop references into bins. Bin bounds only grow, so merging per chunk bins gives the serial result.
+
+	const Reference* refs = ctx.refStack.getPtr(ctx.refStack.getSize() - spec.numRef);
+	if (useTasks(ctx, spec.numRef))
+	{
+		int numChunks = parallelFor(spec.numRef, BinTaskRange, m_maxChunks, [&](int begin, int end, int chunk)
+		{
+			SpatialBin* chunkBins = &m_chunkSpatialBins[chunk * 3 * NumSpatialBins];
+			for (int i = 0; i < 3 * NumSpatialBins; i++)
+			{
+				chunkBins[i].bounds = AABB();
+				chunkBins[i].enter = 0;
+				chunkBins[i].exit = 0;
+			}
+			binReferences((SpatialBin (*)[NumSpatialBins])chunkBins, refs + begin, end - begin, origin, binSize, invBinSize);
+		});
+
+		for (int chunk = 0; chunk < numChunks; chunk++)
+		{
+			const SpatialBin* chunkBins = &m_chunkSpatialBins[chunk * 3 * NumSpatialBins];
+			for (int i = 0; i < 3 * NumSpatialBins; i++)
+			{
+				SpatialBin& bin = ctx.bins[i / NumSpatialBins][i % NumSpatialBins];
+				if (chunkBins[i].bounds.valid())
+					bin.bounds.grow(chunkBins[i].bounds);
+				bin.enter += chunkBins[i].enter;
+				bin.exit += chunkBins[i].exit;
+			}
+		}
+	}
+	else
+	{
+		binReferences(ctx.bins, refs, spec.numRef, origin, binSize, invBinSize);
+	}
+
+	// Select best split plane.
+
+	SpatialSplit split;
+	for (int dim = 0; dim < 3; dim++)
+	{
+		// Sweep right to left and determine bounds.
+
+		AABB rightBounds;
+		for (int i = NumSpatialBins - 1; i > 0; i--)
+		{
+			rightBounds.grow(ctx.bins[dim][i].bounds);
+			ctx.rightBounds[i - 1] = rightBounds;
+		}
+
+		// Sweep left to right and select lowest SAH.
+
+		AABB leftBounds;
+		int leftNum = 0;
+		int rightNum = spec.numRef;
+
+		for (int i = 1; i < NumSpatialBins; i++)
+		{
+			leftBounds.grow(ctx.bins[dim][i - 1].bounds);
+			leftNum += ctx.bins[dim][i - 1].enter;
+			rightNum -= ctx.bins[dim][i - 1].exit;
+
+			F32 sah = nodeSAH + leftBounds.area() * m_platform.getTriangleCost(leftNum) + ctx.rightBounds[i - 1].area() * m_platform.getTriangleCost(rightNum);
+			if (sah < split.sah)
+			{
+				split.sah = sah;
+				split.dim = dim;
+				split.pos = origin._v[dim] + binSize._v[dim] * (F32)i;
+			}
+		}
+	}
+	return split;
+}
+
+//------------------------------------------------------------------------
+
+void ParallelSplitBVHBuilder::binReferences(SpatialBin (*bins)[NumSpatialBins], const Reference* refs, int count, const Vec3f& origin, const Vec3f& binSize, const Vec3f& invBinSize)
+{
+	for (int refIdx = 0; refIdx < count; refIdx++)
+	{
+		const Reference& ref = refs[refIdx];
+
+		Vec3i firstBin = clamp3i(Vec3i((ref.bounds.min() - origin) * invBinSize), Vec3i(0, 0, 0), Vec3i(NumSpatialBins - 1, NumSpatialBins - 1, NumSpatialBins - 1));
+		Vec3i lastBin = clamp3i(Vec3i((ref.bounds.max() - origin) * invBinSize), firstBin, Vec3i(NumSpatialBins - 1, NumSpatialBins - 1, NumSpatialBins - 1));
+
+		for (int dim = 0; dim < 3; dim++)
+		{
+			Reference currRef = ref;
+			for (int i = firstBin._v[dim]; i < lastBin._v[dim]; i++)
+			{
+				Reference leftRef, rightRef;
+				splitReference(leftRef, rightRef, currRef, dim, origin._v[dim] + binSize._v[dim] * (F32)(i + 1));
+				bins[dim][i].bounds.grow(leftRef.bounds);
+				currRef = rightRef;
+			}
+			bins[dim][lastBin._v[dim]].bounds.grow(currRef.bounds);
+			bins[dim][firstBin._v[dim]].enter++;
+			bins[dim][lastBin._v[dim]].exit++;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+
+void ParallelSplitBVHBuilder::performSpatialSplit(BuildContext& ctx, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const SpatialSplit& split)
+{
+	// Categorize references and compute bounds.
+	//
+	// Left-hand side:      [leftStart, leftEnd[
+	// Uncategorized/split: [leftEnd, rightStart[
+	// Right-hand side:     [rightStart, refs.getSize()[
+
+	Array<Reference>& refs = ctx.refStack;
+	int leftStart = refs.getSize() - spec.numRef;
+	int leftEnd = leftStart;
+	int rightStart = refs.getSize();
+	left.bounds = right.bounds = AABB();
+
+	for (int i = leftEnd; i < rightStart; i++)
+	{
+		// Entirely on the left-hand side?
+
+		if (refs[i].bounds.max()._v[split.dim] <= split.pos)
+		{
+			left.bounds.grow(refs[i].bounds);
+			swap(refs[i], refs[leftEnd++]);
+		}
+
+		// Entirely on the right-hand side?
+
+		else if (refs[i].bounds.min()._v[split.dim] >= split.pos)
+		{
+			right.bounds.grow(refs[i].bounds);
+			swap(refs[i--], refs[--rightStart]);
+		}
+	}
+
+	// Duplicate or unsplit references intersecting both sides.
+
+	while (leftEnd < rightStart)
+	{
+		// Split reference.
+
+		Reference lref, rref;
+		splitReference(lref, rref, refs[leftEnd], split.dim, split.pos);
+
+		// Compute SAH for duplicate/unsplit candidates.
+
+		AABB lub = left.bounds;  // Unsplit to left:     new left-hand bounds.
+		AABB rub = right.bounds; // Unsplit to right:    new right-hand bounds.
+		AABB ldb = left.bounds;  // Duplicate:           new left-hand bounds.
+		AABB rdb = right.bounds; // Duplicate:           new right-hand bounds.
+		lub.grow(refs[leftEnd].bounds);
+		rub.grow(refs[leftEnd].bounds);
+		ldb.grow(lref.bounds);
+		rdb.grow(rref.bounds);
+
+		F32 lac = m_platform.getTriangleCost(leftEnd - leftStart);
+		F32 rac = m_platform.getTriangleCost(refs.getSize() - rightStart);
+		F32 lbc = m_platform.getTriangleCost(leftEnd - leftStart + 1);
+		F32 rbc = m_platform.getTriangleCost(refs.getSize() - rightStart + 1);
+
+		F32 unsplitLeftSAH = lub.area() * lbc + right.bounds.area() * rac;
+		F32 unsplitRightSAH = left.bounds.area() * lac + rub.area() * rbc;
+		F32 duplicateSAH = ldb.area() * lbc + rdb.area() * rbc;
+		F32 minSAH = min1f3(unsplitLeftSAH, unsplitRightSAH, duplicateSAH);
+
+		// Unsplit to left?
+
+		if (minSAH == unsplitLeftSAH)
+		{
+			left.bounds = lub;
+			leftEnd++;
+		}
+
+		// Unsplit to right?
+
+		else if (minSAH == unsplitRightSAH)
+		{
+			right.bounds = rub;
+			swap(refs[leftEnd], refs[--rightStart]);
+		}
+
+		// Duplicate?
+
+		else
+		{
+			left.bounds = ldb;
+			right.bounds = rdb;
+			refs[leftEnd++] = lref;
+			refs.add(rref);
+		}
+	}
+
+	left.numRef = leftEnd - leftStart;
+	right.numRef = refs.getSize() - rightStart;
+}
+
+//------------------------------------------------------------------------
+
+void ParallelSplitBVHBuilder::splitReference(Reference& left, Reference& right, const Reference& ref, int dim, F32 pos)
+{
+	// Initialize references.
+
+	left.triIdx = right.triIdx = ref.triIdx;
+	left.bounds = right.bounds = AABB();
+
+	// Loop over vertices/edges.
+
+	const Vec3i& inds = m_bvh.getScene()->getTriangle(ref.triIdx).vertices;
+	const Vec3f* verts = m_bvh.getScene()->getVertexPtr();
+	const Vec3f* v1 = &verts[inds.z];
+
+	for (int i = 0; i < 3; i++)
+	{
+		const Vec3f* v0 = v1;
+		v1 = &verts[inds._v[i]];
+		F32 v0p = (*v0)._v[dim];
+		F32 v1p = (*v1)._v[dim];
+
+		// Insert vertex to the boxes it belongs to.
+
+		if (v0p <= pos)
+			left.bounds.grow(*v0);
+		if (v0p >= pos)
+			right.bounds.grow(*v0);
+
+		// Edge intersects the plane => insert intersection to both boxes.
+
+		if ((v0p < pos && v1p > pos) || (v0p > pos && v1p < pos))
+		{
+			Vec3f t = lerp(*v0, *v1, clamp1f((pos - v0p) / (v1p - v0p), 0.0f, 1.0f));
+			left.bounds.grow(t);
+			right.bounds.grow(t);
+		}
+	}
+
+	// Intersect with original bounds.
+
+	left.bounds.max()._v[dim] = pos;
+	right.bounds.min()._v[dim] = pos;
+	left.bounds.intersect(ref.bounds);
+	right.bounds.intersect(ref.bounds);
+}
+
+//------------------------------------------------------------------------
+
+int ParallelSplitBVHBuilder::parallelFor(int count, int minRange, int maxChunks, const std::function<void(int begin, int end, int chunk)>& func)
+{
+	if (count <= 0)
+		return 0;
+
+	// chunks are fixed so buckets indexed by chunk do not depend on the threads picking them
+	int numChunks = m_scheduler ? clamp1i(count / max1i(minRange, 1), 1, max1i(maxChunks, 1)) : 1;
+	if (numChunks == 1)
+	{
+		func(0, count, 0);
+		return 1;
+	}
+
+	enki::TaskSet task(U32(numChunks), [&](enki::TaskSetPartition range, uint32_t threadnum)
+	{
+		for (U32 chunk = range.start; chunk < range.end; chunk++)
+			func(int((long long)count * chunk / numChunks), int((long long)count * (chunk + 1) / numChunks), int(chunk));
+	});
+	m_scheduler->AddTaskSetToPipe(&task);
+	m_scheduler->WaitforTask(&task);
+	return numChunks;
+}
+
+//------------------------------------------------------------------------
+
+void ParallelSplitBVHBuilder::offsetLeaves(BVHNode* node, int offset)
+{
+	if (!offset)
+		return;
+
+	if (node->isLeaf())
+	{
+		LeafNode* leaf = static_cast<LeafNode*>(node);
+		leaf->m_lo += offset;
+		leaf->m_hi += offset;
+		return;
+	}
+
+	for (int i = 0; i < node->getNumChildNodes(); i++)
+		offsetLeaves(node->getChildNode(i), offset);
+}
+
+//------------------------------------------------------------------------
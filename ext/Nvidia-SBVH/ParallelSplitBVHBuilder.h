@@ -0,0 +1,183 @@
+/*
+*  Copyright (c) 2009-2011, NVIDIA Corporation
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions are met:
+*      * Redistributions of source code must retain the above copyright
+*        notice, this list of conditions and the following disclaimer.
+*      * Redistributions in binary form must reproduce the above copyright
+*        notice, this list of conditions and the following disclaimer in the
+*        documentation and/or other materials provided with the distribution.
+*      * Neither the name of NVIDIA Corporation nor the
+*        names of its contributors may be used to endorse or promote products
+*        derived from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+*  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+*  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+*  DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+*  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+*  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+*  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+*  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+#include "BVH.h"
+#include <functional>
+#include <vector>
+
+namespace enki { class TaskScheduler; }
+
+// Multi-threaded variant of SplitBVHBuilder producing the same BVHNode tree and triangle index layout.
+// The top levels are split by the calling thread, with the object and spatial bins of large nodes filled
+// in parallel. Nodes below BuildParams::parallelSubtreeSize references are then built concurrently, one
+// enkiTS task per subtree, and stitched back in the order the serial builder would have emitted them.
+// Large nodes use a binned object split (NumObjectBins centroid bins) instead of the sorted sweep.
+class ParallelSplitBVHBuilder
+{
+private:
+	enum
+	{
+		MaxDepth = 64,
+		MaxSpatialDepth = 48,
+		NumSpatialBins = 32,
+		NumObjectBins = 32,
+		MinBinnedObjectRefs = 1024,     // smaller nodes use the exact sorted sweep
+		MinParallelBinRefs = 16384,     // smaller nodes are binned by the calling thread alone
+		BinTaskRange = 4096,
+	};
+
+	struct Reference
+	{
+		S32                 triIdx;
+		AABB                bounds;
+
+		Reference(void) : triIdx(-1) {}
+	};
+
+	struct NodeSpec
+	{
+		S32                 numRef;
+		AABB                bounds;
+
+		NodeSpec(void) : numRef(0) {}
+	};
+
+	struct ObjectSplit
+	{
+		F32                 sah;
+		S32                 sortDim;
+		S32                 numLeft;
+		AABB                leftBounds;
+		AABB                rightBounds;
+		bool                binned;     // partition by centroid bin instead of sorting
+		S32                 splitBin;
+		F32                 binOrigin;
+		F32                 binScale;
+
+		ObjectSplit(void) : sah(FW_F32_MAX), sortDim(0), numLeft(0), binned(false), splitBin(0), binOrigin(0.0f), binScale(0.0f) {}
+	};
+
+	struct SpatialSplit
+	{
+		F32                 sah;
+		S32                 dim;
+		F32                 pos;
+
+		SpatialSplit(void) : sah(FW_F32_MAX), dim(0), pos(0.0f) {}
+	};
+
+	struct SpatialBin
+	{
+		AABB                bounds;
+		S32                 enter;
+		S32                 exit;
+	};
+
+	struct ObjectBin
+	{
+		AABB                bounds;
+		S32                 count;
+	};
+
+	// state of one building thread, the references of the node being built are on top of refStack
+	struct BuildContext
+	{
+		Array<Reference>    refStack;
+		Array<AABB>         rightBounds;
+		Array<S32>          triIndices;
+		SpatialBin          bins[3][NumSpatialBins];
+		S32                 sortDim;
+		S32                 numNodes;
+		S32                 numDuplicates;
+
+		BuildContext(void) : sortDim(-1), numNodes(0), numDuplicates(0) {}
+	};
+
+	// node deferred to a task, its tree is linked into *slot once built
+	struct Subtree
+	{
+		NodeSpec            spec;
+		S32                 level;
+		BVHNode**           slot;
+		BVHNode*            root;
+		BuildContext        context;
+	};
+
+public:
+	ParallelSplitBVHBuilder(BVH& bvh, const BVH::BuildParams& params);
+	~ParallelSplitBVHBuilder(void);
+
+	BVHNode*                run(int &numNodes);
+
+private:
+	static int              sortCompare(void* data, int idxA, int idxB);
+	static void             sortSwap(void* data, int idxA, int idxB);
+
+	void                    buildTopNode(const NodeSpec& spec, int level, BVHNode** slot);
+	void                    deferSubtree(const NodeSpec& spec, int level, BVHNode** slot);
+	BVHNode*                buildNode(BuildContext& ctx, const NodeSpec& spec, int level);
+	BVHNode*                createLeaf(BuildContext& ctx, const NodeSpec& spec);
+	bool                    splitNode(BuildContext& ctx, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, int level);
+
+	ObjectSplit             findObjectSplit(BuildContext& ctx, const NodeSpec& spec, F32 nodeSAH);
+	ObjectSplit             findBinnedObjectSplit(BuildContext& ctx, const NodeSpec& spec, F32 nodeSAH);
+	void                    performObjectSplit(BuildContext& ctx, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const ObjectSplit& split);
+
+	SpatialSplit            findSpatialSplit(BuildContext& ctx, const NodeSpec& spec, F32 nodeSAH);
+	void                    binReferences(SpatialBin (*bins)[NumSpatialBins], const Reference* refs, int count, const Vec3f& origin, const Vec3f& binSize, const Vec3f& invBinSize);
+	void                    performSpatialSplit(BuildContext& ctx, NodeSpec& left, NodeSpec& right, const NodeSpec& spec, const SpatialSplit& split);
+	void                    splitReference(Reference& left, Reference& right, const Reference& ref, int dim, F32 pos);
+
+	bool                    useTasks(const BuildContext& ctx, int numRef) const { return m_scheduler && &ctx == &m_top && numRef >= MinParallelBinRefs; }
+	// returns the number of chunks [begin, end[ the range was cut into, each runs as one task
+	int                     parallelFor(int count, int minRange, int maxChunks, const std::function<void(int begin, int end, int chunk)>& func);
+	static int              objectBin(const AABB& bounds, int dim, F32 origin, F32 scale);
+	static void             offsetLeaves(BVHNode* node, int offset);
+
+private:
+	ParallelSplitBVHBuilder(const ParallelSplitBVHBuilder&); // forbidden
+	ParallelSplitBVHBuilder& operator=      (const ParallelSplitBVHBuilder&); // forbidden
+
+private:
+	BVH&                    m_bvh;
+	const Platform&         m_platform;
+	const BVH::BuildParams& m_params;
+	enki::TaskScheduler*    m_scheduler;
+
+	F32                     m_minOverlap;
+	S32                     m_subtreeRefs;
+	BuildContext            m_top;
+	std::vector<Subtree*>   m_subtrees;
+	S32                     m_numThreads;
+	S32                     m_maxChunks;
+
+	// per chunk buckets for parallel binning, merged once the chunks are done
+	std::vector<AABB>       m_chunkBounds;
+	std::vector<ObjectBin>  m_chunkObjectBins;
+	std::vector<SpatialBin> m_chunkSpatialBins;
+};
@@ -22,6 +22,21 @@
 
 #include <thread> // C++11
 #include <mutex>  // C++11
+#include <atomic> // C++11
+
+#if CMFT_ARCH_64BIT || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define CMFT_SIMD_X86 1
+    #include <immintrin.h>
+    #if CMFT_COMPILER_MSVC
+        #include <intrin.h>
+        // MSVC accepts AVX intrinsics without /arch, they are only reached after a cpuid check.
+        #define CMFT_TARGET_AVX2
+    #else
+        #define CMFT_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif // CMFT_COMPILER_MSVC
+#else
+    #define CMFT_SIMD_X86 0
+#endif
 
 #define CMFT_COMPUTE_FILTER_AREA_ON_CPU 1
 
@@ -772,6 +787,690 @@ namespace cmft
         return mem;
     }
 
+    /// Accumulates the filter weighted color of _count consecutive texels of a face row.
+    /// _sum is { r*w, g*w, b*w, w }. Texels and normals are 4 floats each.
+    typedef void (*RadianceRowFn)(float _sum[4]
+                                , const float* _normals
+                                , const float* _data
+                                , uint32_t _count
+                                , const float* _tapVec
+                                , float _specularPower
+                                , float _specularAngle
+                                );
+
+    static void radianceRowRef(float _sum[4]
+                             , const float* _normals
+                             , const float* _data
+                             , uint32_t _count
+                             , const float* _tapVec
+                             , float _specularPower
+                             , float _specularAngle
+                             )
+    {
+        for (uint32_t ii = 0; ii < _count; ++ii, _normals += 4, _data += 4)
+        {
+            const float dotProduct = vec3Dot(_normals, _tapVec);
+
+            if (dotProduct >= _specularAngle)
+            {
+                const float solidAngle = _normals[3];
+                const float weight = solidAngle * powf(dotProduct, _specularPower);
+
+                _sum[0] += _data[0] * weight;
+                _sum[1] += _data[1] * weight;
+                _sum[2] += _data[2] * weight;
+                _sum[3] += weight;
+            }
+        }
+    }
+
+#if CMFT_SIMD_X86
+    // pow(x, a) = exp(a*log(x)) for x > 0 with Cephes polynomials, about 1e-7 relative error.
+    // Lanes with x <= 0 return garbage and must be masked by the caller.
+    static inline __m128 powSse2(__m128 _x, __m128 _a)
+    {
+        const __m128 one = _mm_set1_ps(1.0f);
+
+        // log(x), x = m*2^e with m in [sqrt(0.5), sqrt(2)[.
+        const __m128i bits = _mm_castps_si128(_x);
+        __m128 ee = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(126)));
+        __m128 mm = _mm_or_ps(_mm_and_ps(_x, _mm_castsi128_ps(_mm_set1_epi32(0x007fffff))), _mm_set1_ps(0.5f));
+        const __m128 lessSqrtHf = _mm_cmplt_ps(mm, _mm_set1_ps(0.707106781186547524f));
+        ee = _mm_sub_ps(ee, _mm_and_ps(lessSqrtHf, one));
+        mm = _mm_add_ps(_mm_sub_ps(mm, one), _mm_and_ps(lessSqrtHf, mm));
+
+        const __m128 zz = _mm_mul_ps(mm, mm);
+        __m128 yy = _mm_set1_ps(7.0376836292e-2f);
+        yy = _mm_add_ps(_mm_mul_ps(yy, mm), _mm_set1_ps(-1.1514610310e-1f));
+        yy = _mm_add_ps(_mm_mul_ps(yy, mm), _mm_set1_ps( 1.1676998740e-1f));
+        yy = _mm_add_ps(_mm_mul_ps(yy, mm), _mm_set1_ps(-1.2420140846e-1f));
+        yy = _mm_add_ps(_mm_mul_ps(yy, mm), _mm_set1_ps( 1.4249322787e-1f));
+        yy = _mm_add_ps(_mm_mul_ps(yy, mm), _mm_set1_ps(-1.6668057665e-1f));
+        yy = _mm_add_ps(_mm_mul_ps(yy, mm), _mm_set1_ps( 2.0000714765e-1f));
+        yy = _mm_add_ps(_mm_mul_ps(yy, mm), _mm_set1_ps(-2.4999993993e-1f));
+        yy = _mm_add_ps(_mm_mul_ps(yy, mm), _mm_set1_ps( 3.3333331174e-1f));
+        yy = _mm_mul_ps(_mm_mul_ps(yy, mm), zz);
+        yy = _mm_add_ps(yy, _mm_mul_ps(ee, _mm_set1_ps(-2.12194440e-4f)));
+        yy = _mm_sub_ps(yy, _mm_mul_ps(zz, _mm_set1_ps(0.5f)));
+        const __m128 logx = _mm_add_ps(_mm_add_ps(mm, yy), _mm_mul_ps(ee, _mm_set1_ps(0.693359375f)));
+
+        // exp(a*log(x)), lower bound keeps 2^n a normal float.
+        __m128 xx = _mm_mul_ps(_a, logx);
+        xx = _mm_max_ps(_mm_min_ps(xx, _mm_set1_ps(88.3762626647949f)), _mm_set1_ps(-87.0f));
+
+        __m128 fx = _mm_add_ps(_mm_mul_ps(xx, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f));
+        const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+        fx = _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, fx), one));
+
+        xx = _mm_sub_ps(xx, _mm_mul_ps(fx, _mm_set1_ps(0.693359375f)));
+        xx = _mm_sub_ps(xx, _mm_mul_ps(fx, _mm_set1_ps(-2.12194440e-4f)));
+
+        const __m128 xx2 = _mm_mul_ps(xx, xx);
+        __m128 ex = _mm_set1_ps(1.9875691500e-4f);
+        ex = _mm_add_ps(_mm_mul_ps(ex, xx), _mm_set1_ps(1.3981999507e-3f));
+        ex = _mm_add_ps(_mm_mul_ps(ex, xx), _mm_set1_ps(8.3334519073e-3f));
+        ex = _mm_add_ps(_mm_mul_ps(ex, xx), _mm_set1_ps(4.1665795894e-2f));
+        ex = _mm_add_ps(_mm_mul_ps(ex, xx), _mm_set1_ps(1.6666665459e-1f));
+        ex = _mm_add_ps(_mm_mul_ps(ex, xx), _mm_set1_ps(5.0000001201e-1f));
+        ex = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, xx2), xx), one);
+
+        const __m128i pow2n = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(127)), 23);
+        return _mm_mul_ps(ex, _mm_castsi128_ps(pow2n));
+    }
+
+    static void radianceRowSse2(float _sum[4]
+                              , const float* _normals
+                              , const float* _data
+                              , uint32_t _count
+                              , const float* _tapVec
+                              , float _specularPower
+                              , float _specularAngle
+                              )
+    {
+        const __m128 tapX  = _mm_set1_ps(_tapVec[0]);
+        const __m128 tapY  = _mm_set1_ps(_tapVec[1]);
+        const __m128 tapZ  = _mm_set1_ps(_tapVec[2]);
+        const __m128 power = _mm_set1_ps(_specularPower);
+        const __m128 angle = _mm_set1_ps(_specularAngle);
+
+        __m128 sumR = _mm_setzero_ps();
+        __m128 sumG = _mm_setzero_ps();
+        __m128 sumB = _mm_setzero_ps();
+        __m128 sumW = _mm_setzero_ps();
+
+        uint32_t ii = 0;
+        for (; ii + 4 <= _count; ii += 4, _normals += 16, _data += 16)
+        {
+            // 4 texels to structure of arrays.
+            __m128 nx = _mm_loadu_ps(_normals);
+            __m128 ny = _mm_loadu_ps(_normals + 4);
+            __m128 nz = _mm_loadu_ps(_normals + 8);
+            __m128 sa = _mm_loadu_ps(_normals + 12);
+            _MM_TRANSPOSE4_PS(nx, ny, nz, sa);
+
+            const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, tapX), _mm_mul_ps(ny, tapY)), _mm_mul_ps(nz, tapZ));
+            const __m128 inside = _mm_cmpge_ps(dot, angle);
+            if (0 == _mm_movemask_ps(inside))
+            {
+                continue;
+            }
+            const __m128 weight = _mm_and_ps(inside, _mm_mul_ps(sa, powSse2(dot, power)));
+
+            __m128 rr = _mm_loadu_ps(_data);
+            __m128 gg = _mm_loadu_ps(_data + 4);
+            __m128 bb = _mm_loadu_ps(_data + 8);
+            __m128 aa = _mm_loadu_ps(_data + 12);
+            _MM_TRANSPOSE4_PS(rr, gg, bb, aa);
+
+            sumR = _mm_add_ps(sumR, _mm_mul_ps(rr, weight));
+            sumG = _mm_add_ps(sumG, _mm_mul_ps(gg, weight));
+            sumB = _mm_add_ps(sumB, _mm_mul_ps(bb, weight));
+            sumW = _mm_add_ps(sumW, weight);
+        }
+
+        _MM_TRANSPOSE4_PS(sumR, sumG, sumB, sumW);
+        float lanes[4];
+        _mm_storeu_ps(lanes, _mm_add_ps(_mm_add_ps(sumR, sumG), _mm_add_ps(sumB, sumW)));
+        _sum[0] += lanes[0];
+        _sum[1] += lanes[1];
+        _sum[2] += lanes[2];
+        _sum[3] += lanes[3];
+
+        radianceRowRef(_sum, _normals, _data, _count - ii, _tapVec, _specularPower, _specularAngle);
+    }
+
+    // Same as powSse2, 8 lanes.
+    CMFT_TARGET_AVX2 static inline __m256 powAvx2(__m256 _x, __m256 _a)
+    {
+        const __m256 one = _mm256_set1_ps(1.0f);
+
+        const __m256i bits = _mm256_castps_si256(_x);
+        __m256 ee = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+        __m256 mm = _mm256_or_ps(_mm256_and_ps(_x, _mm256_castsi256_ps(_mm256_set1_epi32(0x007fffff))), _mm256_set1_ps(0.5f));
+        const __m256 lessSqrtHf = _mm256_cmp_ps(mm, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+        ee = _mm256_sub_ps(ee, _mm256_and_ps(lessSqrtHf, one));
+        mm = _mm256_add_ps(_mm256_sub_ps(mm, one), _mm256_and_ps(lessSqrtHf, mm));
+
+        const __m256 zz = _mm256_mul_ps(mm, mm);
+        __m256 yy = _mm256_set1_ps(7.0376836292e-2f);
+        yy = _mm256_add_ps(_mm256_mul_ps(yy, mm), _mm256_set1_ps(-1.1514610310e-1f));
+        yy = _mm256_add_ps(_mm256_mul_ps(yy, mm), _mm256_set1_ps( 1.1676998740e-1f));
+        yy = _mm256_add_ps(_mm256_mul_ps(yy, mm), _mm256_set1_ps(-1.2420140846e-1f));
+        yy = _mm256_add_ps(_mm256_mul_ps(yy, mm), _mm256_set1_ps( 1.4249322787e-1f));
+        yy = _mm256_add_ps(_mm256_mul_ps(yy, mm), _mm256_set1_ps(-1.6668057665e-1f));
+        yy = _mm256_add_ps(_mm256_mul_ps(yy, mm), _mm256_set1_ps( 2.0000714765e-1f));
+        yy = _mm256_add_ps(_mm256_mul_ps(yy, mm), _mm256_set1_ps(-2.4999993993e-1f));
+        yy = _mm256_add_ps(_mm256_mul_ps(yy, mm), _mm256_set1_ps( 3.3333331174e-1f));
+        yy = _mm256_mul_ps(_mm256_mul_ps(yy, mm), zz);
+        yy = _mm256_add_ps(yy, _mm256_mul_ps(ee, _mm256_set1_ps(-2.12194440e-4f)));
+        yy = _mm256_sub_ps(yy, _mm256_mul_ps(zz, _mm256_set1_ps(0.5f)));
+        const __m256 logx = _mm256_add_ps(_mm256_add_ps(mm, yy), _mm256_mul_ps(ee, _mm256_set1_ps(0.693359375f)));
+
+        __m256 xx = _mm256_mul_ps(_a, logx);
+        xx = _mm256_max_ps(_mm256_min_ps(xx, _mm256_set1_ps(88.3762626647949f)), _mm256_set1_ps(-87.0f));
+
+        const __m256 fx = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(xx, _mm256_set1_ps(1.44269504088896341f)), _mm256_set1_ps(0.5f)));
+        xx = _mm256_sub_ps(xx, _mm256_mul_ps(fx, _mm256_set1_ps(0.693359375f)));
+        xx = _mm256_sub_ps(xx, _mm256_mul_ps(fx, _mm256_set1_ps(-2.12194440e-4f)));
+
+        const __m256 xx2 = _mm256_mul_ps(xx, xx);
+        __m256 ex = _mm256_set1_ps(1.9875691500e-4f);
+        ex = _mm256_add_ps(_mm256_mul_ps(ex, xx), _mm256_set1_ps(1.3981999507e-3f));
+        ex = _mm256_add_ps(_mm256_mul_ps(ex, xx), _mm256_set1_ps(8.3334519073e-3f));
+        ex = _mm256_add_ps(_mm256_mul_ps(ex, xx), _mm256_set1_ps(4.1665795894e-2f));
+        ex = _mm256_add_ps(_mm256_mul_ps(ex, xx), _mm256_set1_ps(1.6666665459e-1f));
+        ex = _mm256_add_ps(_mm256_mul_ps(ex, xx), _mm256_set1_ps(5.0000001201e-1f));
+        ex = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, xx2), xx), one);
+
+        const __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+        return _mm256_mul_ps(ex, _mm256_castsi256_ps(pow2n));
+    }
+
+    // 8 texels (2 per 128 bit lane) to structure of arrays. Lane order is 0,2,4,6 | 1,3,5,7,
+    // sums don't depend on it.
+    CMFT_TARGET_AVX2 static inline void transpose8x4Avx2(__m256& _xx, __m256& _yy, __m256& _zz, __m256& _ww, const float* _src)
+    {
+        const __m256 ab = _mm256_loadu_ps(_src);
+        const __m256 cd = _mm256_loadu_ps(_src + 8);
+        const __m256 ef = _mm256_loadu_ps(_src + 16);
+        const __m256 gh = _mm256_loadu_ps(_src + 24);
+        const __m256 t0 = _mm256_unpacklo_ps(ab, cd);
+        const __m256 t1 = _mm256_unpackhi_ps(ab, cd);
+        const __m256 t2 = _mm256_unpacklo_ps(ef, gh);
+        const __m256 t3 = _mm256_unpackhi_ps(ef, gh);
+        _xx = _mm256_shuffle_ps(t0, t2, 0x44);
+        _yy = _mm256_shuffle_ps(t0, t2, 0xee);
+        _zz = _mm256_shuffle_ps(t1, t3, 0x44);
+        _ww = _mm256_shuffle_ps(t1, t3, 0xee);
+    }
+
+    CMFT_TARGET_AVX2 static void radianceRowAvx2(float _sum[4]
+                                               , const float* _normals
+                                               , const float* _data
+                                               , uint32_t _count
+                                               , const float* _tapVec
+                                               , float _specularPower
+                                               , float _specularAngle
+                                               )
+    {
+        const __m256 tapX  = _mm256_set1_ps(_tapVec[0]);
+        const __m256 tapY  = _mm256_set1_ps(_tapVec[1]);
+        const __m256 tapZ  = _mm256_set1_ps(_tapVec[2]);
+        const __m256 power = _mm256_set1_ps(_specularPower);
+        const __m256 angle = _mm256_set1_ps(_specularAngle);
+
+        __m256 sumR = _mm256_setzero_ps();
+        __m256 sumG = _mm256_setzero_ps();
+        __m256 sumB = _mm256_setzero_ps();
+        __m256 sumW = _mm256_setzero_ps();
+
+        uint32_t ii = 0;
+        for (; ii + 8 <= _count; ii += 8, _normals += 32, _data += 32)
+        {
+            __m256 nx, ny, nz, sa;
+            transpose8x4Avx2(nx, ny, nz, sa, _normals);
+
+            const __m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, tapX), _mm256_mul_ps(ny, tapY)), _mm256_mul_ps(nz, tapZ));
+            const __m256 inside = _mm256_cmp_ps(dot, angle, _CMP_GE_OQ);
+            if (0 == _mm256_movemask_ps(inside))
+            {
+                continue;
+            }
+            const __m256 weight = _mm256_and_ps(inside, _mm256_mul_ps(sa, powAvx2(dot, power)));
+
+            __m256 rr, gg, bb, aa;
+            transpose8x4Avx2(rr, gg, bb, aa, _data);
+
+            sumR = _mm256_add_ps(sumR, _mm256_mul_ps(rr, weight));
+            sumG = _mm256_add_ps(sumG, _mm256_mul_ps(gg, weight));
+            sumB = _mm256_add_ps(sumB, _mm256_mul_ps(bb, weight));
+            sumW = _mm256_add_ps(sumW, weight);
+        }
+
+        float lanes[4][8];
+        _mm256_storeu_ps(lanes[0], sumR);
+        _mm256_storeu_ps(lanes[1], sumG);
+        _mm256_storeu_ps(lanes[2], sumB);
+        _mm256_storeu_ps(lanes[3], sumW);
+        for (uint8_t cc = 0; cc < 4; ++cc)
+        {
+            _sum[cc] += ((lanes[cc][0] + lanes[cc][1]) + (lanes[cc][2] + lanes[cc][3]))
+                      + ((lanes[cc][4] + lanes[cc][5]) + (lanes[cc][6] + lanes[cc][7]));
+        }
+
+        radianceRowSse2(_sum, _normals, _data, _count - ii, _tapVec, _specularPower, _specularAngle);
+    }
+#endif // CMFT_SIMD_X86
+
+    static bool cpuSupportsAvx2()
+    {
+    #if CMFT_SIMD_X86
+    #   if CMFT_COMPILER_MSVC
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+
+        // AVX enabled by the OS for ymm registers.
+        __cpuid(info, 1);
+        const bool osxsave = 0 != (info[2] & (1<<27));
+        const bool avx     = 0 != (info[2] & (1<<28));
+        if (!osxsave || !avx || 6 != (_xgetbv(0) & 6))
+        {
+            return false;
+        }
+
+        __cpuidex(info, 7, 0);
+        return 0 != (info[1] & (1<<5));
+    #   else
+        __builtin_cpu_init();
+        return 0 != __builtin_cpu_supports("avx2");
+    #   endif
+    #else
+        return false;
+    #endif // CMFT_SIMD_X86
+    }
+
+    static CpuSimd::Enum bestCpuSimd()
+    {
+    #if CMFT_SIMD_X86
+        return cpuSupportsAvx2() ? CpuSimd::Avx2 : CpuSimd::Sse2;
+    #else
+        return CpuSimd::None;
+    #endif // CMFT_SIMD_X86
+    }
+
+    static RadianceRowFn radianceRowFor(CpuSimd::Enum _simd)
+    {
+    #if CMFT_SIMD_X86
+        switch (_simd)
+        {
+        case CpuSimd::Avx2: return radianceRowAvx2;
+        case CpuSimd::Sse2: return radianceRowSse2;
+        default: break;
+        }
+    #endif // CMFT_SIMD_X86
+
+        return radianceRowRef;
+    }
+
+    static CpuSimd::Enum s_radianceFilterSimd = bestCpuSimd();
+    static RadianceRowFn s_radianceRow = radianceRowFor(s_radianceFilterSimd);
+
+    CpuSimd::Enum setRadianceFilterSimd(CpuSimd::Enum _simd)
+    {
+        s_radianceFilterSimd = CMFT_MIN(_simd, bestCpuSimd());
+        s_radianceRow = radianceRowFor(s_radianceFilterSimd);
+        return s_radianceFilterSimd;
+    }
+
+    CpuSimd::Enum getRadianceFilterSimd()
+    {
+        return s_radianceFilterSimd;
+    }
+
+    const char* getCpuSimdStr(CpuSimd::Enum _simd)
+    {
+        static const char* s_cpuSimdStr[CpuSimd::Count] =
+        {
+            "Scalar",
+            "SSE2",
+            "AVX2",
+        };
+        return s_cpuSimdStr[uint8_t(_simd)];
+    }
+
+    // 3rd order spherical harmonics.
+    //-----
+
+    /// Accumulates the projection of _count texels of a face row on the 9 first SH basis, weighted
+    /// by the texel solid angles. _sum is { coeff 0 r,g,b, ..., coeff 8 r,g,b, solid angle }.
+    /// Same basis as evalSHBasis5. Texels and normals are 4 floats each.
+    typedef void (*ShRowFn)(float _sum[SH3_COEFF_NUM*3+1], const float* _normals, const float* _data, uint32_t _count);
+
+    static inline void evalSHBasis3(float _shBasis[SH3_COEFF_NUM], const float* _dir)
+    {
+        const float x = _dir[0];
+        const float y = _dir[1];
+        const float z = _dir[2];
+
+        _shBasis[0] =  0.282094792f;
+
+        _shBasis[1] = -0.488602512f*y;
+        _shBasis[2] =  0.488602512f*z;
+        _shBasis[3] = -0.488602512f*x;
+
+        _shBasis[4] =  1.092548431f*y*x;
+        _shBasis[5] = -1.092548431f*y*z;
+        _shBasis[6] =  0.315391565f*(3.0f*z*z-1.0f);
+        _shBasis[7] = -1.092548431f*x*z;
+        _shBasis[8] =  0.546274215f*(x*x-y*y);
+    }
+
+    static void shRowRef(float _sum[SH3_COEFF_NUM*3+1], const float* _normals, const float* _data, uint32_t _count)
+    {
+        for (uint32_t ii = 0; ii < _count; ++ii, _normals += 4, _data += 4)
+        {
+            float shBasis[SH3_COEFF_NUM];
+            evalSHBasis3(shBasis, _normals);
+            const float weight = _normals[3];
+
+            for (uint8_t jj = 0; jj < SH3_COEFF_NUM; ++jj)
+            {
+                _sum[jj*3+0] += _data[0] * shBasis[jj] * weight;
+                _sum[jj*3+1] += _data[1] * shBasis[jj] * weight;
+                _sum[jj*3+2] += _data[2] * shBasis[jj] * weight;
+            }
+            _sum[SH3_COEFF_NUM*3] += weight;
+        }
+    }
+
+#if CMFT_SIMD_X86
+    static void shRowSse2(float _sum[SH3_COEFF_NUM*3+1], const float* _normals, const float* _data, uint32_t _count)
+    {
+        __m128 acc[SH3_COEFF_NUM*3+1];
+        for (uint8_t jj = 0; jj < SH3_COEFF_NUM*3+1; ++jj)
+        {
+            acc[jj] = _mm_setzero_ps();
+        }
+
+        uint32_t ii = 0;
+        for (; ii + 4 <= _count; ii += 4, _normals += 16, _data += 16)
+        {
+            // 4 texels to structure of arrays.
+            __m128 nx = _mm_loadu_ps(_normals);
+            __m128 ny = _mm_loadu_ps(_normals + 4);
+            __m128 nz = _mm_loadu_ps(_normals + 8);
+            __m128 sa = _mm_loadu_ps(_normals + 12);
+            _MM_TRANSPOSE4_PS(nx, ny, nz, sa);
+
+            __m128 rr = _mm_loadu_ps(_data);
+            __m128 gg = _mm_loadu_ps(_data + 4);
+            __m128 bb = _mm_loadu_ps(_data + 8);
+            __m128 aa = _mm_loadu_ps(_data + 12);
+            _MM_TRANSPOSE4_PS(rr, gg, bb, aa);
+            rr = _mm_mul_ps(rr, sa);
+            gg = _mm_mul_ps(gg, sa);
+            bb = _mm_mul_ps(bb, sa);
+
+            const __m128 shBasis[SH3_COEFF_NUM] =
+            {
+                _mm_set1_ps(0.282094792f),
+                _mm_mul_ps(_mm_set1_ps(-0.488602512f), ny),
+                _mm_mul_ps(_mm_set1_ps( 0.488602512f), nz),
+                _mm_mul_ps(_mm_set1_ps(-0.488602512f), nx),
+                _mm_mul_ps(_mm_set1_ps( 1.092548431f), _mm_mul_ps(ny, nx)),
+                _mm_mul_ps(_mm_set1_ps(-1.092548431f), _mm_mul_ps(ny, nz)),
+                _mm_mul_ps(_mm_set1_ps( 0.315391565f), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(nz, nz)), _mm_set1_ps(1.0f))),
+                _mm_mul_ps(_mm_set1_ps(-1.092548431f), _mm_mul_ps(nx, nz)),
+                _mm_mul_ps(_mm_set1_ps( 0.546274215f), _mm_sub_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny))),
+            };
+
+            for (uint8_t jj = 0; jj < SH3_COEFF_NUM; ++jj)
+            {
+                acc[jj*3+0] = _mm_add_ps(acc[jj*3+0], _mm_mul_ps(rr, shBasis[jj]));
+                acc[jj*3+1] = _mm_add_ps(acc[jj*3+1], _mm_mul_ps(gg, shBasis[jj]));
+                acc[jj*3+2] = _mm_add_ps(acc[jj*3+2], _mm_mul_ps(bb, shBasis[jj]));
+            }
+            acc[SH3_COEFF_NUM*3] = _mm_add_ps(acc[SH3_COEFF_NUM*3], sa);
+        }
+
+        for (uint8_t jj = 0; jj < SH3_COEFF_NUM*3+1; ++jj)
+        {
+            float lanes[4];
+            _mm_storeu_ps(lanes, acc[jj]);
+            _sum[jj] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        }
+
+        shRowRef(_sum, _normals, _data, _count - ii);
+    }
+
+    CMFT_TARGET_AVX2 static void shRowAvx2(float _sum[SH3_COEFF_NUM*3+1], const float* _normals, const float* _data, uint32_t _count)
+    {
+        __m256 acc[SH3_COEFF_NUM*3+1];
+        for (uint8_t jj = 0; jj < SH3_COEFF_NUM*3+1; ++jj)
+        {
+            acc[jj] = _mm256_setzero_ps();
+        }
+
+        uint32_t ii = 0;
+        for (; ii + 8 <= _count; ii += 8, _normals += 32, _data += 32)
+        {
+            __m256 nx, ny, nz, sa;
+            transpose8x4Avx2(nx, ny, nz, sa, _normals);
+
+            __m256 rr, gg, bb, aa;
+            transpose8x4Avx2(rr, gg, bb, aa, _data);
+            rr = _mm256_mul_ps(rr, sa);
+            gg = _mm256_mul_ps(gg, sa);
+            bb = _mm256_mul_ps(bb, sa);
+
+            const __m256 shBasis[SH3_COEFF_NUM] =
+            {
+                _mm256_set1_ps(0.282094792f),
+                _mm256_mul_ps(_mm256_set1_ps(-0.488602512f), ny),
+                _mm256_mul_ps(_mm256_set1_ps( 0.488602512f), nz),
+                _mm256_mul_ps(_mm256_set1_ps(-0.488602512f), nx),
+                _mm256_mul_ps(_mm256_set1_ps( 1.092548431f), _mm256_mul_ps(ny, nx)),
+                _mm256_mul_ps(_mm256_set1_ps(-1.092548431f), _mm256_mul_ps(ny, nz)),
+                _mm256_mul_ps(_mm256_set1_ps( 0.315391565f), _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(3.0f), _mm256_mul_ps(nz, nz)), _mm256_set1_ps(1.0f))),
+                _mm256_mul_ps(_mm256_set1_ps(-1.092548431f), _mm256_mul_ps(nx, nz)),
+                _mm256_mul_ps(_mm256_set1_ps( 0.546274215f), _mm256_sub_ps(_mm256_mul_ps(nx, nx), _mm256_mul_ps(ny, ny))),
+            };
+
+            for (uint8_t jj = 0; jj < SH3_COEFF_NUM; ++jj)
+            {
+                acc[jj*3+0] = _mm256_add_ps(acc[jj*3+0], _mm256_mul_ps(rr, shBasis[jj]));
+                acc[jj*3+1] = _mm256_add_ps(acc[jj*3+1], _mm256_mul_ps(gg, shBasis[jj]));
+                acc[jj*3+2] = _mm256_add_ps(acc[jj*3+2], _mm256_mul_ps(bb, shBasis[jj]));
+            }
+            acc[SH3_COEFF_NUM*3] = _mm256_add_ps(acc[SH3_COEFF_NUM*3], sa);
+        }
+
+        for (uint8_t jj = 0; jj < SH3_COEFF_NUM*3+1; ++jj)
+        {
+            float lanes[8];
+            _mm256_storeu_ps(lanes, acc[jj]);
+            _sum[jj] += ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]))
+                      + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+        }
+
+        shRowSse2(_sum, _normals, _data, _count - ii);
+    }
+#endif // CMFT_SIMD_X86
+
+    static ShRowFn shRowFor(CpuSimd::Enum _simd)
+    {
+    #if CMFT_SIMD_X86
+        switch (_simd)
+        {
+        case CpuSimd::Avx2: return shRowAvx2;
+        case CpuSimd::Sse2: return shRowSse2;
+        default: break;
+        }
+    #endif // CMFT_SIMD_X86
+
+        return shRowRef;
+    }
+
+    /// Rows of the 6 faces are handed out to the threads, each one reduces its rows in a
+    /// private sum that is added to m_sum once it's done.
+    struct ShProjectionTask
+    {
+        const uint8_t* m_data;
+        const float* m_normals;
+        uint32_t m_faceSize;
+        uint32_t m_faceOffsets[6];
+        ShRowFn m_row;
+        std::atomic<uint32_t> m_nextRow;
+        std::mutex m_access;
+        double m_sum[SH3_COEFF_NUM*3+1];
+    };
+
+    static void shProjectionCpu(ShProjectionTask* _task)
+    {
+        double sum[SH3_COEFF_NUM*3+1] = {};
+        const uint32_t faceSize = _task->m_faceSize;
+        const uint32_t rowCount = faceSize*6;
+
+        for (uint32_t row = _task->m_nextRow++; row < rowCount; row = _task->m_nextRow++)
+        {
+            const uint32_t face = row / faceSize;
+            const uint32_t yy = row % faceSize;
+            const float* data = (const float*)(_task->m_data + _task->m_faceOffsets[face]) + yy*faceSize*4;
+            const float* normals = _task->m_normals + (face*faceSize + yy)*faceSize*4;
+
+            // a row in float, rows are accumulated in double
+            float rowSum[SH3_COEFF_NUM*3+1] = {};
+            _task->m_row(rowSum, normals, data, faceSize);
+            for (uint8_t jj = 0; jj < SH3_COEFF_NUM*3+1; ++jj)
+            {
+                sum[jj] += double(rowSum[jj]);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(_task->m_access);
+        for (uint8_t jj = 0; jj < SH3_COEFF_NUM*3+1; ++jj)
+        {
+            _task->m_sum[jj] += sum[jj];
+        }
+    }
+
+    bool imageShCoeffs3(float _shCoeffs[SH3_COEFF_NUM][3], const Image& _image, uint8_t _numCpuProcessingThreads, AllocatorI* _allocator)
+    {
+        // Input image must be a cubemap.
+        if (!imageIsCubemap(_image))
+        {
+            return false;
+        }
+
+        // Processing is done in Rgba32f format.
+        ImageSoftRef imageRgba32f;
+        imageRefOrConvert(imageRgba32f, TextureFormat::RGBA32F, _image, _allocator);
+
+        float* cubemapVectors = buildCubemapNormalSolidAngle(imageRgba32f.m_width, EdgeFixup::None, g_allocator);
+
+        ShProjectionTask task;
+        task.m_data = (const uint8_t*)imageRgba32f.m_data;
+        task.m_normals = cubemapVectors;
+        task.m_faceSize = imageRgba32f.m_width;
+        imageGetFaceOffsets(task.m_faceOffsets, imageRgba32f);
+        task.m_row = shRowFor(getRadianceFilterSimd());
+        task.m_nextRow = 0;
+        memset(task.m_sum, 0, sizeof(task.m_sum));
+
+        // Calling thread takes part in the reduction.
+        std::thread cpuThreads[64];
+        const uint32_t numThreads = CMFT_CLAMP(uint32_t(_numCpuProcessingThreads), 1u, CMFT_MIN(64u, task.m_faceSize*6));
+        for (uint32_t ii = 1; ii < numThreads; ++ii)
+        {
+            cpuThreads[ii] = std::thread(shProjectionCpu, &task);
+        }
+        shProjectionCpu(&task);
+        for (uint32_t ii = 1; ii < numThreads; ++ii)
+        {
+            cpuThreads[ii].join();
+        }
+
+        // Normalization, same as cubemapShCoeffs.
+        const double norm = PI4 / task.m_sum[SH3_COEFF_NUM*3];
+        for (uint8_t ii = 0; ii < SH3_COEFF_NUM; ++ii)
+        {
+            _shCoeffs[ii][0] = float(task.m_sum[ii*3+0] * norm);
+            _shCoeffs[ii][1] = float(task.m_sum[ii*3+1] * norm);
+            _shCoeffs[ii][2] = float(task.m_sum[ii*3+2] * norm);
+        }
+
+        CMFT_FREE(g_allocator, cubemapVectors);
+        imageUnload(imageRgba32f, _allocator);
+
+        return true;
+    }
+
+    bool imageIrradianceFilterSh3(Image& _dst, uint32_t _dstFaceSize, float _shCoeffs[SH3_COEFF_NUM][3], const Image& _src, uint8_t _numCpuProcessingThreads, AllocatorI* _allocator)
+    {
+        if (!imageShCoeffs3(_shCoeffs, _src, _numCpuProcessingThreads, _allocator))
+        {
+            return false;
+        }
+
+        // Alloc dst data.
+        const uint32_t dstFaceSize = (0 == _dstFaceSize) ? _src.m_width : _dstFaceSize;
+        const uint32_t dstDataSize = dstFaceSize * dstFaceSize * 6 /*numFaces*/ * 4 /*numChannels*/ * 4 /*bytesPerChannel*/;
+        float* dstData = (float*)CMFT_ALLOC(_allocator, dstDataSize);
+        MALLOC_CHECK(dstData);
+
+        // Build cubemap texel vectors.
+        float* cubemapVectors = buildCubemapNormalSolidAngle(dstFaceSize, EdgeFixup::None, g_allocator);
+
+        // Bands are scaled by the clamped cosine convolution over PI, like imageIrradianceFilterSh.
+        static const float bandFactor[SH3_COEFF_NUM] = { 1.0f, 2.0f/3.0f, 2.0f/3.0f, 2.0f/3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+        const float* vecPtr = cubemapVectors;
+        float* dstPtr = dstData;
+        for (uint32_t texel = 0, count = dstFaceSize*dstFaceSize*6; texel < count; ++texel, dstPtr += 4, vecPtr += 4)
+        {
+            float shBasis[SH3_COEFF_NUM];
+            evalSHBasis3(shBasis, vecPtr);
+
+            dstPtr[0] = dstPtr[1] = dstPtr[2] = 0.0f;
+            for (uint8_t ii = 0; ii < SH3_COEFF_NUM; ++ii)
+            {
+                const float basis = shBasis[ii] * bandFactor[ii];
+                dstPtr[0] += _shCoeffs[ii][0] * basis;
+                dstPtr[1] += _shCoeffs[ii][1] * basis;
+                dstPtr[2] += _shCoeffs[ii][2] * basis;
+            }
+            dstPtr[3] = 1.0f;
+        }
+
+        CMFT_FREE(g_allocator, cubemapVectors);
+
+        // Fill structure.
+        Image result;
+        result.m_width = dstFaceSize;
+        result.m_height = dstFaceSize;
+        result.m_dataSize = dstDataSize;
+        result.m_format = TextureFormat::RGBA32F;
+        result.m_numMips = 1;
+        result.m_numFaces = 6;
+        result.m_data = dstData;
+
+        // Convert back to source format.
+        if (TextureFormat::RGBA32F == _src.m_format)
+        {
+            imageMove(_dst, result, _allocator);
+        }
+        else
+        {
+            imageConvert(_dst, (TextureFormat::Enum)_src.m_format, result, _allocator);
+            imageUnload(result, _allocator);
+        }
+
+        return true;
+    }
+
     template <typename floatOrDouble>
     void processFilterArea(floatOrDouble _res[3]
                          , float _specularPower
@@ -790,6 +1489,7 @@ namespace cmft
         const uint32_t pitch = _srcFaceSize*bytesPerPixel;
         const uint32_t normalFaceSize = pitch*_srcFaceSize;
         const float faceSize_MinusOne = float(int32_t(_srcFaceSize-1));
+        const RadianceRowFn radianceRow = s_radianceRow;
 
         for (uint8_t face = 0; face < 6; ++face)
         {
@@ -811,23 +1511,21 @@ namespace cmft
                 const uint8_t* rowData    = (const uint8_t*)faceData    + yy*pitch;
                 const uint8_t* rowNormals = (const uint8_t*)faceNormals + yy*pitch;
 
-                for (uint32_t xx = minX; xx <= maxX; ++xx)
-                {
-                    const float* normalPtr = (const float*)((const uint8_t*)rowNormals + xx*bytesPerPixel);
-                    const float dotProduct = vec3Dot(normalPtr, _tapVec);
-
-                    if (dotProduct >= _specularAngle)
-                    {
-                        const float solidAngle = normalPtr[3];
-                        const floatOrDouble weight = floatOrDouble(solidAngle * powf(dotProduct, _specularPower));
-
-                        const float* dataPtr = (const float*)((const uint8_t*)rowData + xx*bytesPerPixel);
-                        colorWeight[0] += floatOrDouble(dataPtr[0]) * weight;
-                        colorWeight[1] += floatOrDouble(dataPtr[1]) * weight;
-                        colorWeight[2] += floatOrDouble(dataPtr[2]) * weight;
-                        colorWeight[3] += floatOrDouble(1.0)        * weight;
-                    }
-                }
+                // Texels of a row are contiguous, see radianceRowFor.
+                float rowWeight[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                radianceRow(rowWeight
+                          , (const float*)(rowNormals + minX*bytesPerPixel)
+                          , (const float*)(rowData    + minX*bytesPerPixel)
+                          , maxX - minX + 1
+                          , _tapVec
+                          , _specularPower
+                          , _specularAngle
+                          );
+
+                colorWeight[0] += floatOrDouble(rowWeight[0]);
+                colorWeight[1] += floatOrDouble(rowWeight[1]);
+                colorWeight[2] += floatOrDouble(rowWeight[2]);
+                colorWeight[3] += floatOrDouble(rowWeight[3]);
             }
         }
 
@@ -26,6 +26,16 @@ namespace cmft
     /// Converts cubemap image into irradiance cubemap. Uses fast spherical harmonics implementation.
     void imageIrradianceFilterSh(Image& _image, uint32_t _faceSize, AllocatorI* _allocator = g_allocator);
 
+    #define SH3_COEFF_NUM 9
+
+    /// Computes 3rd order spherical harmonics coefficients of given cubemap image. Rows of the faces are
+    /// reduced by _numCpuProcessingThreads threads with the instruction set of setRadianceFilterSimd.
+    bool imageShCoeffs3(float _shCoeffs[SH3_COEFF_NUM][3], const Image& _image, uint8_t _numCpuProcessingThreads = 0, AllocatorI* _allocator = g_allocator);
+
+    /// Creates irradiance cubemap of _dstFaceSize from the 3rd order spherical harmonics of _src,
+    /// also returned in _shCoeffs. Same irradiance scale as imageIrradianceFilterSh.
+    bool imageIrradianceFilterSh3(Image& _dst, uint32_t _dstFaceSize, float _shCoeffs[SH3_COEFF_NUM][3], const Image& _src, uint8_t _numCpuProcessingThreads = 0, AllocatorI* _allocator = g_allocator);
+
     struct LightingModel
     {
         enum Enum
@@ -101,6 +111,25 @@ namespace cmft
                            , AllocatorI* _allocator = g_allocator
                            );
 
+    struct CpuSimd
+    {
+        enum Enum
+        {
+            None,
+            Sse2,
+            Avx2,
+
+            Count
+        };
+    };
+
+    /// Instruction set used by CPU radiance filtering threads. The best one supported by the host is
+    /// selected by default, requesting an unsupported one falls back to the best available.
+    /// Returns the instruction set that will be used.
+    CpuSimd::Enum setRadianceFilterSimd(CpuSimd::Enum _simd);
+    CpuSimd::Enum getRadianceFilterSimd();
+    const char* getCpuSimdStr(CpuSimd::Enum _simd);
+
 } // namespace cmft
 
 #endif // CMFT_CUBEMAPFILTER_H_HEADER_GUARD
@@ -62,11 +62,16 @@ void Evaluation::AddSingleEvaluation(size_t nodeType)
     evaluation.mbDepthBuffer          = false;
     evaluation.scene = nullptr;
     evaluation.renderer = nullptr;
+    evaluation.denoiser = nullptr;
     mStages.push_back(evaluation);
 }
 
 void Evaluation::StageIsAdded(int index)
 {
+    // restored by undo, its scene reference, renderer and denoiser were released when it was deleted
+    gEvaluation.mStages[index].scene = nullptr;
+    gEvaluation.mStages[index].renderer = nullptr;
+    gEvaluation.mStages[index].denoiser = nullptr;
     for (size_t i = 0;i< gEvaluation.mStages.size();i++)
     {
         if (i == index)
@@ -87,6 +87,13 @@ struct EvaluationInfo
     int mLocalFrame;
 };
 
+// IrradianceSHBlock of GLSL nodes: SH of the irradiance of each input, when its node computed one
+struct IrradianceSHInfo
+{
+    float coefficients[8 * 9][4];
+    int valid[8];
+};
+
 struct TextureFormat
 {
     enum Enum
@@ -162,13 +169,18 @@ protected:
     unsigned char *mBits;
 } Image;
 
+// bytes and channels of one texel for a TextureFormat
+unsigned int GetTexelSize(uint8_t fmt);
+unsigned int GetTexelComponentCount(uint8_t fmt);
+
 class RenderTarget
 {
 
 public:
-    RenderTarget() : mGLTexID(0), mGLTexDepth(0), mFbo(0), mDepthBuffer(0)
+    RenderTarget() : mGLTexID(0), mGLTexDepth(0), mFbo(0), mDepthBuffer(0), mbIrradianceSH(false)
     {
         memset(&mImage, 0, sizeof(Image_t));
+        memset(mIrradianceSH, 0, sizeof(mIrradianceSH));
     }
 
     void InitBuffer(int width, int height, bool depthBuffer);
@@ -185,6 +197,9 @@ public:
     unsigned int mGLTexDepth;
     TextureID mDepthBuffer;
     TextureID mFbo;
+    // 3rd order SH of the irradiance cubemap, RGB per coefficient. Set by Evaluation::SetEvaluationIrradianceSH
+    float mIrradianceSH[9][4];
+    bool mbIrradianceSH;
 };
 
 struct Input
@@ -222,9 +237,31 @@ struct EvaluationStage
     // scene render
     void *scene;
     void *renderer;
+    void *denoiser;
     Image_t DecodeImage();
 };
 
+inline size_t UndoMemorySize(const EvaluationStage& stage)
+{
+    return sizeof(EvaluationStage) + stage.mParameters.capacity() + stage.mInputSamplers.capacity() * sizeof(InputSampler);
+}
+
+// parameters and samplers are set again from the node record (NodeIsAdded) and the decoder is reopened on demand:
+// keep them out of the history instead of duplicating them per add/delete.
+inline void UndoSnapshot(EvaluationStage& snapshot, EvaluationStage& stage)
+{
+    std::vector<unsigned char> parameters;
+    std::vector<InputSampler> inputSamplers;
+    std::shared_ptr<FFMPEGCodec::Decoder> decoder;
+    parameters.swap(stage.mParameters);
+    inputSamplers.swap(stage.mInputSamplers);
+    decoder.swap(stage.mDecoder);
+    snapshot = stage;
+    parameters.swap(stage.mParameters);
+    inputSamplers.swap(stage.mInputSamplers);
+    decoder.swap(stage.mDecoder);
+}
+
 enum EvaluationMask
 {
     EvaluationC = 1 << 0,
@@ -276,23 +313,41 @@ struct Evaluation
     static void SetBlendingMode(int target, int blendSrc, int blendDst);
     static void EnableDepthBuffer(int target, int enable);
     static int EncodePng(Image *image, std::vector<unsigned char> &pngImage);
+    // library images (thumbnails, saved node images). QOI for 8 bits images, PNG is still decoded
+    static int EncodeImageBlob(Image *image, std::vector<unsigned char> &blob);
+    static int DecodeImageBlob(const unsigned char *data, size_t dataSize, Image *image);
     static int SetNodeImage(int target, Image *image);
     static int GetEvaluationSize(int target, int *imageWidth, int *imageHeight);
     static int SetEvaluationSize(int target, int imageWidth, int imageHeight);
     static int SetEvaluationCubeSize(int target, int faceWidth);
     static int CubemapFilter(Image *image, int faceSize, int lightingModel, int excludeBase, int glossScale, int glossBias);
+    // irradiance cubemap of faceSize (source size when 0) from the 3rd order SH of the image, coefficients gets the 9 RGB triplets
+    static int CubemapIrradiance(Image *image, int faceSize, float *coefficients);
+    // SH coefficients visible to the GLSL nodes using target as an input, NULL clears them
+    static int SetEvaluationIrradianceSH(int target, const float *coefficients);
+    // CPU radiance filter throughput for 128 to 1024 face sizes, scalar and SIMD, then the SH irradiance. Results are logged
+    static void BenchmarkCubemapFilter();
+    // serial and parallel SBVH builds of a path tracer scene, time and SAH cost,
+    // then camera ray throughput of the 2, 4 and 8 wide BVH traversals
+    static void BenchmarkBVH(const char *filename);
     static int Job(int(*jobFunction)(void*), void *ptr, unsigned int size);
     static int JobMain(int(*jobMainFunction)(void*), void *ptr, unsigned int size);
+    static int IsJobCancelled();
+    static void* ParallelFor(void(*function)(void *userData, int begin, int end), void *userData, int count, int grain);
+    static int WaitJob(void *handle);
     static void SetProcessing(int target, int processing);
     static int AllocateComputeBuffer(int target, int elementCount, int elementSize);
     static void NodeUICallBack(const ImDrawList* parent_list, const ImDrawCmd* cmd);
     static int LoadSVG(const char *filename, Image *image, float dpi);
     static int LoadScene(const char *filename, void **scene);
+    static int LoadSceneAsync(int target, const char *filename, void **scene);
     static int SetEvaluationScene(int target, void *scene);
     static int GetEvaluationScene(int target, void **scene);
     static int GetEvaluationRenderer(int target, void **renderer);
     static int InitRenderer(int target, int mode, void *scene);
+    static int SetRendererNoiseThreshold(int target, float threshold);
     static int UpdateRenderer(int target);
+    static int DenoiseRenderer(int target, int source, int iterations, float colorSigma, float normalSigma, float depthSigma);
 
     // synchronous texture cache
     // use for simple textures(stock) or to replace with a more efficient one
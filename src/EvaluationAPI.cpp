@@ -50,6 +50,11 @@
 #include "NodesDelegate.h"
 #include "cmft/print.h"
 #include "ffmpegCodec.h"
+#include "Utils.h"
+#include <chrono>
+#include <list>
+#include <map>
+#include <mutex>
 
 extern enki::TaskScheduler g_TS;
 extern cmft::ClContext* clContext;
@@ -103,6 +108,11 @@ unsigned int GetTexelSize(uint8_t fmt)
     return textureFormatSize[fmt];
 }
 
+unsigned int GetTexelComponentCount(uint8_t fmt)
+{
+    return textureComponentCount[fmt];
+}
+
 
 void RenderTarget::BindAsTarget() const
 {
@@ -566,7 +576,7 @@ int Evaluation::SetEvaluationImageCube(int target, Image *image, int cubeFace)
     return EVAL_OK;
 }
 
-int Evaluation::CubemapFilter(Image *image, int faceSize, int lightingModel, int excludeBase, int glossScale, int glossBias)
+static bool RadianceFilter(Image *image, int faceSize, int lightingModel, int excludeBase, int glossScale, int glossBias)
 {
     cmft::Image img;
     img.m_data = image->GetBits();
@@ -582,7 +592,6 @@ int Evaluation::CubemapFilter(Image *image, int faceSize, int lightingModel, int
     cmft::setWarningPrintf(Log);
     cmft::setInfoPrintf(Log);
 
-    faceSize = 16;
     if (!cmft::imageRadianceFilter(img
         , faceSize // face size
         , (cmft::LightingModel::Enum)lightingModel
@@ -593,7 +602,7 @@ int Evaluation::CubemapFilter(Image *image, int faceSize, int lightingModel, int
         , cmft::EdgeFixup::None
         , gCPUCount
         , clContext))
-        return EVAL_ERR;
+        return false;
 
     image->SetBits((unsigned char*)img.m_data, img.m_dataSize);
     image->mNumMips = img.m_numMips;
@@ -601,9 +610,171 @@ int Evaluation::CubemapFilter(Image *image, int faceSize, int lightingModel, int
     image->mWidth = img.m_width;
     image->mHeight = img.m_height;
     image->mFormat = img.m_format;
+    return true;
+}
+
+// filtered cubemaps keyed by the input texels and the filter parameters. Re-evaluating the graph
+// or going back to previous parameters doesn't filter again
+struct CubemapFilterCache
+{
+    CubemapFilterCache() : mMemoryUsed(0) {}
+    std::mutex mMutex;
+    std::list<std::pair<uint64_t, std::shared_ptr<Image> > > mEntries; // most recent first
+    size_t mMemoryUsed;
+};
+static CubemapFilterCache gCubemapFilterCache;
+static const size_t cubemapFilterCacheBudget = 256 << 20;
+
+static void CopyFilteredImage(Image *destination, const Image& source)
+{
+    // not the assignment operator: the decoder of the input stays
+    destination->SetBits(source.GetBits(), source.mDataSize);
+    destination->mNumMips = source.mNumMips;
+    destination->mNumFaces = source.mNumFaces;
+    destination->mWidth = source.mWidth;
+    destination->mHeight = source.mHeight;
+    destination->mFormat = source.mFormat;
+}
+
+int Evaluation::CubemapFilter(Image *image, int faceSize, int lightingModel, int excludeBase, int glossScale, int glossBias)
+{
+    const int parameters[] = { image->mWidth, image->mHeight, image->mNumMips, image->mNumFaces, image->mFormat, faceSize, lightingModel, excludeBase, glossScale, glossBias };
+    const uint64_t key = Hash64(image->GetBits(), image->mDataSize, Hash64(parameters, sizeof(parameters)));
+    {
+        std::lock_guard<std::mutex> lock(gCubemapFilterCache.mMutex);
+        auto& entries = gCubemapFilterCache.mEntries;
+        for (auto iter = entries.begin(); iter != entries.end(); ++iter)
+        {
+            if (iter->first != key)
+                continue;
+            entries.splice(entries.begin(), entries, iter);
+            CopyFilteredImage(image, *entries.front().second);
+            return EVAL_OK;
+        }
+    }
+
+    if (!RadianceFilter(image, faceSize, lightingModel, excludeBase, glossScale, glossBias))
+        return EVAL_ERR;
+
+    auto filtered = std::make_shared<Image>();
+    CopyFilteredImage(filtered.get(), *image);
+    std::lock_guard<std::mutex> lock(gCubemapFilterCache.mMutex);
+    auto& entries = gCubemapFilterCache.mEntries;
+    entries.push_front(std::make_pair(key, filtered));
+    gCubemapFilterCache.mMemoryUsed += filtered->mDataSize;
+    while (gCubemapFilterCache.mMemoryUsed > cubemapFilterCacheBudget && entries.size() > 1)
+    {
+        gCubemapFilterCache.mMemoryUsed -= entries.back().second->mDataSize;
+        entries.pop_back();
+    }
     return EVAL_OK;
 }
 
+int Evaluation::CubemapIrradiance(Image *image, int faceSize, float *coefficients)
+{
+    cmft::Image img;
+    img.m_data = image->GetBits();
+    img.m_dataSize = image->mDataSize;
+    img.m_numMips = image->mNumMips;
+    img.m_numFaces = image->mNumFaces;
+    img.m_width = image->mWidth;
+    img.m_height = image->mHeight;
+    img.m_format = (cmft::TextureFormat::Enum)image->mFormat;
+
+    extern unsigned int gCPUCount;
+
+    cmft::setWarningPrintf(Log);
+    cmft::setInfoPrintf(Log);
+
+    // projection and reconstruction are cheap, no cache like CubemapFilter
+    cmft::Image irradiance;
+    float shCoeffs[SH3_COEFF_NUM][3];
+    if (!cmft::imageIrradianceFilterSh3(irradiance, faceSize, shCoeffs, img, uint8_t(gCPUCount)))
+        return EVAL_ERR;
+    memcpy(coefficients, shCoeffs, sizeof(shCoeffs));
+
+    image->SetBits((unsigned char*)irradiance.m_data, irradiance.m_dataSize);
+    image->mNumMips = irradiance.m_numMips;
+    image->mNumFaces = irradiance.m_numFaces;
+    image->mWidth = irradiance.m_width;
+    image->mHeight = irradiance.m_height;
+    image->mFormat = irradiance.m_format;
+    cmft::imageUnload(irradiance);
+    return EVAL_OK;
+}
+
+int Evaluation::SetEvaluationIrradianceSH(int target, const float *coefficients)
+{
+    auto tgt = gCurrentContext->GetRenderTarget(target);
+    if (!tgt)
+        return EVAL_ERR;
+    tgt->mbIrradianceSH = coefficients != NULL;
+    memset(tgt->mIrradianceSH, 0, sizeof(tgt->mIrradianceSH));
+    if (coefficients)
+    {
+        for (int i = 0; i < 9; i++)
+            memcpy(tgt->mIrradianceSH[i], &coefficients[i * 3], sizeof(float) * 3);
+    }
+    gCurrentContext->SetTargetDirty(target, true);
+    return EVAL_OK;
+}
+
+void Evaluation::BenchmarkCubemapFilter()
+{
+    // same synthetic HDR source for every size, the cost grows with the filtered texel count
+    const int sourceSize = 128;
+    Image source;
+    source.mWidth = source.mHeight = sourceSize;
+    source.mNumFaces = 6;
+    source.mNumMips = 1;
+    source.mFormat = TextureFormat::RGBA32F;
+    source.Allocate(size_t(sourceSize) * sourceSize * 6 * 4 * sizeof(float));
+    float *texels = (float*)source.GetBits();
+    uint32_t seed = 0x12345678;
+    for (size_t i = 0; i < size_t(sourceSize) * sourceSize * 6; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        // a few bright texels, like light sources in an environment
+        const float intensity = ((seed >> 8) & 1023) == 0 ? 50.f : float(seed >> 24) / 255.f;
+        texels[i * 4] = texels[i * 4 + 1] = texels[i * 4 + 2] = intensity;
+        texels[i * 4 + 3] = 1.f;
+    }
+
+    const cmft::CpuSimd::Enum bestSimd = cmft::setRadianceFilterSimd(cmft::CpuSimd::Count);
+    std::vector<cmft::CpuSimd::Enum> simds(1, cmft::CpuSimd::None);
+    if (bestSimd != cmft::CpuSimd::None)
+        simds.push_back(bestSimd);
+    for (int faceSize = 128; faceSize <= 1024; faceSize <<= 1)
+    {
+        for (auto simd : simds)
+        {
+            cmft::setRadianceFilterSimd(simd);
+            Image image = source;
+            auto start = std::chrono::high_resolution_clock::now();
+            if (!RadianceFilter(&image, faceSize, cmft::LightingModel::BlinnBrdf, 0, 10, 1))
+                continue;
+            double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            double filteredTexels = 0.;
+            for (int mip = 0; mip < image.mNumMips; mip++)
+                filteredTexels += 6. * double(faceSize >> mip) * double(faceSize >> mip);
+            Log("Cubemap filter %4d %-6s : %7.3f s, %7.3f Mtexels/s\n", faceSize, cmft::getCpuSimdStr(simd), float(seconds), float(filteredTexels / seconds / 1000000.));
+        }
+    }
+    // SH projection of the source and reconstruction of a small irradiance cubemap
+    for (auto simd : simds)
+    {
+        cmft::setRadianceFilterSimd(simd);
+        Image image = source;
+        float coefficients[27];
+        auto start = std::chrono::high_resolution_clock::now();
+        if (CubemapIrradiance(&image, 32, coefficients) != EVAL_OK)
+            continue;
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        Log("Cubemap SH irradiance %4d %-6s : %7.3f ms, %7.3f Mtexels/s\n", sourceSize, cmft::getCpuSimdStr(simd), float(seconds * 1000.), float(6. * sourceSize * sourceSize / seconds / 1000000.));
+    }
+    cmft::setRadianceFilterSimd(bestSimd);
+}
+
 int Evaluation::AllocateImage(Image *image)
 {
     return EVAL_OK;
@@ -629,10 +800,241 @@ int Evaluation::EncodePng(Image *image, std::vector<unsigned char> &pngImage)
     return EVAL_OK;
 }
 
+// QOI, "Quite OK Image" lossless format. Much faster to encode than PNG for a similar size.
+// Used for images stored in the library.
+static const unsigned char qoiMagic[4] = { 'q', 'o', 'i', 'f' };
+static const unsigned char qoiPadding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+enum
+{
+    QOI_OP_INDEX = 0x00,
+    QOI_OP_DIFF = 0x40,
+    QOI_OP_LUMA = 0x80,
+    QOI_OP_RUN = 0xc0,
+    QOI_OP_RGB = 0xfe,
+    QOI_OP_RGBA = 0xff,
+};
+
+union QOIPixel
+{
+    struct { unsigned char r, g, b, a; } rgba;
+    uint32_t v;
+};
+
+static inline int QOIHash(const QOIPixel& px)
+{
+    return (px.rgba.r * 3 + px.rgba.g * 5 + px.rgba.b * 7 + px.rgba.a * 11) & 63;
+}
+
+static inline void QOIWrite32(std::vector<unsigned char>& out, uint32_t v)
+{
+    out.push_back((unsigned char)(v >> 24));
+    out.push_back((unsigned char)(v >> 16));
+    out.push_back((unsigned char)(v >> 8));
+    out.push_back((unsigned char)v);
+}
+
+static void EncodeQOI(const unsigned char *pixels, int width, int height, int channels, std::vector<unsigned char>& out)
+{
+    size_t pixelCount = size_t(width) * height;
+    out.clear();
+    out.reserve(14 + pixelCount * (channels + 1) / 2 + sizeof(qoiPadding));
+    out.insert(out.end(), qoiMagic, qoiMagic + 4);
+    QOIWrite32(out, uint32_t(width));
+    QOIWrite32(out, uint32_t(height));
+    out.push_back((unsigned char)channels);
+    out.push_back(0); // sRGB with linear alpha
+
+    QOIPixel index[64];
+    memset(index, 0, sizeof(index));
+    QOIPixel previous;
+    previous.v = 0;
+    previous.rgba.a = 255;
+    QOIPixel px = previous;
+    int run = 0;
+    for (size_t i = 0; i < pixelCount; i++)
+    {
+        const unsigned char *src = pixels + i * channels;
+        px.rgba.r = src[0];
+        px.rgba.g = src[1];
+        px.rgba.b = src[2];
+        if (channels == 4)
+            px.rgba.a = src[3];
+
+        if (px.v == previous.v)
+        {
+            run++;
+            if (run == 62 || i == pixelCount - 1)
+            {
+                out.push_back((unsigned char)(QOI_OP_RUN | (run - 1)));
+                run = 0;
+            }
+            continue;
+        }
+        if (run)
+        {
+            out.push_back((unsigned char)(QOI_OP_RUN | (run - 1)));
+            run = 0;
+        }
+
+        int hash = QOIHash(px);
+        if (index[hash].v == px.v)
+        {
+            out.push_back((unsigned char)(QOI_OP_INDEX | hash));
+        }
+        else
+        {
+            index[hash] = px;
+            if (px.rgba.a == previous.rgba.a)
+            {
+                signed char vr = (signed char)(px.rgba.r - previous.rgba.r);
+                signed char vg = (signed char)(px.rgba.g - previous.rgba.g);
+                signed char vb = (signed char)(px.rgba.b - previous.rgba.b);
+                signed char vgr = (signed char)(vr - vg);
+                signed char vgb = (signed char)(vb - vg);
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                {
+                    out.push_back((unsigned char)(QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2)));
+                }
+                else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8)
+                {
+                    out.push_back((unsigned char)(QOI_OP_LUMA | (vg + 32)));
+                    out.push_back((unsigned char)((vgr + 8) << 4 | (vgb + 8)));
+                }
+                else
+                {
+                    out.push_back(QOI_OP_RGB);
+                    out.push_back(px.rgba.r);
+                    out.push_back(px.rgba.g);
+                    out.push_back(px.rgba.b);
+                }
+            }
+            else
+            {
+                out.push_back(QOI_OP_RGBA);
+                out.push_back(px.rgba.r);
+                out.push_back(px.rgba.g);
+                out.push_back(px.rgba.b);
+                out.push_back(px.rgba.a);
+            }
+        }
+        previous = px;
+    }
+    out.insert(out.end(), qoiPadding, qoiPadding + sizeof(qoiPadding));
+}
+
+static bool DecodeQOI(const unsigned char *data, size_t dataSize, Image *image)
+{
+    static const size_t headerSize = 14;
+    if (dataSize < headerSize + sizeof(qoiPadding) || memcmp(data, qoiMagic, 4))
+        return false;
+    uint32_t width = (data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7];
+    uint32_t height = (data[8] << 24) | (data[9] << 16) | (data[10] << 8) | data[11];
+    int channels = data[12];
+    if (!width || !height || (channels != 3 && channels != 4) || uint64_t(width) * height > (1 << 28))
+        return false;
+
+    size_t pixelCount = size_t(width) * height;
+    image->Allocate(pixelCount * channels);
+    unsigned char *dst = image->GetBits();
+    QOIPixel index[64];
+    memset(index, 0, sizeof(index));
+    QOIPixel px;
+    px.v = 0;
+    px.rgba.a = 255;
+    size_t p = headerSize;
+    size_t chunksEnd = dataSize - sizeof(qoiPadding);
+    int run = 0;
+    for (size_t i = 0; i < pixelCount; i++)
+    {
+        if (run)
+        {
+            run--;
+        }
+        else if (p < chunksEnd)
+        {
+            int b1 = data[p++];
+            if (b1 == QOI_OP_RGB)
+            {
+                px.rgba.r = data[p++];
+                px.rgba.g = data[p++];
+                px.rgba.b = data[p++];
+            }
+            else if (b1 == QOI_OP_RGBA)
+            {
+                px.rgba.r = data[p++];
+                px.rgba.g = data[p++];
+                px.rgba.b = data[p++];
+                px.rgba.a = data[p++];
+            }
+            else if ((b1 & 0xc0) == QOI_OP_INDEX)
+            {
+                px = index[b1];
+            }
+            else if ((b1 & 0xc0) == QOI_OP_DIFF)
+            {
+                px.rgba.r += ((b1 >> 4) & 3) - 2;
+                px.rgba.g += ((b1 >> 2) & 3) - 2;
+                px.rgba.b += (b1 & 3) - 2;
+            }
+            else if ((b1 & 0xc0) == QOI_OP_LUMA)
+            {
+                int b2 = data[p++];
+                int vg = (b1 & 0x3f) - 32;
+                px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                px.rgba.g += vg;
+                px.rgba.b += vg - 8 + (b2 & 0x0f);
+            }
+            else
+            {
+                run = b1 & 0x3f;
+            }
+            index[QOIHash(px)] = px;
+        }
+        unsigned char *pixel = dst + i * channels;
+        pixel[0] = px.rgba.r;
+        pixel[1] = px.rgba.g;
+        pixel[2] = px.rgba.b;
+        if (channels == 4)
+            pixel[3] = px.rgba.a;
+    }
+    image->mWidth = int(width);
+    image->mHeight = int(height);
+    image->mNumFaces = 1;
+    image->mNumMips = 1;
+    image->mFormat = (channels == 4) ? TextureFormat::RGBA8 : TextureFormat::RGB8;
+    return true;
+}
+
+int Evaluation::EncodeImageBlob(Image *image, std::vector<unsigned char> &blob)
+{
+    if (image->mFormat != TextureFormat::RGB8 && image->mFormat != TextureFormat::RGBA8)
+        return EncodePng(image, blob);
+    EncodeQOI(image->GetBits(), image->mWidth, image->mHeight, textureComponentCount[image->mFormat], blob);
+    return EVAL_OK;
+}
+
+int Evaluation::DecodeImageBlob(const unsigned char *data, size_t dataSize, Image *image)
+{
+    if (DecodeQOI(data, dataSize, image))
+        return EVAL_OK;
+
+    // PNG from libraries saved before QOI. Expanded to RGBA, grey and grey+alpha PNGs have no matching format
+    int components;
+    unsigned char *bits = stbi_load_from_memory(data, int(dataSize), &image->mWidth, &image->mHeight, &components, 4);
+    if (!bits)
+        return EVAL_ERR;
+    image->SetBits(bits, image->mWidth * image->mHeight * 4);
+    stbi_image_free(bits);
+    image->mNumFaces = 1;
+    image->mNumMips = 1;
+    image->mFormat = TextureFormat::RGBA8;
+    return EVAL_OK;
+}
+
 int Evaluation::SetThumbnailImage(Image *image)
 {
     std::vector<unsigned char> pngImage;
-    if (EncodePng(image, pngImage) == EVAL_ERR)
+    if (EncodeImageBlob(image, pngImage) == EVAL_ERR)
         return EVAL_ERR;
 
     extern Library library;
@@ -641,14 +1043,14 @@ int Evaluation::SetThumbnailImage(Image *image)
     int materialIndex = imogen.GetCurrentMaterialIndex();
     Material & material = library.mMaterials[materialIndex];
     material.mThumbnail = pngImage;
-    material.mThumbnailTextureId = 0;
+    material.mThumbnailRuntimeId = GetRuntimeId();
     return EVAL_OK;
 }
 
 int Evaluation::SetNodeImage(int target, Image *image)
 {
     std::vector<unsigned char> pngImage;
-    if (EncodePng(image, pngImage) == EVAL_ERR)
+    if (EncodeImageBlob(image, pngImage) == EVAL_ERR)
         return EVAL_ERR;
 
     extern Library library;
@@ -663,22 +1065,36 @@ int Evaluation::SetNodeImage(int target, Image *image)
 
 typedef int(*jobFunction)(void*);
 
+// jobs always run, even when superseded by a newer evaluation of their stage: they own the buffers they were given.
+// they check IsJobCancelled to skip the work and the upload of a stale result
+static void RunTaggedJob(const JobTag& tag, jobFunction function, void *buffer)
+{
+    JobTag previousTag = gCurrentJobTag;
+    gCurrentJobTag = tag;
+    size_t parallelForMark = ParallelForMark();
+    function(buffer);
+    ReleaseParallelFors(parallelForMark);
+    gCurrentJobTag = previousTag;
+}
+
 struct CFunctionTaskSet : enki::ITaskSet
 {
     CFunctionTaskSet(jobFunction function, void *ptr, unsigned int size) : enki::ITaskSet()
         , mFunction(function)
         , mBuffer(malloc(size))
+        , mTag(gCurrentJobTag)
     {
         memcpy(mBuffer, ptr, size);
     }
     virtual void    ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum)
     {
-        mFunction(mBuffer);
+        RunTaggedJob(mTag, mFunction, mBuffer);
         free(mBuffer);
         delete this;
     }
     jobFunction mFunction;
     void *mBuffer;
+    JobTag mTag;
 };
 
 struct CFunctionMainTask : enki::IPinnedTask
@@ -687,17 +1103,19 @@ struct CFunctionMainTask : enki::IPinnedTask
         : enki::IPinnedTask(0) // set pinned thread to 0
         , mFunction(function)
         , mBuffer(malloc(size))
+        , mTag(gCurrentJobTag)
     {
         memcpy(mBuffer, ptr, size);
     }
     virtual void Execute()
     {
-        mFunction(mBuffer);
+        RunTaggedJob(mTag, mFunction, mBuffer);
         free(mBuffer);
         delete this;
     }
     jobFunction mFunction;
     void *mBuffer;
+    JobTag mTag;
 };
 
 void Evaluation::SetProcessing(int target, int processing)
@@ -737,6 +1155,125 @@ int Evaluation::JobMain(int(*jobMainFunction)(void*), void *ptr, unsigned int si
     return EVAL_OK;
 }
 
+int Evaluation::IsJobCancelled()
+{
+    return gCurrentJobTag.IsCancelled() ? 1 : 0;
+}
+
+typedef void(*parallelForFunction)(void *userData, int begin, int end);
+
+struct CParallelForTaskSet : enki::ITaskSet
+{
+    CParallelForTaskSet(parallelForFunction function, void *userData, int count, int grain) : enki::ITaskSet(uint32_t(count), uint32_t(grain))
+        , mFunction(function)
+        , mUserData(userData)
+        , mTag(gCurrentJobTag)
+        , mDetached(false)
+    {
+    }
+    virtual void    ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum)
+    {
+        // remaining ranges are dropped, WaitJob still returns once all are consumed
+        if (mTag.IsCancelled())
+            return;
+        JobTag previousTag = gCurrentJobTag;
+        gCurrentJobTag = mTag;
+        mFunction(mUserData, int(range.start), int(range.end));
+        gCurrentJobTag = previousTag;
+    }
+    parallelForFunction mFunction;
+    void *mUserData;
+    JobTag mTag;
+    // the function that started it returned without WaitJob
+    bool mDetached;
+};
+
+// handles are ids of gParallelForTasks, WaitJob ignores the ones already released
+static std::mutex gParallelForMutex;
+static std::map<uint64_t, CParallelForTaskSet*> gParallelForTasks;
+static uint64_t gParallelForCounter = 0;
+// started by the C function running on this thread
+static thread_local std::vector<uint64_t> gParallelForStarted;
+
+// gParallelForMutex is locked
+static void FreeDetachedParallelFors()
+{
+    for (auto iter = gParallelForTasks.begin(); iter != gParallelForTasks.end();)
+    {
+        if (iter->second->mDetached && iter->second->GetIsComplete())
+        {
+            delete iter->second;
+            iter = gParallelForTasks.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+}
+
+size_t ParallelForMark()
+{
+    return gParallelForStarted.size();
+}
+
+void ReleaseParallelFors(size_t mark)
+{
+    if (gParallelForStarted.size() <= mark)
+        return;
+    std::lock_guard<std::mutex> lock(gParallelForMutex);
+    for (size_t i = mark; i < gParallelForStarted.size(); i++)
+    {
+        auto iter = gParallelForTasks.find(gParallelForStarted[i]);
+        if (iter != gParallelForTasks.end())
+            iter->second->mDetached = true;
+    }
+    gParallelForStarted.resize(mark);
+    FreeDetachedParallelFors();
+}
+
+void* Evaluation::ParallelFor(void(*function)(void *userData, int begin, int end), void *userData, int count, int grain)
+{
+    if (count <= 0)
+        return NULL;
+    if (grain <= 0)
+    {
+        // a few ranges per thread so uneven rows balance out
+        grain = ImMax(count / int(g_TS.GetNumTaskThreads() * 8), 1);
+    }
+    // userData isn't copied, unlike Job: it must stay valid until WaitJob or the end of the work
+    CParallelForTaskSet *taskSet = new CParallelForTaskSet(function, userData, count, grain);
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(gParallelForMutex);
+        FreeDetachedParallelFors();
+        id = ++gParallelForCounter;
+        gParallelForTasks[id] = taskSet;
+    }
+    gParallelForStarted.push_back(id);
+    g_TS.AddTaskSetToPipe(taskSet);
+    return (void*)uintptr_t(id);
+}
+
+int Evaluation::WaitJob(void *handle)
+{
+    if (!handle)
+        return EVAL_OK;
+    CParallelForTaskSet *taskSet;
+    {
+        std::lock_guard<std::mutex> lock(gParallelForMutex);
+        auto iter = gParallelForTasks.find(uint64_t(uintptr_t(handle)));
+        if (iter == gParallelForTasks.end())
+            return EVAL_ERR;
+        taskSet = iter->second;
+        gParallelForTasks.erase(iter);
+    }
+    // the calling thread runs ranges too
+    g_TS.WaitforTask(taskSet);
+    delete taskSet;
+    return EVAL_OK;
+}
+
 void Evaluation::SetBlendingMode(int target, int blendSrc, int blendDst)
 {
     EvaluationStage& evaluation = gEvaluation.mStages[target];
@@ -770,13 +1307,6 @@ void Evaluation::BindGLSLParameters(EvaluationStage& stage)
     }
 }
 
-void EvaluationStage::Clear()
-{
-    if (gEvaluationMask&EvaluationGLSL)
-        glDeleteBuffers(1, &mParametersBuffer);
-    mParametersBuffer = 0;
-}
-
 unsigned int Evaluation::UploadImage(Image *image, unsigned int textureId, int cubeFace)
 {
     if (!textureId)
@@ -949,66 +1479,138 @@ int Evaluation::SetEvaluationCubeSize(int target, int faceWidth)
 #include "Loader.h"
 #include "TiledRenderer.h"
 #include "ProgressiveRenderer.h"
+#include "CPURenderer.h"
+#include "Denoiser.h"
 #include "GPUBVH.h"
 #include "Camera.h"
+#include "ScenePool.h"
 
+// blocks the calling thread until the scene is loaded, C nodes written before LoadSceneAsync call it from a Job
 int Evaluation::LoadScene(const char *filename, void **pscene)
 {
-    // todo: make a real good cache system
-    static std::map<std::string, GLSLPathTracer::Scene *> cachedScenes;
-    std::string sFilename(filename);
-    auto iter = cachedScenes.find(sFilename);
-    if (iter != cachedScenes.end())
-    {
-        *pscene = iter->second;
-        return EVAL_OK;
-    }
+    GLSLPathTracer::Scene *scene = nullptr;
+    float progress = 0.f;
+    if (gScenePool.Request(filename, true, &scene, &progress) != ScenePool::Loaded)
+        return EVAL_ERR;
+    *pscene = scene;
+    return EVAL_OK;
+}
 
-    GLSLPathTracer::Scene *scene = GLSLPathTracer::LoadScene(sFilename);
-    if (!scene)
+int Evaluation::LoadSceneAsync(int target, const char *filename, void **pscene)
+{
+    GLSLPathTracer::Scene *scene = nullptr;
+    float progress = 0.f;
+    ScenePool::Status status = gScenePool.Request(filename, gCurrentContext->IsSynchronous(), &scene, &progress);
+    if (status == ScenePool::Loading)
     {
-        Log("Unable to load scene\n");
-        return EVAL_ERR;
+        // the node is evaluated again until the load task is done
+        gCurrentContext->StageSetProcessing(target, 1);
+        gCurrentContext->StageSetProgress(target, progress);
+        return EVAL_DIRTY;
     }
-    cachedScenes.insert(std::make_pair(sFilename, scene));
+    gCurrentContext->StageSetProcessing(target, 0);
+    if (status == ScenePool::Failed)
+        return EVAL_ERR;
     *pscene = scene;
+    return EVAL_OK;
+}
 
-    Log("Scene Loaded\n\n");
-
-    scene->buildBVH();
+template<int Width> static void BenchmarkTraversal(const GLSLPathTracer::WideBVH<Width>& wideBVH, const glm::vec3& origin, const std::vector<glm::vec3>& directions)
+{
+    int hits = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const auto& direction : directions)
+    {
+        float t = 1000000.f;
+        int triIndex;
+        hits += wideBVH.intersect(origin, direction, t, triIndex) ? 1 : 0;
+    }
+    double closestSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
 
-    // --------Print info on memory usage ------------- //
+    start = std::chrono::high_resolution_clock::now();
+    for (const auto& direction : directions)
+        wideBVH.occluded(origin, direction, 1000000.f);
+    double occludedSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
 
-    Log("Triangles: %d\n", scene->triangleIndices.size());
-    Log("Triangle Indices: %d\n", scene->gpuBVH->bvhTriangleIndices.size());
-    Log("Vertices: %d\n", scene->vertexData.size());
+    Log("BVH%d traversal : %d nodes, closest hit %6.2f Mrays/s, any hit %6.2f Mrays/s, %d hits for %d rays\n", Width, int(wideBVH.nodes.size()),
+        float(directions.size() / closestSeconds * 1e-6), float(directions.size() / occludedSeconds * 1e-6), hits, int(directions.size()));
+}
 
-    long long scene_data_bytes =
-        sizeof(GLSLPathTracer::GPUBVHNode) * scene->gpuBVH->bvh->getNumNodes() +
-        sizeof(GLSLPathTracer::TriangleData) * scene->gpuBVH->bvhTriangleIndices.size() +
-        sizeof(GLSLPathTracer::VertexData) * scene->vertexData.size() +
-        sizeof(GLSLPathTracer::NormalTexData) * scene->normalTexData.size() +
-        sizeof(GLSLPathTracer::MaterialData) * scene->materialData.size() +
-        sizeof(GLSLPathTracer::LightData) * scene->lightData.size();
+void Evaluation::BenchmarkBVH(const char *filename)
+{
+    GLSLPathTracer::Scene *scene = GLSLPathTracer::LoadScene(filename);
+    if (!scene)
+    {
+        Log("Unable to load scene %s\n", filename);
+        return;
+    }
 
-    Log("GPU Memory used for BVH and scene data: %d MB\n", scene_data_bytes / 1048576);
+    for (int parallel = 0; parallel < 2; parallel++)
+    {
+        BVH::Stats stats;
+        BVH::BuildParams params;
+        params.enablePrints = false;
+        params.stats = &stats;
+        params.taskScheduler = parallel ? &g_TS : nullptr;
 
-    long long tex_data_bytes =
-        scene->texData.albedoTextureSize.x * scene->texData.albedoTextureSize.y * scene->texData.albedoTexCount * 3 +
-        scene->texData.metallicRoughnessTextureSize.x * scene->texData.metallicRoughnessTextureSize.y * scene->texData.metallicRoughnessTexCount * 3 +
-        scene->texData.normalTextureSize.x * scene->texData.normalTextureSize.y * scene->texData.normalTexCount * 3 +
-        scene->hdrLoaderRes.width * scene->hdrLoaderRes.height * sizeof(GL_FLOAT) * 3;
+        auto start = std::chrono::high_resolution_clock::now();
+        BVH *bvh = scene->createBVH(params);
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        Log("BVH build %-8s : %7.3f s, SAH cost %8.2f, %d nodes, %d triangle references for %d triangles\n", parallel ? "parallel" : "serial",
+            float(seconds), stats.SAHCost, stats.numInnerNodes + stats.numLeafNodes, stats.numTris, int(scene->triangleIndices.size()));
+        delete bvh->getScene();
+        delete bvh;
+    }
 
-    Log("GPU Memory used for Textures: %d MB\n", tex_data_bytes / 1048576);
+    // traversal: one thread, camera rays at the scene resolution
+    scene->buildBVH(&g_TS);
+    const GLSLPathTracer::Camera *camera = scene->camera;
+    glm::ivec2 resolution = scene->renderOptions.resolution;
+    float tanHalfFov = tanf(camera->fov * 0.5f);
+    std::vector<glm::vec3> directions;
+    directions.reserve(size_t(resolution.x) * resolution.y);
+    for (int y = 0; y < resolution.y; y++)
+    {
+        for (int x = 0; x < resolution.x; x++)
+        {
+            float dx = (2.f * (x + 0.5f) / resolution.x - 1.f) * tanHalfFov * resolution.x / resolution.y;
+            float dy = (2.f * (y + 0.5f) / resolution.y - 1.f) * tanHalfFov;
+            directions.push_back(glm::normalize(dx * camera->right + dy * camera->up + camera->forward));
+        }
+    }
+    BenchmarkTraversal(GLSLPathTracer::WideBVH<2>(scene->gpuBVH, scene->vertexData), camera->position, directions);
+    BenchmarkTraversal(GLSLPathTracer::WideBVH<4>(scene->gpuBVH, scene->vertexData), camera->position, directions);
+    BenchmarkTraversal(GLSLPathTracer::WideBVH<8>(scene->gpuBVH, scene->vertexData), camera->position, directions);
+    delete scene;
+}
 
-    Log("Total GPU Memory used: %d MB\n", (scene_data_bytes + tex_data_bytes) / 1048576);
+// stages hold a reference on their scene. The renderer of a stage is bound to its scene.
+static void SetStageScene(EvaluationStage& stage, void *scene)
+{
+    if (stage.scene == scene)
+        return;
+    delete (GLSLPathTracer::Renderer*)stage.renderer;
+    stage.renderer = nullptr;
+    if (scene)
+        gScenePool.AddRef((GLSLPathTracer::Scene*)scene);
+    if (stage.scene)
+        gScenePool.Release((GLSLPathTracer::Scene*)stage.scene);
+    stage.scene = scene;
+}
 
-    return EVAL_OK;
+void EvaluationStage::Clear()
+{
+    if (gEvaluationMask&EvaluationGLSL)
+        glDeleteBuffers(1, &mParametersBuffer);
+    mParametersBuffer = 0;
+    SetStageScene(*this, nullptr);
+    delete (GLSLPathTracer::Denoiser*)denoiser;
+    denoiser = nullptr;
 }
 
 int Evaluation::SetEvaluationScene(int target, void *scene)
 {
-    gEvaluation.mStages[target].scene = scene;
+    SetStageScene(gEvaluation.mStages[target], scene);
     return EVAL_OK;
 }
 
@@ -1027,19 +1629,42 @@ int Evaluation::GetEvaluationRenderer(int target, void **renderer)
 int Evaluation::InitRenderer(int target, int mode, void *scene)
 {
     GLSLPathTracer::Scene *rdscene = (GLSLPathTracer::Scene *)scene;
-    gEvaluation.mStages[target].scene = scene;
+    SetStageScene(gEvaluation.mStages[target], scene);
 
+    // mode is the Tiled|Progressive|CPU enum of the PathTracer node
+    GLSLPathTracer::RendererType rendererType = (mode == 2) ? GLSLPathTracer::Renderer_CPU : ((mode == 1) ? GLSLPathTracer::Renderer_Progressive : GLSLPathTracer::Renderer_Tiled);
     GLSLPathTracer::Renderer *currentRenderer = (GLSLPathTracer::Renderer*)gEvaluation.mStages[target].renderer;
+    if (currentRenderer && currentRenderer->getType() != rendererType)
+    {
+        delete currentRenderer;
+        currentRenderer = nullptr;
+        gEvaluation.mStages[target].renderer = nullptr;
+    }
     if (!currentRenderer)
     {
-        //auto renderer = new GLSLPathTracer::TiledRenderer(rdscene, "Stock/PathTracer/Tiled/");
-        auto renderer = new GLSLPathTracer::ProgressiveRenderer(rdscene, "Stock/PathTracer/Progressive/");
+        GLSLPathTracer::Renderer *renderer;
+        if (rendererType == GLSLPathTracer::Renderer_CPU)
+            renderer = new GLSLPathTracer::CPURenderer(rdscene, &g_TS);
+        else if (rendererType == GLSLPathTracer::Renderer_Tiled)
+            renderer = new GLSLPathTracer::TiledRenderer(rdscene, "Stock/PathTracer/Tiled/");
+        else
+            renderer = new GLSLPathTracer::ProgressiveRenderer(rdscene, "Stock/PathTracer/Progressive/");
         renderer->init();
         gEvaluation.mStages[target].renderer = renderer;
     }
     return EVAL_OK;
 }
 
+int Evaluation::SetRendererNoiseThreshold(int target, float threshold)
+{
+    GLSLPathTracer::Renderer *renderer = (GLSLPathTracer::Renderer *)gEvaluation.mStages[target].renderer;
+    if (!renderer)
+        return EVAL_ERR;
+    if (renderer->getType() == GLSLPathTracer::Renderer_Progressive)
+        ((GLSLPathTracer::ProgressiveRenderer*)renderer)->setNoiseThreshold(threshold);
+    return EVAL_OK;
+}
+
 int Evaluation::UpdateRenderer(int target)
 {
     GLSLPathTracer::Renderer *renderer = (GLSLPathTracer::Renderer *)gEvaluation.mStages[target].renderer;
@@ -1056,17 +1681,38 @@ int Evaluation::UpdateRenderer(int target)
     }
 
     renderer->update(0.0166f);
-    auto tgt = gCurrentContext->GetRenderTarget(target);
     renderer->render();
 
-    tgt->BindAsTarget();
-    renderer->present();
+    if (renderer->getType() == GLSLPathTracer::Renderer_CPU)
+    {
+        // tiles are traced by tasks, upload the last completed pass if any
+        auto cpuRenderer = (GLSLPathTracer::CPURenderer*)renderer;
+        const unsigned char *bits = cpuRenderer->getImage();
+        if (bits)
+        {
+            glm::ivec2 size = cpuRenderer->getScreenSize();
+            Image image;
+            image.mWidth = size.x;
+            image.mHeight = size.y;
+            image.mNumMips = 1;
+            image.mNumFaces = 1;
+            image.mFormat = TextureFormat::RGBA8;
+            image.SetBits((unsigned char*)bits, size_t(size.x) * size.y * 4);
+            SetEvaluationImage(target, &image);
+        }
+    }
+    else
+    {
+        auto tgt = gCurrentContext->GetRenderTarget(target);
+        tgt->BindAsTarget();
+        renderer->present();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glUseProgram(0);
+    }
 
     float progress = renderer->getProgress();
     gCurrentContext->StageSetProgress(target, progress);
     bool renderDone = progress >= 1.f - FLT_EPSILON;
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glUseProgram(0);
 
     if (renderDone)
     {
@@ -1075,3 +1721,68 @@ int Evaluation::UpdateRenderer(int target)
     }
     return EVAL_DIRTY;
 }
+
+int Evaluation::DenoiseRenderer(int target, int source, int iterations, float colorSigma, float normalSigma, float depthSigma)
+{
+    EvaluationStage& stage = gEvaluation.mStages[target];
+    GLSLPathTracer::Renderer *renderer = (GLSLPathTracer::Renderer *)gEvaluation.mStages[source].renderer;
+    if (!renderer)
+        return EVAL_OK;
+    if (!stage.denoiser)
+        stage.denoiser = new GLSLPathTracer::Denoiser("Stock/PathTracer/Denoiser/", &g_TS);
+    auto denoiser = (GLSLPathTracer::Denoiser*)stage.denoiser;
+
+    GLSLPathTracer::DenoiserSettings settings;
+    settings.iterations = std::min(std::max(iterations, 0), 10);
+    settings.colorSigma = std::max(colorSigma, FLT_EPSILON);
+    settings.normalSigma = std::max(normalSigma, FLT_EPSILON);
+    settings.depthSigma = std::max(depthSigma, FLT_EPSILON);
+
+    if (renderer->getType() == GLSLPathTracer::Renderer_CPU)
+    {
+        // the source stage is evaluated every frame, filter each finished pass once
+        const glm::vec3 *color, *albedo;
+        const glm::vec4 *normalDepth;
+        int pass = ((GLSLPathTracer::CPURenderer*)renderer)->getDenoiserInputs(color, albedo, normalDepth);
+        if (pass < 0 || (pass == denoiser->filteredPass && settings == denoiser->filteredSettings))
+            return EVAL_OK;
+        denoiser->filteredPass = pass;
+        denoiser->filteredSettings = settings;
+
+        glm::ivec2 size = renderer->getScreenSize();
+        const unsigned char *bits = denoiser->filter(size, color, albedo, normalDepth, settings);
+        Image image;
+        image.mWidth = size.x;
+        image.mHeight = size.y;
+        image.mNumMips = 1;
+        image.mNumFaces = 1;
+        image.mFormat = TextureFormat::RGBA8;
+        image.SetBits((unsigned char*)bits, size_t(size.x) * size.y * 4);
+        SetEvaluationImage(target, &image);
+        return EVAL_OK;
+    }
+
+    denoiser->filteredPass = -1;
+    GLuint color, albedo, normalDepth;
+    auto tgt = gCurrentContext->GetRenderTarget(target);
+    if (renderer->getType() == GLSLPathTracer::Renderer_Progressive && ((GLSLPathTracer::ProgressiveRenderer*)renderer)->getDenoiserInputs(color, albedo, normalDepth))
+    {
+        denoiser->filter(renderer->getScreenSize(), color, albedo, normalDepth, settings);
+        tgt->BindAsTarget();
+        denoiser->present();
+    }
+    else
+    {
+        // only the progressive and CPU renderers write the guides, the tiled one is drawn unfiltered
+        if (renderer->getType() == GLSLPathTracer::Renderer_Tiled && !denoiser->passThroughLogged)
+        {
+            Log("Denoiser: the tiled renderer has no albedo/normal guides, its output is not filtered. Use the progressive or CPU renderer.\n");
+            denoiser->passThroughLogged = true;
+        }
+        tgt->BindAsTarget();
+        renderer->present();
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glUseProgram(0);
+    return EVAL_OK;
+}
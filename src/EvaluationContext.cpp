@@ -28,8 +28,10 @@
 #include "EvaluationContext.h"
 #include "Evaluators.h"
 #include "NodesDelegate.h"
+#include "PythonWorker.h"
 
 EvaluationContext *gCurrentContext = NULL;
+thread_local JobTag gCurrentJobTag;
 
 static const unsigned int wrap[] = { GL_REPEAT, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_BORDER, GL_MIRRORED_REPEAT };
 static const unsigned int filter[] = { GL_LINEAR, GL_NEAREST };
@@ -90,6 +92,11 @@ EvaluationContext::EvaluationContext(Evaluation& evaluation, bool synchronousEva
 
 EvaluationContext::~EvaluationContext()
 {
+    // Python runs still queued for this context see their tag cancelled and don't touch it,
+    // the one being run is waited for
+    for (auto& generation : mJobGenerations)
+        (*generation)++;
+    gPythonWorker.WaitCurrentJob();
     for (auto& stream : mWriteStreams)
     {
         stream.second->Finish();
@@ -115,6 +122,9 @@ void EvaluationContext::Clear()
     mbDirty.clear();
     mbProcessing.clear();
     mProgress.clear();
+    for (auto& generation : mJobGenerations)
+        (*generation)++;
+    mJobGenerations.clear();
 }
 
 unsigned int EvaluationContext::GetEvaluationTexture(size_t target)
@@ -243,8 +253,7 @@ void EvaluationContext::EvaluateGLSLCompute(const EvaluationStage& evaluationSta
         UploadVertices(bladeVertices, sizeof(bladeVertices));
     }
 
-    const Evaluator& evaluator = gEvaluators.GetEvaluator(evaluationStage.mNodeType);
-    const unsigned int program = evaluator.mGLSLProgram;
+    const unsigned int program = gEvaluators.GetGLSLProgram(evaluationStage.mNodeType);
 
     // allocate buffer
     unsigned int feedbackVertexArray = 0;
@@ -318,8 +327,7 @@ void EvaluationContext::EvaluateGLSL(const EvaluationStage& evaluationStage, siz
         DebugBreak();
     }
     */
-    const Evaluator& evaluator = gEvaluators.GetEvaluator(evaluationStage.mNodeType);
-    const unsigned int program = evaluator.mGLSLProgram;
+    const unsigned int program = gEvaluators.GetGLSLProgram(evaluationStage.mNodeType);
     const int blendOps[] = { evaluationStage.mBlendingSrc, evaluationStage.mBlendingDst };
     unsigned int blend[] = { GL_ONE, GL_ZERO };
 
@@ -346,6 +354,18 @@ void EvaluationContext::EvaluateGLSL(const EvaluationStage& evaluationStage, siz
         camera->ComputeViewProjectionMatrix(evaluationInfo.viewProjection, evaluationInfo.viewInverse);
     }
 
+    IrradianceSHInfo irradianceSH;
+    memset(&irradianceSH, 0, sizeof(IrradianceSHInfo));
+    for (int inputIndex = 0; inputIndex < 8; inputIndex++)
+    {
+        const int targetIndex = input.mInputs[inputIndex];
+        if (targetIndex < 0 || !mStageTarget[targetIndex] || !mStageTarget[targetIndex]->mbIrradianceSH)
+            continue;
+        memcpy(irradianceSH.coefficients[inputIndex * 9], mStageTarget[targetIndex]->mIrradianceSH, sizeof(float) * 9 * 4);
+        irradianceSH.valid[inputIndex] = 1;
+    }
+    gEvaluators.SetIrradianceSH(irradianceSH);
+
     size_t faceCount = evaluationInfo.uiPass ? 1 : tgt->mImage.mNumFaces;
     for (size_t face = 0; face < faceCount; face++)
     {
@@ -421,7 +441,13 @@ void EvaluationContext::EvaluateC(const EvaluationStage& evaluationStage, size_t
         const Evaluator& evaluator = gEvaluators.GetEvaluator(evaluationStage.mNodeType);
         if (evaluator.mCFunction)
         {
+            // jobs queued by the node are tagged with this evaluation
+            JobTag previousTag = gCurrentJobTag;
+            gCurrentJobTag = StageNewJobTag(index);
+            size_t parallelForMark = ParallelForMark();
             int res = evaluator.mCFunction((unsigned char*)evaluationStage.mParameters.data(), &evaluationInfo);
+            ReleaseParallelFors(parallelForMark);
+            gCurrentJobTag = previousTag;
             if (res == EVAL_DIRTY)
             {
                 mStillDirty.push_back(uint32_t(index));
@@ -436,15 +462,34 @@ void EvaluationContext::EvaluateC(const EvaluationStage& evaluationStage, size_t
 
 void EvaluationContext::EvaluatePython(const EvaluationStage& evaluationStage, size_t index, EvaluationInfo& evaluationInfo)
 {
-    try // todo: find a better solution than a try catch
-    {
-        const Evaluator& evaluator = gEvaluators.GetEvaluator(evaluationStage.mNodeType);
-        evaluator.RunPython();
-    }
-    catch (...)
+    const Evaluator& evaluator = gEvaluators.GetEvaluator(evaluationStage.mNodeType);
+    EvaluationContext *context = this;
+    if (mbSynchronousEvaluation)
     {
-
+        // bakes and Evaluate calls need the image before returning
+        gPythonWorker.Call([&]() { evaluator.RunPython(evaluationStage.mParameters, evaluationInfo, context); });
+        return;
     }
+    // the script runs on the Python worker with copies of the stage state, the node is
+    // processing until it's done, like a C job
+    StageSetProcessing(index, 1);
+    Evaluator pythonEvaluator = evaluator;
+    std::vector<unsigned char> parameters = evaluationStage.mParameters;
+    EvaluationInfo info = evaluationInfo;
+    JobTag tag = StageNewJobTag(index);
+    gPythonWorker.Post([pythonEvaluator, parameters, info, context, index, tag]() {
+        // superseded while queued, the newer run clears processing. Also cancelled when the context is destroyed
+        if (tag.IsCancelled())
+            return;
+        gCurrentJobTag = tag;
+        pythonEvaluator.RunPython(parameters, info, context);
+        gCurrentJobTag = JobTag();
+        gPythonWorker.PostToMainThread([context, index, tag]() {
+            // context may be gone by now, the tag tells
+            if (!tag.IsCancelled())
+                context->StageSetProcessing(index, 0);
+        });
+    });
 }
 
 
@@ -700,11 +745,14 @@ void EvaluationContext::UserAddStage()
     URAdd<bool> undoRedoAddDirty(int(mbDirty.size()), []() {return &gCurrentContext->mbDirty; });
     URAdd<int> undoRedoAddProcessing(int(mbProcessing.size()), []() {return &gCurrentContext->mbProcessing; });
     URAdd<float> undoRedoAddProgress(int(mProgress.size()), []() {return &gCurrentContext->mProgress; });
+    GrowJobGenerations(mStageTarget.size());
+    URAdd<std::shared_ptr<std::atomic<int> > > undoRedoAddJobGeneration(int(mJobGenerations.size()), []() {return &gCurrentContext->mJobGenerations; });
 
     mStageTarget.push_back(std::make_shared<RenderTarget>());
     mbDirty.push_back(true);
     mbProcessing.push_back(0);
     mProgress.push_back(0.f);
+    mJobGenerations.push_back(std::make_shared<std::atomic<int> >(0));
 }
 
 void EvaluationContext::UserDeleteStage(size_t index)
@@ -713,6 +761,14 @@ void EvaluationContext::UserDeleteStage(size_t index)
     URDel<bool> undoRedoDelDirty(int(index), []() {return &gCurrentContext->mbDirty; });
     URDel<int> undoRedoDelProcessing(int(index), []() {return &gCurrentContext->mbProcessing; });
     URDel<float> undoRedoDelProgress(int(index), []() {return &gCurrentContext->mProgress; });
+    // undo puts the counter back in place, the jobs cancelled below stay cancelled
+    GrowJobGenerations(mStageTarget.size());
+    URDel<std::shared_ptr<std::atomic<int> > > undoRedoDelJobGeneration(int(index), []() {return &gCurrentContext->mJobGenerations; });
+
+    // jobs of this stage and of the following ones hold indices that are no longer valid
+    for (size_t i = index; i < mJobGenerations.size(); i++)
+        (*mJobGenerations[i])++;
+    mJobGenerations.erase(mJobGenerations.begin() + index);
 
     mStageTarget.erase(mStageTarget.begin() + index);
     mbDirty.erase(mbDirty.begin() + index);
@@ -754,6 +810,21 @@ void EvaluationContext::StageSetProcessing(size_t target, int processing)
     mbProcessing[target] = processing; 
 }
 
+void EvaluationContext::GrowJobGenerations(size_t count)
+{
+    while (mJobGenerations.size() < count)
+        mJobGenerations.push_back(std::make_shared<std::atomic<int> >(0));
+}
+
+JobTag EvaluationContext::StageNewJobTag(size_t target)
+{
+    GrowJobGenerations(target + 1);
+    JobTag tag;
+    tag.mGeneration = mJobGenerations[target];
+    tag.mValue = ++(*tag.mGeneration);
+    return tag;
+}
+
 void EvaluationContext::StageSetProgress(size_t target, float progress)
 {
     mProgress.resize(gEvaluation.GetStagesCount(), 0.f);
@@ -23,9 +23,27 @@
 // SOFTWARE.
 //
 #pragma once
+#include <atomic>
 #include <memory>
 #include "Evaluation.h"
 
+// Identifies the evaluation that queued an asynchronous job. A newer evaluation of the same
+// stage bumps its generation: older jobs poll IsJobCancelled to skip their work and upload.
+struct JobTag
+{
+    std::shared_ptr<std::atomic<int> > mGeneration;
+    int mValue{ 0 };
+    bool IsCancelled() const { return mGeneration && mGeneration->load() != mValue; }
+};
+
+// tag of the evaluation or job running on this thread, copied by jobs queued from it
+extern thread_local JobTag gCurrentJobTag;
+
+// ParallelFor handles started on this thread since the mark are released when the C function that
+// started them returns: the ones WaitJob didn't free are deleted once their work is done
+size_t ParallelForMark();
+void ReleaseParallelFors(size_t mark);
+
 struct EvaluationContext
 {
     EvaluationContext(Evaluation& evaluation, bool synchronousEvaluation, int defaultWidth, int defaultHeight);
@@ -48,10 +66,14 @@ struct EvaluationContext
     FFMPEGCodec::Encoder *GetEncoder(const std::string &filename, int width, int height);
     bool IsSynchronous() const { return mbSynchronousEvaluation; }
     void SetTargetDirty(size_t target, bool onlyChild = false);
+    bool StageIsDirty(size_t target) const { if (target >= mbDirty.size()) return false; return mbDirty[target]; }
+    void StageSetDirty(size_t target, bool dirty) { if (target < mbDirty.size()) mbDirty[target] = dirty; }
     int StageIsProcessing(size_t target) const { if (target >= mbProcessing.size()) return 0; return mbProcessing[target]; }
     float StageGetProgress(size_t target) const { if (target >= mProgress.size()) return 0.f; return mProgress[target]; }
     void StageSetProcessing(size_t target, int processing);
     void StageSetProgress(size_t target, float progress);
+    // new evaluation of a stage, jobs tagged by the previous ones are cancelled
+    JobTag StageNewJobTag(size_t target);
 
     void AllocRenderTargetsForEditingPreview();
 
@@ -82,6 +104,8 @@ protected:
     void RunNode(size_t nodeIndex);
 
     void RecurseBackward(size_t target, std::vector<size_t>& usedNodes);
+    // generations are created lazily, make sure there is one for each of the first count stages
+    void GrowJobGenerations(size_t count);
 
     void BindTextures(const EvaluationStage& evaluationStage, unsigned int program);
     void AllocRenderTargetsForBaking(const std::vector<size_t>& nodesToEvaluate);
@@ -96,6 +120,7 @@ protected:
     std::vector<bool> mbDirty;
     std::vector<int> mbProcessing;
     std::vector<float> mProgress;
+    std::vector<std::shared_ptr<std::atomic<int> > > mJobGenerations;
     EvaluationInfo mEvaluationInfo;
 
     std::vector<int> mStillDirty;
@@ -25,9 +25,21 @@
 #include <GL/gl3w.h>    // Initialize with gl3wInit()
 #include "Evaluators.h"
 #include "Evaluation.h"
+#include "ProgramCache.h"
+#include "HotReload.h"
+#include "FrameCache.h"
+#include "EvaluationContext.h"
+#include "PythonWorker.h"
 #include "nfd.h"
+#include <chrono>
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <sys/stat.h>
+#endif
 
 Evaluators gEvaluators;
+// content of gIrradianceSHGLSLBuffer
+static IrradianceSHInfo gIrradianceSHUploaded;
 
 struct EValuationFunction
 {
@@ -53,20 +65,28 @@ static const EValuationFunction evaluationFunctions[] = {
     { "SetEvaluationCubeSize", (void*)Evaluation::SetEvaluationCubeSize },
     { "AllocateComputeBuffer", (void*)Evaluation::AllocateComputeBuffer },
     { "CubemapFilter", (void*)Evaluation::CubemapFilter},
+    { "CubemapIrradiance", (void*)Evaluation::CubemapIrradiance},
+    { "SetEvaluationIrradianceSH", (void*)Evaluation::SetEvaluationIrradianceSH},
     { "SetProcessing", (void*)Evaluation::SetProcessing},
     { "Job", (void*)Evaluation::Job },
     { "JobMain", (void*)Evaluation::JobMain },
+    { "IsJobCancelled", (void*)Evaluation::IsJobCancelled },
+    { "ParallelFor", (void*)Evaluation::ParallelFor },
+    { "WaitJob", (void*)Evaluation::WaitJob },
     { "memmove", memmove },
     { "strcpy", strcpy },
     { "strlen", strlen },
     { "fabsf", fabsf },
     { "LoadSVG", (void*)Evaluation::LoadSVG},
     { "LoadScene", (void*)Evaluation::LoadScene},
+    { "LoadSceneAsync", (void*)Evaluation::LoadSceneAsync},
     { "SetEvaluationScene", (void*)Evaluation::SetEvaluationScene},
     { "GetEvaluationScene", (void*)Evaluation::GetEvaluationScene},
     { "GetEvaluationRenderer", (void*)Evaluation::GetEvaluationRenderer},
     { "InitRenderer", (void*)Evaluation::InitRenderer},
+    { "SetRendererNoiseThreshold", (void*)Evaluation::SetRendererNoiseThreshold},
     { "UpdateRenderer", (void*)Evaluation::UpdateRenderer},
+    { "DenoiseRenderer", (void*)Evaluation::DenoiseRenderer},
 };
 
 static void libtccErrorFunc(void *opaque, const char *msg)
@@ -75,6 +95,148 @@ static void libtccErrorFunc(void *opaque, const char *msg)
     Log("\n");
 }
 
+typedef int(*CFunction)(void *parameters, void *evaluationInfo);
+
+static bool CompileTCC(const std::string& text, const char *name, void **mem, CFunction *function)
+{
+    TCCState *s = tcc_new();
+
+    int *noLib = (int*)s;
+    noLib[2] = 1; // no stdlib
+
+    tcc_set_error_func(s, 0, libtccErrorFunc);
+    tcc_add_include_path(s, "Nodes/C/");
+    tcc_set_output_type(s, TCC_OUTPUT_MEMORY);
+
+    if (tcc_compile_string(s, text.c_str()) != 0)
+    {
+        Log("%s - Compilation error!\n", name);
+        tcc_delete(s);
+        return false;
+    }
+
+    for (auto& evaluationFunction : evaluationFunctions)
+        tcc_add_symbol(s, evaluationFunction.szFunctionName, evaluationFunction.function);
+
+    int size = tcc_relocate(s, NULL);
+    if (size == -1)
+    {
+        Log("%s - Libtcc unable to relocate program!\n", name);
+        tcc_delete(s);
+        return false;
+    }
+    *mem = malloc(size);
+    tcc_relocate(s, *mem);
+
+    *(void**)(function) = tcc_get_symbol(s, "main");
+    if (!*function)
+    {
+        Log("%s - No main function!\n", name);
+    }
+    tcc_delete(s);
+    return true;
+}
+
+// Native backend: nodes are built by the system C compiler as shared objects, cached by source hash.
+// API functions are turned into function pointers by a generated prelude and bound after loading,
+// C runtime functions are left to the compiler and its libraries.
+static const char *nativeCacheDirectory = "NativeC/";
+static const char *nativeRuntimeFunctions[] = { "memmove", "strcpy", "strlen", "fabsf" };
+
+static bool IsNativeRuntimeFunction(const char *name)
+{
+    for (auto runtimeFunction : nativeRuntimeFunctions)
+    {
+        if (!strcmp(runtimeFunction, name))
+            return true;
+    }
+    return false;
+}
+
+static bool CompileNative(const std::string& sourcePath, const std::string& text, const std::string& filename, void **handle, CFunction *function)
+{
+#ifdef _WIN32
+    return false;
+#else
+    const char *compiler = getenv("IMOGEN_CC");
+    if (!compiler)
+        compiler = "cc";
+    std::string prelude = "// generated by Imogen, binds API calls to pointers set after dlopen\n";
+    for (auto& evaluationFunction : evaluationFunctions)
+    {
+        if (!IsNativeRuntimeFunction(evaluationFunction.szFunctionName))
+            prelude += std::string("#define ") + evaluationFunction.szFunctionName + " (*imogen_" + evaluationFunction.szFunctionName + ")\n";
+    }
+    const std::string flags = " -O2 -fPIC -shared -w -I\"Nodes/C/\"";
+
+    std::string keyText = std::string(compiler) + flags + prelude + text;
+    char keyString[32];
+    snprintf(keyString, sizeof(keyString), "%016llx", (unsigned long long)Hash64(keyText.data(), keyText.size()));
+    const std::string baseName = ReplaceAll(filename, ".c", "");
+    const std::string libraryPath = std::string(nativeCacheDirectory) + baseName + "_" + keyString + ".so";
+
+    struct stat libraryStat;
+    if (stat(libraryPath.c_str(), &libraryStat) != 0)
+    {
+        mkdir(nativeCacheDirectory, 0755);
+        const std::string preludePath = std::string(nativeCacheDirectory) + "Prelude.h";
+        FILE *fp = fopen(preludePath.c_str(), "wt");
+        if (!fp)
+            return false;
+        fputs(prelude.c_str(), fp);
+        fclose(fp);
+
+        const std::string tmpPath = libraryPath + ".tmp";
+        std::string command = std::string(compiler) + flags + " -include \"" + preludePath + "\" -o \"" + tmpPath + "\" \"" + sourcePath + "\" -lm";
+        if (system(command.c_str()) != 0 || !ReplaceFileAtomic(tmpPath.c_str(), libraryPath.c_str()))
+        {
+            Log("%s - Native compilation failed, using TCC.\n", filename.c_str());
+            remove(tmpPath.c_str());
+            return false;
+        }
+
+        // objects built from previous versions of this node
+        std::vector<std::string> libraries;
+        DiscoverFiles("so", nativeCacheDirectory, libraries);
+        const std::string stalePrefix = std::string(nativeCacheDirectory) + baseName + "_";
+        for (auto& library : libraries)
+        {
+            if (library != libraryPath && library.compare(0, stalePrefix.size(), stalePrefix) == 0 && library.size() == libraryPath.size())
+                remove(library.c_str());
+        }
+    }
+
+    void *library = dlopen(libraryPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!library)
+    {
+        Log("%s - %s\n", filename.c_str(), dlerror());
+        return false;
+    }
+    for (auto& evaluationFunction : evaluationFunctions)
+    {
+        void **slot = (void**)dlsym(library, (std::string("imogen_") + evaluationFunction.szFunctionName).c_str());
+        if (slot)
+            *slot = evaluationFunction.function;
+    }
+    *(void**)(function) = dlsym(library, "main");
+    if (!*function)
+    {
+        Log("%s - No main function!\n", filename.c_str());
+        dlclose(library);
+        return false;
+    }
+    *handle = library;
+    return true;
+#endif
+}
+
+static void CloseNative(void *handle)
+{
+#ifndef _WIN32
+    dlclose(handle);
+#endif
+}
+
 void LogPython(const std::string &str)
 {
     Log(str.c_str());
@@ -82,6 +244,26 @@ void LogPython(const std::string &str)
 
 PYBIND11_MAKE_OPAQUE(Image);
 
+static const std::vector<unsigned char> *gPythonParameters = NULL;
+static const EvaluationInfo *gPythonEvaluationInfo = NULL;
+static EvaluationContext *gPythonEvaluationContext = NULL;
+
+// bindings touching GL, the library or the UI run on the main thread, GIL released.
+// The context of the node being run is made current so a bake in progress isn't affected
+template <typename T> T OnMainThread(const std::function<T()>& function)
+{
+    EvaluationContext *context = gPythonEvaluationContext;
+    T res = T();
+    gPythonWorker.RunOnMainThread([&]() {
+        EvaluationContext *previousContext = gCurrentContext;
+        if (context)
+            gCurrentContext = context;
+        res = function();
+        gCurrentContext = previousContext;
+    });
+    return res;
+}
+
 struct PyGraph {
     Material* mGraph;
 };
@@ -94,7 +276,52 @@ struct PyNode {
 
 PYBIND11_EMBEDDED_MODULE(Imogen, m) 
 {
-    pybind11::class_<Image>(m, "Image");
+    // pixels are exposed through the buffer protocol: numpy.asarray(image) is a view, no copy.
+    // shape is (height, width, components) or (faces, height, width, components) for cubemaps, mip 0 only.
+    pybind11::class_<Image>(m, "Image", pybind11::buffer_protocol())
+        .def(pybind11::init<>())
+        .def(pybind11::init([](int width, int height, int format, int faces) {
+            Image *image = new Image;
+            image->mWidth = width;
+            image->mHeight = height;
+            image->mFormat = uint8_t(format);
+            image->mNumFaces = uint8_t(faces);
+            image->mNumMips = 1;
+            size_t size = size_t(width) * height * faces * GetTexelSize(image->mFormat);
+            image->Allocate(size);
+            memset(image->GetBits(), 0, size);
+            return image;
+        }), pybind11::arg("width"), pybind11::arg("height"), pybind11::arg("format") = int(TextureFormat::RGBA8), pybind11::arg("faces") = 1)
+        .def_readonly("width", &Image::mWidth)
+        .def_readonly("height", &Image::mHeight)
+        .def_readonly("format", &Image::mFormat)
+        .def_readonly("faces", &Image::mNumFaces)
+        .def_readonly("mips", &Image::mNumMips)
+        .def_buffer([](Image& image) -> pybind11::buffer_info {
+            if (!image.GetBits())
+                throw std::runtime_error("Image has no pixels");
+            const pybind11::ssize_t components = GetTexelComponentCount(image.mFormat);
+            const pybind11::ssize_t itemSize = GetTexelSize(image.mFormat) / components;
+            std::string format = pybind11::format_descriptor<unsigned char>::format();
+            if (itemSize == 2)
+                format = (image.mFormat == TextureFormat::RGB16F || image.mFormat == TextureFormat::RGBA16F) ? "e" : pybind11::format_descriptor<uint16_t>::format();
+            else if (itemSize == 4)
+                format = pybind11::format_descriptor<float>::format();
+            const pybind11::ssize_t rowStride = image.mWidth * components * itemSize;
+            if (image.mNumFaces == 1)
+            {
+                return pybind11::buffer_info(image.GetBits(), itemSize, format, 3,
+                    { pybind11::ssize_t(image.mHeight), pybind11::ssize_t(image.mWidth), components },
+                    { rowStride, components * itemSize, itemSize });
+            }
+            // faces are stored one after the other, each with its mip chain
+            pybind11::ssize_t faceStride = 0;
+            for (int i = 0; i < image.mNumMips; i++)
+                faceStride += pybind11::ssize_t(image.mWidth >> i) * (image.mHeight >> i) * components * itemSize;
+            return pybind11::buffer_info(image.GetBits(), itemSize, format, 4,
+                { pybind11::ssize_t(image.mNumFaces), pybind11::ssize_t(image.mHeight), pybind11::ssize_t(image.mWidth), components },
+                { faceStride, rowStride, components * itemSize, itemSize });
+        });
     auto graph = pybind11::class_<PyGraph>(m, "Graph");
     graph.def("GetEvaluationList", [](PyGraph& pyGraph) {
         auto d = pybind11::list();
@@ -231,92 +458,139 @@ PYBIND11_EMBEDDED_MODULE(Imogen, m)
         }
         return d;
     });
-    m.def("RegisterPlugin", [](std::string& name, std::string command) {
-        imogen.mRegisteredPlugins.push_back({ name, command });
-        Log("Plugin registered : %s \n", name.c_str());
-    });
+    // image transfers, encoding and filtering don't need the interpreter: the GIL is released
+    // so other Python threads keep running. Evaluate may run Python nodes, RunPython takes it back.
+    typedef pybind11::call_guard<pybind11::gil_scoped_release> ReleaseGIL;
+    m.def("RegisterPlugin", [](const std::string& name, const std::string& command) {
+        OnMainThread<int>([&]() {
+            imogen.mRegisteredPlugins.push_back({ name, command });
+            Log("Plugin registered : %s \n", name.c_str());
+            return 0;
+        });
+    }, ReleaseGIL());
     m.def("FileDialogRead", []() {
-        nfdchar_t *outPath = NULL;
-        nfdresult_t result = NFD_OpenDialog(NULL, NULL, &outPath);
+        return OnMainThread<std::string>([]() {
+            nfdchar_t *outPath = NULL;
+            nfdresult_t result = NFD_OpenDialog(NULL, NULL, &outPath);
 
-        if (result == NFD_OKAY)
-        {
-            std::string res = outPath;
-            free(outPath);
-            return res;
-        }
-        return std::string();
-
-    });
+            if (result == NFD_OKAY)
+            {
+                std::string res = outPath;
+                free(outPath);
+                return res;
+            }
+            return std::string();
+        });
+    }, ReleaseGIL());
     m.def("FileDialogWrite", []() {
-        nfdchar_t *outPath = NULL;
-        nfdresult_t result = NFD_SaveDialog(NULL, NULL, &outPath);
+        return OnMainThread<std::string>([]() {
+            nfdchar_t *outPath = NULL;
+            nfdresult_t result = NFD_SaveDialog(NULL, NULL, &outPath);
 
-        if (result == NFD_OKAY)
-        {
-            std::string res = outPath;
-            free(outPath);
-            return res;
-        }
-        return std::string();
-    });
+            if (result == NFD_OKAY)
+            {
+                std::string res = outPath;
+                free(outPath);
+                return res;
+            }
+            return std::string();
+        });
+    }, ReleaseGIL());
     m.def("Log", LogPython );
-    m.def("ReadImage", Evaluation::ReadImage );
-    m.def("WriteImage", Evaluation::WriteImage );
-    m.def("GetEvaluationImage", Evaluation::GetEvaluationImage );
-    m.def("SetEvaluationImage", Evaluation::SetEvaluationImage );
-    m.def("SetEvaluationImageCube", Evaluation::SetEvaluationImageCube );
+    m.def("ReadImage", [](const std::string& filename, Image *image) { return Evaluation::ReadImage((char*)filename.c_str(), image); }, ReleaseGIL());
+    m.def("WriteImage", [](const std::string& filename, Image *image, int format, int quality) { return Evaluation::WriteImage((char*)filename.c_str(), image, format, quality); }, ReleaseGIL());
+    m.def("GetEvaluationImage", [](int target, Image *image) {
+        return OnMainThread<int>([&]() { return Evaluation::GetEvaluationImage(target, image); });
+    }, ReleaseGIL());
+    m.def("SetEvaluationImage", [](int target, Image *image) {
+        return OnMainThread<int>([&]() { return Evaluation::SetEvaluationImage(target, image); });
+    }, ReleaseGIL());
+    m.def("SetEvaluationImageCube", [](int target, Image *image, int cubeFace) {
+        return OnMainThread<int>([&]() { return Evaluation::SetEvaluationImageCube(target, image, cubeFace); });
+    }, ReleaseGIL());
     m.def("AllocateImage", Evaluation::AllocateImage );
     m.def("FreeImage", Evaluation::FreeImage );
-    m.def("SetThumbnailImage", Evaluation::SetThumbnailImage );
-    m.def("Evaluate", Evaluation::Evaluate );
-    m.def("SetBlendingMode", Evaluation::SetBlendingMode );
-    m.def("GetEvaluationSize", Evaluation::GetEvaluationSize );
-    m.def("SetEvaluationSize", Evaluation::SetEvaluationSize );
-    m.def("SetEvaluationCubeSize", Evaluation::SetEvaluationCubeSize );
-    m.def("CubemapFilter", Evaluation::CubemapFilter );
-    m.def("SetProcessing", Evaluation::SetProcessing );
+    m.def("SetThumbnailImage", [](Image *image) {
+        return OnMainThread<int>([&]() { return Evaluation::SetThumbnailImage(image); });
+    }, ReleaseGIL());
+    m.def("Evaluate", [](int target, int width, int height, Image *image) {
+        return OnMainThread<int>([&]() { return Evaluation::Evaluate(target, width, height, image); });
+    }, ReleaseGIL());
+    m.def("SetBlendingMode", [](int target, int blendSrc, int blendDst) {
+        OnMainThread<int>([&]() { Evaluation::SetBlendingMode(target, blendSrc, blendDst); return 0; });
+    }, ReleaseGIL());
+    m.def("GetEvaluationSize", [](int target) {
+        int width = 0, height = 0;
+        {
+            pybind11::gil_scoped_release release;
+            OnMainThread<int>([&]() { return Evaluation::GetEvaluationSize(target, &width, &height); });
+        }
+        return pybind11::make_tuple(width, height);
+    });
+    m.def("SetEvaluationSize", [](int target, int width, int height) {
+        return OnMainThread<int>([&]() { return Evaluation::SetEvaluationSize(target, width, height); });
+    }, ReleaseGIL());
+    m.def("SetEvaluationCubeSize", [](int target, int faceWidth) {
+        return OnMainThread<int>([&]() { return Evaluation::SetEvaluationCubeSize(target, faceWidth); });
+    }, ReleaseGIL());
+    m.def("CubemapFilter", Evaluation::CubemapFilter, ReleaseGIL());
+    m.def("IsJobCancelled", Evaluation::IsJobCancelled );
+    m.def("SetProcessing", [](int target, int processing) {
+        OnMainThread<int>([&]() { Evaluation::SetProcessing(target, processing); return 0; });
+    }, ReleaseGIL());
     /*
     m.def("Job", Evaluation::Job );
     m.def("JobMain", Evaluation::JobMain );
     */
     m.def("GetLibraryGraphs", []() {
-        auto d = pybind11::list();
-        for (auto& graph : library.mMaterials)
+        std::vector<std::string> names;
         {
-            const std::string& s = graph.mName;
-            d.append(graph.mName);
+            pybind11::gil_scoped_release release;
+            OnMainThread<int>([&]() {
+                for (auto& graph : library.mMaterials)
+                    names.push_back(graph.mName);
+                return 0;
+            });
         }
+        auto d = pybind11::list();
+        for (auto& name : names)
+            d.append(name);
         return d;
         }
         );
     m.def("GetGraph", [](const std::string& graphName) -> PyGraph* {
-        
-        for (auto& graph : library.mMaterials)
-        {
-            if (graph.mName == graphName)
+        pybind11::gil_scoped_release release;
+        return OnMainThread<PyGraph*>([&]() -> PyGraph* {
+            for (auto& graph : library.mMaterials)
             {
-                return new PyGraph{ &graph };
+                if (graph.mName == graphName)
+                {
+                    LoadMaterial(&graph);
+                    return new PyGraph{ &graph };
+                }
             }
-        }
-        return nullptr;
+            return nullptr;
+        });
     }
     );
-    /*
+    // evaluation state of the Python node being run, passed to its main function
     m.def("accessor_api", []() {
         auto d = pybind11::dict();
-
-        d["target"] = 10;
-
-        auto l = pybind11::list();
-        l.append(5);
-        l.append(-1);
-        l.append(-1);
-        d["inputs"] = l;
-
+        if (!gPythonEvaluationInfo)
+            return d;
+        const EvaluationInfo& info = *gPythonEvaluationInfo;
+        d["target"] = info.targetIndex;
+        auto inputs = pybind11::list();
+        for (auto input : info.inputIndices)
+            inputs.append(input);
+        d["inputs"] = inputs;
+        d["frame"] = info.mFrame;
+        d["localFrame"] = info.mLocalFrame;
+        d["uiPass"] = info.uiPass;
+        d["forcedDirty"] = info.forcedDirty;
+        d["parameters"] = pybind11::bytes((const char*)gPythonParameters->data(), gPythonParameters->size());
         return d;
     });
-    */
     
     /*
     m.def("GetImage", []() {
@@ -338,6 +612,85 @@ std::string Evaluators::GetEvaluator(const std::string& filename)
     return mEvaluatorScripts[filename].mText;
 }
 
+bool Evaluators::ReadEvaluatorText(const EvaluatorFile& file, bool *changed)
+{
+    const std::string& filename = file.mFilename;
+    std::ifstream t(file.mDirectory + filename);
+    if (!t.good())
+    {
+        Log("%s - Unable to load file.\n", filename.c_str());
+        return false;
+    }
+    std::string str((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
+    auto iter = mEvaluatorScripts.find(filename);
+    if (iter == mEvaluatorScripts.end())
+    {
+        mEvaluatorScripts[filename] = EvaluatorScript(str);
+        if (changed)
+            *changed = true;
+        return true;
+    }
+    if (changed)
+        *changed = iter->second.mText != str;
+    iter->second.mText = str;
+    return true;
+}
+
+bool Evaluators::GetGLSLProgramSource(const EvaluatorFile& file, std::string& source, std::string& nodeName, bool& transformFeedback)
+{
+    const std::string& filename = file.mFilename;
+    EvaluatorScript& shader = mEvaluatorScripts[filename];
+    if (file.mEvaluatorType == EVALUATOR_GLSL)
+    {
+        if (filename == "Shader.glsl")
+            return false;
+        source = ReplaceAll(mEvaluatorScripts["Shader.glsl"].mText, "__NODE__", shader.mText);
+        nodeName = ReplaceAll(filename, ".glsl", "");
+        source = ReplaceAll(source, "__FUNCTION__", nodeName + "()");
+        transformFeedback = false;
+        return true;
+    }
+    if (file.mEvaluatorType == EVALUATOR_GLSLCOMPUTE)
+    {
+        source = shader.mText;
+        nodeName = ReplaceAll(filename, ".glslc", "");
+        // plain glsl in compute directory
+        transformFeedback = nodeName != filename;
+        if (!transformFeedback)
+            nodeName = ReplaceAll(filename, ".glsl", "");
+        return true;
+    }
+    return false;
+}
+
+void Evaluators::CompileC(const EvaluatorFile& file)
+{
+    const std::string& filename = file.mFilename;
+    EvaluatorScript& program = mEvaluatorScripts[filename];
+    if (program.mNativeHandle)
+        CloseNative(program.mNativeHandle);
+    if (program.mMem)
+        free(program.mMem);
+    program.mNativeHandle = NULL;
+    program.mMem = NULL;
+    program.mCFunction = NULL;
+    try
+    {
+        if (!mbNativeC || !CompileNative(file.mDirectory + filename, program.mText, filename, &program.mNativeHandle, &program.mCFunction))
+            CompileTCC(program.mText, filename.c_str(), &program.mMem, &program.mCFunction);
+    }
+    catch (...)
+    {
+        Log("Error at compiling %s", filename.c_str());
+    }
+
+    if (program.mNodeType != -1)
+    {
+        mEvaluatorPerNodeType[program.mNodeType].mCFunction = program.mCFunction;
+        mEvaluatorPerNodeType[program.mNodeType].mMem = program.mMem;
+    }
+}
+
 void Evaluators::SetEvaluators(const std::vector<EvaluatorFile>& evaluatorfilenames)
 {
     ClearEvaluators();
@@ -350,47 +703,18 @@ void Evaluators::SetEvaluators(const std::vector<EvaluatorFile>& evaluatorfilena
     {
         if (file.mEvaluatorType != EVALUATOR_GLSL&& file.mEvaluatorType != EVALUATOR_GLSLCOMPUTE)
             continue;
-        const std::string filename = file.mFilename;
-
-        std::ifstream t(file.mDirectory + filename);
-        if (t.good())
-        {
-            std::string str((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
-            if (mEvaluatorScripts.find(filename) == mEvaluatorScripts.end())
-                mEvaluatorScripts[filename] = EvaluatorScript(str);
-            else
-                mEvaluatorScripts[filename].mText = str;
-        }
+        ReadEvaluatorText(file);
     }
 
     // GLSL
-    std::string baseShader = mEvaluatorScripts["Shader.glsl"].mText;
     for (auto& file : evaluatorfilenames)
     {
         if (file.mEvaluatorType != EVALUATOR_GLSL)
             continue;
-        const std::string filename = file.mFilename;
-
-        if (filename == "Shader.glsl")
-            continue;
-
-        EvaluatorScript& shader = mEvaluatorScripts[filename];
-        std::string shaderText = ReplaceAll(baseShader, "__NODE__", shader.mText);
-        std::string nodeName = ReplaceAll(filename, ".glsl", "");
-        shaderText = ReplaceAll(shaderText, "__FUNCTION__", nodeName + "()");
-
-        unsigned int program = LoadShader(shaderText, filename.c_str());
-
-        int parameterBlockIndex = glGetUniformBlockIndex(program, (nodeName + "Block").c_str());
-        if (parameterBlockIndex != -1)
-            glUniformBlockBinding(program, parameterBlockIndex, 1);
-
-        parameterBlockIndex = glGetUniformBlockIndex(program, "EvaluationBlock");
-        if (parameterBlockIndex != -1)
-            glUniformBlockBinding(program, parameterBlockIndex, 2);
-        shader.mProgram = program;
-        if (shader.mNodeType != -1)
-            mEvaluatorPerNodeType[shader.mNodeType].mGLSLProgram = program;
+        std::string source, nodeName;
+        bool transformFeedback;
+        if (GetGLSLProgramSource(file, source, nodeName, transformFeedback))
+            SetGLSLProgramSource(file.mFilename, source, nodeName, transformFeedback);
     }
 
     if (!gEvaluationStateGLSLBuffer)
@@ -403,6 +727,17 @@ void Evaluators::SetEvaluators(const std::vector<EvaluatorFile>& evaluatorfilena
         glBindBuffer(GL_UNIFORM_BUFFER, 0);
     }
 
+    if (!gIrradianceSHGLSLBuffer)
+    {
+        glGenBuffers(1, &gIrradianceSHGLSLBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, gIrradianceSHGLSLBuffer);
+
+        memset(&gIrradianceSHUploaded, 0, sizeof(IrradianceSHInfo));
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(IrradianceSHInfo), &gIrradianceSHUploaded, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, 3, gIrradianceSHGLSLBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
     TagTime("GLSL init");
 
     // GLSL compute
@@ -410,35 +745,10 @@ void Evaluators::SetEvaluators(const std::vector<EvaluatorFile>& evaluatorfilena
     {
         if (file.mEvaluatorType != EVALUATOR_GLSLCOMPUTE)
             continue;
-        const std::string filename = file.mFilename;
-
-        EvaluatorScript& shader = mEvaluatorScripts[filename];
-        //std::string shaderText = ReplaceAll(baseShader, "__NODE__", shader.mText);
-        std::string nodeName = ReplaceAll(filename, ".glslc", "");
-        //shaderText = ReplaceAll(shaderText, "__FUNCTION__", nodeName + "()");
-
-        unsigned int program = 0;
-        if (nodeName == filename)
-        {
-            // glsl in compute directory
-            nodeName = ReplaceAll(filename, ".glsl", "");
-            program = LoadShader(shader.mText, filename.c_str());
-        }
-        else
-        {
-            program = LoadShaderTransformFeedback(shader.mText, filename.c_str());
-        }
-
-        int parameterBlockIndex = glGetUniformBlockIndex(program, (nodeName + "Block").c_str());
-        if (parameterBlockIndex != -1)
-            glUniformBlockBinding(program, parameterBlockIndex, 1);
-
-        parameterBlockIndex = glGetUniformBlockIndex(program, "EvaluationBlock");
-        if (parameterBlockIndex != -1)
-            glUniformBlockBinding(program, parameterBlockIndex, 2);
-        shader.mProgram = program;
-        if (shader.mNodeType != -1)
-            mEvaluatorPerNodeType[shader.mNodeType].mGLSLProgram = program;
+        std::string source, nodeName;
+        bool transformFeedback;
+        if (GetGLSLProgramSource(file, source, nodeName, transformFeedback))
+            SetGLSLProgramSource(file.mFilename, source, nodeName, transformFeedback);
     }
     TagTime("GLSL compute init");
     // C
@@ -446,101 +756,300 @@ void Evaluators::SetEvaluators(const std::vector<EvaluatorFile>& evaluatorfilena
     {
         if (file.mEvaluatorType != EVALUATOR_C)
             continue;
+        if (!ReadEvaluatorText(file))
+            continue;
+        CompileC(file);
+    }
+    TagTime("C init");
+    
+    std::vector<std::string> pythonModules;
+    for (auto& file : evaluatorfilenames)
+    {
+        if (file.mEvaluatorType != EVALUATOR_PYTHON)
+            continue;
         const std::string filename = file.mFilename;
-        try
+        std::string nodeName = ReplaceAll(filename, ".py", "");
+        EvaluatorScript& shader = mEvaluatorScripts[filename];
+        shader.mPyModule = "Nodes.Python." + nodeName;
+        if (shader.mNodeType != -1)
+            mEvaluatorPerNodeType[shader.mNodeType].mPyModule = shader.mPyModule;
+        pythonModules.push_back(shader.mPyModule);
+    }
+    // the worker owns the interpreter, modules are only referenced by name on this side
+    gPythonWorker.Call([&pythonModules]() {
+        for (auto& moduleName : pythonModules)
         {
-            std::ifstream t(file.mDirectory + filename);
-            if (!t.good())
+            try
             {
-                Log("%s - Unable to load file.\n", filename.c_str());
-                continue;
+                pybind11::module::import(moduleName.c_str());
             }
-            std::string str((std::istreambuf_iterator<char>(t)), std::istreambuf_iterator<char>());
-            if (mEvaluatorScripts.find(filename) == mEvaluatorScripts.end())
-                mEvaluatorScripts[filename] = EvaluatorScript(str);
-            else
-                mEvaluatorScripts[filename].mText = str;
-
-            EvaluatorScript& program = mEvaluatorScripts[filename];
-            TCCState *s = tcc_new();
-
-            int *noLib = (int*)s;
-            noLib[2] = 1; // no stdlib
-
-            tcc_set_error_func(s, 0, libtccErrorFunc);
-            tcc_add_include_path(s, "Nodes/C/");
-            tcc_set_output_type(s, TCC_OUTPUT_MEMORY);
-
-            if (tcc_compile_string(s, program.mText.c_str()) != 0)
+            catch (pybind11::error_already_set& ex)
             {
-                Log("%s - Compilation error!\n", filename.c_str());
-                continue;
+                Log("%s\n", ex.what());
             }
+        }
+    });
+    
+    TagTime("Python init");
+}
 
-            for (auto& evaluationFunction : evaluationFunctions)
-                tcc_add_symbol(s, evaluationFunction.szFunctionName, evaluationFunction.function);
+void Evaluators::ReloadEvaluator(const EvaluatorFile& file, const std::vector<EvaluatorFile>& evaluatorfilenames)
+{
+    // editors and the watcher may report the same save several times
+    bool changed = false;
+    if (!ReadEvaluatorText(file, &changed) || !changed)
+        return;
+    const std::string& filename = file.mFilename;
+    Log("Reloading %s\n", filename.c_str());
 
-            int size = tcc_relocate(s, NULL);
-            if (size == -1)
+    if (file.mEvaluatorType == EVALUATOR_GLSL || file.mEvaluatorType == EVALUATOR_GLSLCOMPUTE)
+    {
+        // the base shader is spliced into every GLSL node
+        std::vector<const EvaluatorFile*> files(1, &file);
+        if (file.mEvaluatorType == EVALUATOR_GLSL && filename == "Shader.glsl")
+        {
+            files.clear();
+            for (auto& otherFile : evaluatorfilenames)
             {
-                Log("%s - Libtcc unable to relocate program!\n", filename.c_str());
-                continue;
+                if (otherFile.mEvaluatorType == EVALUATOR_GLSL)
+                    files.push_back(&otherFile);
             }
-            program.mMem = malloc(size);
-            tcc_relocate(s, program.mMem);
-
-            *(void**)(&program.mCFunction) = tcc_get_symbol(s, "main");
-            if (!program.mCFunction)
+        }
+        for (auto filePointer : files)
+        {
+            const EvaluatorFile& otherFile = *filePointer;
+            std::string source, nodeName;
+            bool transformFeedback;
+            if (!GetGLSLProgramSource(otherFile, source, nodeName, transformFeedback))
+                continue;
+            EvaluatorScript& shader = mEvaluatorScripts[otherFile.mFilename];
+            uint64_t key = gProgramCache.GetKey(source, transformFeedback);
+            if (gHotReload.CompileProgramAsync(otherFile.mFilename, source, transformFeedback))
             {
-                Log("%s - No main function!\n", filename.c_str());
+                // current program stays in use until SetGLSLProgram installs the new one
+                shader.mBlockName = nodeName + "Block";
+                shader.mbTransformFeedback = transformFeedback;
+                shader.mProgramKey = key;
             }
-            tcc_delete(s);
-
-            if (program.mNodeType != -1)
+            else
             {
-                mEvaluatorPerNodeType[program.mNodeType].mCFunction = program.mCFunction;
-                mEvaluatorPerNodeType[program.mNodeType].mMem = program.mMem;
+                SetGLSLProgramSource(otherFile.mFilename, source, nodeName, transformFeedback);
+                if (shader.mNodeType != -1)
+                    SetNodeTypeDirty(shader.mNodeType);
             }
         }
-        catch (...)
-        {
-            Log("Error at compiling %s", filename.c_str());
-        }
+        return;
     }
-    TagTime("C init");
-    
-    for (auto& file : evaluatorfilenames)
+
+    EvaluatorScript& script = mEvaluatorScripts[filename];
+    if (file.mEvaluatorType == EVALUATOR_C)
     {
-        if (file.mEvaluatorType != EVALUATOR_PYTHON)
-            continue;
-        const std::string filename = file.mFilename;
-        std::string nodeName = ReplaceAll(filename, ".py", "");
-        EvaluatorScript& shader = mEvaluatorScripts[filename];
-        try
-        {
-            shader.mPyModule = pybind11::module::import("Nodes.Python.testnode");
-            if (shader.mNodeType != -1)
-                mEvaluatorPerNodeType[shader.mNodeType].mPyModule = shader.mPyModule;
-        }
-        catch (...)
-        {
-            Log("Python exception\n");
-        }
+        CompileC(file);
+    }
+    else if (file.mEvaluatorType == EVALUATOR_PYTHON)
+    {
+        // queued before the evaluations triggered by SetNodeTypeDirty
+        const std::string moduleName = script.mPyModule;
+        gPythonWorker.Post([moduleName]() {
+            pybind11::module::import(moduleName.c_str()).reload();
+        });
+    }
+    if (script.mNodeType != -1)
+        SetNodeTypeDirty(script.mNodeType);
+}
+
+void Evaluators::SetNodeTypeDirty(int nodeType)
+{
+    // cached frames were produced by the previous code
+    gFrameCache.Clear();
+    if (!gCurrentContext)
+        return;
+    for (size_t i = 0; i < gEvaluation.GetStagesCount(); i++)
+    {
+        if (gEvaluation.GetStageType(i) == size_t(nodeType))
+            gCurrentContext->SetTargetDirty(i);
     }
-    
-    TagTime("Python init");
+}
+
+static void BindProgramBlocks(unsigned int program, const std::string& blockName)
+{
+    int parameterBlockIndex = glGetUniformBlockIndex(program, blockName.c_str());
+    if (parameterBlockIndex != -1)
+        glUniformBlockBinding(program, parameterBlockIndex, 1);
+
+    parameterBlockIndex = glGetUniformBlockIndex(program, "EvaluationBlock");
+    if (parameterBlockIndex != -1)
+        glUniformBlockBinding(program, parameterBlockIndex, 2);
+
+    parameterBlockIndex = glGetUniformBlockIndex(program, "IrradianceSHBlock");
+    if (parameterBlockIndex != -1)
+        glUniformBlockBinding(program, parameterBlockIndex, 3);
+}
+
+void Evaluators::SetIrradianceSH(const IrradianceSHInfo& info)
+{
+    // most nodes have no SH input, the block only changes with the irradiance of the inputs
+    if (memcmp(&info, &gIrradianceSHUploaded, sizeof(IrradianceSHInfo)))
+    {
+        gIrradianceSHUploaded = info;
+        glBindBuffer(GL_UNIFORM_BUFFER, gIrradianceSHGLSLBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(IrradianceSHInfo), &info, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    glBindBufferBase(GL_UNIFORM_BUFFER, 3, gIrradianceSHGLSLBuffer);
+}
+
+void Evaluators::SetGLSLProgram(const std::string& filename, unsigned int program)
+{
+    EvaluatorScript& shader = mEvaluatorScripts[filename];
+    if (shader.mProgram)
+        glDeleteProgram(shader.mProgram);
+    BindProgramBlocks(program, shader.mBlockName);
+    gProgramCache.Store(shader.mProgramKey, program);
+    shader.mProgram = program;
+    shader.mProgramSource = std::string();
+    shader.mbProgramResolved = true;
+    if (shader.mNodeType != -1)
+    {
+        mEvaluatorPerNodeType[shader.mNodeType].mGLSLScript = filename;
+        mEvaluatorPerNodeType[shader.mNodeType].mGLSLProgram = program;
+        SetNodeTypeDirty(shader.mNodeType);
+    }
+}
+
+void Evaluators::SetGLSLProgramSource(const std::string& filename, const std::string& source, const std::string& nodeName, bool transformFeedback)
+{
+    EvaluatorScript& shader = mEvaluatorScripts[filename];
+    if (shader.mProgram)
+        glDeleteProgram(shader.mProgram);
+    shader.mProgramSource = source;
+    shader.mBlockName = nodeName + "Block";
+    shader.mbTransformFeedback = transformFeedback;
+    shader.mProgramKey = gProgramCache.GetKey(source, transformFeedback);
+    shader.mProgram = 0;
+    shader.mbProgramResolved = false;
+    if (shader.mNodeType != -1)
+    {
+        mEvaluatorPerNodeType[shader.mNodeType].mGLSLScript = filename;
+        mEvaluatorPerNodeType[shader.mNodeType].mGLSLProgram = 0;
+    }
+}
+
+unsigned int Evaluators::GetGLSLProgram(size_t nodeType)
+{
+    Evaluator& evaluator = mEvaluatorPerNodeType[nodeType];
+    if (evaluator.mGLSLProgram || evaluator.mGLSLScript.empty())
+        return evaluator.mGLSLProgram;
+
+    EvaluatorScript& shader = mEvaluatorScripts[evaluator.mGLSLScript];
+    if (!shader.mbProgramResolved)
+    {
+        shader.mbProgramResolved = true;
+        unsigned int program = gProgramCache.Load(shader.mProgramKey, shader.mProgramSource, evaluator.mGLSLScript.c_str(), shader.mbTransformFeedback);
+        if (program)
+            BindProgramBlocks(program, shader.mBlockName);
+        shader.mProgram = program;
+        // source is kept in the cache binary from now on
+        shader.mProgramSource = std::string();
+    }
+    evaluator.mGLSLProgram = shader.mProgram;
+    return evaluator.mGLSLProgram;
 }
 
 void Evaluators::ClearEvaluators()
 {
     // clear
-    for (auto& program : mEvaluatorPerNodeType)
+    for (auto& script : mEvaluatorScripts)
+    {
+        if (script.second.mProgram)
+            glDeleteProgram(script.second.mProgram);
+        script.second.mProgram = 0;
+        if (script.second.mMem)
+            free(script.second.mMem);
+        script.second.mMem = NULL;
+        if (script.second.mNativeHandle)
+            CloseNative(script.second.mNativeHandle);
+        script.second.mNativeHandle = NULL;
+    }
+}
+
+void Evaluators::BenchmarkC(int width, int height, int iterations)
+{
+    // per pixel kernel, same code for both backends. Rows are split across cores with ParallelFor
+    static const char *benchmarkSource =
+        "#include \"Imogen.h\"\n"
+        "typedef struct Benchmark_t { unsigned char *bits; int width; int height; } Benchmark;\n"
+        "void Rows(void *userData, int begin, int end)\n"
+        "{\n"
+        "    Benchmark *param = (Benchmark*)userData;\n"
+        "    int x, y;\n"
+        "    for (y = begin; y < end; y++)\n"
+        "    {\n"
+        "        for (x = 0; x < param->width; x++)\n"
+        "        {\n"
+        "            float u = (float)x / (float)param->width;\n"
+        "            float v = (float)y / (float)param->height;\n"
+        "            float d = fabsf(u - 0.5f) + fabsf(v - 0.5f);\n"
+        "            float c = d * d * (3.f - 2.f * d);\n"
+        "            unsigned char *p = param->bits + (y * param->width + x) * 4;\n"
+        "            p[0] = (unsigned char)(c * 255.f);\n"
+        "            p[1] = (unsigned char)(u * 255.f);\n"
+        "            p[2] = (unsigned char)(v * 255.f);\n"
+        "            p[3] = 255;\n"
+        "        }\n"
+        "    }\n"
+        "}\n"
+        "int main(Benchmark *param, Evaluation *evaluation)\n"
+        "{\n"
+        "    return WaitJob(ParallelFor(Rows, param, param->height, 0));\n"
+        "}\n";
+
+    struct Benchmark
     {
-        if (program.mGLSLProgram)
-            glDeleteProgram(program.mGLSLProgram);
-        if (program.mMem)
-            free(program.mMem);
+        unsigned char *bits;
+        int width;
+        int height;
+    };
+    std::vector<unsigned char> bits(size_t(width) * height * 4);
+    Benchmark parameters = { bits.data(), width, height };
+
+    auto run = [&](const char *backend, CFunction function) {
+        if (!function)
+            return;
+        function(&parameters, NULL);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; i++)
+            function(&parameters, NULL);
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        Log("C benchmark %s : %5.3f ms per %dx%d image, %5.1f Mpixels/s\n", backend, float(seconds * 1000. / iterations), width, height,
+            float(double(width) * height * iterations / seconds / 1000000.));
+    };
+
+    void *mem = NULL;
+    CFunction tccFunction = NULL;
+    if (CompileTCC(benchmarkSource, "Benchmark", &mem, &tccFunction))
+        run("TCC", tccFunction);
+
+#ifndef _WIN32
+    mkdir(nativeCacheDirectory, 0755);
+#endif
+    const std::string sourcePath = std::string(nativeCacheDirectory) + "Benchmark.c";
+    std::ofstream sourceFile(sourcePath);
+    sourceFile << benchmarkSource;
+    sourceFile.close();
+    void *handle = NULL;
+    CFunction nativeFunction = NULL;
+    if (CompileNative(sourcePath, benchmarkSource, "Benchmark.c", &handle, &nativeFunction))
+    {
+        run("native", nativeFunction);
+        CloseNative(handle);
+    }
+    else
+    {
+        Log("C benchmark native : backend not available\n");
     }
+    if (mem)
+        free(mem);
 }
 
 int Evaluators::GetMask(size_t nodeType)
@@ -556,6 +1065,7 @@ int Evaluators::GetMask(size_t nodeType)
         mask |= EvaluationGLSL;
         iter->second.mNodeType = int(nodeType);
         mEvaluatorPerNodeType[nodeType].mGLSLProgram = iter->second.mProgram;
+        mEvaluatorPerNodeType[nodeType].mGLSLScript = iter->first;
     }
     iter = mEvaluatorScripts.find(nodeName + ".glslc");
     if (iter != mEvaluatorScripts.end())
@@ -563,6 +1073,7 @@ int Evaluators::GetMask(size_t nodeType)
         mask |= EvaluationGLSLCompute;
         iter->second.mNodeType = int(nodeType);
         mEvaluatorPerNodeType[nodeType].mGLSLProgram = iter->second.mProgram;
+        mEvaluatorPerNodeType[nodeType].mGLSLScript = iter->first;
     }
     iter = mEvaluatorScripts.find(nodeName + ".c");
     if (iter != mEvaluatorScripts.end())
@@ -588,8 +1099,27 @@ void Evaluators::InitPythonModules()
     mImogenModule.dec_ref();
 }
 
-void Evaluator::RunPython() const
+void Evaluator::RunPython(const std::vector<unsigned char>& parameters, const EvaluationInfo& evaluationInfo, EvaluationContext *context) const
 {
-    mPyModule.attr("main")(gEvaluators.mImogenModule.attr("accessor_api")());
+    // may be called from a binding that released the GIL (Evaluate)
+    pybind11::gil_scoped_acquire acquire;
+    const std::vector<unsigned char> *previousParameters = gPythonParameters;
+    const EvaluationInfo *previousInfo = gPythonEvaluationInfo;
+    EvaluationContext *previousContext = gPythonEvaluationContext;
+    gPythonParameters = &parameters;
+    gPythonEvaluationInfo = &evaluationInfo;
+    gPythonEvaluationContext = context;
+    try
+    {
+        // already in sys.modules, import is a lookup
+        pybind11::module::import(mPyModule.c_str()).attr("main")(gEvaluators.mImogenModule.attr("accessor_api")());
+    }
+    catch (pybind11::error_already_set& ex)
+    {
+        Log("%s\n", ex.what());
+    }
+    gPythonParameters = previousParameters;
+    gPythonEvaluationInfo = previousInfo;
+    gPythonEvaluationContext = previousContext;
 }
 
@@ -30,15 +30,22 @@
 #include "Imogen.h"
 #include "pybind11/embed.h"
 
+struct EvaluationStage;
+struct EvaluationInfo;
+struct IrradianceSHInfo;
+struct EvaluationContext;
+
 struct Evaluator
 {
     Evaluator() : mGLSLProgram(0), mCFunction(0), mMem(0) {}
-    unsigned int mGLSLProgram;
+    unsigned int mGLSLProgram; // 0 until first use, see Evaluators::GetGLSLProgram
+    std::string mGLSLScript;
     int(*mCFunction)(void *parameters, void *evaluationInfo);
     void *mMem;
-    pybind11::module mPyModule;
+    std::string mPyModule; // module name, imported on the Python worker
 
-    void RunPython() const;
+    // Python worker only. context is made current for bindings run on the main thread
+    void RunPython(const std::vector<unsigned char>& parameters, const EvaluationInfo& evaluationInfo, EvaluationContext *context) const;
 
 #ifdef _DEBUG
     std::string mName;
@@ -47,32 +54,60 @@ struct Evaluator
 
 struct Evaluators
 {
-    Evaluators() : gEvaluationStateGLSLBuffer(0) {}
+    Evaluators() : gEvaluationStateGLSLBuffer(0), gIrradianceSHGLSLBuffer(0), mbNativeC(getenv("IMOGEN_NO_NATIVE_C") == NULL) {}
     void SetEvaluators(const std::vector<EvaluatorFile>& evaluatorfilenames);
     std::string GetEvaluator(const std::string& filename);
     int GetMask(size_t nodeType);
     void ClearEvaluators();
 
     const Evaluator& GetEvaluator(size_t nodeType) const { return mEvaluatorPerNodeType[nodeType]; }
+    // programs are linked (or loaded from the program cache) the first time a node type is evaluated
+    unsigned int GetGLSLProgram(size_t nodeType);
+    // recompile a single evaluator after its file changed, stages using it and their children are set dirty
+    void ReloadEvaluator(const EvaluatorFile& file, const std::vector<EvaluatorFile>& evaluatorfilenames);
+    // install a program compiled off the main thread, the previous one is deleted
+    void SetGLSLProgram(const std::string& filename, unsigned int program);
+    // compare TCC and native per pixel throughput, results are logged
+    void BenchmarkC(int width, int height, int iterations);
 
     unsigned int gEvaluationStateGLSLBuffer;
+    // binding 3, IrradianceSHBlock. Uploaded when info differs from the previous draw
+    unsigned int gIrradianceSHGLSLBuffer;
+    void SetIrradianceSH(const IrradianceSHInfo& info);
+    // Python worker only, see PythonWorker
     void InitPythonModules();
     pybind11::module mImogenModule;
+    // build C nodes with the system compiler (IMOGEN_CC, cc by default) when available, TCC otherwise
+    bool mbNativeC;
 protected:
 
     struct EvaluatorScript
     {
-        EvaluatorScript() : mProgram(0), mCFunction(0), mMem(0), mNodeType(-1) {}
-        EvaluatorScript(const std::string & text) : mText(text), mProgram(0), mCFunction(0), mMem(0), mNodeType(-1) {}
+        EvaluatorScript() : mProgram(0), mCFunction(0), mMem(0), mNodeType(-1), mNativeHandle(NULL), mProgramKey(0), mbTransformFeedback(false), mbProgramResolved(true) {}
+        EvaluatorScript(const std::string & text) : mText(text), mProgram(0), mCFunction(0), mMem(0), mNodeType(-1), mNativeHandle(NULL), mProgramKey(0), mbTransformFeedback(false), mbProgramResolved(true) {}
         std::string mText;
         unsigned int mProgram;
         int(*mCFunction)(void *parameters, void *evaluationInfo);
         void *mMem;
         int mNodeType;
-        pybind11::module mPyModule;
-        
+        void *mNativeHandle;
+        std::string mPyModule;
+
+        // pending GLSL program
+        std::string mProgramSource;
+        std::string mBlockName;
+        uint64_t mProgramKey;
+        bool mbTransformFeedback;
+        bool mbProgramResolved;
     };
 
+    // return false when the file can't be read. changed is set when the text differs from the loaded one
+    bool ReadEvaluatorText(const EvaluatorFile& file, bool *changed = NULL);
+    bool GetGLSLProgramSource(const EvaluatorFile& file, std::string& source, std::string& nodeName, bool& transformFeedback);
+    void SetGLSLProgramSource(const std::string& filename, const std::string& source, const std::string& nodeName, bool transformFeedback);
+    void CompileC(const EvaluatorFile& file);
+    void SetNodeTypeDirty(int nodeType);
+
     std::map<std::string, EvaluatorScript> mEvaluatorScripts;
     std::vector<Evaluator> mEvaluatorPerNodeType;
     
@@ -0,0 +1,415 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "FrameCache.h"
+#include "EvaluationContext.h"
+#include "NodesDelegate.h"
+#include "Imogen.h"
+#include "TaskScheduler.h"
+#include "stb_image.h"
+#include <chrono>
+
+extern enki::TaskScheduler g_TS;
+unsigned char *stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality);
+
+FrameCache gFrameCache;
+// average UI frame time given to prerendering, in seconds
+static const double prerenderFrameBudget = 0.004;
+
+static void RecurseBackward(size_t target, std::vector<bool>& usedNodes)
+{
+    if (usedNodes[target])
+        return;
+    usedNodes[target] = true;
+    for (auto inp : gEvaluation.GetEvaluationStage(target).mInput.mInputs)
+    {
+        if (inp >= 0)
+            RecurseBackward(inp, usedNodes);
+    }
+}
+
+struct CompressFrameTaskSet : enki::ITaskSet
+{
+    CompressFrameTaskSet(std::shared_ptr<FrameCache::Entry> entry) : enki::ITaskSet(), mEntry(entry)
+    {
+    }
+    virtual void    ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum)
+    {
+        int outlen = 0;
+        unsigned char *bits = stbi_zlib_compress(mEntry->mImage.GetBits(), int(mEntry->mImage.mDataSize), &outlen, 5);
+        {
+            std::lock_guard<std::mutex> lock(gFrameCache.mMutex);
+            if (bits && !mEntry->mbEvicted && size_t(outlen) < mEntry->mImage.mDataSize)
+            {
+                gFrameCache.mMemoryUsed -= mEntry->mImage.mDataSize;
+                mEntry->mCompressed.assign(bits, bits + outlen);
+                mEntry->mImage.Free();
+                gFrameCache.mMemoryUsed += mEntry->mCompressed.size();
+            }
+        }
+        free(bits);
+        delete this;
+    }
+    std::shared_ptr<FrameCache::Entry> mEntry;
+};
+
+FrameCache::FrameCache() : mbEnabled(true)
+    , mbCompress(false)
+    , mBudget(size_t(1024) << 20)
+    , mPrerenderAhead(25)
+    , mMemoryUsed(0)
+    , mUseCounter(0)
+    , mCurrentNode(-1)
+    , mCurrentFrame(-1)
+    , mCurrentKey(0)
+    , mbCurrentStored(false)
+    , mbStoreCurrent(false)
+    , mStableFrames(0)
+    , mbPrerenderComplete(false)
+    , mPrerenderContext(NULL)
+    , mPrerenderStageCount(0)
+    , mPrerenderWidth(0)
+    , mPrerenderHeight(0)
+    , mPrerenderWait(0)
+{
+}
+
+FrameCache::~FrameCache()
+{
+    delete mPrerenderContext;
+}
+
+uint64_t FrameCache::ComputeKey(size_t nodeIndex, int frame) const
+{
+    const size_t stageCount = gEvaluation.GetStagesCount();
+    if (nodeIndex >= stageCount || stageCount != gNodeDelegate.mNodes.size())
+        return 0;
+    if (gEvaluation.GetEvaluationStage(nodeIndex).gEvaluationMask&EvaluationGLSLCompute)
+        return 0;
+
+    std::vector<bool> usedNodes(stageCount, false);
+    RecurseBackward(nodeIndex, usedNodes);
+
+    uint64_t key = Hash64(&nodeIndex, sizeof(size_t));
+    key = Hash64(&frame, sizeof(int), key);
+    for (size_t i = 0; i < stageCount; i++)
+    {
+        if (!usedNodes[i])
+            continue;
+        const EvaluationStage& stage = gEvaluation.GetEvaluationStage(i);
+        const auto& node = gNodeDelegate.mNodes[i];
+        // painting and scene nodes keep state outside of their parameters
+        if (gMetaNodes[stage.mNodeType].mbHasUI || stage.renderer)
+            return 0;
+        const bool active = frame >= node.mStartFrame && frame <= node.mEndFrame;
+        key = Hash64(&i, sizeof(size_t), key);
+        key = Hash64(&stage.mNodeType, sizeof(size_t), key);
+        key = Hash64(stage.mParameters.data(), stage.mParameters.size(), key);
+        key = Hash64(stage.mInput.mInputs, sizeof(stage.mInput.mInputs), key);
+        key = Hash64(stage.mInputSamplers.data(), stage.mInputSamplers.size() * sizeof(InputSampler), key);
+        key = Hash64(&stage.mLocalTime, sizeof(int), key);
+        key = Hash64(&stage.mBlendingSrc, sizeof(int), key);
+        key = Hash64(&stage.mBlendingDst, sizeof(int), key);
+        key = Hash64(&active, sizeof(bool), key);
+    }
+    return key ? key : 1;
+}
+
+bool FrameCache::IsComplete(const EvaluationContext& context, size_t nodeIndex) const
+{
+    std::vector<bool> usedNodes(gEvaluation.GetStagesCount(), false);
+    RecurseBackward(nodeIndex, usedNodes);
+    for (size_t i = 0; i < usedNodes.size(); i++)
+    {
+        if (usedNodes[i] && (context.StageIsDirty(i) || context.StageIsProcessing(i)))
+            return false;
+    }
+    return true;
+}
+
+void FrameCache::BeginFrame(int nodeIndex, int frame)
+{
+    uint64_t key = (mbEnabled && nodeIndex >= 0) ? ComputeKey(nodeIndex, frame) : 0;
+    if (key == mCurrentKey)
+        return;
+
+    Resume();
+    mbStoreCurrent = frame != mCurrentFrame;
+    mCurrentKey = key;
+    mCurrentNode = nodeIndex;
+    mCurrentFrame = frame;
+    mStableFrames = 0;
+    mbCurrentStored = false;
+    mbPrerenderComplete = false;
+    // a clean target already holds this state
+    if (key && gCurrentContext->StageIsDirty(nodeIndex) && Restore(nodeIndex, key))
+        mbCurrentStored = true;
+}
+
+void FrameCache::EndFrame()
+{
+    if (!mCurrentKey || mbCurrentStored)
+        return;
+    // parameter edits at a fixed frame are only stored once they settle
+    mStableFrames++;
+    if (!mbStoreCurrent && mStableFrames < 2)
+        return;
+    if (!IsComplete(*gCurrentContext, mCurrentNode))
+        return;
+    auto target = gCurrentContext->GetRenderTarget(mCurrentNode);
+    if (!target || !target->mGLTexID)
+        return;
+
+    Image image;
+    if (Evaluation::GetEvaluationImage(mCurrentNode, &image) != EVAL_OK)
+        return;
+    Insert(mCurrentKey, image);
+    mbCurrentStored = true;
+}
+
+bool FrameCache::Restore(size_t nodeIndex, uint64_t key)
+{
+    Image image;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto iter = mEntries.find(key);
+        if (iter == mEntries.end())
+            return false;
+        Entry& entry = *iter->second;
+        entry.mLastUse = ++mUseCounter;
+        image = entry.mImage;
+        if (!entry.mCompressed.empty())
+        {
+            int outlen = 0;
+            char *bits = stbi_zlib_decode_malloc((const char*)entry.mCompressed.data(), int(entry.mCompressed.size()), &outlen);
+            if (!bits)
+                return false;
+            image.SetBits((unsigned char*)bits, outlen);
+            free(bits);
+        }
+    }
+
+    // keep the stage decoder, SetEvaluationImage would release it otherwise
+    image.mDecoder = gEvaluation.GetEvaluationStage(nodeIndex).mDecoder.get();
+    if (Evaluation::SetEvaluationImage(int(nodeIndex), &image) != EVAL_OK)
+        return false;
+    gCurrentContext->StageSetDirty(nodeIndex, false);
+
+    // upstream nodes that only feed the restored one can wait for the next cache miss
+    const size_t stageCount = gEvaluation.GetStagesCount();
+    std::vector<bool> usedNodes(stageCount, false);
+    std::vector<bool> neededNodes(stageCount, false);
+    RecurseBackward(nodeIndex, usedNodes);
+    for (size_t i = 0; i < stageCount; i++)
+    {
+        if (!usedNodes[i])
+            RecurseBackward(i, neededNodes);
+    }
+    for (size_t i = 0; i < stageCount; i++)
+    {
+        if (i == nodeIndex || !usedNodes[i] || neededNodes[i] || !gCurrentContext->StageIsDirty(i))
+            continue;
+        gCurrentContext->StageSetDirty(i, false);
+        mSkippedNodes.push_back(i);
+    }
+    return true;
+}
+
+void FrameCache::Resume()
+{
+    for (auto index : mSkippedNodes)
+    {
+        if (index < gEvaluation.GetStagesCount())
+            gCurrentContext->SetTargetDirty(index);
+    }
+    mSkippedNodes.clear();
+}
+
+void FrameCache::Insert(uint64_t key, Image_t& image)
+{
+    const size_t size = image.mDataSize;
+    if (size > mBudget)
+        return;
+
+    auto entry = std::make_shared<Entry>();
+    entry->mImage = image;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto iter = mEntries.find(key);
+        if (iter != mEntries.end())
+        {
+            mMemoryUsed -= iter->second->GetMemorySize();
+            iter->second->mbEvicted = true;
+            mEntries.erase(iter);
+        }
+        Evict(size);
+        entry->mLastUse = ++mUseCounter;
+        mEntries[key] = entry;
+        mMemoryUsed += size;
+    }
+    if (mbCompress)
+        g_TS.AddTaskSetToPipe(new CompressFrameTaskSet(entry));
+}
+
+void FrameCache::Evict(size_t requiredSize)
+{
+    while (!mEntries.empty() && mMemoryUsed + requiredSize > mBudget)
+    {
+        auto oldest = mEntries.begin();
+        for (auto iter = mEntries.begin(); iter != mEntries.end(); ++iter)
+        {
+            if (iter->second->mLastUse < oldest->second->mLastUse)
+                oldest = iter;
+        }
+        mMemoryUsed -= oldest->second->GetMemorySize();
+        oldest->second->mbEvicted = true;
+        mEntries.erase(oldest);
+    }
+}
+
+void FrameCache::Prerender(int frameMin, int frameMax, bool loop)
+{
+    if (!mbEnabled || !mCurrentKey || !mbCurrentStored || mbPrerenderComplete || mPrerenderAhead <= 0)
+        return;
+    if (mPrerenderWait > 0)
+    {
+        mPrerenderWait--;
+        return;
+    }
+    // the UI stays responsive while editing
+    if (ImGui::IsAnyMouseDown())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mMemoryUsed >= mBudget)
+            return;
+    }
+
+    // video decoders are only stepped by the editing context
+    const size_t stageCount = gEvaluation.GetStagesCount();
+    std::vector<bool> usedNodes(stageCount, false);
+    RecurseBackward(mCurrentNode, usedNodes);
+    for (size_t i = 0; i < stageCount; i++)
+    {
+        if (usedNodes[i] && gEvaluation.GetEvaluationStage(i).mDecoder)
+        {
+            mbPrerenderComplete = true;
+            return;
+        }
+    }
+
+    // same size as the previewed output, it is displayed in place of it
+    auto target = gCurrentContext->GetRenderTarget(mCurrentNode);
+    if (!target || !target->mImage.mWidth || !target->mImage.mHeight)
+        return;
+    const int width = target->mImage.mWidth;
+    const int height = target->mImage.mHeight;
+    if (!mPrerenderContext || mPrerenderStageCount != stageCount || mPrerenderWidth != width || mPrerenderHeight != height)
+    {
+        DeletePrerenderContext();
+        mPrerenderContext = new EvaluationContext(gEvaluation, true, width, height);
+        mPrerenderStageCount = stageCount;
+        mPrerenderWidth = width;
+        mPrerenderHeight = height;
+    }
+
+    EvaluationContext *previousContext = gCurrentContext;
+    const int currentTime = gEvaluationTime;
+    gCurrentContext = mPrerenderContext;
+    mPrerenderContext->AllocRenderTargetsForEditingPreview();
+
+    bool done = true;
+    for (int i = 1; i <= mPrerenderAhead; i++)
+    {
+        int frame = mCurrentFrame + i;
+        if (frame >= frameMax)
+        {
+            if (!loop)
+                break;
+            frame = frameMin + (frame - frameMax) % ImMax(frameMax - frameMin, 1);
+        }
+        gNodeDelegate.SetTime(frame, false);
+        gNodeDelegate.ApplyAnimation(frame);
+        uint64_t key = ComputeKey(mCurrentNode, frame);
+        if (!key)
+            break;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if (mEntries.find(key) != mEntries.end())
+                continue;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        mPrerenderContext->RunBackward(mCurrentNode);
+        if (IsComplete(*mPrerenderContext, mCurrentNode))
+        {
+            Image image;
+            if (Evaluation::GetEvaluationImage(mCurrentNode, &image) == EVAL_OK)
+                Insert(key, image);
+            done = false;
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        mPrerenderWait = ImMin(int(seconds / prerenderFrameBudget), 60);
+        break;
+    }
+
+    // back to the displayed frame, dirty flags go to the prerender context
+    gNodeDelegate.SetTime(currentTime, false);
+    gNodeDelegate.ApplyAnimation(currentTime);
+    gCurrentContext = previousContext;
+    mbPrerenderComplete = done;
+}
+
+void FrameCache::DeletePrerenderContext()
+{
+    if (!mPrerenderContext)
+        return;
+    for (size_t i = 0; i < mPrerenderStageCount; i++)
+    {
+        auto target = mPrerenderContext->GetRenderTarget(i);
+        if (target)
+            target->Destroy();
+    }
+    delete mPrerenderContext;
+    mPrerenderContext = NULL;
+}
+
+void FrameCache::Clear()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto& entry : mEntries)
+            entry.second->mbEvicted = true;
+        mEntries.clear();
+        mMemoryUsed = 0;
+    }
+    mSkippedNodes.clear();
+    mCurrentKey = 0;
+    mCurrentNode = -1;
+    mCurrentFrame = -1;
+    mbCurrentStored = false;
+    mbPrerenderComplete = false;
+    DeletePrerenderContext();
+}
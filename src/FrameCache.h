@@ -0,0 +1,100 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Evaluation.h"
+
+struct EvaluationContext;
+
+// RAM flipbook of the previewed node output, one image per timeline frame.
+// Entries are keyed by a hash of the frame and of every upstream stage state, so
+// any edit makes previous entries unreachable without explicit invalidation.
+struct FrameCache
+{
+    FrameCache();
+    ~FrameCache();
+
+    // before RunDirty: upload the cached image if the frame was already evaluated
+    void BeginFrame(int nodeIndex, int frame);
+    // after RunDirty: store the evaluated image once the node and its inputs are done
+    void EndFrame();
+    // evaluate at most one missing frame ahead of the playhead in a baking context.
+    // Evaluation is synchronous: frames are spaced so it takes a small part of the UI time
+    void Prerender(int frameMin, int frameMax, bool loop);
+    void Clear();
+
+    size_t GetMemoryUsed() const { std::lock_guard<std::mutex> lock(mMutex); return mMemoryUsed; }
+    size_t GetFrameCount() const { std::lock_guard<std::mutex> lock(mMutex); return mEntries.size(); }
+
+    bool mbEnabled;
+    bool mbCompress;
+    size_t mBudget;
+    int mPrerenderAhead;
+
+    struct Entry
+    {
+        Entry() : mLastUse(0), mbEvicted(false) {}
+        Image_t mImage;
+        std::vector<unsigned char> mCompressed;
+        uint64_t mLastUse;
+        bool mbEvicted;
+        size_t GetMemorySize() const { return mCompressed.empty() ? mImage.mDataSize : mCompressed.size(); }
+    };
+    mutable std::mutex mMutex;
+    size_t mMemoryUsed;
+
+protected:
+    std::map<uint64_t, std::shared_ptr<Entry> > mEntries;
+    std::vector<size_t> mSkippedNodes;
+    uint64_t mUseCounter;
+
+    int mCurrentNode;
+    int mCurrentFrame;
+    uint64_t mCurrentKey;
+    bool mbCurrentStored;
+    bool mbStoreCurrent;
+    int mStableFrames;
+    bool mbPrerenderComplete;
+
+    EvaluationContext *mPrerenderContext;
+    size_t mPrerenderStageCount;
+    int mPrerenderWidth;
+    int mPrerenderHeight;
+    // UI frames to skip before the next prerendered frame, from the cost of the last one
+    int mPrerenderWait;
+
+    uint64_t ComputeKey(size_t nodeIndex, int frame) const;
+    bool IsComplete(const EvaluationContext& context, size_t nodeIndex) const;
+    bool Restore(size_t nodeIndex, uint64_t key);
+    void Insert(uint64_t key, Image_t& image);
+    void Resume();
+    void Evict(size_t requiredSize);
+    void DeletePrerenderContext();
+};
+
+extern FrameCache gFrameCache;
@@ -0,0 +1,248 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <GL/gl3w.h>
+#include <SDL.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+#include "HotReload.h"
+#include "Evaluators.h"
+#include "Utils.h"
+
+HotReload gHotReload;
+
+HotReload::HotReload() : mEvaluatorFiles(NULL), mWindow(NULL), mSharedContext(NULL), mbQuit(false), mNotifyFd(-1), mLastPoll(0)
+{
+}
+
+static uint64_t GetFileTimestamp(const std::string& path)
+{
+    struct stat fileStat;
+    if (stat(path.c_str(), &fileStat) != 0)
+        return 0;
+    return uint64_t(fileStat.st_mtime) ^ (uint64_t(fileStat.st_size) << 32);
+}
+
+void HotReload::Init(SDL_Window *window, const std::vector<EvaluatorFile>& evaluatorFiles)
+{
+    mEvaluatorFiles = &evaluatorFiles;
+    mWindow = window;
+
+    SDL_GLContext mainContext = SDL_GL_GetCurrentContext();
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    mSharedContext = SDL_GL_CreateContext(window);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+    // context creation makes the new one current
+    SDL_GL_MakeCurrent(window, mainContext);
+    if (mSharedContext)
+    {
+        mbQuit = false;
+        mThread = std::thread(&HotReload::CompileThread, this);
+    }
+    else
+    {
+        Log("Unable to create shared GL context, shaders will be compiled on the main thread: %s\n", SDL_GetError());
+    }
+
+#ifdef __linux__
+    mNotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (mNotifyFd != -1)
+    {
+        for (auto& file : evaluatorFiles)
+        {
+            bool watched = false;
+            for (auto& watch : mWatches)
+                watched |= watch.second == file.mDirectory;
+            if (watched)
+                continue;
+            // editors either rewrite the file or move a temporary one over it
+            int watch = inotify_add_watch(mNotifyFd, file.mDirectory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (watch != -1)
+                mWatches[watch] = file.mDirectory;
+        }
+        return;
+    }
+#endif
+    // no notification API, compare timestamps periodically
+    mTimestamps.resize(evaluatorFiles.size());
+    for (size_t i = 0; i < evaluatorFiles.size(); i++)
+        mTimestamps[i] = GetFileTimestamp(evaluatorFiles[i].mDirectory + evaluatorFiles[i].mFilename);
+}
+
+void HotReload::Finish()
+{
+    if (mThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mbQuit = true;
+        }
+        mCondition.notify_one();
+        mThread.join();
+    }
+    for (auto& compiled : mCompiled)
+    {
+        if (compiled.mProgram)
+            glDeleteProgram(compiled.mProgram);
+    }
+    mCompiled.clear();
+    if (mSharedContext)
+        SDL_GL_DeleteContext(mSharedContext);
+    mSharedContext = NULL;
+#ifdef __linux__
+    if (mNotifyFd != -1)
+        close(mNotifyFd);
+#endif
+    mNotifyFd = -1;
+    mWatches.clear();
+}
+
+bool HotReload::CompileProgramAsync(const std::string& filename, const std::string& source, bool transformFeedback)
+{
+    if (!mSharedContext)
+        return false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        // a newer save of the same file supersedes anything still queued or compiling
+        int generation = ++mGenerations[filename];
+        for (auto& request : mRequests)
+        {
+            if (request.mFilename == filename)
+            {
+                request.mSource = source;
+                request.mbTransformFeedback = transformFeedback;
+                request.mGeneration = generation;
+                return true;
+            }
+        }
+        mRequests.push_back({ filename, source, transformFeedback, generation, 0 });
+    }
+    mCondition.notify_one();
+    return true;
+}
+
+void HotReload::CompileThread()
+{
+    SDL_GL_MakeCurrent(mWindow, mSharedContext);
+    while (true)
+    {
+        CompileRequest request;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [this] { return mbQuit || !mRequests.empty(); });
+            if (mbQuit)
+                break;
+            request = mRequests.front();
+            mRequests.pop_front();
+        }
+        request.mProgram = request.mbTransformFeedback ? LoadShaderTransformFeedback(request.mSource, request.mFilename.c_str()) : LoadShader(request.mSource, request.mFilename.c_str());
+        // the program must be complete before the main context uses it
+        glFinish();
+        request.mSource = std::string();
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCompiled.push_back(request);
+    }
+    SDL_GL_MakeCurrent(mWindow, NULL);
+}
+
+void HotReload::FileChanged(const std::string& directory, const std::string& filename)
+{
+    for (auto& file : *mEvaluatorFiles)
+    {
+        if (file.mDirectory == directory && file.mFilename == filename)
+            gEvaluators.ReloadEvaluator(file, *mEvaluatorFiles);
+    }
+}
+
+void HotReload::PollTimestamps()
+{
+    uint32_t ticks = SDL_GetTicks();
+    if (ticks - mLastPoll < 500)
+        return;
+    mLastPoll = ticks;
+    for (size_t i = 0; i < mTimestamps.size() && i < mEvaluatorFiles->size(); i++)
+    {
+        const EvaluatorFile& file = (*mEvaluatorFiles)[i];
+        uint64_t timestamp = GetFileTimestamp(file.mDirectory + file.mFilename);
+        if (timestamp == mTimestamps[i])
+            continue;
+        mTimestamps[i] = timestamp;
+        gEvaluators.ReloadEvaluator(file, *mEvaluatorFiles);
+    }
+}
+
+void HotReload::Update()
+{
+    if (!mEvaluatorFiles)
+        return;
+
+#ifdef __linux__
+    if (mNotifyFd != -1)
+    {
+        alignas(struct inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(mNotifyFd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char *ptr = buffer; ptr < buffer + length;)
+            {
+                const struct inotify_event *event = (const struct inotify_event *)ptr;
+                auto iter = mWatches.find(event->wd);
+                if (event->len && iter != mWatches.end())
+                    FileChanged(iter->second, event->name);
+                ptr += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
+    else
+#endif
+    {
+        PollTimestamps();
+    }
+
+    std::vector<CompileRequest> compiled;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        compiled.swap(mCompiled);
+        for (auto& request : compiled)
+        {
+            // superseded by a newer save
+            if (mGenerations[request.mFilename] != request.mGeneration && request.mProgram)
+            {
+                glDeleteProgram(request.mProgram);
+                request.mProgram = 0;
+            }
+        }
+    }
+    for (auto& request : compiled)
+    {
+        // on error, the log has the details and the previous program stays in use
+        if (request.mProgram)
+            gEvaluators.SetGLSLProgram(request.mFilename, request.mProgram);
+    }
+}
@@ -0,0 +1,85 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Imogen.h"
+
+struct SDL_Window;
+
+// Watches evaluator directories and reloads only the evaluator whose file changed.
+// GLSL programs are compiled by a worker thread owning a GL context shared with the main one,
+// so the previous program keeps rendering until the new one is linked.
+struct HotReload
+{
+    HotReload();
+
+    // main GL context must be current
+    void Init(SDL_Window *window, const std::vector<EvaluatorFile>& evaluatorFiles);
+    void Finish();
+    // main thread, once per frame: dispatch file changes and install compiled programs
+    void Update();
+    // return false when there is no shared context, the caller must compile on the main thread
+    bool CompileProgramAsync(const std::string& filename, const std::string& source, bool transformFeedback);
+
+protected:
+    struct CompileRequest
+    {
+        std::string mFilename;
+        std::string mSource;
+        bool mbTransformFeedback;
+        int mGeneration;
+        unsigned int mProgram;
+    };
+
+    const std::vector<EvaluatorFile> *mEvaluatorFiles;
+    SDL_Window *mWindow;
+    void *mSharedContext;
+
+    std::thread mThread;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<CompileRequest> mRequests;
+    std::vector<CompileRequest> mCompiled;
+    std::map<std::string, int> mGenerations;
+    bool mbQuit;
+
+    // file watching
+    int mNotifyFd;
+    std::map<int, std::string> mWatches;
+    std::vector<uint64_t> mTimestamps;
+    uint32_t mLastPoll;
+
+    void CompileThread();
+    void FileChanged(const std::string& directory, const std::string& filename);
+    void PollTimestamps();
+};
+
+extern HotReload gHotReload;
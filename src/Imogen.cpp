@@ -29,6 +29,7 @@
 #include "TextEditor.h"
 #include <fstream>
 #include <streambuf>
+#include <mutex>
 #include "Evaluation.h"
 #include "NodesDelegate.h"
 #include "Library.h"
@@ -39,6 +40,9 @@
 #include "imgui_stdlib.h"
 #include "ImSequencer.h"
 #include "Evaluators.h"
+#include "FrameCache.h"
+#include "ThumbnailAtlas.h"
+#include "PythonWorker.h"
 #include "nfd.h"
 
 unsigned char *stbi_write_png_to_mem(unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len);
@@ -59,16 +63,34 @@ struct ImguiAppLog
     ImGuiTextFilter     Filter;
     ImVector<int>       LineOffsets;        // Index to lines offset
     bool                ScrollToBottom;
+    std::mutex          PendingMutex;
+    std::string         Pending;            // added by any thread, moved to Buf when drawn
 
     void    Clear() { Buf.clear(); LineOffsets.clear(); }
 
     void    AddLog(const char* fmt, ...)
     {
-        int old_size = Buf.size();
+        char text[10240];
         va_list args;
         va_start(args, fmt);
-        Buf.appendfv(fmt, args);
+        vsnprintf(text, sizeof(text), fmt, args);
         va_end(args);
+        std::lock_guard<std::mutex> lock(PendingMutex);
+        Pending += text;
+    }
+
+    // main thread
+    void    FlushPending()
+    {
+        std::string text;
+        {
+            std::lock_guard<std::mutex> lock(PendingMutex);
+            text.swap(Pending);
+        }
+        if (text.empty())
+            return;
+        int old_size = Buf.size();
+        Buf.appendf("%s", text.c_str());
         for (int new_size = Buf.size(); old_size < new_size; old_size++)
             if (Buf[old_size] == '\n')
                 LineOffsets.push_back(old_size);
@@ -77,6 +99,7 @@ struct ImguiAppLog
 
     void DrawEmbedded()
     {
+        FlushPending();
         if (ImGui::Button("Clear")) Clear();
         ImGui::SameLine();
         bool copy = ImGui::Button("Copy");
@@ -255,8 +278,8 @@ void Imogen::HandleEditor(TextEditor &editor, TileNodeEditGraphDelegate &nodeGra
         t << textToSave;
         t.close();
 
-        gEvaluators.SetEvaluators(mEvaluatorFiles);
-        gCurrentContext->RunAll();
+        // only this evaluator is rebuilt, the file watcher will see the same text and skip it
+        gEvaluators.ReloadEvaluator(mEvaluatorFiles[currentShaderIndex], mEvaluatorFiles);
     }
 
     ImGui::SameLine();
@@ -536,115 +559,107 @@ std::string GetName(const std::string &name)
 
 struct PinnedTaskUploadImage : enki::IPinnedTask
 {
-    PinnedTaskUploadImage(Image *image, ASyncId identifier, bool isThumbnail)
+    PinnedTaskUploadImage(Image *image, ASyncId identifier)
         : enki::IPinnedTask(0) // set pinned thread to 0
         , mImage(image)
         , mIdentifier(identifier)
-        , mbIsThumbnail(isThumbnail)
     {
     }
 
     virtual void Execute()
     {
-        unsigned int textureId = Evaluation::UploadImage(mImage, 0);
-        if (mbIsThumbnail)
+        TileNodeEditGraphDelegate::ImogenNode *node = gNodeDelegate.Get(mIdentifier);
+        size_t nodeIndex = node - gNodeDelegate.mNodes.data();
+        if (node)
         {
-            Material* material = library.Get(mIdentifier);
-            if (material)
-                material->mThumbnailTextureId = textureId;
-        }
-        else
-        {
-            TileNodeEditGraphDelegate::ImogenNode *node = gNodeDelegate.Get(mIdentifier);
-            size_t nodeIndex = node - gNodeDelegate.mNodes.data();
-            if (node)
-            {
-                Evaluation::SetEvaluationImage(int(nodeIndex), mImage);
-                gEvaluation.SetEvaluationParameters(nodeIndex, node->mParameters);
-                gCurrentContext->StageSetProcessing(nodeIndex, false);
-            }
-            Evaluation::FreeImage(mImage);
+            Evaluation::SetEvaluationImage(int(nodeIndex), mImage);
+            gEvaluation.SetEvaluationParameters(nodeIndex, node->mParameters);
+            gCurrentContext->StageSetProcessing(nodeIndex, false);
         }
+        Evaluation::FreeImage(mImage);
     }
     Image *mImage;
     ASyncId mIdentifier;
-    bool mbIsThumbnail;
 };
 
-struct DecodeThumbnailTaskSet : enki::ITaskSet
+// node images of one ValidateMaterial, encoded in parallel. The main loop stores the blobs and journals
+// the material once, when the whole set is complete
+struct EncodeImageTaskSet : enki::ITaskSet
 {
-    DecodeThumbnailTaskSet(std::vector<uint8_t> *src, ASyncId identifier) : enki::ITaskSet(), mIdentifier(identifier), mSrc(src)
+    EncodeImageTaskSet(ASyncId materialIdentifier) : enki::ITaskSet(), mMaterialIdentifier(materialIdentifier)
+    {
+    }
+    void AddImage(Image image, ASyncId nodeIdentifier)
     {
+        mImages.push_back(image);
+        mNodeIdentifiers.push_back(nodeIdentifier);
+        mBlobs.resize(mImages.size());
+        m_SetSize = uint32_t(mImages.size());
     }
     virtual void    ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum)
     {
-        Image image;
-        int components;
-        unsigned char *data = stbi_load_from_memory(mSrc->data(), int(mSrc->size()), &image.mWidth, &image.mHeight, &components, 0);
-        if (data)
+        for (uint32_t i = range.start; i < range.end; i++)
         {
-            image.SetBits(data, image.mWidth * image.mHeight * components);
-            image.mNumFaces = 1;
-            image.mNumMips = 1;
-            image.mFormat = (components == 4) ? TextureFormat::RGBA8 : TextureFormat::RGB8;
-            PinnedTaskUploadImage uploadTexTask(&image, mIdentifier, true);
-            g_TS.AddPinnedTask(&uploadTexTask);
-            g_TS.WaitforTask(&uploadTexTask);
-            Evaluation::FreeImage(&image);
+            if (Evaluation::EncodeImageBlob(&mImages[i], mBlobs[i]) != EVAL_OK)
+                mBlobs[i].clear();
+            Evaluation::FreeImage(&mImages[i]);
         }
-        delete this;
-    }
-    ASyncId mIdentifier;
-    std::vector<uint8_t> *mSrc;
-};
-
-struct EncodeImageTaskSet : enki::ITaskSet
-{
-    EncodeImageTaskSet(Image image, ASyncId materialIdentifier, ASyncId nodeIdentifier) : enki::ITaskSet(), mMaterialIdentifier(materialIdentifier), mNodeIdentifier(nodeIdentifier), mImage(image)
-    {
     }
-    virtual void    ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum)
+    // main thread
+    void Store()
     {
-        int outlen;
-        int components = 4;
-        unsigned char *bits = stbi_write_png_to_mem((unsigned char*)mImage.GetBits(), mImage.mWidth * components, mImage.mWidth, mImage.mHeight, components, &outlen);
-        if (bits)
+        Material *material = library.Get(mMaterialIdentifier);
+        if (!material)
+            return;
+        for (size_t i = 0; i < mBlobs.size(); i++)
         {
-            Material *material = library.Get(mMaterialIdentifier);
-            if (material)
-            {
-                MaterialNode *node = material->Get(mNodeIdentifier);
-                if (node)
-                {
-                    node->mImage.resize(outlen);
-                    memcpy(node->mImage.data(), bits, outlen);
-                }
-            }
+            // nodes validated again since have a new identifier and their own encode
+            MaterialNode *node = material->Get(mNodeIdentifiers[i]);
+            if (!node || mBlobs[i].empty())
+                continue;
+            node->mImage.swap(mBlobs[i]);
+            node->mMappedImage.Reset();
         }
-        delete this;
+        JournalMaterial(&library, material - library.mMaterials.data());
     }
     ASyncId mMaterialIdentifier;
-    ASyncId mNodeIdentifier;
-    Image mImage;
+    std::vector<Image> mImages;
+    std::vector<ASyncId> mNodeIdentifiers;
+    std::vector<std::vector<unsigned char> > mBlobs;
 };
 
+// in validation order
+static std::vector<EncodeImageTaskSet*> gImageEncodes;
+
+static void StoreEncodedImages(bool wait)
+{
+    size_t doneCount = 0;
+    for (; doneCount < gImageEncodes.size(); doneCount++)
+    {
+        EncodeImageTaskSet *encode = gImageEncodes[doneCount];
+        if (wait)
+            g_TS.WaitforTask(encode);
+        else if (!encode->GetIsComplete())
+            break;
+        encode->Store();
+        delete encode;
+    }
+    gImageEncodes.erase(gImageEncodes.begin(), gImageEncodes.begin() + doneCount);
+}
+
 struct DecodeImageTaskSet : enki::ITaskSet
 {
-    DecodeImageTaskSet(std::vector<uint8_t> *src, ASyncId identifier) : enki::ITaskSet(), mIdentifier(identifier), mSrc(src)
+    DecodeImageTaskSet(std::vector<uint8_t> *src, const LibraryBlob& mappedSrc, ASyncId identifier) : enki::ITaskSet(), mIdentifier(identifier), mSrc(src), mMappedSrc(mappedSrc)
     {
     }
     virtual void    ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum)
     {
         Image image;
-        int components;
-        unsigned char *data = stbi_load_from_memory(mSrc->data(), int(mSrc->size()), &image.mWidth, &image.mHeight, &components, 0);
-        if (data)
+        const uint8_t *src = mSrc->empty() ? mMappedSrc.GetData() : mSrc->data();
+        size_t srcSize = mSrc->empty() ? size_t(mMappedSrc.mSize) : mSrc->size();
+        if (src && Evaluation::DecodeImageBlob(src, srcSize, &image) == EVAL_OK)
         {
-            image.SetBits(data, image.mWidth * image.mHeight * components);
-            image.mNumFaces = 1;
-            image.mNumMips = 1;
-            image.mFormat = (components == 3) ? TextureFormat::RGB8 : TextureFormat::RGBA8;
-            PinnedTaskUploadImage uploadTexTask(&image, mIdentifier, false);
+            PinnedTaskUploadImage uploadTexTask(&image, mIdentifier);
             g_TS.AddPinnedTask(&uploadTexTask);
             g_TS.WaitforTask(&uploadTexTask);
         }
@@ -652,111 +667,94 @@ struct DecodeImageTaskSet : enki::ITaskSet
     }
     ASyncId mIdentifier;
     std::vector<uint8_t> *mSrc;
+    LibraryBlob mMappedSrc;
 };
 
-void DecodeThumbnailAsync(Material * material)
-{
-    static unsigned int defaultTextureId = gEvaluation.GetTexture("Stock/thumbnail-icon.png");
-    if (!material->mThumbnailTextureId)
-    {
-        material->mThumbnailTextureId = defaultTextureId;
-        g_TS.AddTaskSetToPipe(new DecodeThumbnailTaskSet(&material->mThumbnail, std::make_pair(material-library.mMaterials.data(), material->mRuntimeUniqueId)));
-    }
-}
-
 template <typename T, typename Ty> bool TVRes(std::vector<T, Ty>& res, const char *szName, int &selection, int index, Evaluation& evaluation, int viewMode)
 {
     bool ret = false;
     if (!ImGui::TreeNodeEx(szName, ImGuiTreeNodeFlags_FramePadding | ImGuiTreeNodeFlags_DefaultOpen))
         return ret;
 
-    std::string currentGroup = "";
-    bool currentGroupIsSkipped = false;
-
     std::vector<SortedResource<T, Ty>> sortedResources;
     SortedResource<T, Ty>::ComputeSortedResources(res, sortedResources);
     
     float regionWidth = ImGui::GetWindowContentRegionWidth();
-    float currentStep = 0.f;
     float stepSize = (viewMode == 2) ? 64.f : 128.f;
-    for (const auto& sortedRes : sortedResources)
-    {
-        unsigned int indexInRes = sortedRes.mIndex;
-        bool selected = ((selection >> 16) == index) && (selection & 0xFFFF) == (int)indexInRes;
-        ImGuiTreeNodeFlags node_flags = ImGuiTreeNodeFlags_FramePadding | ImGuiTreeNodeFlags_Leaf | ImGuiTreeNodeFlags_NoTreePushOnOpen | (selected ? ImGuiTreeNodeFlags_Selected : 0);
+    const int itemsPerRow = (viewMode == 2 || viewMode == 3) ? ImMax(int(regionWidth / stepSize), 1) : 1;
 
-        std::string grp = GetGroup(res[indexInRes].mName);
+    size_t groupBegin = 0;
+    while (groupBegin < sortedResources.size())
+    {
+        // resources of a group are consecutive once sorted
+        std::string currentGroup = GetGroup(res[sortedResources[groupBegin].mIndex].mName);
+        size_t groupEnd = groupBegin + 1;
+        while (groupEnd < sortedResources.size() && GetGroup(res[sortedResources[groupEnd].mIndex].mName) == currentGroup)
+            groupEnd++;
+        const size_t first = groupBegin;
+        groupBegin = groupEnd;
+        if (currentGroup.length() && !ImGui::TreeNode(currentGroup.c_str()))
+            continue;
 
-        if ( grp != currentGroup)
+        // rows out of the view are skipped: no thumbnail request, no widget
+        const int rowCount = int((groupEnd - first + itemsPerRow - 1) / itemsPerRow);
+        ImGuiListClipper clipper(rowCount);
+        while (clipper.Step())
         {
-            if (currentGroup.length() && !currentGroupIsSkipped)
-                ImGui::TreePop();
-
-            currentGroup = grp;
-            currentStep = 0.f;
-            if (currentGroup.length())
+            for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
             {
-                if (!ImGui::TreeNode(currentGroup.c_str()))
+                const size_t rowBegin = first + size_t(row) * itemsPerRow;
+                const size_t rowEnd = ImMin(rowBegin + itemsPerRow, groupEnd);
+                for (size_t sortedIndex = rowBegin; sortedIndex < rowEnd; sortedIndex++)
                 {
-                    currentGroupIsSkipped = true;
-                    continue;
-                }
-            }
-            currentGroupIsSkipped = false;
-        }
-        else if (currentGroupIsSkipped)
-            continue;
+                    unsigned int indexInRes = sortedResources[sortedIndex].mIndex;
+                    bool selected = ((selection >> 16) == index) && (selection & 0xFFFF) == (int)indexInRes;
+                    ImGuiTreeNodeFlags node_flags = ImGuiTreeNodeFlags_FramePadding | ImGuiTreeNodeFlags_Leaf | ImGuiTreeNodeFlags_NoTreePushOnOpen | (selected ? ImGuiTreeNodeFlags_Selected : 0);
 
-        if ((regionWidth - currentStep) < stepSize)
-        {
-            currentStep = 0.f;
-        }
-        if (viewMode == 2 || viewMode == 3)
-        {
-            if (currentStep > FLT_EPSILON)
-            {
-                ImGui::SameLine();
-            }
-        }
+                    if (sortedIndex != rowBegin)
+                        ImGui::SameLine();
 
-        ImGui::BeginGroup();
+                    ImGui::BeginGroup();
 
-        T& resource = res[indexInRes];
-        DecodeThumbnailAsync(&resource);
-        bool clicked = false;
-        switch (viewMode)
-        {
-        case 0:
-            ImGui::TreeNodeEx(GetName(resource.mName).c_str(), node_flags);
-            clicked |= ImGui::IsItemClicked();
-            break;
-        case 1:
-            ImGui::Image((ImTextureID)(int64_t)(resource.mThumbnailTextureId), ImVec2(64, 64), ImVec2(0, 1), ImVec2(1, 0));
-            clicked = ImGui::IsItemClicked();
-            ImGui::SameLine();
-            ImGui::TreeNodeEx(GetName(resource.mName).c_str(), node_flags);
-            clicked |= ImGui::IsItemClicked();
-            break;
-        case 2:
-            ImGui::Image((ImTextureID)(int64_t)(resource.mThumbnailTextureId), ImVec2(64, 64), ImVec2(0, 1), ImVec2(1, 0));
-            clicked = ImGui::IsItemClicked();
-            break;
-        case 3:
-            ImGui::Image((ImTextureID)(int64_t)(resource.mThumbnailTextureId), ImVec2(128, 128), ImVec2(0, 1), ImVec2(1, 0));
-            clicked = ImGui::IsItemClicked();
-            break;
-        }
-        if (clicked)
-        {
-            selection = (index << 16) + indexInRes;
-            ret = true;
+                    T& resource = res[indexInRes];
+                    bool clicked = false;
+                    ImVec2 uv0, uv1;
+                    ImTextureID thumbnail = (viewMode == 0) ? 0 : gThumbnailAtlas.Get(&resource, uv0, uv1);
+                    switch (viewMode)
+                    {
+                    case 0:
+                        ImGui::TreeNodeEx(GetName(resource.mName).c_str(), node_flags);
+                        clicked |= ImGui::IsItemClicked();
+                        break;
+                    case 1:
+                        ImGui::Image(thumbnail, ImVec2(64, 64), uv0, uv1);
+                        clicked = ImGui::IsItemClicked();
+                        ImGui::SameLine();
+                        ImGui::TreeNodeEx(GetName(resource.mName).c_str(), node_flags);
+                        clicked |= ImGui::IsItemClicked();
+                        break;
+                    case 2:
+                        ImGui::Image(thumbnail, ImVec2(64, 64), uv0, uv1);
+                        clicked = ImGui::IsItemClicked();
+                        break;
+                    case 3:
+                        ImGui::Image(thumbnail, ImVec2(128, 128), uv0, uv1);
+                        clicked = ImGui::IsItemClicked();
+                        break;
+                    }
+                    if (clicked)
+                    {
+                        selection = (index << 16) + indexInRes;
+                        ret = true;
+                    }
+                    ImGui::EndGroup();
+                }
+            }
         }
-        ImGui::EndGroup();
-        currentStep += stepSize;
-    }
 
-    if (currentGroup.length() && !currentGroupIsSkipped)
-        ImGui::TreePop();
+        if (currentGroup.length())
+            ImGui::TreePop();
+    }
 
     ImGui::TreePop();
     return ret;
@@ -773,6 +771,7 @@ void ValidateMaterial(Library& library, TileNodeEditGraphDelegate &nodeGraphDele
         return;
     Material& material = library.mMaterials[materialIndex];
     material.mMaterialNodes.resize(nodeGraphDelegate.mNodes.size());
+    EncodeImageTaskSet *encode = new EncodeImageTaskSet(std::make_pair(materialIndex, material.mRuntimeUniqueId));
 
     for (size_t i = 0; i < nodeGraphDelegate.mNodes.size(); i++)
     {
@@ -785,7 +784,7 @@ void ValidateMaterial(Library& library, TileNodeEditGraphDelegate &nodeGraphDele
             Image image;
             if (Evaluation::GetEvaluationImage(int(i), &image) == EVAL_OK)
             {
-                g_TS.AddTaskSetToPipe(new EncodeImageTaskSet(image, std::make_pair(materialIndex, material.mRuntimeUniqueId), std::make_pair(i, dstNode.mRuntimeUniqueId)));
+                encode->AddImage(image, std::make_pair(i, dstNode.mRuntimeUniqueId));
             }
         }
 
@@ -825,6 +824,15 @@ void ValidateMaterial(Library& library, TileNodeEditGraphDelegate &nodeGraphDele
     material.mFrameMin = nodeGraphDelegate.mFrameMin;
     material.mFrameMax = nodeGraphDelegate.mFrameMax;
     material.mPinnedParameters = nodeGraphDelegate.mPinnedParameters;
+    if (encode->mImages.empty())
+    {
+        delete encode;
+        JournalMaterial(&library, materialIndex);
+        return;
+    }
+    // journaled with the images once they are encoded
+    g_TS.AddTaskSetToPipe(encode);
+    gImageEncodes.push_back(encode);
 }
 
 void UpdateNewlySelectedGraph(TileNodeEditGraphDelegate &nodeGraphDelegate, Evaluation& evaluation)
@@ -833,17 +841,19 @@ void UpdateNewlySelectedGraph(TileNodeEditGraphDelegate &nodeGraphDelegate, Eval
     if (selectedMaterial != -1)
     {
         ClearAll(nodeGraphDelegate, evaluation);
+        gFrameCache.Clear();
 
         Material& material = library.mMaterials[selectedMaterial];
+        LoadMaterial(&material);
         for (size_t i = 0; i < material.mMaterialNodes.size(); i++)
         {
             MaterialNode& node = material.mMaterialNodes[i];
             NodeGraphAddNode(&nodeGraphDelegate, node.mType, node.mParameters, node.mPosX, node.mPosY, node.mFrameStart, node.mFrameEnd);
-            if (!node.mImage.empty())
+            if (!node.mImage.empty() || node.mMappedImage.IsValid())
             {
                 TileNodeEditGraphDelegate::ImogenNode& lastNode = nodeGraphDelegate.mNodes.back();
                 gCurrentContext->StageSetProcessing(i, true);
-                g_TS.AddTaskSetToPipe(new DecodeImageTaskSet(&node.mImage, std::make_pair(i, lastNode.mRuntimeUniqueId)));
+                g_TS.AddTaskSetToPipe(new DecodeImageTaskSet(&node.mImage, node.mMappedImage, std::make_pair(i, lastNode.mRuntimeUniqueId)));
             }
         }
         for (size_t i = 0; i < material.mMaterialConnections.size(); i++)
@@ -878,8 +888,9 @@ void LibraryEdit(Library& library, TileNodeEditGraphDelegate &nodeGraphDelegate,
         library.mMaterials.push_back(Material());
         Material& back = library.mMaterials.back();
         back.mName = "Name_Of_New_Graph";
-        back.mThumbnailTextureId = 0;
+        back.mThumbnailRuntimeId = 0;
         back.mRuntimeUniqueId = GetRuntimeId();
+        JournalMaterial(&library, library.mMaterials.size() - 1);
         
         if (previousSelection != -1)
         {
@@ -902,6 +913,7 @@ void LibraryEdit(Library& library, TileNodeEditGraphDelegate &nodeGraphDelegate,
             {
                 Log("Importing Graph %s\n", material.mName.c_str());
                 library.mMaterials.push_back(material);
+                JournalMaterial(&library, library.mMaterials.size() - 1);
             }
             free(outPath);
         }
@@ -1407,6 +1419,22 @@ void Imogen::ShowAppMainMenuBar()
 {
     if (ImGui::BeginMainMenuBar())
     {
+        if (ImGui::BeginMenu("Edit"))
+        {
+            if (ImGui::MenuItem("Undo", "CTRL+Z", false, !gUndoRedoHandler.mUndos.empty()))
+                gUndoRedoHandler.Undo();
+            if (ImGui::MenuItem("Redo", "CTRL+Y", false, !gUndoRedoHandler.mRedos.empty()))
+                gUndoRedoHandler.Redo();
+            ImGui::Separator();
+            int budget = int(gUndoRedoHandler.mMemoryBudget >> 20);
+            if (ImGui::SliderInt("Undo memory (MB)", &budget, 1, 1024))
+            {
+                gUndoRedoHandler.mMemoryBudget = size_t(budget) << 20;
+                gUndoRedoHandler.Trim();
+            }
+            ImGui::Text("%d entries, %d KB", int(gUndoRedoHandler.mUndos.size()), int(gUndoRedoHandler.GetMemoryUsed() >> 10));
+            ImGui::EndMenu();
+        }
         if (ImGui::BeginMenu("Plugins"))
         {
             if (ImGui::MenuItem("Reload plugins")) {}
@@ -1415,14 +1443,9 @@ void Imogen::ShowAppMainMenuBar()
             {
                 if (ImGui::MenuItem(plugin.mName.c_str())) 
                 {
-                    try
-                    {
-                        pybind11::exec(plugin.mPythonCommand);
-                    }
-                    catch (pybind11::error_already_set& ex)
-                    {
-                        Log(ex.what());
-                    }
+                    // errors are logged by the worker
+                    const std::string command = plugin.mPythonCommand;
+                    gPythonWorker.Post([command]() { pybind11::exec(command); });
                 }
             }
             ImGui::EndMenu();
@@ -1434,6 +1457,7 @@ void Imogen::ShowAppMainMenuBar()
 void Imogen::Show(Library& library, TileNodeEditGraphDelegate &nodeGraphDelegate, Evaluation& evaluation)
 {
     ImGuiIO& io = ImGui::GetIO();
+    StoreEncodedImages(false);
     ShowAppMainMenuBar();
     ImVec2 rc = ImGui::GetItemRectSize();
     ImVec2 deltaHeight = ImVec2(0, rc.y);
@@ -1484,6 +1508,7 @@ void Imogen::Show(Library& library, TileNodeEditGraphDelegate &nodeGraphDelegate
                 ImGui::SameLine();
                 if (ImGui::Button("Delete Graph"))
                 {
+                    JournalMaterialErase(selectedMaterial);
                     library.mMaterials.erase(library.mMaterials.begin() + selectedMaterial);
                     selectedMaterial = int(library.mMaterials.size()) - 1;
                     UpdateNewlySelectedGraph(nodeGraphDelegate, evaluation);
@@ -1576,6 +1601,11 @@ void Imogen::Show(Library& library, TileNodeEditGraphDelegate &nodeGraphDelegate
             if (ImGui::ImageButton((ImTextureID)(uint64_t)(gPlayLoop ? playLoopTextureId : playNoLoopTextureId), ImVec2(16.f, 16.f)))
                 gPlayLoop = !gPlayLoop;
 
+            ImGui::SameLine();
+            ImGui::Checkbox("Cache", &gFrameCache.mbEnabled);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("%d frames, %d MB", int(gFrameCache.GetFrameCount()), int(gFrameCache.GetMemoryUsed() >> 20));
+
             ImGui::SameLine();
             ImGui::PushID(202);
             ImGui::InputInt("", &gNodeDelegate.mFrameMax, 0, 0);
@@ -1674,6 +1704,8 @@ void Imogen::Show(Library& library, TileNodeEditGraphDelegate &nodeGraphDelegate
 void Imogen::ValidateCurrentMaterial(Library& library, TileNodeEditGraphDelegate &nodeGraphDelegate)
 {
     ValidateMaterial(library, nodeGraphDelegate, selectedMaterial);
+    // node images are in the journal before it's closed
+    StoreEncodedImages(true);
 }
 
 void Imogen::DiscoverNodes(const char *extension, const char *directory, EVALUATOR_TYPE evaluatorType, std::vector<EvaluatorFile>& files)
@@ -28,6 +28,8 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <algorithm>
+#include <assert.h>
 #include "imgui.h"
 #include "imgui_internal.h"
 #include "Library.h"
@@ -69,6 +71,7 @@ struct Imogen
     void Finish();
     
     void Show(Library& library, TileNodeEditGraphDelegate &nodeGraphDelegate, Evaluation& evaluation);
+    // also waits for the node images being encoded, they are in the library and its journal on return
     void ValidateCurrentMaterial(Library& library, TileNodeEditGraphDelegate &nodeGraphDelegate);
     void DiscoverNodes(const char *extension, const char *directory, EVALUATOR_TYPE evaluatorType, std::vector<EvaluatorFile>& files);
 
@@ -130,6 +133,17 @@ struct UndoRedo
     }
     void Discard() { mbDiscarded = true; }
     bool IsDiscarded() const { return mbDiscarded; }
+
+    // bytes held by this entry and its sub entries, used for the history memory budget
+    virtual size_t GetMemorySize() const
+    {
+        size_t size = sizeof(*this);
+        for (auto& undoRedo : mSubUndoRedo)
+            size += undoRedo->GetMemorySize();
+        return size;
+    }
+    // fold a following change into this entry (same widget being dragged). return true when merged.
+    virtual bool Coalesce(const UndoRedo& next) { return false; }
 protected:
     std::vector<std::shared_ptr<UndoRedo> > mSubUndoRedo;
     bool mbDiscarded;
@@ -137,7 +151,7 @@ protected:
 
 struct UndoRedoHandler
 {
-    UndoRedoHandler() : mbProcessing(false), mCurrent(NULL) {}
+    UndoRedoHandler() : mbProcessing(false), mCurrent(NULL), mMemoryBudget(64 << 20), mMemoryUsed(0) {}
     ~UndoRedoHandler()
     {
         Clear();
@@ -152,6 +166,7 @@ struct UndoRedoHandler
         mRedos.push_back(mUndos.back());
         mUndos.pop_back();
         mbProcessing = false;
+        mLastCoalesceId = 0;
     }
 
     void Redo()
@@ -163,18 +178,52 @@ struct UndoRedoHandler
         mUndos.push_back(mRedos.back());
         mRedos.pop_back();
         mbProcessing = false;
+        mLastCoalesceId = 0;
     }
 
     template <typename T> void AddUndo(const T &undoRedo)
     {
         if (undoRedo.IsDiscarded())
             return;
+        mbProcessing = true;
+        for (auto& redo : mRedos)
+            mMemoryUsed -= redo->GetMemorySize();
+        mRedos.clear();
+        mbProcessing = false;
+
         if (mCurrent && &undoRedo != mCurrent)
+        {
             mCurrent->AddSubUndoRedo(undoRedo);
-        else
-            mUndos.push_back(std::make_shared<T>(undoRedo));
+            return;
+        }
+        const size_t lastSize = mUndos.empty() ? 0 : mUndos.back()->GetMemorySize();
+        bool coalesced = !mUndos.empty() && mUndos.back()->Coalesce(undoRedo);
+        mLastCoalesceId = 0;
+        if (coalesced)
+        {
+            // merged record may have grown
+            mMemoryUsed += mUndos.back()->GetMemorySize() - lastSize;
+            Trim();
+            return;
+        }
+        mUndos.push_back(std::make_shared<T>(undoRedo));
+        mMemoryUsed += mUndos.back()->GetMemorySize();
+        Trim();
+    }
+
+    // drop oldest entries until the history fits the budget. The last entry is always kept.
+    void Trim()
+    {
+        size_t dropCount = 0;
+        while (mMemoryUsed > mMemoryBudget && dropCount + 1 < mUndos.size())
+        {
+            mMemoryUsed -= mUndos[dropCount]->GetMemorySize();
+            dropCount++;
+        }
+        if (!dropCount)
+            return;
         mbProcessing = true;
-        mRedos.clear();
+        mUndos.erase(mUndos.begin(), mUndos.begin() + dropCount);
         mbProcessing = false;
     }
 
@@ -184,10 +233,18 @@ struct UndoRedoHandler
         mUndos.clear();
         mRedos.clear();
         mbProcessing = false;
+        mMemoryUsed = 0;
+        mLastCoalesceId = 0;
     }
 
+    size_t GetMemoryUsed() const { return mMemoryUsed; }
+
     bool mbProcessing;
     UndoRedo* mCurrent;
+    size_t mMemoryBudget;
+    size_t mMemoryUsed;
+    // ImGui id of the widget that produced the last coalescable entry, 0 when the next one must not merge
+    unsigned int mLastCoalesceId = 0;
     //private:
 
     std::vector<std::shared_ptr<UndoRedo> > mUndos;
@@ -212,6 +269,12 @@ inline UndoRedo::~UndoRedo()
     }
 }
 
+// approximate heap + inline size of an undo snapshot. overload for types owning large buffers.
+template<typename T> size_t UndoMemorySize(const T& element) { return sizeof(T); }
+template<typename T> size_t UndoMemorySize(const std::vector<T>& elements) { return sizeof(elements) + elements.capacity() * sizeof(T); }
+// copy of an element kept by add/delete records. overload to leave out state that is rebuilt on undo/redo.
+template<typename T, typename U> void UndoSnapshot(T& snapshot, U&& element) { snapshot = element; }
+
 template<typename T> struct URChange : public UndoRedo
 {
     URChange(int index, T* (*GetElements)(int index), void(*Changed)(int index) = [](int index) {}) : GetElements(GetElements), mIndex(index), Changed(Changed)
@@ -249,6 +312,11 @@ template<typename T> struct URChange : public UndoRedo
         Changed(mIndex);
     }
 
+    virtual size_t GetMemorySize() const
+    {
+        return UndoRedo::GetMemorySize() + UndoMemorySize(mPreDo) + UndoMemorySize(mPostDo);
+    }
+
     T mPreDo;
     T mPostDo;
     int mIndex;
@@ -257,6 +325,122 @@ template<typename T> struct URChange : public UndoRedo
     void(*Changed)(int index);
 };
 
+// Parameter blocks only keep the modified byte range. Successive edits from the same active widget
+// (slider drag, text typing) on the same range are merged into a single history entry.
+template<> struct URChange<std::vector<unsigned char> > : public UndoRedo
+{
+    typedef std::vector<unsigned char> Bytes;
+    URChange(int index, Bytes* (*GetElements)(int index), void(*Changed)(int index) = [](int index) {}) : GetElements(GetElements), mIndex(index), Changed(Changed), mOffset(0), mPreSize(0), mPostSize(0), mActiveId(0)
+    {
+        if (gUndoRedoHandler.mbProcessing)
+            return;
+
+        mPreDo = *GetElements(mIndex);
+    }
+    virtual ~URChange()
+    {
+        if (gUndoRedoHandler.mbProcessing || mbDiscarded)
+            return;
+
+        const Bytes& current = *GetElements(mIndex);
+        if (current == mPreDo)
+            return;
+
+        mPreSize = mPreDo.size();
+        mPostSize = current.size();
+        size_t commonSize = std::min(mPreSize, mPostSize);
+        size_t begin = 0;
+        while (begin < commonSize && mPreDo[begin] == current[begin])
+            begin++;
+        size_t preEnd = mPreSize;
+        size_t postEnd = mPostSize;
+        while (preEnd > begin && postEnd > begin && mPreDo[preEnd - 1] == current[postEnd - 1])
+        {
+            preEnd--;
+            postEnd--;
+        }
+        mOffset = begin;
+        mActiveId = ImGui::GetActiveID();
+        mPostDo.assign(current.begin() + begin, current.begin() + postEnd);
+        mPreDo = Bytes(mPreDo.begin() + begin, mPreDo.begin() + preEnd);
+        gUndoRedoHandler.AddUndo(*this);
+        gUndoRedoHandler.mLastCoalesceId = mActiveId;
+    }
+    virtual void Undo()
+    {
+        Apply(mPreDo, mPostDo.size(), mPreSize);
+        Changed(mIndex);
+        UndoRedo::Undo();
+    }
+    virtual void Redo()
+    {
+        UndoRedo::Redo();
+        Apply(mPostDo, mPreDo.size(), mPostSize);
+        Changed(mIndex);
+    }
+    virtual size_t GetMemorySize() const
+    {
+        return UndoRedo::GetMemorySize() + mPreDo.capacity() + mPostDo.capacity();
+    }
+    virtual bool Coalesce(const UndoRedo& next)
+    {
+        // same widget, still held since the previous frame and nothing else recorded in between
+        const URChange* change = dynamic_cast<const URChange*>(&next);
+        if (!change || !mActiveId || change->mActiveId != mActiveId || gUndoRedoHandler.mLastCoalesceId != mActiveId
+            || GImGui->ActiveIdPreviousFrame != mActiveId)
+            return false;
+        if (change->GetElements != GetElements || change->mIndex != mIndex || !mSubUndoRedo.empty() || !change->mSubUndoRedo.empty())
+            return false;
+        // only fixed size blocks are merged: ranges can then be expressed in the same coordinates
+        if (mPreSize != mPostSize || change->mPreSize != mPostSize || change->mPostSize != mPostSize)
+            return false;
+
+        // next change is already applied, bytes outside both ranges are unchanged and read back from the element
+        const Bytes& current = *GetElements(mIndex);
+        size_t begin = std::min(mOffset, change->mOffset);
+        size_t end = std::max(mOffset + mPostDo.size(), change->mOffset + change->mPostDo.size());
+        Bytes preDo(end - begin);
+        for (size_t i = begin; i < end; i++)
+        {
+            if (i >= mOffset && i < mOffset + mPreDo.size())
+                preDo[i - begin] = mPreDo[i - mOffset];
+            else if (i >= change->mOffset && i < change->mOffset + change->mPreDo.size())
+                preDo[i - begin] = change->mPreDo[i - change->mOffset];
+            else
+                preDo[i - begin] = current[i];
+        }
+        size_t previousSize = GetMemorySize();
+        mPreDo.swap(preDo);
+        mPostDo.assign(current.begin() + begin, current.begin() + end);
+        mOffset = begin;
+        gUndoRedoHandler.mMemoryUsed += GetMemorySize();
+        gUndoRedoHandler.mMemoryUsed -= previousSize;
+        return true;
+    }
+
+    Bytes mPreDo;
+    Bytes mPostDo;
+    int mIndex;
+
+    Bytes* (*GetElements)(int index);
+    void(*Changed)(int index);
+
+protected:
+    size_t mOffset;
+    size_t mPreSize;
+    size_t mPostSize;
+    unsigned int mActiveId;
+
+    // replace the stored range (currently replacedSize bytes long) with bytes
+    void Apply(const Bytes& bytes, size_t replacedSize, size_t finalSize)
+    {
+        Bytes& elements = *GetElements(mIndex);
+        elements.erase(elements.begin() + mOffset, elements.begin() + mOffset + replacedSize);
+        elements.insert(elements.begin() + mOffset, bytes.begin(), bytes.end());
+        assert(elements.size() == finalSize);
+    }
+};
+
 
 struct URDummy : public UndoRedo
 {
@@ -290,7 +474,7 @@ template<typename T> struct URDel : public UndoRedo
         if (gUndoRedoHandler.mbProcessing)
             return;
 
-        mDeletedElement = (*GetElements())[mIndex];
+        UndoSnapshot(mDeletedElement, (*GetElements())[mIndex]);
     }
     virtual ~URDel()
     {
@@ -312,6 +496,11 @@ template<typename T> struct URDel : public UndoRedo
         GetElements()->erase(GetElements()->begin() + mIndex);
     }
 
+    virtual size_t GetMemorySize() const
+    {
+        return UndoRedo::GetMemorySize() + UndoMemorySize(mDeletedElement);
+    }
+
     T mDeletedElement;
     int mIndex;
 
@@ -330,7 +519,7 @@ template<typename T> struct URAdd : public UndoRedo
         if (gUndoRedoHandler.mbProcessing || mbDiscarded)
             return;
 
-        mAddedElement = (*GetElements())[mIndex];
+        UndoSnapshot(mAddedElement, (*GetElements())[mIndex]);
         // add to handler
         gUndoRedoHandler.AddUndo(*this);
     }
@@ -347,6 +536,11 @@ template<typename T> struct URAdd : public UndoRedo
         OnNew(mIndex);
     }
 
+    virtual size_t GetMemorySize() const
+    {
+        return UndoRedo::GetMemorySize() + UndoMemorySize(mAddedElement);
+    }
+
     T mAddedElement;
     int mIndex;
 
@@ -26,13 +26,35 @@
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <mutex>
 #include "Library.h"
 #include "imgui.h"
 #include "rapidjson/rapidjson.h"
 #include "rapidjson/document.h"
 #include "rapidjson/writer.h"
+#include "TaskScheduler.h"
 
 int Log(const char *szFormat, ...);
+extern enki::TaskScheduler g_TS;
+
+// 64 bits file offsets, long is 32 bits on Windows
+static uint64_t FileTell(FILE *fp)
+{
+#ifdef WIN32
+    return uint64_t(_ftelli64(fp));
+#else
+    return uint64_t(ftello(fp));
+#endif
+}
+
+static int FileSeek(FILE *fp, uint64_t offset, int origin)
+{
+#ifdef WIN32
+    return _fseeki64(fp, int64_t(offset), origin);
+#else
+    return fseeko(fp, off_t(offset), origin);
+#endif
+}
 
 enum : uint32_t
 {
@@ -45,6 +67,8 @@ enum : uint32_t
     v_frameStartEnd,
     v_animation,
     v_pinnedParameters,
+    v_libraryTOC,
+    v_blobStore,
     v_lastVersion
 };
 #define ADD(_fieldAdded, _fieldName) if (dataVersion >= _fieldAdded){ Ser(_fieldName); }
@@ -57,25 +81,77 @@ enum : uint32_t
 #define VERSION_IN_RANGE(_from, _to) \
     (dataVersion >= (_from) && dataVersion < (_to))
 
+// Since v_libraryTOC, the file is :
+// [version][TOC offset] then per material [version][material][thumbnail] then the TOC
+// The TOC lists name and byte ranges of each material so the file can be mapped and
+// materials deserialized when selected. Thumbnails and node images are kept as ranges
+// in the mapping until they are decoded.
+// Since v_blobStore, thumbnails and node images are written once per content hash in a store
+// placed after the materials. Materials reference them by hash, the store index follows the TOC.
 template<bool doWrite> struct Serialize
 {
-    Serialize(const char *szFilename)
+    Serialize(const char *szFilename) : mData(nullptr), mDataSize(0), mDataOffset(0), mBaseOffset(0), mBuffer(nullptr)
     {
         fp = fopen(szFilename, doWrite ? "wb" : "rb");
     }
 
+    // read from a mapped file range
+    Serialize(std::shared_ptr<LibraryFile> mappedFile, uint64_t offset, uint64_t size) : fp(nullptr), mMappedFile(mappedFile), mDataOffset(0), mBaseOffset(offset), mBuffer(nullptr)
+    {
+        mData = mappedFile->mData + offset;
+        mDataSize = size_t(size);
+    }
+
+    // write appended to a memory buffer
+    Serialize(std::vector<uint8_t> *buffer) : fp(nullptr), mData(nullptr), mDataSize(0), mDataOffset(0), mBaseOffset(0), mBuffer(buffer)
+    {
+        dataVersion = v_lastVersion - 1;
+    }
+
     ~Serialize()
     {
         if (fp)
             fclose(fp);
     }
 
+    void Write(const void *data, size_t size)
+    {
+        if (!size)
+            return;
+        if (mBuffer)
+            mBuffer->insert(mBuffer->end(), (const uint8_t*)data, (const uint8_t*)data + size);
+        else
+            fwrite(data, size, 1, fp);
+    }
+
+    void Read(void *data, size_t size)
+    {
+        if (!mData)
+        {
+            fread(data, size, 1, fp);
+            return;
+        }
+        size_t available = (mDataOffset < mDataSize) ? (mDataSize - mDataOffset) : 0;
+        size_t readSize = (size < available) ? size : available;
+        memcpy(data, mData + mDataOffset, readSize);
+        if (readSize < size)
+            memset((unsigned char*)data + readSize, 0, size - readSize);
+        mDataOffset += readSize;
+    }
+
+    uint64_t Tell() const
+    {
+        if (mBuffer)
+            return uint64_t(mBuffer->size());
+        return mData ? uint64_t(mDataOffset) : FileTell(fp);
+    }
+
     template<typename T> void Ser(T& data)
     {
         if (doWrite)
-            fwrite(&data, sizeof(T), 1, fp);
+            Write(&data, sizeof(T));
         else
-            fread(&data, sizeof(T), 1, fp);
+            Read(&data, sizeof(T));
     }
 
     void Ser(std::string& data)
@@ -83,15 +159,15 @@ template<bool doWrite> struct Serialize
         if (doWrite)
         {
             uint32_t len = uint32_t(strlen(data.c_str()));// uint32_t(data.length());
-            fwrite(&len, sizeof(uint32_t), 1, fp);
-            fwrite(data.c_str(), len, 1, fp);
+            Write(&len, sizeof(uint32_t));
+            Write(data.c_str(), len);
         }
         else
         {
             uint32_t len;
-            fread(&len, sizeof(uint32_t), 1, fp);
+            Read(&len, sizeof(uint32_t));
             data.resize(len);
-            fread(&data[0], len, 1, fp);
+            Read(&data[0], len);
             data = std::string(data.c_str(), strlen(data.c_str()));
         }
     }
@@ -113,12 +189,111 @@ template<bool doWrite> struct Serialize
             return;
         if (doWrite)
         {
-            fwrite(data.data(), count*sizeof(T), 1, fp);
+            Write(data.data(), count * sizeof(T));
         }
         else
         {
             data.resize(count);
-            fread(&data[0], count * sizeof(T), 1, fp);
+            Read(&data[0], count * sizeof(T));
+        }
+    }
+
+    struct PendingStoreBlob
+    {
+        const uint8_t *mData;
+        uint64_t mSize;
+        uint64_t mOffset; // once written
+    };
+
+    void AddStoreBlob(uint64_t hash, const uint8_t *data, uint64_t size)
+    {
+        PendingStoreBlob& pendingBlob = mStoreBlobs[hash];
+        pendingBlob.mData = data;
+        pendingBlob.mSize = size;
+        pendingBlob.mOffset = 0;
+        mStoreHashes.push_back(hash);
+    }
+
+    // before v_blobStore, same layout as SerArray. Then a hash in the store.
+    // When reading from a mapping, only the range is kept
+    void SerBlob(std::vector<uint8_t>& data, LibraryBlob& blob)
+    {
+        if (dataVersion >= v_blobStore)
+        {
+            SerStoreBlob(data, blob);
+            return;
+        }
+        if (doWrite)
+        {
+            if (!data.empty() || !blob.IsValid())
+            {
+                SerArray(data);
+                return;
+            }
+            uint32_t count = uint32_t(blob.mSize);
+            Ser(count);
+            Write(blob.GetData(), count);
+        }
+        else
+        {
+            if (!mMappedFile)
+            {
+                SerArray(data);
+                return;
+            }
+            uint32_t count;
+            Ser(count);
+            data.clear();
+            blob.Reset();
+            if (!count || mDataOffset + count > mDataSize)
+            {
+                mDataOffset = mDataSize;
+                return;
+            }
+            blob.mFile = mMappedFile;
+            blob.mOffset = mBaseOffset + mDataOffset;
+            blob.mSize = count;
+            mDataOffset += count;
+        }
+    }
+
+    void SerStoreBlob(std::vector<uint8_t>& data, LibraryBlob& blob)
+    {
+        if (doWrite)
+        {
+            const uint8_t *bytes = data.empty() ? blob.GetData() : data.data();
+            uint64_t size = data.empty() ? (blob.IsValid() ? blob.mSize : 0) : data.size();
+            uint64_t hash = size ? Hash64(bytes, size_t(size)) : 0;
+            Ser(hash);
+            if (size)
+                AddStoreBlob(hash, bytes, size);
+        }
+        else
+        {
+            uint64_t hash = 0;
+            Ser(hash);
+            data.clear();
+            blob.Reset();
+            if (!hash || !mMappedFile)
+                return;
+            auto iter = mMappedFile->mStore.find(hash);
+            if (iter == mMappedFile->mStore.end())
+                return;
+            blob.mFile = mMappedFile;
+            blob.mOffset = iter->second.mOffset;
+            blob.mSize = iter->second.mSize;
+        }
+    }
+
+    // store blobs referenced by a material that was never deserialized
+    void AddMappedStoreBlobs(const Material& material)
+    {
+        const LibraryFile *file = material.mMappedMaterial.mFile.get();
+        for (auto hash : material.mMappedStoreHashes)
+        {
+            auto iter = file->mStore.find(hash);
+            if (iter != file->mStore.end())
+                AddStoreBlob(hash, file->mData + iter->second.mOffset, iter->second.mSize);
         }
     }
 
@@ -137,17 +312,22 @@ template<bool doWrite> struct Serialize
         SerArray(data);
     }
 
+    void Ser(std::vector<uint64_t>& data)
+    {
+        SerArray(data);
+    }
+
     void Ser(AnimationBase *animBase)
     {
         ADD(v_animation, animBase->mFrames);
         if (doWrite)
         {
-            fwrite(animBase->GetData(), animBase->GetValuesByteLength(), 1, fp);
+            Write(animBase->GetData(), animBase->GetValuesByteLength());
         }
         else
         {
             animBase->Allocate(animBase->mFrames.size());
-            fread(animBase->GetData(), animBase->GetValuesByteLength(), 1, fp);
+            Read(animBase->GetData(), animBase->GetValuesByteLength());
         }
     }
 
@@ -179,7 +359,10 @@ template<bool doWrite> struct Serialize
         ADD(v_initial, materialNode->mPosY);
         ADD(v_initial, materialNode->mInputSamplers);
         ADD(v_initial, materialNode->mParameters);
-        ADD(v_nodeImage, materialNode->mImage);
+        if (dataVersion >= v_nodeImage)
+        {
+            SerBlob(materialNode->mImage, materialNode->mMappedImage);
+        }
         ADD(v_frameStartEnd, materialNode->mFrameStart);
         ADD(v_frameStartEnd, materialNode->mFrameEnd);
     }
@@ -208,7 +391,11 @@ template<bool doWrite> struct Serialize
         REM(v_materialComment, v_rugs, std::string, (material->mComment), "");
         ADD(v_initial, material->mMaterialNodes);
         ADD(v_initial, material->mMaterialConnections);
-        ADD(v_thumbnail, material->mThumbnail);
+        // thumbnail is stored next to the material since v_libraryTOC
+        if (VERSION_IN_RANGE(v_thumbnail, v_libraryTOC))
+        {
+            SerBlob(material->mThumbnail, material->mMappedThumbnail);
+        }
         ADD(v_rugs, material->mMaterialRugs);
         ADD(v_animation, material->mAnimTrack);
         ADD(v_animation, material->mFrameMin);
@@ -216,49 +403,635 @@ template<bool doWrite> struct Serialize
         ADD(v_pinnedParameters, material->mPinnedParameters);
     }
 
+    // material blob with its own version, so a blob can be copied as is to a newer file
+    void SerMaterialBlob(Material *material)
+    {
+        Ser(dataVersion);
+        if (dataVersion > v_lastVersion)
+            return;
+        Ser(material);
+    }
+
+    struct TOCEntry
+    {
+        std::string mName;
+        uint64_t mMaterialOffset;
+        uint64_t mMaterialSize;
+        uint64_t mThumbnailOffset;
+        uint64_t mThumbnailSize;
+        std::vector<uint64_t> mStoreHashes;
+
+        // runtime
+        uint64_t mThumbnailHash;
+    };
+
+    void Ser(TOCEntry *entry)
+    {
+        ADD(v_libraryTOC, entry->mName);
+        ADD(v_libraryTOC, entry->mMaterialOffset);
+        ADD(v_libraryTOC, entry->mMaterialSize);
+        ADD(v_libraryTOC, entry->mThumbnailOffset);
+        ADD(v_libraryTOC, entry->mThumbnailSize);
+        ADD(v_blobStore, entry->mStoreHashes);
+    }
+
+    struct StoreEntry
+    {
+        uint64_t mHash;
+        uint64_t mOffset;
+        uint64_t mSize;
+    };
+
+    void Ser(StoreEntry *entry)
+    {
+        ADD(v_blobStore, entry->mHash);
+        ADD(v_blobStore, entry->mOffset);
+        ADD(v_blobStore, entry->mSize);
+    }
+
+    bool WriteTOCLibrary(Library *library)
+    {
+        uint64_t tocOffsetPosition = Tell();
+        uint64_t tocOffset = 0;
+        Ser(tocOffset);
+
+        std::vector<TOCEntry> toc(library->mMaterials.size());
+        for (size_t i = 0; i < library->mMaterials.size(); i++)
+        {
+            Material& material = library->mMaterials[i];
+            TOCEntry& entry = toc[i];
+            entry.mName = material.mName;
+            entry.mMaterialOffset = Tell();
+            mStoreHashes.clear();
+            if (material.mMappedMaterial.IsValid())
+            {
+                // never deserialized, copy as is
+                Write(material.mMappedMaterial.GetData(), size_t(material.mMappedMaterial.mSize));
+                AddMappedStoreBlobs(material);
+            }
+            else
+            {
+                SerMaterialBlob(&material);
+            }
+            entry.mMaterialSize = Tell() - entry.mMaterialOffset;
+            entry.mStoreHashes = mStoreHashes;
+
+            // thumbnail is only referenced by the TOC
+            LibraryBlob thumbnail = material.mMappedThumbnail;
+            const uint8_t *bytes = material.mThumbnail.empty() ? thumbnail.GetData() : material.mThumbnail.data();
+            uint64_t size = material.mThumbnail.empty() ? (thumbnail.IsValid() ? thumbnail.mSize : 0) : material.mThumbnail.size();
+            entry.mThumbnailHash = size ? Hash64(bytes, size_t(size)) : 0;
+            if (size)
+                AddStoreBlob(entry.mThumbnailHash, bytes, size);
+        }
+
+        // each distinct image is written once
+        std::vector<StoreEntry> store;
+        store.reserve(mStoreBlobs.size());
+        for (auto& storeBlob : mStoreBlobs)
+        {
+            StoreEntry storeEntry;
+            storeEntry.mHash = storeBlob.first;
+            storeEntry.mOffset = Tell();
+            storeEntry.mSize = storeBlob.second.mSize;
+            Write(storeBlob.second.mData, size_t(storeEntry.mSize));
+            store.push_back(storeEntry);
+            storeBlob.second.mOffset = storeEntry.mOffset;
+        }
+        for (auto& entry : toc)
+        {
+            auto iter = mStoreBlobs.find(entry.mThumbnailHash);
+            bool hasThumbnail = entry.mThumbnailHash && iter != mStoreBlobs.end();
+            entry.mThumbnailOffset = hasThumbnail ? iter->second.mOffset : 0;
+            entry.mThumbnailSize = hasThumbnail ? iter->second.mSize : 0;
+        }
+
+        tocOffset = Tell();
+        Ser(toc);
+        Ser(store);
+        FileSeek(fp, tocOffsetPosition, SEEK_SET);
+        Ser(tocOffset);
+        return !ferror(fp);
+    }
+
+    bool ReadTOCLibrary(Library *library)
+    {
+        if (!mMappedFile)
+            return false;
+        uint64_t tocOffset = 0;
+        Ser(tocOffset);
+        if (tocOffset >= mDataSize)
+            return false;
+        mDataOffset = size_t(tocOffset);
+
+        std::vector<TOCEntry> toc;
+        Ser(toc);
+        if (dataVersion >= v_blobStore)
+        {
+            std::vector<StoreEntry> store;
+            Ser(store);
+            for (auto& storeEntry : store)
+            {
+                if (storeEntry.mOffset + storeEntry.mSize > mDataSize)
+                    continue;
+                LibraryFile::StoredBlob& storedBlob = mMappedFile->mStore[storeEntry.mHash];
+                storedBlob.mOffset = mBaseOffset + storeEntry.mOffset;
+                storedBlob.mSize = storeEntry.mSize;
+            }
+        }
+        library->mMaterials.resize(toc.size());
+        for (size_t i = 0; i < toc.size(); i++)
+        {
+            const TOCEntry& entry = toc[i];
+            if (entry.mMaterialOffset + entry.mMaterialSize > mDataSize || entry.mThumbnailOffset + entry.mThumbnailSize > mDataSize)
+            {
+                Log("Library TOC entry %s is out of file bounds.\n", entry.mName.c_str());
+                library->mMaterials.clear();
+                return false;
+            }
+            Material& material = library->mMaterials[i];
+            material.mName = entry.mName;
+            material.mMappedMaterial.mFile = mMappedFile;
+            material.mMappedMaterial.mOffset = mBaseOffset + entry.mMaterialOffset;
+            material.mMappedMaterial.mSize = entry.mMaterialSize;
+            material.mMappedStoreHashes = entry.mStoreHashes;
+            if (entry.mThumbnailSize)
+            {
+                material.mMappedThumbnail.mFile = mMappedFile;
+                material.mMappedThumbnail.mOffset = mBaseOffset + entry.mThumbnailOffset;
+                material.mMappedThumbnail.mSize = entry.mThumbnailSize;
+            }
+        }
+        return true;
+    }
+
     bool Ser(Library *library)
     {
-        if (!fp)
+        if (!fp && !mData)
             return false;
         if (doWrite)
             dataVersion = v_lastVersion-1;
         Ser(dataVersion);
         if (dataVersion > v_lastVersion)
             return false; // no forward compatibility
+        if (dataVersion >= v_libraryTOC)
+            return doWrite ? WriteTOCLibrary(library) : ReadTOCLibrary(library);
         ADD(v_initial, library->mMaterials);
         return true;
     }
 
     FILE *fp;
+    std::shared_ptr<LibraryFile> mMappedFile;
+    const uint8_t *mData;
+    size_t mDataSize;
+    size_t mDataOffset;
+    uint64_t mBaseOffset;
+    std::vector<uint8_t> *mBuffer;
+    std::map<uint64_t, PendingStoreBlob> mStoreBlobs; // store blobs to write, by hash
+    std::vector<uint64_t> mStoreHashes; // referenced by the material being written
     uint32_t dataVersion;
 };
 
 typedef Serialize<true> SerializeWrite;
 typedef Serialize<false> SerializeRead;
 
+static void InitMaterialNodes(Material& material, uint32_t dataVersion)
+{
+    for (auto& node : material.mMaterialNodes)
+    {
+        node.mRuntimeUniqueId = GetRuntimeId();
+        if (dataVersion >= v_nodeTypeName)
+        {
+            node.mType = uint32_t(GetMetaNodeIndex(node.mTypeName));
+        }
+    }
+}
+
 void LoadLib(Library *library, const char *szFilename)
 {
-    SerializeRead loadSer(szFilename);
-    loadSer.Ser(library);
+    // the mapping is kept alive by the materials, thumbnails and node images referencing it
+    auto mappedFile = std::make_shared<LibraryFile>();
+    if (!mappedFile->Open(szFilename))
+        return;
+    SerializeRead loadSer(mappedFile, 0, mappedFile->mSize);
+    if (!loadSer.Ser(library))
+        Log("Unable to read library %s\n", szFilename);
 
     for (auto& material : library->mMaterials)
     {
-        material.mThumbnailTextureId = 0;
+        material.mThumbnailRuntimeId = GetRuntimeId();
         material.mRuntimeUniqueId = GetRuntimeId();
-        for (auto& node : material.mMaterialNodes)
+        if (!material.mMappedMaterial.IsValid())
+        {
+            InitMaterialNodes(material, loadSer.dataVersion);
+        }
+    }
+}
+
+void LoadMaterial(Material *material)
+{
+    if (!material->mMappedMaterial.IsValid())
+        return;
+    LibraryBlob blob = material->mMappedMaterial;
+    material->mMappedMaterial.Reset();
+
+    // name from the TOC might have been edited since
+    std::string name = material->mName;
+    SerializeRead loadSer(blob.mFile, blob.mOffset, blob.mSize);
+    loadSer.SerMaterialBlob(material);
+    material->mName = name;
+    InitMaterialNodes(*material, loadSer.dataVersion);
+}
+
+// copy mapped thumbnail and node images so their mapping can be released. Ranges in keep stay mapped
+static void DetachMaterial(Material& material, const LibraryFile *keep = nullptr)
+{
+    if (material.mMappedMaterial.IsValid() && material.mMappedMaterial.mFile.get() != keep)
+        LoadMaterial(&material);
+    if (material.mMappedThumbnail.mFile.get() != keep)
+    {
+        if (material.mThumbnail.empty() && material.mMappedThumbnail.IsValid())
+        {
+            const uint8_t *data = material.mMappedThumbnail.GetData();
+            material.mThumbnail.assign(data, data + material.mMappedThumbnail.mSize);
+        }
+        material.mMappedThumbnail.Reset();
+    }
+    for (auto& node : material.mMaterialNodes)
+    {
+        if (node.mMappedImage.mFile.get() == keep)
+            continue;
+        if (node.mImage.empty() && node.mMappedImage.IsValid())
+        {
+            const uint8_t *data = node.mMappedImage.GetData();
+            node.mImage.assign(data, data + node.mMappedImage.mSize);
+        }
+        node.mMappedImage.Reset();
+    }
+}
+
+bool SaveLib(Library *library, const char *szFilename)
+{
+    // materials may still reference the file being replaced: write aside, remap, then rename
+    std::string tempFilename = std::string(szFilename) + ".tmp";
+    bool written;
+    {
+        SerializeWrite saveSer(tempFilename.c_str());
+        written = saveSer.Ser(library);
+    }
+    if (!written)
+    {
+        Log("Unable to write library %s\n", tempFilename.c_str());
+        remove(tempFilename.c_str());
+        return false;
+    }
+
+    auto mappedFile = std::make_shared<LibraryFile>();
+    if (mappedFile->Open(tempFilename.c_str()))
+    {
+        SerializeRead loadSer(mappedFile, 0, mappedFile->mSize);
+        Library savedLibrary;
+        if (loadSer.Ser(&savedLibrary) && savedLibrary.mMaterials.size() == library->mMaterials.size())
         {
-            node.mRuntimeUniqueId = GetRuntimeId();
-            if (loadSer.dataVersion >= v_nodeTypeName)
+            for (size_t i = 0; i < library->mMaterials.size(); i++)
             {
-                node.mType = uint32_t(GetMetaNodeIndex(node.mTypeName));
+                Material& material = library->mMaterials[i];
+                Material& savedMaterial = savedLibrary.mMaterials[i];
+                if (material.mThumbnail.empty())
+                    material.mMappedThumbnail = savedMaterial.mMappedThumbnail;
+                if (material.mMappedMaterial.IsValid())
+                {
+                    material.mMappedMaterial = savedMaterial.mMappedMaterial;
+                    material.mMappedStoreHashes = savedMaterial.mMappedStoreHashes;
+                    continue;
+                }
+                // node images of deserialized materials still point to the previous file
+                LoadMaterial(&savedMaterial);
+                if (savedMaterial.mMaterialNodes.size() != material.mMaterialNodes.size())
+                    continue;
+                for (size_t j = 0; j < material.mMaterialNodes.size(); j++)
+                {
+                    MaterialNode& node = material.mMaterialNodes[j];
+                    if (node.mImage.empty())
+                        node.mMappedImage = savedMaterial.mMaterialNodes[j].mMappedImage;
+                }
             }
         }
     }
+    // Windows can't replace a file that is still mapped: anything left in the previous file is copied,
+    // its mapping is released with the last reference
+    for (auto& material : library->mMaterials)
+        DetachMaterial(material, mappedFile.get());
+    if (!ReplaceFileAtomic(tempFilename.c_str(), szFilename))
+    {
+        Log("Unable to replace library %s\n", szFilename);
+        return false;
+    }
+    return true;
+}
+
+// Append-only journal of material edits, next to the library file.
+// [magic][library size][library stamp] then records [op][material index][payload size][payload][payload hash]
+// Put payload is [name][material blob][thumbnail hash][images]. Replay stops at the first torn record.
+enum : uint32_t
+{
+    JournalPut,
+    JournalErase,
+};
+static const uint32_t JournalMagic = 0x4C4A4D49; // IMJL
+static const size_t JournalHeaderSize = sizeof(uint32_t) + sizeof(uint64_t) * 2;
+static const size_t JournalMaxSize = 64 * 1024 * 1024;
+
+struct LibraryJournal
+{
+    LibraryJournal() : mFile(nullptr) {}
+    std::string mFilename;
+    FILE *mFile;
+    std::mutex mWriteMutex;
+    std::mutex mPendingMutex;
+    std::vector<std::vector<uint8_t> > mPending;
+    std::vector<uint64_t> mMaterialHashes; // last journaled payload per material
+};
+static LibraryJournal gLibraryJournal;
+
+static uint64_t GetLibraryStamp(const char *szLibraryFilename, uint64_t& librarySize)
+{
+    MappedFile mappedFile;
+    librarySize = 0;
+    if (!mappedFile.Open(szLibraryFilename))
+        return 0;
+    librarySize = mappedFile.mSize;
+    // the TOC is written last and changes with any material
+    size_t tailSize = std::min(mappedFile.mSize, size_t(4096));
+    return Hash64(mappedFile.mData + mappedFile.mSize - tailSize, tailSize);
+}
+
+static void FlushJournal()
+{
+    std::lock_guard<std::mutex> writeLock(gLibraryJournal.mWriteMutex);
+    std::vector<std::vector<uint8_t> > pending;
+    {
+        std::lock_guard<std::mutex> lock(gLibraryJournal.mPendingMutex);
+        pending.swap(gLibraryJournal.mPending);
+    }
+    if (!gLibraryJournal.mFile || pending.empty())
+        return;
+    for (auto& record : pending)
+        fwrite(record.data(), record.size(), 1, gLibraryJournal.mFile);
+    fflush(gLibraryJournal.mFile);
+}
+
+struct JournalWriteTaskSet : enki::ITaskSet
+{
+    virtual void    ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum)
+    {
+        FlushJournal();
+        delete this;
+    }
+};
+
+static void PushJournalRecord(uint32_t op, size_t materialIndex, const std::vector<uint8_t>& payload)
+{
+    std::vector<uint8_t> record;
+    SerializeWrite recordSer(&record);
+    uint32_t index = uint32_t(materialIndex);
+    uint32_t payloadSize = uint32_t(payload.size());
+    uint64_t hash = Hash64(payload.data(), payload.size());
+    recordSer.Ser(op);
+    recordSer.Ser(index);
+    recordSer.Ser(payloadSize);
+    recordSer.Write(payload.data(), payload.size());
+    recordSer.Ser(hash);
+    {
+        std::lock_guard<std::mutex> lock(gLibraryJournal.mPendingMutex);
+        gLibraryJournal.mPending.push_back(std::move(record));
+    }
+    g_TS.AddTaskSetToPipe(new JournalWriteTaskSet);
+}
+
+static void ApplyJournalRecord(Library *library, std::shared_ptr<LibraryFile> journal, uint32_t op, uint32_t index, uint64_t payloadOffset, uint32_t payloadSize)
+{
+    auto& materials = library->mMaterials;
+    if (op == JournalErase)
+    {
+        if (index < materials.size())
+            materials.erase(materials.begin() + index);
+        return;
+    }
+    if (op != JournalPut || index > materials.size())
+        return;
+    if (index == materials.size())
+    {
+        materials.push_back(Material());
+        materials.back().mRuntimeUniqueId = GetRuntimeId();
+    }
+    Material& material = materials[index];
+    material.mThumbnailRuntimeId = GetRuntimeId();
+
+    SerializeRead payloadSer(journal, payloadOffset, payloadSize);
+    payloadSer.Ser(material.mName);
+    uint32_t blobSize = 0;
+    payloadSer.Ser(blobSize);
+    material.mMappedMaterial.mFile = journal;
+    material.mMappedMaterial.mOffset = payloadOffset + payloadSer.mDataOffset;
+    material.mMappedMaterial.mSize = blobSize;
+    payloadSer.mDataOffset += blobSize;
+    uint64_t thumbnailHash = 0;
+    payloadSer.Ser(thumbnailHash);
+
+    // images used by the material
+    uint32_t storeCount = 0;
+    payloadSer.Ser(storeCount);
+    for (uint32_t i = 0; i < storeCount; i++)
+    {
+        uint64_t hash = 0;
+        uint64_t size = 0;
+        payloadSer.Ser(hash);
+        payloadSer.Ser(size);
+        if (payloadSer.mDataOffset + size > payloadSize)
+            break;
+        LibraryFile::StoredBlob& storedBlob = journal->mStore[hash];
+        storedBlob.mOffset = payloadOffset + payloadSer.mDataOffset;
+        storedBlob.mSize = size;
+        payloadSer.mDataOffset += size_t(size);
+    }
+    material.mThumbnail.clear();
+    material.mMappedThumbnail.Reset();
+    auto iter = journal->mStore.find(thumbnailHash);
+    if (thumbnailHash && iter != journal->mStore.end())
+    {
+        material.mMappedThumbnail.mFile = journal;
+        material.mMappedThumbnail.mOffset = iter->second.mOffset;
+        material.mMappedThumbnail.mSize = iter->second.mSize;
+    }
+
+    LoadMaterial(&material);
+    DetachMaterial(material);
+}
+
+// returns the size of the journal part that can be kept, 0 if it doesn't apply to the library
+static size_t ReplayJournal(Library *library, uint64_t librarySize, uint64_t libraryStamp)
+{
+    auto mappedFile = std::make_shared<LibraryFile>();
+    if (!mappedFile->Open(gLibraryJournal.mFilename.c_str()))
+        return 0;
+    SerializeRead journalSer(mappedFile, 0, mappedFile->mSize);
+    uint32_t magic = 0;
+    uint64_t size = 0;
+    uint64_t stamp = 0;
+    journalSer.Ser(magic);
+    journalSer.Ser(size);
+    journalSer.Ser(stamp);
+    if (magic != JournalMagic || size != librarySize || stamp != libraryStamp)
+    {
+        Log("Library journal %s doesn't match the library. Discarded.\n", gLibraryJournal.mFilename.c_str());
+        return 0;
+    }
+
+    size_t validSize = JournalHeaderSize;
+    int recordCount = 0;
+    while (validSize + sizeof(uint32_t) * 3 <= mappedFile->mSize)
+    {
+        uint32_t op, index, payloadSize;
+        journalSer.Ser(op);
+        journalSer.Ser(index);
+        journalSer.Ser(payloadSize);
+        uint64_t payloadOffset = journalSer.Tell();
+        if (payloadOffset + payloadSize + sizeof(uint64_t) > mappedFile->mSize)
+            break;
+        journalSer.mDataOffset += payloadSize;
+        uint64_t hash;
+        journalSer.Ser(hash);
+        if (hash != Hash64(mappedFile->mData + payloadOffset, payloadSize))
+            break;
+        ApplyJournalRecord(library, mappedFile, op, index, payloadOffset, payloadSize);
+        validSize = journalSer.mDataOffset;
+        recordCount++;
+    }
+    if (recordCount)
+        Log("Library journal : %d changes restored.\n", recordCount);
+    if (validSize < mappedFile->mSize)
+    {
+        // torn record from an interrupted write: keep the valid part only
+        Log("Library journal : %d bytes discarded.\n", int(mappedFile->mSize - validSize));
+        std::string tempFilename = gLibraryJournal.mFilename + ".tmp";
+        FILE *fp = fopen(tempFilename.c_str(), "wb");
+        bool written = fp && fwrite(mappedFile->mData, validSize, 1, fp) == 1;
+        if (fp)
+            fclose(fp);
+        mappedFile->Close();
+        if (!written || !ReplaceFileAtomic(tempFilename.c_str(), gLibraryJournal.mFilename.c_str()))
+            return 0;
+    }
+    return validSize;
+}
+
+void OpenLibraryJournal(Library *library, const char *szLibraryFilename)
+{
+    gLibraryJournal.mFilename = std::string(szLibraryFilename) + ".journal";
+    uint64_t librarySize;
+    uint64_t libraryStamp = GetLibraryStamp(szLibraryFilename, librarySize);
+    if (ReplayJournal(library, librarySize, libraryStamp))
+    {
+        gLibraryJournal.mFile = fopen(gLibraryJournal.mFilename.c_str(), "ab");
+        if (gLibraryJournal.mFile)
+            FileSeek(gLibraryJournal.mFile, 0, SEEK_END);
+    }
+    else
+    {
+        gLibraryJournal.mFile = fopen(gLibraryJournal.mFilename.c_str(), "wb");
+        if (gLibraryJournal.mFile)
+        {
+            uint32_t magic = JournalMagic;
+            fwrite(&magic, sizeof(uint32_t), 1, gLibraryJournal.mFile);
+            fwrite(&librarySize, sizeof(uint64_t), 1, gLibraryJournal.mFile);
+            fwrite(&libraryStamp, sizeof(uint64_t), 1, gLibraryJournal.mFile);
+            fflush(gLibraryJournal.mFile);
+        }
+    }
+    if (!gLibraryJournal.mFile)
+        Log("Unable to open library journal %s. Changes will be saved on exit only.\n", gLibraryJournal.mFilename.c_str());
+    gLibraryJournal.mMaterialHashes.clear();
+    gLibraryJournal.mMaterialHashes.resize(library->mMaterials.size(), 0);
+}
+
+void JournalMaterial(Library *library, size_t materialIndex)
+{
+    if (!gLibraryJournal.mFile || materialIndex >= library->mMaterials.size())
+        return;
+    Material& material = library->mMaterials[materialIndex];
+
+    // [name][material blob][thumbnail hash][images referenced by the material and its thumbnail]
+    std::vector<uint8_t> payload;
+    SerializeWrite payloadSer(&payload);
+    payloadSer.Ser(material.mName);
+    std::vector<uint8_t> blob;
+    SerializeWrite blobSer(&blob);
+    if (material.mMappedMaterial.IsValid())
+    {
+        blobSer.Write(material.mMappedMaterial.GetData(), size_t(material.mMappedMaterial.mSize));
+        blobSer.AddMappedStoreBlobs(material);
+    }
+    else
+    {
+        blobSer.SerMaterialBlob(&material);
+    }
+    payloadSer.SerArray(blob);
+    payloadSer.SerStoreBlob(material.mThumbnail, material.mMappedThumbnail);
+    payloadSer.mStoreBlobs.insert(blobSer.mStoreBlobs.begin(), blobSer.mStoreBlobs.end());
+    uint32_t storeCount = uint32_t(payloadSer.mStoreBlobs.size());
+    payloadSer.Ser(storeCount);
+    for (auto& storeBlob : payloadSer.mStoreBlobs)
+    {
+        uint64_t hash = storeBlob.first;
+        uint64_t size = storeBlob.second.mSize;
+        payloadSer.Ser(hash);
+        payloadSer.Ser(size);
+        payloadSer.Write(storeBlob.second.mData, size_t(size));
+    }
+
+    auto& hashes = gLibraryJournal.mMaterialHashes;
+    hashes.resize(library->mMaterials.size(), 0);
+    uint64_t hash = Hash64(payload.data(), payload.size());
+    if (hashes[materialIndex] == hash)
+        return;
+    hashes[materialIndex] = hash;
+    PushJournalRecord(JournalPut, materialIndex, payload);
 }
 
-void SaveLib(Library *library, const char *szFilename)
+void JournalMaterialErase(size_t materialIndex)
 {
-    SerializeWrite(szFilename).Ser(library);
+    if (!gLibraryJournal.mFile)
+        return;
+    auto& hashes = gLibraryJournal.mMaterialHashes;
+    if (materialIndex < hashes.size())
+        hashes.erase(hashes.begin() + materialIndex);
+    PushJournalRecord(JournalErase, materialIndex, std::vector<uint8_t>());
+}
+
+void CloseLibraryJournal(Library *library, const char *szLibraryFilename)
+{
+    FlushJournal();
+    size_t journalSize = 0;
+    {
+        std::lock_guard<std::mutex> writeLock(gLibraryJournal.mWriteMutex);
+        if (gLibraryJournal.mFile)
+        {
+            journalSize = size_t(FileTell(gLibraryJournal.mFile));
+            fclose(gLibraryJournal.mFile);
+            gLibraryJournal.mFile = nullptr;
+        }
+    }
+
+    // compact when the journal is big compared to the library. Otherwise it is replayed on next run
+    uint64_t librarySize;
+    GetLibraryStamp(szLibraryFilename, librarySize);
+    if (journalSize && journalSize <= JournalHeaderSize)
+        return;
+    if (journalSize && journalSize < JournalMaxSize && journalSize * 4 < librarySize)
+        return;
+    if (SaveLib(library, szLibraryFilename))
+        remove(gLibraryJournal.mFilename.c_str());
 }
 
 unsigned int GetRuntimeId()
@@ -477,8 +1250,13 @@ uint32_t GetCurveParameterColor(uint32_t paramType, int suffixIndex)
 	return 0xFFAAAAAA;
 }
 
+static std::vector<std::vector<size_t> > gMetaNodesParameterOffsets; // filled by LoadMetaNodes
+
 size_t GetParameterOffset(uint32_t type, uint32_t parameterIndex)
 {
+    if (type < gMetaNodesParameterOffsets.size() && parameterIndex < gMetaNodesParameterOffsets[type].size())
+        return gMetaNodesParameterOffsets[type][parameterIndex];
+
     const MetaNode& currentMeta = gMetaNodes[type];
     size_t ret = 0;
     int i = 0;
@@ -982,9 +1760,19 @@ void LoadMetaNodes(const std::vector<std::string>& metaNodeFilenames)
     }
 
 
+    gMetaNodesParameterOffsets.resize(gMetaNodes.size());
     for (size_t i = 0; i < gMetaNodes.size(); i++)
     {
         gMetaNodesIndices[gMetaNodes[i].mName] = i;
+
+        auto& offsets = gMetaNodesParameterOffsets[i];
+        size_t offset = 0;
+        offsets.clear();
+        for (const MetaParameter& param : gMetaNodes[i].mParams)
+        {
+            offsets.push_back(offset);
+            offset += GetParameterTypeSize(param.mType);
+        }
     }
 }
 
@@ -1291,16 +2079,16 @@ AnimationBase::AnimationPointer AnimationBase::GetPointer(int32_t frame, bool bS
         int32_t last = int32_t(mFrames.size() - (bSetting ? 0 : 1));
         return {last, mFrames.back(), last, mFrames.back(), 0.f };
     }
-    for (int i = 0; i < int(mFrames.size()) - 1; i++)
+    // frames are sorted: first key at or after frame ends the segment
+    auto iter = std::lower_bound(mFrames.begin() + 1, mFrames.end(), frame);
+    if (iter == mFrames.end())
     {
-        if (mFrames[i] <= frame && mFrames[i + 1] >= frame)
-        {
-            float ratio = float(frame - mFrames[i]) / float(mFrames[i+1] - mFrames[i]);
-            return { i, mFrames[i], i + 1, mFrames[i+1], ratio };
-        }
+        assert(0);
+        return { bSetting ? -1 : 0, 0, 0, 0, 0.f };
     }
-    assert(0);
-    return { bSetting? -1:0, 0, 0, 0, 0.f };
+    int i = int(iter - mFrames.begin()) - 1;
+    float ratio = float(frame - mFrames[i]) / float(mFrames[i + 1] - mFrames[i]);
+    return { i, mFrames[i], i + 1, mFrames[i + 1], ratio };
 }
 
 AnimTrack& AnimTrack::operator = (const AnimTrack& other)
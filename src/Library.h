@@ -78,6 +78,32 @@ inline Camera Lerp(Camera a, Camera b, float t) { return a.Lerp(b, t); }
 // if item at index doesn't correspond to uniqueid, then a search is done
 // based on the unique id
 typedef std::pair<size_t, unsigned int> ASyncId;
+
+// mapped library or journal file with the index of its image store.
+// Thumbnails and node images are stored once per content hash.
+struct LibraryFile : public MappedFile
+{
+    struct StoredBlob
+    {
+        uint64_t mOffset;
+        uint64_t mSize;
+    };
+    std::map<uint64_t, StoredBlob> mStore;
+};
+
+// byte range inside a memory mapped library file. Holds a reference to the mapping.
+struct LibraryBlob
+{
+    LibraryBlob() : mOffset(0), mSize(0) {}
+    std::shared_ptr<LibraryFile> mFile;
+    uint64_t mOffset;
+    uint64_t mSize;
+
+    bool IsValid() const { return mFile && mSize; }
+    const uint8_t* GetData() const { return mFile ? mFile->mData + mOffset : nullptr; }
+    void Reset() { mFile.reset(); mOffset = mSize = 0; }
+};
+
 template<typename T> T* GetByAsyncId(ASyncId id, std::vector<T>& items)
 {
     if (items.size() > id.first && items[id.first].mRuntimeUniqueId == id.second)
@@ -133,6 +159,7 @@ struct MaterialNode
 
     // runtime
     unsigned int mRuntimeUniqueId;
+    LibraryBlob mMappedImage; // used when mImage is empty
 };
 
 struct MaterialNodeRug
@@ -357,8 +384,11 @@ struct Material
     MaterialNode* Get(ASyncId id) { return GetByAsyncId(id, mMaterialNodes); }
 
     //run time
-    unsigned int mThumbnailTextureId;
+    unsigned int mThumbnailRuntimeId; // changes with the thumbnail content, identifies it in the thumbnail atlas
     unsigned int mRuntimeUniqueId;
+    LibraryBlob mMappedMaterial; // valid until the material is deserialized by LoadMaterial
+    std::vector<uint64_t> mMappedStoreHashes; // store blobs referenced by mMappedMaterial
+    LibraryBlob mMappedThumbnail; // used when mThumbnail is empty
 };
 
 struct Library
@@ -379,7 +409,16 @@ struct Library
 };
 
 void LoadLib(Library *library, const char *szFilename);
-void SaveLib(Library *library, const char *szFilename);
+bool SaveLib(Library *library, const char *szFilename);
+// deserialize a material whose content is still in the mapped library file
+void LoadMaterial(Material *material);
+
+// crash safe autosave: material changes are appended to a journal by a background task.
+// Open replays it over the loaded library. Close compacts it into the library when it gets big.
+void OpenLibraryJournal(Library *library, const char *szLibraryFilename);
+void JournalMaterial(Library *library, size_t materialIndex);
+void JournalMaterialErase(size_t materialIndex);
+void CloseLibraryJournal(Library *library, const char *szLibraryFilename);
 
 enum ConTypes
 {
@@ -422,7 +461,6 @@ const char* GetCurveParameterSuffix(uint32_t paramType, int suffixIndex);
 uint32_t GetCurveParameterColor(uint32_t paramType, int suffixIndex);
 AnimationBase *AllocateAnimation(uint32_t valueType);
 CurveType GetCurveTypeForParameterType(ConTypes paramType);
-void DecodeThumbnailAsync(Material * material);
 struct MetaCon
 {
     std::string mName;
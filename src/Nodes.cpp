@@ -35,6 +35,7 @@
 #include "NodesDelegate.h"
 #include <array>
 #include "imgui_markdown/imgui_markdown.h"
+#include "ThumbnailAtlas.h"
 
 int Log(const char *szFormat, ...);
 void AddExtractedView(size_t nodeIndex);
@@ -64,8 +65,9 @@ inline ImGui::MarkdownImageData ImageCallback(ImGui::MarkdownLinkCallbackData da
         Material* libraryMaterial = library.GetByName(material.c_str());
         if (libraryMaterial)
         {
-            DecodeThumbnailAsync(libraryMaterial);
-            return { true, true, (ImTextureID)(uint64_t)libraryMaterial->mThumbnailTextureId, ImVec2(100, 100), ImVec2(0.f, 1.f), ImVec2(1.f, 0.f) };
+            ImVec2 uv0, uv1;
+            ImTextureID thumbnail = gThumbnailAtlas.Get(libraryMaterial, uv0, uv1);
+            return { true, true, thumbnail, ImVec2(100, 100), uv0, uv1 };
         }
     }
     else
@@ -937,23 +937,39 @@ void TileNodeEditGraphDelegate::GetKeyedParameters(int frame, uint32_t nodeIndex
 
 }
 
+bool TileNodeEditGraphDelegate::SampleAnimTrack(AnimTrack& animTrack, int frame)
+{
+    if (animTrack.mNodeIndex >= mNodes.size())
+        return false;
+    auto& node = mNodes[animTrack.mNodeIndex];
+    const size_t parameterOffset = GetParameterOffset(uint32_t(node.mType), animTrack.mParamIndex);
+    const size_t parameterSize = GetParameterTypeSize(animTrack.mValueType);
+    if (parameterOffset + parameterSize > node.mParameters.size())
+        return false;
+
+    // constant segments sample the same bytes: don't upload or dirty for them
+    mAnimationSample.resize(parameterSize);
+    memcpy(mAnimationSample.data(), &node.mParameters[parameterOffset], parameterSize);
+    animTrack.mAnimation->GetValue(frame, mAnimationSample.data());
+    if (!memcmp(mAnimationSample.data(), &node.mParameters[parameterOffset], parameterSize))
+        return false;
+    memcpy(&node.mParameters[parameterOffset], mAnimationSample.data(), parameterSize);
+    return true;
+}
+
 void TileNodeEditGraphDelegate::ApplyAnimationForNode(size_t nodeIndex, int frame)
 {
     bool animatedNodes = false;
-    auto& node = mNodes[nodeIndex];
     for (auto& animTrack : mAnimTrack)
     {
         if (animTrack.mNodeIndex == nodeIndex)
         {
-            size_t parameterOffset = GetParameterOffset(uint32_t(node.mType), animTrack.mParamIndex);
-            animTrack.mAnimation->GetValue(frame, &node.mParameters[parameterOffset]);
-
-            animatedNodes = true;
+            animatedNodes |= SampleAnimTrack(animTrack, frame);
         }
     }
     if (animatedNodes)
     {
-        gEvaluation.SetEvaluationParameters(nodeIndex, node.mParameters);
+        gEvaluation.SetEvaluationParameters(nodeIndex, mNodes[nodeIndex].mParameters);
         gCurrentContext->SetTargetDirty(nodeIndex);
     }
 }
@@ -964,10 +980,8 @@ void TileNodeEditGraphDelegate::ApplyAnimation(int frame)
     animatedNodes.resize(mNodes.size(), false);
     for (auto& animTrack : mAnimTrack)
     {
-        auto& node = mNodes[animTrack.mNodeIndex];
-        animatedNodes[animTrack.mNodeIndex] = true;
-        size_t parameterOffset = GetParameterOffset(uint32_t(node.mType), animTrack.mParamIndex);
-        animTrack.mAnimation->GetValue(frame, &node.mParameters[parameterOffset]);
+        if (SampleAnimTrack(animTrack, frame))
+            animatedNodes[animTrack.mNodeIndex] = true;
     }
     for (size_t i = 0; i < animatedNodes.size(); i++)
     {
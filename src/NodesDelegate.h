@@ -82,6 +82,8 @@ struct TileNodeEditGraphDelegate : public NodeGraphDelegate
     void GetKeyedParameters(int frame, uint32_t nodeIndex, std::vector<bool>& keyed);
     void ApplyAnimation(int frame);
     void ApplyAnimationForNode(size_t nodeIndex, int frame);
+    // return true when the sampled value differs from the node parameter
+    bool SampleAnimTrack(AnimTrack& animTrack, int frame);
     void RemoveAnimation(size_t nodeIndex);
     void RemovePins(size_t nodeIndex);
 
@@ -128,6 +130,11 @@ struct TileNodeEditGraphDelegate : public NodeGraphDelegate
                 return true;
             return false;
         }
+
+        friend size_t UndoMemorySize(const ImogenNode& node)
+        {
+            return sizeof(ImogenNode) + node.mParameters.capacity() + node.mInputSamplers.capacity() * sizeof(InputSampler);
+        }
     };
 
     EvaluationContext mEditingContext;
@@ -138,6 +145,7 @@ struct TileNodeEditGraphDelegate : public NodeGraphDelegate
     std::vector<uint32_t> mPinnedParameters;
 
     int mFrameMin, mFrameMax;
+    std::vector<unsigned char> mAnimationSample;
     bool mbMouseDragging;
 
     ImogenNode* Get(ASyncId id) { return GetByAsyncId(id, mNodes); }
@@ -0,0 +1,205 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <GL/gl3w.h>
+#include <stdio.h>
+#include "ProgramCache.h"
+#include "Utils.h"
+
+ProgramCache gProgramCache;
+
+static const char *programCacheFilename = "programs.cache";
+static const uint32_t programCacheMagic = 0x50474D49; // 'IMGP'
+static const uint32_t programCacheVersion = 1;
+
+ProgramCache::ProgramCache() : mDriverHash(0), mbInitialized(false), mbSupported(false), mbDirty(false), mHitCount(0), mCompileCount(0)
+{
+}
+
+void ProgramCache::Init()
+{
+    mbInitialized = true;
+
+    GLint formatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    mbSupported = formatCount > 0;
+    if (!mbSupported)
+    {
+        Log("Program binaries not supported by driver. Shaders will be compiled.\n");
+        return;
+    }
+
+    std::string driver;
+    const GLenum driverStrings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for (auto driverString : driverStrings)
+    {
+        const char *str = (const char*)glGetString(driverString);
+        driver += str ? str : "";
+        driver += "\n";
+    }
+    mDriverHash = Hash64(driver.data(), driver.size());
+
+    FILE *fp = fopen(programCacheFilename, "rb");
+    if (!fp)
+        return;
+
+    uint32_t header[2] = { 0, 0 };
+    uint64_t driverHash = 0;
+    uint32_t count = 0;
+    bool valid = fread(header, sizeof(header), 1, fp) == 1 && fread(&driverHash, sizeof(driverHash), 1, fp) == 1 && fread(&count, sizeof(count), 1, fp) == 1;
+    if (!valid || header[0] != programCacheMagic || header[1] != programCacheVersion || driverHash != mDriverHash)
+    {
+        // other driver or layout: everything will be compiled and the file rewritten
+        fclose(fp);
+        mbDirty = true;
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint64_t key;
+        uint32_t format, size;
+        if (fread(&key, sizeof(key), 1, fp) != 1 || fread(&format, sizeof(format), 1, fp) != 1 || fread(&size, sizeof(size), 1, fp) != 1)
+            break;
+        Entry& entry = mEntries[key];
+        entry.mFormat = format;
+        entry.mBinary.resize(size);
+        if (size && fread(entry.mBinary.data(), size, 1, fp) != 1)
+        {
+            // truncated file
+            mEntries.erase(key);
+            mbDirty = true;
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+uint64_t ProgramCache::GetKey(const std::string& source, bool transformFeedback)
+{
+    if (!mbInitialized)
+        Init();
+    uint64_t key = Hash64(source.data(), source.size(), mDriverHash ^ (transformFeedback ? 0x5446ULL : 0ULL));
+    auto iter = mEntries.find(key);
+    if (iter != mEntries.end())
+        iter->second.mbLive = true;
+    return key;
+}
+
+unsigned int ProgramCache::Load(uint64_t key, const std::string& source, const char *name, bool transformFeedback)
+{
+    if (!mbInitialized)
+        Init();
+
+    auto iter = mEntries.find(key);
+    if (iter != mEntries.end())
+    {
+        Entry& entry = iter->second;
+        GLuint program = glCreateProgram();
+        glProgramBinary(program, entry.mFormat, entry.mBinary.data(), GLsizei(entry.mBinary.size()));
+        GLint linked = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (linked)
+        {
+            entry.mbLive = true;
+            mHitCount++;
+            return program;
+        }
+        // rejected by the driver, compile again
+        glDeleteProgram(program);
+        mEntries.erase(iter);
+        mbDirty = true;
+    }
+
+    unsigned int program = transformFeedback ? LoadShaderTransformFeedback(source, name) : LoadShader(source, name);
+    mCompileCount++;
+    Store(key, program);
+    return program;
+}
+
+void ProgramCache::Store(uint64_t key, unsigned int program)
+{
+    if (!mbInitialized)
+        Init();
+    if (!program || !mbSupported)
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    Entry& entry = mEntries[key];
+    entry.mBinary.resize(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, NULL, &format, entry.mBinary.data());
+    entry.mFormat = format;
+    entry.mbLive = true;
+    mbDirty = true;
+}
+
+void ProgramCache::Save()
+{
+    if (!mbSupported)
+        return;
+
+    // entries not referenced this session belong to edited or removed shaders
+    for (auto iter = mEntries.begin(); iter != mEntries.end();)
+    {
+        if (!iter->second.mbLive)
+        {
+            iter = mEntries.erase(iter);
+            mbDirty = true;
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+    if (!mbDirty)
+        return;
+
+    std::string tmpFilename = std::string(programCacheFilename) + ".tmp";
+    FILE *fp = fopen(tmpFilename.c_str(), "wb");
+    if (!fp)
+        return;
+    uint32_t header[2] = { programCacheMagic, programCacheVersion };
+    uint32_t count = uint32_t(mEntries.size());
+    bool written = fwrite(header, sizeof(header), 1, fp) == 1 && fwrite(&mDriverHash, sizeof(mDriverHash), 1, fp) == 1 && fwrite(&count, sizeof(count), 1, fp) == 1;
+    for (auto& entry : mEntries)
+    {
+        uint32_t format = entry.second.mFormat;
+        uint32_t size = uint32_t(entry.second.mBinary.size());
+        written = written && fwrite(&entry.first, sizeof(entry.first), 1, fp) == 1 && fwrite(&format, sizeof(format), 1, fp) == 1 && fwrite(&size, sizeof(size), 1, fp) == 1;
+        written = written && (!size || fwrite(entry.second.mBinary.data(), size, 1, fp) == 1);
+    }
+    fclose(fp);
+    if (!written || !ReplaceFileAtomic(tmpFilename.c_str(), programCacheFilename))
+    {
+        Log("Unable to write program cache.\n");
+        remove(tmpFilename.c_str());
+        return;
+    }
+    mbDirty = false;
+}
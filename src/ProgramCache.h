@@ -0,0 +1,69 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Linked GL program binaries persisted between sessions.
+// Entries are keyed by a hash of the final shader source and of the driver (vendor, renderer, version),
+// so a driver update or a shader edit simply misses and falls back to compilation.
+struct ProgramCache
+{
+    ProgramCache();
+
+    // compute the key of a program source and keep its entry alive for the next Save
+    uint64_t GetKey(const std::string& source, bool transformFeedback);
+    // create the program from its binary when available, compile and store it otherwise
+    unsigned int Load(uint64_t key, const std::string& source, const char *name, bool transformFeedback);
+    // keep the binary of a program linked elsewhere (hot reload)
+    void Store(uint64_t key, unsigned int program);
+    // rewrite the cache file when entries were added or dropped
+    void Save();
+
+    int GetHitCount() const { return mHitCount; }
+    int GetCompileCount() const { return mCompileCount; }
+
+protected:
+    struct Entry
+    {
+        Entry() : mFormat(0), mbLive(false) {}
+        unsigned int mFormat;
+        std::vector<unsigned char> mBinary;
+        bool mbLive;
+    };
+    std::map<uint64_t, Entry> mEntries;
+    uint64_t mDriverHash;
+    bool mbInitialized;
+    bool mbSupported;
+    bool mbDirty;
+    int mHitCount;
+    int mCompileCount;
+
+    void Init();
+};
+
+extern ProgramCache gProgramCache;
@@ -0,0 +1,225 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <algorithm>
+#include <chrono>
+#include "PythonWorker.h"
+#include "Evaluators.h"
+#include "TaskScheduler.h"
+#include "Utils.h"
+
+extern enki::TaskScheduler g_TS;
+PythonWorker gPythonWorker;
+
+struct PythonWorker::MainTask : enki::IPinnedTask
+{
+    MainTask(const std::function<void()>& function) : enki::IPinnedTask(0) // set pinned thread to 0
+        , mFunction(function)
+        , mbDone(false)
+    {
+    }
+    virtual void Execute()
+    {
+        mFunction();
+        std::lock_guard<std::mutex> lock(mMutex);
+        mbDone = true;
+        mCondition.notify_one();
+    }
+    std::function<void()> mFunction;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mbDone;
+};
+
+PythonWorker::PythonWorker() : mbQuit(false), mMainThreadWaits(0), mbRunning(false)
+{
+}
+
+static void RunJob(const std::function<void()>& function)
+{
+    pybind11::gil_scoped_acquire acquire;
+    try
+    {
+        function();
+    }
+    catch (pybind11::error_already_set& ex)
+    {
+        Log("%s\n", ex.what());
+    }
+    catch (std::exception& ex)
+    {
+        Log("Python worker: %s\n", ex.what());
+    }
+}
+
+void PythonWorker::Init()
+{
+    mMainThreadId = std::this_thread::get_id();
+    mbQuit = false;
+    mbRunning = true;
+    mThread = std::thread(&PythonWorker::WorkerThread, this);
+    Call([]() {
+        gEvaluators.InitPythonModules();
+        pybind11::exec(R"(
+            import sys
+            import Imogen
+            class CatchImogenIO:
+                def __init__(self):
+                    pass
+                def write(self, txt):
+                    Imogen.Log(txt)
+            catchImogenIO = CatchImogenIO()
+            sys.stdout = catchImogenIO
+            sys.stderr = catchImogenIO
+            print("Python stdout, stderr catched.\n"))");
+        pybind11::module::import("Plugins");
+    });
+}
+
+void PythonWorker::Finish()
+{
+    if (!mThread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mbQuit = true;
+    }
+    mCondition.notify_one();
+    // the job being run may wait for the main thread
+    while (mbRunning)
+    {
+        g_TS.RunPinnedTasks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    mThread.join();
+    g_TS.RunPinnedTasks();
+    for (auto task : mMainTasks)
+        delete task;
+    mMainTasks.clear();
+}
+
+void PythonWorker::WorkerThread()
+{
+    pybind11::initialize_interpreter(true); // start the interpreter and keep it alive
+    {
+        // the GIL is only held while a job runs so the main thread can take it when the worker waits for it
+        pybind11::gil_scoped_release release;
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mCondition.wait(lock, [this]() { return mbQuit || !mJobs.empty(); });
+                if (mbQuit)
+                    break;
+                job = std::move(mJobs.front());
+                mJobs.pop_front();
+            }
+            RunJob(job);
+        }
+    }
+    pybind11::finalize_interpreter();
+    mbRunning = false;
+}
+
+void PythonWorker::Post(const std::function<void()>& function)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJobs.push_back(function);
+    }
+    mCondition.notify_one();
+}
+
+void PythonWorker::Call(const std::function<void()>& function)
+{
+    if (IsWorkerThread() || mMainThreadWaits)
+    {
+        // nested in a binding, the worker can't run anything until we return
+        RunJob(function);
+        return;
+    }
+    std::atomic<bool> done(false);
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        // synchronous evaluations go before queued nodes
+        mJobs.push_front([&function, &done]() {
+            struct SetDone
+            {
+                std::atomic<bool>& mDone;
+                ~SetDone() { mDone = true; }
+            } setDone{ done };
+            function();
+        });
+    }
+    mCondition.notify_one();
+    while (!done)
+    {
+        g_TS.RunPinnedTasks();
+        std::this_thread::yield();
+    }
+}
+
+void PythonWorker::WaitCurrentJob()
+{
+    if (!mbRunning || IsWorkerThread() || mMainThreadWaits)
+        return;
+    // the worker runs one job at a time and Call goes first in the queue
+    Call([]() {});
+}
+
+void PythonWorker::RunOnMainThread(const std::function<void()>& function)
+{
+    if (std::this_thread::get_id() == mMainThreadId)
+    {
+        function();
+        return;
+    }
+    MainTask task(function);
+    mMainThreadWaits++;
+    g_TS.AddPinnedTask(&task);
+    {
+        std::unique_lock<std::mutex> lock(task.mMutex);
+        task.mCondition.wait(lock, [&task]() { return task.mbDone; });
+    }
+    // RunPinnedTasks still writes to the task after Execute
+    while (!task.GetIsComplete())
+        std::this_thread::yield();
+    mMainThreadWaits--;
+}
+
+void PythonWorker::PostToMainThread(const std::function<void()>& function)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mMainTasks.erase(std::remove_if(mMainTasks.begin(), mMainTasks.end(), [](MainTask *task) {
+        if (!task->GetIsComplete())
+            return false;
+        delete task;
+        return true;
+    }), mMainTasks.end());
+    MainTask *task = new MainTask(function);
+    mMainTasks.push_back(task);
+    g_TS.AddPinnedTask(task);
+}
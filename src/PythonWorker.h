@@ -0,0 +1,78 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Thread owning the Python interpreter. Python nodes and plugins are queued to it so a slow
+// script doesn't stall rendering. Bindings touching GL or the library go back to the main
+// thread with pinned tasks while the worker waits with the GIL released.
+struct PythonWorker
+{
+    PythonWorker();
+
+    // start the interpreter, import the Imogen module and the plugins. Returns once done
+    void Init();
+    void Finish();
+
+    // queue a function, it runs on the worker with the GIL held
+    void Post(const std::function<void()>& function);
+    // run a function with the GIL held and wait for it. Pinned tasks are run while waiting
+    // so the function can call back into the main thread.
+    void Call(const std::function<void()>& function);
+
+    // from a binding, GIL released: run a function on the main thread and wait for it
+    void RunOnMainThread(const std::function<void()>& function);
+    // queue a function to the main thread, it runs on the next RunPinnedTasks
+    void PostToMainThread(const std::function<void()>& function);
+    // returns once the job being run, if any, is done. Queued jobs stay queued
+    void WaitCurrentJob();
+
+    bool IsWorkerThread() const { return std::this_thread::get_id() == mThread.get_id(); }
+
+protected:
+    struct MainTask;
+
+    std::thread mThread;
+    std::thread::id mMainThreadId;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<std::function<void()> > mJobs;
+    bool mbQuit;
+    // worker is blocked in RunOnMainThread, calls from the main thread must not queue
+    std::atomic<int> mMainThreadWaits;
+    std::atomic<bool> mbRunning;
+    // posted to the main thread, deleted once enki is done with them
+    std::vector<MainTask*> mMainTasks;
+
+    void WorkerThread();
+};
+
+extern PythonWorker gPythonWorker;
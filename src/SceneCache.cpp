@@ -0,0 +1,354 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <memory>
+#include "SceneCache.h"
+#include "Utils.h"
+#include "Scene.h"
+#include "Camera.h"
+
+using GLSLPathTracer::Scene;
+using GLSLPathTracer::Camera;
+using GLSLPathTracer::RenderOptions;
+using GLSLPathTracer::TexData;
+using GLSLPathTracer::GPUBVH;
+using GLSLPathTracer::GPUBVHNode;
+using GLSLPathTracer::TriangleData;
+using GLSLPathTracer::NormalTexData;
+using GLSLPathTracer::VertexData;
+using GLSLPathTracer::MaterialData;
+using GLSLPathTracer::LightData;
+using GLSLPathTracer::TriIndexData;
+
+static const uint32_t sceneCacheMagic = 0x43534D49; // 'IMSC'
+static const uint32_t sceneCacheVersion = 1;
+
+// arrays are stored as in memory, any change of their element layout misses
+static uint64_t GetLayoutHash()
+{
+    const uint32_t sizes[] = { uint32_t(sizeof(TriangleData)), uint32_t(sizeof(NormalTexData)), uint32_t(sizeof(VertexData)), uint32_t(sizeof(MaterialData)),
+        uint32_t(sizeof(LightData)), uint32_t(sizeof(TriIndexData)), uint32_t(sizeof(GPUBVHNode)), uint32_t(sizeof(glm::vec2)) };
+    return Hash64(sizes, sizeof(sizes));
+}
+
+static uint64_t GetFileTimestamp(const std::string& path)
+{
+    struct stat fileStat;
+    if (stat(path.c_str(), &fileStat) != 0)
+        return 0;
+    return uint64_t(fileStat.st_mtime) ^ (uint64_t(fileStat.st_size) << 32);
+}
+
+static bool GetFileHash(const std::string& path, uint64_t& hash)
+{
+    MappedFile file;
+    if (!file.Open(path.c_str()))
+        return false;
+    hash = Hash64(file.mData, file.mSize);
+    return true;
+}
+
+namespace
+{
+    struct CacheWriter
+    {
+        FILE *fp;
+        uint64_t mOffset;
+        bool mbValid;
+
+        void Write(const void *data, size_t size)
+        {
+            if (size && mbValid)
+                mbValid = fwrite(data, size, 1, fp) == 1;
+            mOffset += size;
+        }
+        template<typename T> void Write(const T& value) { Write(&value, sizeof(T)); }
+        void WriteString(const std::string& str)
+        {
+            Write(uint32_t(str.size()));
+            Write(str.data(), str.size());
+        }
+        // byte size, then the data at a 16 bytes aligned offset so the reader can use it in place
+        void WriteArray(const void *data, uint64_t size)
+        {
+            static const unsigned char padding[16] = {};
+            Write(size);
+            Write(padding, size_t((16 - mOffset % 16) % 16));
+            Write(data, size_t(size));
+        }
+        template<typename T> void WriteVector(const std::vector<T>& vector) { WriteArray(vector.data(), vector.size() * sizeof(T)); }
+    };
+
+    struct CacheReader
+    {
+        const unsigned char *mData;
+        size_t mSize;
+        size_t mOffset;
+        bool mbValid;
+
+        const void *Read(size_t size)
+        {
+            if (!mbValid || size > mSize - mOffset)
+            {
+                mbValid = false;
+                return nullptr;
+            }
+            const void *ptr = mData + mOffset;
+            mOffset += size;
+            return ptr;
+        }
+        template<typename T> T Read()
+        {
+            T value{};
+            const void *ptr = Read(sizeof(T));
+            if (ptr)
+                memcpy(&value, ptr, sizeof(T));
+            return value;
+        }
+        std::string ReadString()
+        {
+            uint32_t size = Read<uint32_t>();
+            const char *ptr = (const char*)Read(size);
+            return ptr ? std::string(ptr, size) : std::string();
+        }
+        // pointer in the mapping, nullptr for an empty or truncated array
+        const void *ReadArray(size_t elementSize, size_t& count)
+        {
+            uint64_t size = Read<uint64_t>();
+            Read((16 - mOffset % 16) % 16);
+            count = 0;
+            if (!mbValid || size % elementSize || size > mSize - mOffset)
+            {
+                mbValid = false;
+                return nullptr;
+            }
+            count = size_t(size / elementSize);
+            return count ? Read(size_t(size)) : nullptr;
+        }
+        template<typename T> void ReadVector(std::vector<T>& vector)
+        {
+            size_t count;
+            const void *ptr = ReadArray(sizeof(T), count);
+            vector.resize(count);
+            if (count)
+                memcpy(vector.data(), ptr, count * sizeof(T));
+        }
+    };
+}
+
+GLSLPathTracer::Scene *LoadSceneCache(const std::string& filename)
+{
+    std::string cacheFilename = filename + ".cache";
+    auto file = std::make_shared<MappedFile>();
+    if (!file->Open(cacheFilename.c_str()))
+        return nullptr;
+
+    CacheReader reader = { file->mData, file->mSize, 0, true };
+    if (reader.Read<uint32_t>() != sceneCacheMagic || reader.Read<uint32_t>() != sceneCacheVersion || reader.Read<uint64_t>() != GetLayoutHash())
+    {
+        Log("Scene cache %s has another version, the scene will be loaded from its sources.\n", cacheFilename.c_str());
+        return nullptr;
+    }
+
+    std::vector<std::string> sourceFiles(reader.Read<uint32_t>());
+    for (auto& sourceFile : sourceFiles)
+    {
+        sourceFile = reader.ReadString();
+        uint64_t timestamp = reader.Read<uint64_t>();
+        uint64_t hash = reader.Read<uint64_t>();
+        if (!reader.mbValid)
+            break;
+        if (GetFileTimestamp(sourceFile) == timestamp)
+            continue;
+        // touched but maybe not modified
+        uint64_t currentHash;
+        if (!GetFileHash(sourceFile, currentHash) || currentHash != hash)
+        {
+            Log("Scene cache %s is outdated, %s changed.\n", cacheFilename.c_str(), sourceFile.c_str());
+            return nullptr;
+        }
+    }
+
+    std::unique_ptr<Scene> scene(new Scene(filename));
+    // set first, the scene doesn't own the arrays pointing into the mapping
+    scene->mappedData = file;
+
+    RenderOptions& options = scene->renderOptions;
+    options.rendererType = reader.ReadString();
+    options.resolution = reader.Read<glm::ivec2>();
+    options.maxSamples = reader.Read<int>();
+    options.maxDepth = reader.Read<int>();
+    options.numTilesX = reader.Read<int>();
+    options.numTilesY = reader.Read<int>();
+    options.useEnvMap = reader.Read<int>() != 0;
+    options.hdrMultiplier = reader.Read<float>();
+    options.bvhWidth = reader.Read<int>();
+
+    glm::vec3 position = reader.Read<glm::vec3>();
+    Camera *camera = new Camera(position, position + glm::vec3(0.f, 0.f, 1.f), 0.f);
+    scene->camera = camera;
+    camera->position = position;
+    camera->up = reader.Read<glm::vec3>();
+    camera->right = reader.Read<glm::vec3>();
+    camera->forward = reader.Read<glm::vec3>();
+    camera->worldUp = reader.Read<glm::vec3>();
+    camera->pitch = reader.Read<float>();
+    camera->yaw = reader.Read<float>();
+    camera->fov = reader.Read<float>();
+    camera->focalDist = reader.Read<float>();
+    camera->aperture = reader.Read<float>();
+
+    reader.ReadVector(scene->triangleIndices);
+    reader.ReadVector(scene->normalTexData);
+    reader.ReadVector(scene->vertexData);
+    reader.ReadVector(scene->materialData);
+    reader.ReadVector(scene->lightData);
+
+    // the mapping is read-only, nothing writes these arrays once loaded
+    size_t nodeCount;
+    GPUBVHNode *gpuNodes = (GPUBVHNode*)reader.ReadArray(sizeof(GPUBVHNode), nodeCount);
+    scene->gpuBVH = new GPUBVH(int(nodeCount), gpuNodes);
+    reader.ReadVector(scene->gpuBVH->bvhTriangleIndices);
+
+    TexData& texData = scene->texData;
+    texData.albedoTexCount = reader.Read<int>();
+    texData.metallicRoughnessTexCount = reader.Read<int>();
+    texData.normalTexCount = reader.Read<int>();
+    texData.albedoTextureSize = reader.Read<glm::ivec2>();
+    texData.metallicRoughnessTextureSize = reader.Read<glm::ivec2>();
+    texData.normalTextureSize = reader.Read<glm::ivec2>();
+    size_t count;
+    texData.albedoTextures = (unsigned char*)reader.ReadArray(1, count);
+    texData.metallicRoughnessTextures = (unsigned char*)reader.ReadArray(1, count);
+    texData.normalTextures = (unsigned char*)reader.ReadArray(1, count);
+
+    HDRLoaderResult& hdr = scene->hdrLoaderRes;
+    hdr.width = reader.Read<int>();
+    hdr.height = reader.Read<int>();
+    hdr.cols = (float*)reader.ReadArray(sizeof(float), count);
+    hdr.marginalDistData = (glm::vec2*)reader.ReadArray(sizeof(glm::vec2), count);
+    hdr.conditionalDistData = (glm::vec2*)reader.ReadArray(sizeof(glm::vec2), count);
+
+    if (!reader.mbValid || !nodeCount)
+    {
+        Log("Scene cache %s is truncated, the scene will be loaded from its sources.\n", cacheFilename.c_str());
+        return nullptr;
+    }
+
+    scene->sourceFiles = sourceFiles;
+    scene->buildWideBVH();
+    return scene.release();
+}
+
+void SaveSceneCache(const GLSLPathTracer::Scene& scene)
+{
+    if (!scene.gpuBVH || !scene.camera)
+        return;
+
+    std::string cacheFilename = scene.getSceneName() + ".cache";
+    std::string tmpFilename = cacheFilename + ".tmp";
+    FILE *fp = fopen(tmpFilename.c_str(), "wb");
+    if (!fp)
+        return;
+
+    CacheWriter writer = { fp, 0, true };
+    writer.Write(sceneCacheMagic);
+    writer.Write(sceneCacheVersion);
+    writer.Write(GetLayoutHash());
+
+    writer.Write(uint32_t(scene.sourceFiles.size()));
+    for (auto& sourceFile : scene.sourceFiles)
+    {
+        uint64_t hash = 0;
+        if (!GetFileHash(sourceFile, hash))
+            writer.mbValid = false;
+        writer.WriteString(sourceFile);
+        writer.Write(GetFileTimestamp(sourceFile));
+        writer.Write(hash);
+    }
+
+    const RenderOptions& options = scene.renderOptions;
+    writer.WriteString(options.rendererType);
+    writer.Write(options.resolution);
+    writer.Write(options.maxSamples);
+    writer.Write(options.maxDepth);
+    writer.Write(options.numTilesX);
+    writer.Write(options.numTilesY);
+    writer.Write(int(options.useEnvMap));
+    writer.Write(options.hdrMultiplier);
+    writer.Write(options.bvhWidth);
+
+    const Camera& camera = *scene.camera;
+    writer.Write(camera.position);
+    writer.Write(camera.up);
+    writer.Write(camera.right);
+    writer.Write(camera.forward);
+    writer.Write(camera.worldUp);
+    writer.Write(camera.pitch);
+    writer.Write(camera.yaw);
+    writer.Write(camera.fov);
+    writer.Write(camera.focalDist);
+    writer.Write(camera.aperture);
+
+    writer.WriteVector(scene.triangleIndices);
+    writer.WriteVector(scene.normalTexData);
+    writer.WriteVector(scene.vertexData);
+    writer.WriteVector(scene.materialData);
+    writer.WriteVector(scene.lightData);
+
+    const GPUBVH& gpuBVH = *scene.gpuBVH;
+    writer.WriteArray(gpuBVH.gpuNodes, uint64_t(gpuBVH.numNodes) * sizeof(GPUBVHNode));
+    writer.WriteVector(gpuBVH.bvhTriangleIndices);
+
+    // texture arrays are not allocated when their count is 0
+    const TexData& texData = scene.texData;
+    writer.Write(texData.albedoTexCount);
+    writer.Write(texData.metallicRoughnessTexCount);
+    writer.Write(texData.normalTexCount);
+    writer.Write(texData.albedoTextureSize);
+    writer.Write(texData.metallicRoughnessTextureSize);
+    writer.Write(texData.normalTextureSize);
+    auto textureBytes = [](int count, const glm::ivec2& size) { return count ? uint64_t(size.x) * size.y * 3 * count : 0; };
+    writer.WriteArray(texData.albedoTextures, textureBytes(texData.albedoTexCount, texData.albedoTextureSize));
+    writer.WriteArray(texData.metallicRoughnessTextures, textureBytes(texData.metallicRoughnessTexCount, texData.metallicRoughnessTextureSize));
+    writer.WriteArray(texData.normalTextures, textureBytes(texData.normalTexCount, texData.normalTextureSize));
+
+    const HDRLoaderResult& hdr = scene.hdrLoaderRes;
+    uint64_t hdrTexels = hdr.cols ? uint64_t(hdr.width) * hdr.height : 0;
+    writer.Write(hdr.width);
+    writer.Write(hdr.height);
+    writer.WriteArray(hdr.cols, hdrTexels * 3 * sizeof(float));
+    writer.WriteArray(hdr.marginalDistData, (hdr.cols ? uint64_t(hdr.height) : 0) * sizeof(glm::vec2));
+    writer.WriteArray(hdr.conditionalDistData, hdrTexels * sizeof(glm::vec2));
+
+    fclose(fp);
+    if (!writer.mbValid || !ReplaceFileAtomic(tmpFilename.c_str(), cacheFilename.c_str()))
+    {
+        Log("Unable to write scene cache %s\n", cacheFilename.c_str());
+        remove(tmpFilename.c_str());
+    }
+}
@@ -0,0 +1,41 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+#include <string>
+
+namespace GLSLPathTracer
+{
+    class Scene;
+}
+
+// Binary cache of a loaded path tracer scene, written next to the scene file as "<scene>.cache".
+// It holds the mesh, material, light and texture arrays and the flattened BVH. Texture, HDR and BVH node
+// arrays point directly into the memory mapped file, the smaller arrays are copied.
+// The cache is valid while every file read by LoadScene has the same timestamp and size, or the same content hash.
+
+// nullptr when there is no valid cache for this scene
+GLSLPathTracer::Scene *LoadSceneCache(const std::string& filename);
+// write the cache of a scene loaded from its sources, with its GPUBVH built
+void SaveSceneCache(const GLSLPathTracer::Scene& scene);
@@ -0,0 +1,265 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include <functional>
+#include <thread>
+#include "ScenePool.h"
+#include "SceneCache.h"
+#include "Scene.h"
+#include "Loader.h"
+#include "GPUBVH.h"
+#include "WideBVH.h"
+#include "TaskScheduler.h"
+#include "Utils.h"
+
+extern enki::TaskScheduler g_TS;
+
+ScenePool gScenePool;
+
+// RAM of the scene arrays, also uploaded by the GPU renderers
+static size_t GetSceneMemorySize(const GLSLPathTracer::Scene& scene)
+{
+    size_t sceneDataBytes =
+        sizeof(GLSLPathTracer::GPUBVHNode) * scene.gpuBVH->numNodes +
+        sizeof(GLSLPathTracer::TriIndexData) * scene.gpuBVH->bvhTriangleIndices.size() +
+        sizeof(GLSLPathTracer::TriangleData) * scene.triangleIndices.size() +
+        sizeof(GLSLPathTracer::VertexData) * scene.vertexData.size() +
+        sizeof(GLSLPathTracer::NormalTexData) * scene.normalTexData.size() +
+        sizeof(GLSLPathTracer::MaterialData) * scene.materialData.size() +
+        sizeof(GLSLPathTracer::LightData) * scene.lightData.size();
+    if (scene.wideBVH4)
+        sceneDataBytes += sizeof(GLSLPathTracer::WideBVHNode<4>) * scene.wideBVH4->nodes.size();
+    if (scene.wideBVH8)
+        sceneDataBytes += sizeof(GLSLPathTracer::WideBVHNode<8>) * scene.wideBVH8->nodes.size();
+
+    const GLSLPathTracer::TexData& texData = scene.texData;
+    size_t texDataBytes =
+        size_t(texData.albedoTextureSize.x) * texData.albedoTextureSize.y * texData.albedoTexCount * 3 +
+        size_t(texData.metallicRoughnessTextureSize.x) * texData.metallicRoughnessTextureSize.y * texData.metallicRoughnessTexCount * 3 +
+        size_t(texData.normalTextureSize.x) * texData.normalTextureSize.y * texData.normalTexCount * 3 +
+        size_t(scene.hdrLoaderRes.width) * scene.hdrLoaderRes.height * sizeof(float) * 3;
+
+    Log("Triangles: %d\n", int(scene.triangleIndices.size()));
+    Log("Triangle Indices: %d\n", int(scene.gpuBVH->bvhTriangleIndices.size()));
+    Log("Vertices: %d\n", int(scene.vertexData.size()));
+    Log("Memory used for BVH and scene data: %d MB\n", int(sceneDataBytes >> 20));
+    Log("Memory used for Textures: %d MB\n", int(texDataBytes >> 20));
+    return sceneDataBytes + texDataBytes;
+}
+
+struct SceneLoadTaskSet : enki::ITaskSet
+{
+    SceneLoadTaskSet(std::function<void()> function) : enki::ITaskSet(), mFunction(function)
+    {
+    }
+    virtual void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum)
+    {
+        mFunction();
+    }
+    std::function<void()> mFunction;
+};
+
+ScenePool::ScenePool() : mBudget(size_t(2048) << 20), mUseCounter(0)
+{
+}
+
+ScenePool::Entry::~Entry()
+{
+    // ITaskSet has no virtual destructor
+    delete static_cast<SceneLoadTaskSet*>(mTask);
+}
+
+ScenePool::Status ScenePool::GetStatus(const Entry& entry)
+{
+    if (entry.mTask && !entry.mTask->GetIsComplete())
+        return Loading;
+    return Status(entry.mStatus.load());
+}
+
+void ScenePool::Load(Entry& entry)
+{
+    entry.mProgress = 0.1f;
+    GLSLPathTracer::Scene *scene = LoadSceneCache(entry.mFilename);
+    if (scene)
+    {
+        Log("Scene %s loaded from cache\n", entry.mFilename.c_str());
+    }
+    else
+    {
+        scene = GLSLPathTracer::LoadScene(entry.mFilename);
+        if (!scene)
+        {
+            Log("Unable to load scene %s\n", entry.mFilename.c_str());
+            entry.mStatus = Failed;
+            return;
+        }
+        Log("Scene %s loaded\n", entry.mFilename.c_str());
+        entry.mProgress = 0.5f;
+
+        scene->buildBVH(&g_TS);
+        entry.mProgress = 0.9f;
+        SaveSceneCache(*scene);
+    }
+    entry.mMemorySize = GetSceneMemorySize(*scene);
+    entry.mScene = scene;
+    entry.mProgress = 1.f;
+    // publishes mScene and mMemorySize
+    entry.mStatus = Loaded;
+}
+
+ScenePool::Status ScenePool::Request(const std::string& filename, bool synchronous, GLSLPathTracer::Scene **scene, float *progress)
+{
+    std::shared_ptr<Entry> entry;
+    bool startLoad = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto iter = mEntries.find(filename);
+        if (iter == mEntries.end())
+        {
+            entry = std::make_shared<Entry>(filename);
+            if (!synchronous)
+            {
+                Entry *loadedEntry = entry.get();
+                entry->mTask = new SceneLoadTaskSet([loadedEntry]() { Load(*loadedEntry); });
+            }
+            mEntries.insert(std::make_pair(filename, entry));
+            startLoad = true;
+        }
+        else
+        {
+            entry = iter->second;
+        }
+        entry->mLastUse = ++mUseCounter;
+    }
+
+    if (startLoad)
+    {
+        if (synchronous)
+            Load(*entry);
+        else
+            g_TS.AddTaskSetToPipe(entry->mTask);
+    }
+
+    // bakes need the scene before returning, it may be loading for another stage
+    if (synchronous)
+    {
+        if (entry->mTask)
+            g_TS.WaitforTask(entry->mTask);
+        while (entry->mStatus == Loading)
+            std::this_thread::yield();
+    }
+
+    *progress = entry->mProgress;
+    Status status = GetStatus(*entry);
+    if (status == Loading)
+        return Loading;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (status == Failed)
+    {
+        // next request retries, the files may have been fixed
+        auto iter = mEntries.find(filename);
+        if (iter != mEntries.end() && iter->second == entry)
+            mEntries.erase(iter);
+        return Failed;
+    }
+    *scene = entry->mScene;
+    // the scene loaded may take the budget of unused ones. It's not referenced yet but the most recently used.
+    Evict();
+    return Loaded;
+}
+
+std::shared_ptr<ScenePool::Entry> ScenePool::Find(GLSLPathTracer::Scene *scene)
+{
+    for (auto& entry : mEntries)
+    {
+        if (entry.second->mScene == scene)
+            return entry.second;
+    }
+    return nullptr;
+}
+
+void ScenePool::AddRef(GLSLPathTracer::Scene *scene)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto entry = Find(scene);
+    if (!entry)
+        return;
+    entry->mRefCount++;
+    entry->mLastUse = ++mUseCounter;
+}
+
+void ScenePool::Release(GLSLPathTracer::Scene *scene)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto entry = Find(scene);
+    if (!entry)
+        return;
+    entry->mRefCount--;
+    Evict();
+}
+
+size_t ScenePool::GetMemoryUsed()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    size_t memoryUsed = 0;
+    for (auto& entry : mEntries)
+    {
+        if (GetStatus(*entry.second) == Loaded)
+            memoryUsed += entry.second->mMemorySize;
+    }
+    return memoryUsed;
+}
+
+void ScenePool::Evict()
+{
+    size_t memoryUsed = 0;
+    for (auto& entry : mEntries)
+    {
+        if (GetStatus(*entry.second) == Loaded)
+            memoryUsed += entry.second->mMemorySize;
+    }
+
+    while (memoryUsed > mBudget)
+    {
+        // least recently used of the loaded scenes no stage references
+        auto oldest = mEntries.end();
+        for (auto iter = mEntries.begin(); iter != mEntries.end(); ++iter)
+        {
+            const Entry& entry = *iter->second;
+            if (GetStatus(entry) != Loaded || entry.mRefCount > 0 || entry.mLastUse == mUseCounter)
+                continue;
+            if (oldest == mEntries.end() || entry.mLastUse < oldest->second->mLastUse)
+                oldest = iter;
+        }
+        if (oldest == mEntries.end())
+            break;
+
+        Log("Scene %s unloaded\n", oldest->first.c_str());
+        memoryUsed -= oldest->second->mMemorySize;
+        delete oldest->second->mScene;
+        mEntries.erase(oldest);
+    }
+}
@@ -0,0 +1,93 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <stdint.h>
+
+namespace GLSLPathTracer
+{
+    class Scene;
+}
+
+namespace enki
+{
+    class ITaskSet;
+}
+
+// Path tracer scenes loaded in memory, shared by every stage loading the same file.
+// Scenes are loaded by a task and referenced by the stages they are set to. Unreferenced scenes stay
+// loaded so switching back to a material is instant, the least recently used ones are deleted
+// when the loaded scenes take more than mBudget bytes. GPU resources belong to the stage renderers
+// and are released with the stage reference.
+struct ScenePool
+{
+    ScenePool();
+
+    enum Status
+    {
+        Loading,
+        Loaded,
+        Failed,
+    };
+
+    // start loading filename if it's not loaded or loading. Synchronous loads on the calling thread.
+    // When loaded, scene is set. progress is in [0..1]
+    Status Request(const std::string& filename, bool synchronous, GLSLPathTracer::Scene **scene, float *progress);
+    void AddRef(GLSLPathTracer::Scene *scene);
+    void Release(GLSLPathTracer::Scene *scene);
+
+    size_t GetMemoryUsed();
+    size_t mBudget;
+
+protected:
+    struct Entry
+    {
+        Entry(const std::string& filename) : mFilename(filename), mScene(nullptr), mTask(nullptr), mStatus(Loading), mProgress(0.f), mMemorySize(0), mRefCount(0), mLastUse(0) {}
+        ~Entry();
+        std::string mFilename;
+        GLSLPathTracer::Scene *mScene;
+        // the task loading the scene, owned by the entry as enki touches it after it ran
+        enki::ITaskSet *mTask;
+        std::atomic<int> mStatus;
+        std::atomic<float> mProgress;
+        size_t mMemorySize;
+        int mRefCount;
+        uint64_t mLastUse;
+    };
+    std::map<std::string, std::shared_ptr<Entry> > mEntries;
+    std::mutex mMutex;
+    uint64_t mUseCounter;
+
+    static void Load(Entry& entry);
+    static Status GetStatus(const Entry& entry);
+    std::shared_ptr<Entry> Find(GLSLPathTracer::Scene *scene);
+    void Evict();
+};
+
+extern ScenePool gScenePool;
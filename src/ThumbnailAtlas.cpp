@@ -0,0 +1,224 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#include <GL/gl3w.h>
+#include "ThumbnailAtlas.h"
+#include "Evaluation.h"
+#include "Library.h"
+#include "TaskScheduler.h"
+
+extern enki::TaskScheduler g_TS;
+
+ThumbnailAtlas gThumbnailAtlas;
+
+// box filter to the slot size, RGBA8
+static void ResampleThumbnail(const Image& image, std::vector<uint8_t>& pixels)
+{
+    const int size = ThumbnailAtlas::SlotSize;
+    const int components = (image.mFormat == TextureFormat::RGBA8) ? 4 : 3;
+    const unsigned char *src = image.GetBits();
+    pixels.resize(size * size * 4);
+    for (int dy = 0; dy < size; dy++)
+    {
+        int sy0 = dy * image.mHeight / size;
+        int sy1 = ImMax(sy0 + 1, (dy + 1) * image.mHeight / size);
+        for (int dx = 0; dx < size; dx++)
+        {
+            int sx0 = dx * image.mWidth / size;
+            int sx1 = ImMax(sx0 + 1, (dx + 1) * image.mWidth / size);
+            unsigned int sum[4] = { 0, 0, 0, 0 };
+            for (int sy = sy0; sy < sy1; sy++)
+            {
+                const unsigned char *line = src + (sy * image.mWidth + sx0) * components;
+                for (int sx = sx0; sx < sx1; sx++, line += components)
+                {
+                    sum[0] += line[0];
+                    sum[1] += line[1];
+                    sum[2] += line[2];
+                    sum[3] += (components == 4) ? line[3] : 255;
+                }
+            }
+            unsigned int count = (sy1 - sy0) * (sx1 - sx0);
+            uint8_t *dst = &pixels[(dy * size + dx) * 4];
+            for (int c = 0; c < 4; c++)
+                dst[c] = uint8_t(sum[c] / count);
+        }
+    }
+}
+
+struct DecodeThumbnailTaskSet : enki::ITaskSet
+{
+    DecodeThumbnailTaskSet(const Material *material, int slotIndex) : enki::ITaskSet()
+        , mSrc(material->mThumbnail)
+        , mMappedSrc(material->mMappedThumbnail)
+        , mSlotIndex(slotIndex)
+        , mKey(material->mThumbnailRuntimeId)
+    {
+    }
+    virtual void    ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum)
+    {
+        std::vector<uint8_t> pixels;
+        Image image;
+        const uint8_t *src = mSrc.empty() ? mMappedSrc.GetData() : mSrc.data();
+        size_t srcSize = mSrc.empty() ? size_t(mMappedSrc.mSize) : mSrc.size();
+        if (src && Evaluation::DecodeImageBlob(src, srcSize, &image) == EVAL_OK && image.mWidth > 0 && image.mHeight > 0)
+        {
+            ResampleThumbnail(image, pixels);
+        }
+        gThumbnailAtlas.PushDecoded(mSlotIndex, mKey, pixels);
+        delete this;
+    }
+    std::vector<uint8_t> mSrc;
+    LibraryBlob mMappedSrc;
+    int mSlotIndex;
+    unsigned int mKey;
+};
+
+ThumbnailAtlas::ThumbnailAtlas() : mTextureId(0), mDefaultTextureId(0), mFrame(0), mDecodingCount(0)
+{
+    mSlots.resize(SlotCount);
+    for (auto& slot : mSlots)
+    {
+        slot.mKey = 0;
+        slot.mLastUse = 0;
+        slot.mState = Slot_Free;
+    }
+}
+
+ImTextureID ThumbnailAtlas::GetDefault(ImVec2& uv0, ImVec2& uv1) const
+{
+    uv0 = ImVec2(0.f, 1.f);
+    uv1 = ImVec2(1.f, 0.f);
+    return (ImTextureID)(int64_t)mDefaultTextureId;
+}
+
+int ThumbnailAtlas::AllocateSlot()
+{
+    int lruIndex = -1;
+    for (int i = 0; i < SlotCount; i++)
+    {
+        const Slot& slot = mSlots[i];
+        if (slot.mState == Slot_Free)
+            return i;
+        // decoding slots and slots drawn this frame are kept
+        if (slot.mState == Slot_Decoding || slot.mLastUse == mFrame)
+            continue;
+        if (lruIndex == -1 || slot.mLastUse < mSlots[lruIndex].mLastUse)
+            lruIndex = i;
+    }
+    if (lruIndex != -1)
+    {
+        mSlotByKey.erase(mSlots[lruIndex].mKey);
+        mSlots[lruIndex].mState = Slot_Free;
+    }
+    return lruIndex;
+}
+
+ImTextureID ThumbnailAtlas::Get(const Material *material, ImVec2& uv0, ImVec2& uv1)
+{
+    if (!mTextureId)
+    {
+        mDefaultTextureId = gEvaluation.GetTexture("Stock/thumbnail-icon.png");
+        glGenTextures(1, &mTextureId);
+        glBindTexture(GL_TEXTURE_2D, mTextureId);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, AtlasSize, AtlasSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        TexParam(GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    unsigned int key = material->mThumbnailRuntimeId;
+    auto iter = mSlotByKey.find(key);
+    if (iter != mSlotByKey.end())
+    {
+        int slotIndex = iter->second;
+        Slot& slot = mSlots[slotIndex];
+        slot.mLastUse = mFrame;
+        if (slot.mState != Slot_Ready)
+            return GetDefault(uv0, uv1);
+
+        // half texel inset so linear filtering doesn't bleed from neighbours. V is flipped like render targets
+        const float texel = 1.f / float(AtlasSize);
+        float x0 = float((slotIndex % SlotsPerRow) * SlotSize) * texel;
+        float y0 = float((slotIndex / SlotsPerRow) * SlotSize) * texel;
+        float slotSize = float(SlotSize) * texel;
+        uv0 = ImVec2(x0 + texel * 0.5f, y0 + slotSize - texel * 0.5f);
+        uv1 = ImVec2(x0 + slotSize - texel * 0.5f, y0 + texel * 0.5f);
+        return (ImTextureID)(int64_t)mTextureId;
+    }
+
+    bool hasThumbnail = !material->mThumbnail.empty() || material->mMappedThumbnail.IsValid();
+    if (!key || !hasThumbnail || mDecodingCount >= MaxDecoding)
+        return GetDefault(uv0, uv1);
+
+    int slotIndex = AllocateSlot();
+    if (slotIndex == -1)
+        return GetDefault(uv0, uv1);
+
+    Slot& slot = mSlots[slotIndex];
+    slot.mKey = key;
+    slot.mLastUse = mFrame;
+    slot.mState = Slot_Decoding;
+    mSlotByKey[key] = slotIndex;
+    mDecodingCount++;
+    g_TS.AddTaskSetToPipe(new DecodeThumbnailTaskSet(material, slotIndex));
+    return GetDefault(uv0, uv1);
+}
+
+void ThumbnailAtlas::PushDecoded(int slotIndex, unsigned int key, std::vector<uint8_t>& pixels)
+{
+    std::lock_guard<std::mutex> lock(mDecodedMutex);
+    mDecoded.push_back({ slotIndex, key, std::vector<uint8_t>() });
+    mDecoded.back().mPixels.swap(pixels);
+}
+
+void ThumbnailAtlas::Update()
+{
+    mFrame++;
+    std::vector<Decoded> decoded;
+    {
+        std::lock_guard<std::mutex> lock(mDecodedMutex);
+        decoded.swap(mDecoded);
+    }
+    if (decoded.empty())
+        return;
+
+    glBindTexture(GL_TEXTURE_2D, mTextureId);
+    for (auto& thumbnail : decoded)
+    {
+        mDecodingCount--;
+        Slot& slot = mSlots[thumbnail.mSlotIndex];
+        if (slot.mKey != thumbnail.mKey || slot.mState != Slot_Decoding)
+            continue;
+        if (thumbnail.mPixels.empty())
+        {
+            slot.mState = Slot_Failed;
+            continue;
+        }
+        int x = (thumbnail.mSlotIndex % SlotsPerRow) * SlotSize;
+        int y = (thumbnail.mSlotIndex / SlotsPerRow) * SlotSize;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, SlotSize, SlotSize, GL_RGBA, GL_UNSIGNED_BYTE, thumbnail.mPixels.data());
+        slot.mState = Slot_Ready;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
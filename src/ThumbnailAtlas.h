@@ -0,0 +1,88 @@
+// https://github.com/CedricGuillemet/Imogen
+//
+// The MIT License(MIT)
+// 
+// Copyright(c) 2018 Cedric Guillemet
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files(the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and / or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions :
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+#pragma once
+#include <map>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+#include "imgui.h"
+
+struct Material;
+
+// Library thumbnails packed in a single texture. Only thumbnails that are drawn get decoded,
+// slots not drawn recently are reused. Decoding happens on enkiTS workers, uploads on the main thread.
+struct ThumbnailAtlas
+{
+    ThumbnailAtlas();
+
+    // texture and uvs to draw the material thumbnail. Default icon until the thumbnail is uploaded
+    ImTextureID Get(const Material *material, ImVec2& uv0, ImVec2& uv1);
+    // main thread, once per frame: upload a batch of decoded thumbnails
+    void Update();
+
+    static const int AtlasSize = 2048;
+    static const int SlotSize = 128;
+    static const int SlotsPerRow = AtlasSize / SlotSize;
+    static const int SlotCount = SlotsPerRow * SlotsPerRow;
+    static const int MaxDecoding = 16;
+
+    // called by decoding tasks. empty pixels when the thumbnail can't be decoded
+    void PushDecoded(int slotIndex, unsigned int key, std::vector<uint8_t>& pixels);
+
+protected:
+    enum SlotState
+    {
+        Slot_Free,
+        Slot_Decoding,
+        Slot_Ready,
+        Slot_Failed,
+    };
+    struct Slot
+    {
+        unsigned int mKey;
+        uint64_t mLastUse;
+        SlotState mState;
+    };
+    struct Decoded
+    {
+        int mSlotIndex;
+        unsigned int mKey;
+        std::vector<uint8_t> mPixels;
+    };
+
+    int AllocateSlot();
+    ImTextureID GetDefault(ImVec2& uv0, ImVec2& uv1) const;
+
+    std::vector<Slot> mSlots;
+    std::map<unsigned int, int> mSlotByKey;
+    std::mutex mDecodedMutex;
+    std::vector<Decoded> mDecoded;
+    unsigned int mTextureId;
+    unsigned int mDefaultTextureId;
+    uint64_t mFrame;
+    int mDecodingCount;
+};
+
+extern ThumbnailAtlas gThumbnailAtlas;
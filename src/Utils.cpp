@@ -25,6 +25,7 @@
 #include <GL/gl3w.h>    // Initialize with gl3wInit()
 #include <SDL.h>
 #include <vector>
+#include <mutex>
 #include "Utils.h"
 #include "Evaluation.h"
 #include "tinydir.h"
@@ -32,6 +33,11 @@
 #ifdef WIN32
 #include <Windows.h>
 #include <shellapi.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 void FlipVImage(Image *image)
@@ -160,6 +166,7 @@ unsigned int LoadShader(const std::string &shaderString, const char *fileName)
 
 
     // Link the program
+    glProgramParameteri(programObject, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(programObject);
 
     glBindAttribLocation(programObject, SemUV0, "inUV");
@@ -229,7 +236,7 @@ unsigned int LoadShaderTransformFeedback(const std::string &shaderString, const
         "outCompute12", "outCompute13", "outCompute14", "outCompute15"*/ };
     glTransformFeedbackVaryings(programHandle, sizeof(varyings) / sizeof(const char*), varyings, GL_INTERLEAVED_ATTRIBS);
 
-
+    glProgramParameteri(programHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(programHandle);
 
     return programHandle;
@@ -239,6 +246,9 @@ void DebugLogText(const char *szText);
 
 int Log(const char *szFormat, ...)
 {
+    // called from jobs and the Python worker too
+    static std::mutex logMutex;
+    std::lock_guard<std::mutex> lock(logMutex);
     va_list ptr_arg;
     va_start(ptr_arg, szFormat);
 
@@ -525,4 +535,87 @@ void GetTextureDimension(unsigned int textureId, int *w, int *h)
     glBindTexture(GL_TEXTURE_2D, textureId);
     glGetTexLevelParameteriv(GL_TEXTURE_2D, miplevel, GL_TEXTURE_WIDTH, w);
     glGetTexLevelParameteriv(GL_TEXTURE_2D, miplevel, GL_TEXTURE_HEIGHT, h);
-}
\ No newline at end of file
+}
+
+uint64_t Hash64(const void *data, size_t size, uint64_t seed)
+{
+    const unsigned char *ptr = (const unsigned char*)data;
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= ptr[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+bool MappedFile::Open(const char *szFilename)
+{
+    Close();
+#ifdef WIN32
+    HANDLE file = CreateFileA(szFilename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || !fileSize.QuadPart)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    void *data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!data)
+    {
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    mFileHandle = file;
+    mMappingHandle = mapping;
+    mSize = size_t(fileSize.QuadPart);
+#else
+    int file = open(szFilename, O_RDONLY);
+    if (file == -1)
+        return false;
+    struct stat fileStat;
+    if (fstat(file, &fileStat) == -1 || !fileStat.st_size)
+    {
+        ::close(file);
+        return false;
+    }
+    void *data = mmap(NULL, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    // the mapping stays valid once the descriptor is closed
+    ::close(file);
+    if (data == MAP_FAILED)
+        return false;
+    mSize = size_t(fileStat.st_size);
+#endif
+    mData = (const unsigned char*)data;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (!mData)
+        return;
+#ifdef WIN32
+    UnmapViewOfFile(mData);
+    CloseHandle(mMappingHandle);
+    CloseHandle(mFileHandle);
+#else
+    munmap((void*)mData, mSize);
+#endif
+    mData = nullptr;
+    mSize = 0;
+    mFileHandle = mMappingHandle = nullptr;
+}
+
+bool ReplaceFileAtomic(const char *szSource, const char *szDestination)
+{
+#ifdef WIN32
+    return MoveFileExA(szSource, szDestination, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return rename(szSource, szDestination) == 0;
+#endif
+}
@@ -26,6 +26,7 @@
 
 #include <string>
 #include <float.h>
+#include <stdint.h>
 
 struct Image_t;
 typedef struct Image_t Image;
@@ -583,4 +584,28 @@ void DiscoverFiles(const char *extension, const char *directory, std::vector<std
 
 inline float sign(float v) { return (v >= 0.f) ? 1.f : -1.f; }
 void OpenShellURL(const std::string &url);
-void GetTextureDimension(unsigned int textureId, int *w, int *h);
\ No newline at end of file
+void GetTextureDimension(unsigned int textureId, int *w, int *h);
+
+// FNV-1a, chain calls with the previous result as seed
+uint64_t Hash64(const void *data, size_t size, uint64_t seed = 0xcbf29ce484222325ULL);
+
+// read-only view of a whole file. Mapped with share-delete on Windows so the file can be replaced while in use
+struct MappedFile
+{
+    MappedFile() : mData(nullptr), mSize(0), mFileHandle(nullptr), mMappingHandle(nullptr) {}
+    ~MappedFile() { Close(); }
+    // owns the mapping, share it with a shared_ptr
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    bool Open(const char *szFilename);
+    void Close();
+
+    const unsigned char *mData;
+    size_t mSize;
+protected:
+    void *mFileHandle;
+    void *mMappingHandle;
+};
+
+// write-then-rename helper: replace destination with source in a single filesystem operation
+bool ReplaceFileAtomic(const char *szSource, const char *szDestination);
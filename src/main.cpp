@@ -42,6 +42,11 @@
 #include "stb_image_write.h"
 #include "ffmpegCodec.h"
 #include "Evaluators.h"
+#include "FrameCache.h"
+#include "ThumbnailAtlas.h"
+#include "ProgramCache.h"
+#include "HotReload.h"
+#include "PythonWorker.h"
 #include "cmft/clcontext.h"
 #include "cmft/clcontext_internal.h"
 #include "Loader.h"
@@ -107,27 +112,13 @@ Imogen imogen;
 enki::TaskScheduler g_TS;
 void InitMDFonts();
 
-int main(int, char**)
+int main(int argc, char** argv)
 {
     TagTime("App start");
     GLSLPathTracer::Log = Log;
     g_TS.Initialize();
     TagTime("Enki TS Init");
-    pybind11::initialize_interpreter(true); // start the interpreter and keep it alive
-    gEvaluators.InitPythonModules();
-    pybind11::exec( R"(
-        import sys
-        import Imogen
-        class CatchImogenIO:
-            def __init__(self):
-                pass
-            def write(self, txt):
-                Imogen.Log(txt)
-        catchImogenIO = CatchImogenIO()
-        sys.stdout = catchImogenIO
-        sys.stderr = catchImogenIO
-        print("Python stdout, stderr catched.\n"))");
-    pybind11::module::import("Plugins");
+    gPythonWorker.Init();
 
     TagTime("Python interpreter Init");
     LoadMetaNodes();
@@ -248,6 +239,7 @@ int main(int, char**)
     static const char* libraryFilename = "library.dat";
     
     LoadLib(&library, libraryFilename);
+    OpenLibraryJournal(&library, libraryFilename);
     TagTime("Library loaded");
 
     imogen.Init();
@@ -256,13 +248,27 @@ int main(int, char**)
     gEvaluation.Init();
     TagTime("Evaluation Init");
     gEvaluators.SetEvaluators(imogen.mEvaluatorFiles);
-
+    gHotReload.Init(window, imogen.mEvaluatorFiles);
     gCPUCount = SDL_GetCPUCount();
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-benchmarkC"))
+            gEvaluators.BenchmarkC(1024, 1024, 20);
+        if (!strcmp(argv[i], "-benchmarkCubemap"))
+            Evaluation::BenchmarkCubemapFilter();
+        if (!strcmp(argv[i], "-benchmarkBVH") && i + 1 < argc)
+            Evaluation::BenchmarkBVH(argv[++i]);
+    }
 
     // default Material
     SetExistingMaterialActive(".default");
 
-    TagTime("App init done");
+    // programs used by the default material are linked at this point
+    static char initTag[256];
+    snprintf(initTag, sizeof(initTag), "App init done (%s start: %d GLSL programs from cache, %d compiled)",
+        gProgramCache.GetCompileCount() ? "cold" : "warm", gProgramCache.GetHitCount(), gProgramCache.GetCompileCount());
+    TagTime(initTag);
+    gProgramCache.Save();
 
     // Main loop
     bool done = false;
@@ -307,7 +313,12 @@ int main(int, char**)
             gNodeDelegate.SetTime(gEvaluationTime, true);
             gNodeDelegate.ApplyAnimation(gEvaluationTime);
         }
+        gHotReload.Update();
+        gFrameCache.BeginFrame(gNodeDelegate.mSelectedNodeIndex, gEvaluationTime);
         gCurrentContext->RunDirty();
+        gFrameCache.EndFrame();
+        gFrameCache.Prerender(gNodeDelegate.mFrameMin, gNodeDelegate.mFrameMax, gPlayLoop);
+        gThumbnailAtlas.Update();
         imogen.Show(library, gNodeDelegate, gEvaluation);
 
         // render everything
@@ -322,6 +333,7 @@ int main(int, char**)
         SDL_GL_SwapWindow(window);
     }
 
+    gPythonWorker.Finish();
     clDestroy(clContext);
     // Unload opencl lib.
     if (clLoaded)
@@ -330,7 +342,8 @@ int main(int, char**)
     }
 
     imogen.ValidateCurrentMaterial(library, gNodeDelegate);
-    SaveLib(&library, libraryFilename);
+    CloseLibraryJournal(&library, libraryFilename);
+    gProgramCache.Save();
     gEvaluation.Finish();
 
     // Cleanup
@@ -340,11 +353,11 @@ int main(int, char**)
 
     imogen.Finish(); // keep dock being saved
 
+    gHotReload.Finish();
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
     SDL_Quit();
 
-    pybind11::finalize_interpreter();
     g_TS.WaitforAllAndShutdown();
     return 0;
 }
\ No newline at end of file